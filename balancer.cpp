@@ -0,0 +1,91 @@
+
+#include <stdexcept>
+
+#include "balancer.h"
+#include "logging.h"
+
+using namespace std;
+
+namespace purech {
+
+const string &Balancer::Lease::url() const
+{
+    return balancer_->upstreams_[index_].url;
+}
+
+void Balancer::Lease::failed()
+{
+    lock_guard lock{balancer_->mutex_};
+    auto& u = balancer_->upstreams_[index_];
+    if (u.downUntil <= clock_t::now()) {
+        LOG_WARN << "Not using " << u.url << " for " << balancer_->quarantine_.count()
+                 << " seconds after a failed request.";
+    }
+    u.downUntil = clock_t::now() + balancer_->quarantine_;
+}
+
+Balancer::Balancer(vector<string> urls, chrono::seconds quarantine)
+    : quarantine_{quarantine}
+{
+    if (urls.empty()) {
+        throw runtime_error("Balancer: No urls");
+    }
+
+    for(auto& url : urls) {
+        upstreams_.push_back({move(url), 0, {}});
+    }
+}
+
+Balancer::Lease Balancer::acquire()
+{
+    lock_guard lock{mutex_};
+
+    const auto now = clock_t::now();
+    const auto count = upstreams_.size();
+    size_t best = count;
+    for(size_t n = 0; n < count; ++n) {
+        const auto i = (next_ + n) % count;
+        const auto& u = upstreams_[i];
+        if (u.downUntil > now) {
+            continue;
+        }
+        if (best == count || u.outstanding < upstreams_[best].outstanding) {
+            best = i;
+        }
+    }
+
+    if (best == count) {
+        // All are quarantined. Try the one that has been down the longest.
+        best = 0;
+        for(size_t i = 1; i < count; ++i) {
+            if (upstreams_[i].downUntil < upstreams_[best].downUntil) {
+                best = i;
+            }
+        }
+    }
+
+    next_ = (best + 1) % count;
+    ++upstreams_[best].outstanding;
+    return {*this, best};
+}
+
+size_t Balancer::healthy() const
+{
+    lock_guard lock{mutex_};
+    const auto now = clock_t::now();
+    size_t n = 0;
+    for(const auto& u : upstreams_) {
+        if (u.downUntil <= now) {
+            ++n;
+        }
+    }
+    return n;
+}
+
+void Balancer::release(size_t index)
+{
+    lock_guard lock{mutex_};
+    --upstreams_[index].outstanding;
+}
+
+} // ns
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace purech {
+
+/*! Spreads the requests to a cluster over several base urls, like one
+ *  port-forwarding per broker pod.
+ *
+ *  Each request goes to the url with the fewest outstanding requests.
+ *  A url that fails is left out for a while, so that the requests fail
+ *  over to the others.
+ */
+class Balancer {
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    // Holds a slot on one url until it goes out of scope
+    class Lease {
+    public:
+        Lease(Balancer& balancer, size_t index)
+            : balancer_{&balancer}, index_{index} {}
+        Lease(const Lease&) = delete;
+        Lease(Lease&& v) noexcept
+            : balancer_{v.balancer_}, index_{v.index_} {
+            v.balancer_ = {};
+        }
+        ~Lease() {
+            if (balancer_) {
+                balancer_->release(index_);
+            }
+        }
+
+        const std::string& url() const;
+
+        // The url did not work. Don't use it for a while.
+        void failed();
+
+    private:
+        Balancer *balancer_;
+        const size_t index_;
+    };
+
+    explicit Balancer(std::vector<std::string> urls,
+                      std::chrono::seconds quarantine = std::chrono::seconds{5});
+
+    Lease acquire();
+
+    size_t size() const noexcept {
+        return upstreams_.size();
+    }
+
+    // Number of urls that are not quarantined
+    size_t healthy() const;
+
+private:
+    struct Upstream {
+        std::string url;
+        size_t outstanding = 0;
+        clock_t::time_point downUntil;
+    };
+
+    void release(size_t index);
+
+    std::vector<Upstream> upstreams_;
+    const std::chrono::seconds quarantine_;
+    mutable std::mutex mutex_;
+    size_t next_ = 0; // Breaks ties round-robin
+};
+
+} // ns
@@ -0,0 +1,202 @@
+// Runs the Engine against the mock admin server (or the given targets)
+// and reports how fast the scan was.
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+#include <sys/resource.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/process.hpp>
+#include <boost/program_options.hpp>
+
+#include "pulsar.h"
+
+using namespace std;
+using namespace purech;
+
+namespace {
+
+double peakRssMb() {
+    rusage ru = {};
+    getrusage(RUSAGE_SELF, &ru);
+    return static_cast<double>(ru.ru_maxrss) / 1024.0; // ru_maxrss is in KB on Linux
+}
+
+} // anon ns
+
+int main(int argc, char *argv[]) {
+    namespace po = boost::program_options;
+    namespace bp = boost::process;
+
+    Config config;
+    config.showSummary = false;
+    string log_level;
+    string fields;
+    string mockServer = (filesystem::path{argv[0]}.parent_path() / "purech-mock-server").string();
+    uint16_t port = 18080;
+    size_t clusters = 3, tenants = 2, namespaces = 4, topics = 50, partitions = 0, subscriptions = 2, consumers = 2;
+    size_t bundles = 4, brokers = 1;
+    unsigned latencyMs = 0, jitterMs = 0;
+    double failureRate = 0;
+    size_t scans = 1;
+
+    po::options_description general("Options");
+    general.add_options()("help,h", "Print help and exit")
+            ("log-level,l", po::value<string>(&log_level)->default_value("warn"),
+             "Log-level to use; one of 'warn', 'info', 'debug', 'trace'")
+            ("max-inflight", po::value<size_t>(&config.maxInflight)->default_value(config.maxInflight),
+             "Max number of concurrent requests to each cluster")
+            ("threads", po::value<size_t>(&config.threads)->default_value(config.threads),
+             "Number of threads for the requests, json parsing and aggregation")
+            ("rate", po::value<double>(&config.rate)->default_value(config.rate),
+             "Max requests per second to each cluster")
+            ("retries", po::value<size_t>(&config.retries)->default_value(config.retries))
+            ("hedge", po::bool_switch(&config.hedge), "Hedge slow requests")
+            ("bulk", po::bool_switch(&config.bulkStats), "Use bulk stats acquisition")
+            ("direct-brokers", po::bool_switch(&config.directBrokers), "With --bulk, also ask each broker directly")
+            ("partition-stats", po::bool_switch(&config.partitionStats), "Keep each partition's stats too")
+            ("broker-load", po::bool_switch(&config.brokers), "Report the load per broker")
+            ("route-to-owner", po::bool_switch(&config.routeToOwner), "Send the topic stats requests to the owners")
+            ("incremental", po::bool_switch(&config.incremental), "Only fetch the active topics after the first scan")
+            ("scans", po::value<size_t>(&scans)->default_value(scans), "Scans to run, one second apart")
+            ("compress", po::bool_switch(&config.compress), "Ask for compressed replies")
+            ("topic-tree", po::bool_switch(&config.topicTree), "Also keep the topic stats in the namespace tree")
+            ("fields", po::value<string>(&fields), "Topic stats fields to deserialize")
+            ("include", po::value<vector<string>>(&config.include)->composing(), "Topic pattern to include")
+            ("exclude", po::value<vector<string>>(&config.exclude)->composing(), "Topic pattern to exclude")
+            ("profile", po::bool_switch(&config.profile), "Print the per-endpoint profile")
+            ("trace", po::value<string>(&config.traceFile), "Write a Chrome trace to this file")
+            ("mock-server", po::value<string>(&mockServer)->default_value(mockServer),
+             "The mock server to start when no targets are given")
+            ("port,p", po::value<uint16_t>(&port)->default_value(port), "First port for the mock server")
+            ("clusters", po::value<size_t>(&clusters)->default_value(clusters))
+            ("tenants", po::value<size_t>(&tenants)->default_value(tenants))
+            ("namespaces", po::value<size_t>(&namespaces)->default_value(namespaces), "Namespaces per tenant")
+            ("topics", po::value<size_t>(&topics)->default_value(topics), "Topics per namespace")
+            ("partitions", po::value<size_t>(&partitions)->default_value(partitions),
+             "Partitions per topic. 0 means the topics are not partitioned")
+            ("subscriptions", po::value<size_t>(&subscriptions)->default_value(subscriptions))
+            ("bundles", po::value<size_t>(&bundles)->default_value(bundles), "Bundles per namespace")
+            ("brokers", po::value<size_t>(&brokers)->default_value(brokers), "Brokers per cluster")
+            ("consumers", po::value<size_t>(&consumers)->default_value(consumers))
+            ("latency-ms", po::value<unsigned>(&latencyMs)->default_value(latencyMs))
+            ("jitter-ms", po::value<unsigned>(&jitterMs)->default_value(jitterMs))
+            ("failure-rate", po::value<double>(&failureRate)->default_value(failureRate))
+            ;
+
+    po::options_description hidden("Hidden options");
+    hidden.add_options()("targets",
+                         po::value<decltype(config.clusters)>(&config.clusters),
+                         "url,cluster-name");
+
+    po::options_description cmdline_options;
+    po::positional_options_description kfo;
+    cmdline_options.add(general).add(hidden);
+    kfo.add("targets", -1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv)
+              .options(cmdline_options)
+              .positional(kfo)
+              .run(),
+              vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << filesystem::path(argv[0]).stem().string() << " [options] [url,cluster-name ...]";
+        cout << general << endl;
+        return -1;
+    }
+
+    if (!fields.empty()) {
+        boost::split(config.fields, fields, boost::is_any_of(","));
+    }
+
+    auto llevel = logfault::LogLevel::WARN;
+    if (log_level == "info") {
+        llevel = logfault::LogLevel::INFO;
+    } else if (log_level == "debug") {
+        llevel = logfault::LogLevel::DEBUGGING;
+    } else if (log_level == "trace") {
+        llevel = logfault::LogLevel::TRACE;
+    }
+    logfault::LogManager::Instance().AddHandler(
+                make_unique<logfault::StreamHandler>(clog, llevel));
+
+    if (config.routeToOwner) {
+        config.brokers = true;
+    }
+
+    if (scans > 1) {
+        config.watchInterval = 1;
+        config.watchIterations = scans;
+    }
+
+    unique_ptr<bp::child> mock;
+    bp::ipstream mockOut;
+    if (config.clusters.empty()) {
+        mock = make_unique<bp::child>(mockServer,
+                                      "--port", to_string(port),
+                                      "--clusters", to_string(clusters),
+                                      "--tenants", to_string(tenants),
+                                      "--namespaces", to_string(namespaces),
+                                      "--topics", to_string(topics),
+                                      "--partitions", to_string(partitions),
+                                      "--subscriptions", to_string(subscriptions),
+                                      "--bundles", to_string(bundles),
+                                      "--brokers", to_string(brokers),
+                                      "--consumers", to_string(consumers),
+                                      "--latency-ms", to_string(latencyMs),
+                                      "--jitter-ms", to_string(jitterMs),
+                                      "--failure-rate", to_string(failureRate),
+                                      bp::std_out > mockOut);
+
+        // The mock server prints one target per cluster when it is ready
+        string line;
+        while(config.clusters.size() < clusters && getline(mockOut, line)) {
+            config.clusters.push_back(line);
+        }
+
+        if (config.clusters.size() < clusters) {
+            cerr << "The mock server did not start." << endl;
+            return 1;
+        }
+    }
+
+    const auto start = chrono::steady_clock::now();
+    try {
+        Engine engine{config};
+        engine.run();
+
+        const auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        const auto& m = engine.metrics();
+        auto ms = [&m](double p) {
+            return static_cast<double>(m.latency.percentile(p)) / 1000.0;
+        };
+
+        cout << fixed << setprecision(3)
+             << "clusters:     " << config.clusters.size() << endl
+             << "topics:       " << m.topics << " (" << m.reused << " reused)" << endl
+             << "wall time:    " << elapsed << " s" << endl
+             << "requests:     " << m.requests << " (" << m.failures << " failed, "
+             << m.retries << " retries, " << m.hedges << " hedged)" << endl
+             << "requests/s:   " << setprecision(1) << (static_cast<double>(m.requests) / elapsed) << endl
+             << "latency ms:   p50 " << setprecision(3) << ms(0.5) << "  p90 " << ms(0.9)
+             << "  p99 " << ms(0.99) << "  max " << (static_cast<double>(m.latency.max()) / 1000.0) << endl
+             << "body MB:      " << setprecision(2) << (static_cast<double>(m.bodyBytes) / (1024.0 * 1024.0))
+             << " (" << (static_cast<double>(m.wireBytes) / (1024.0 * 1024.0)) << " on the wire)" << endl
+             << "peak RSS:     " << setprecision(1) << peakRssMb() << " MB" << endl;
+    } catch (const exception& ex) {
+        cerr << "Caught exception from run: " << ex.what() << endl;
+        return 1;
+    }
+
+    if (mock) {
+        mock->terminate();
+    }
+
+    return 0;
+}
@@ -0,0 +1,363 @@
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+#include <zlib.h>
+
+#include "brokers.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+optional<uint32_t> parseBoundary(const string& hex) {
+    try {
+        size_t pos = 0;
+        const auto value = stoull(hex, &pos, 16);
+        if (pos == hex.size() && value <= 0xffffffffull) {
+            return static_cast<uint32_t>(value);
+        }
+    } catch (const exception&) {
+        ;
+    }
+    return {};
+}
+
+void addShare(BrokerMap::Bundle& bundle, const TopicRow& row, double share) {
+    ++bundle.topics;
+    bundle.rates.msgRateIn += row.rates.msgRateIn * share;
+    bundle.rates.msgThroughputIn += row.rates.msgThroughputIn * share;
+    bundle.rates.msgRateOut += row.rates.msgRateOut * share;
+    bundle.rates.msgThroughputOut += row.rates.msgThroughputOut * share;
+    bundle.backlog += static_cast<uint64_t>(static_cast<double>(row.backlog) * share + 0.5);
+}
+
+void formatBundle(ostream& out, const BrokerMap::Bundle& b) {
+    out << "    " << b.name << " on " << (b.broker.empty() ? "?"s : b.broker) << ": "
+        << b.topics << " topics, " << fixed << setprecision(1)
+        << (b.rates.msgRateIn + b.rates.msgRateOut) << " msg/s, "
+        << ((b.rates.msgThroughputIn + b.rates.msgThroughputOut) / (1024 * 1024)) << " MB/s" << endl;
+}
+
+} // anon ns
+
+void BrokerMap::clear()
+{
+    lock_guard lock{mutex_};
+    brokers_.clear();
+    loads_.clear();
+    owners_.clear();
+    boundaries_.clear();
+    partitions_.clear();
+}
+
+void BrokerMap::setBrokers(vector<string> brokers)
+{
+    lock_guard lock{mutex_};
+    brokers_ = move(brokers);
+}
+
+vector<string> BrokerMap::brokers() const
+{
+    lock_guard lock{mutex_};
+    return brokers_;
+}
+
+void BrokerMap::setOwned(const string &broker, const OwnedBundles &owned)
+{
+    lock_guard lock{mutex_};
+    for(const auto& [bundle, status] : owned) {
+        if (status.is_active) {
+            owners_[bundle] = broker;
+        }
+    }
+}
+
+void BrokerMap::setLoad(const string &broker, const LoadReport &report)
+{
+    lock_guard lock{mutex_};
+    loads_[broker] = report;
+}
+
+void BrokerMap::setBundles(const string &ns, const vector<string> &boundaries)
+{
+    vector<uint32_t> values;
+    for(const auto& hex : boundaries) {
+        const auto value = parseBoundary(hex);
+        if (!value) {
+            LOG_WARN << "Ignoring the bundles of " << ns << ", as " << hex << " is not a hash";
+            return;
+        }
+        values.push_back(*value);
+    }
+    if (values.size() < 2 || !is_sorted(values.begin(), values.end())) {
+        return;
+    }
+
+    lock_guard lock{mutex_};
+    boundaries_[ns] = move(values);
+}
+
+void BrokerMap::setPartitions(const string &topic, size_t partitions)
+{
+    lock_guard lock{mutex_};
+    partitions_[topic] = partitions;
+}
+
+vector<string> BrokerMap::unowned(const string &ns, const vector<string> &topics) const
+{
+    lock_guard lock{mutex_};
+    vector<string> samples;
+    const auto it = boundaries_.find(ns);
+    if (it == boundaries_.end()) {
+        return samples;
+    }
+
+    set<size_t> seen;
+    for(const auto& topic : topics) {
+        const auto bundle = bundleOf(ns, topic);
+        if (bundle && seen.insert(*bundle).second
+                && !owners_.count(bundleName(ns, it->second, *bundle))) {
+            samples.push_back(topic);
+        }
+    }
+    return samples;
+}
+
+void BrokerMap::setOwner(const string &ns, const string &topic, const string &broker)
+{
+    lock_guard lock{mutex_};
+    if (const auto bundle = bundleOf(ns, topic)) {
+        owners_[bundleName(ns, boundaries_.at(ns), *bundle)] = broker;
+    }
+}
+
+string BrokerMap::route(const string &ns, const string &topic) const
+{
+    lock_guard lock{mutex_};
+    const auto bundle = bundleOf(ns, topic);
+    if (!bundle) {
+        return {};
+    }
+    const auto it = owners_.find(bundleName(ns, boundaries_.at(ns), *bundle));
+    if (it == owners_.end() || unreachable_.count(it->second)) {
+        return {};
+    }
+    return it->second;
+}
+
+void BrokerMap::unreachable(const string &broker)
+{
+    lock_guard lock{mutex_};
+    unreachable_.insert(broker);
+}
+
+BrokerMap::Report BrokerMap::report(const Engine::Cluster &cluster) const
+{
+    lock_guard lock{mutex_};
+
+    Report report;
+    report.cluster = cluster.name;
+
+    // Sum the topics per bundle. The rows are sorted, so each namespace is a run.
+    const auto& store = *cluster.store;
+    map<string, Bundle> bundles;
+    const vector<uint32_t> *boundaries = {};
+    string ns;
+    sid_t currentNs = StringPool::none;
+    for(const auto& row : store.topics()) {
+        if (row.ns != currentNs || ns.empty()) {
+            currentNs = row.ns;
+            ns = store.str(row.ns);
+            const auto it = boundaries_.find(ns);
+            boundaries = it == boundaries_.end() ? nullptr : &it->second;
+        }
+
+        const string topic{store.str(row.topic)};
+        size_t parts = 1;
+        if (auto it = partitions_.find(topic); it != partitions_.end() && it->second) {
+            parts = it->second;
+        }
+        if (!boundaries) {
+            report.unowned += parts;
+            continue;
+        }
+
+        const auto share = 1.0 / static_cast<double>(parts);
+        for(size_t i = 0; i < parts; ++i) {
+            const auto name = parts > 1 ? topic + "-partition-" + to_string(i) : topic;
+            if (const auto bundle = bundleOf(ns, name)) {
+                auto& b = bundles[bundleName(ns, *boundaries, *bundle)];
+                addShare(b, row, share);
+            }
+        }
+    }
+
+    // Every broker is listed, as the idle ones are where the load can go
+    map<string, Broker> brokers;
+    for(const auto& name : brokers_) {
+        brokers[name].name = name;
+    }
+    for(auto& [name, bundle] : bundles) {
+        bundle.name = name;
+        if (auto it = owners_.find(name); it != owners_.end()) {
+            bundle.broker = it->second;
+        }
+        if (bundle.broker.empty()) {
+            report.unowned += bundle.topics;
+            continue;
+        }
+
+        auto& broker = brokers[bundle.broker];
+        broker.name = bundle.broker;
+        ++broker.bundles;
+        broker.topics += bundle.topics;
+        broker.rates += bundle.rates;
+        broker.backlog += bundle.backlog;
+    }
+
+    double total = 0;
+    for(auto& [name, broker] : brokers) {
+        if (auto it = loads_.find(name); it != loads_.end()) {
+            broker.report = it->second;
+        }
+        total += broker.throughput();
+        report.brokers.push_back(move(broker));
+    }
+
+    const auto mean = report.brokers.empty() ? 0.0 : total / static_cast<double>(report.brokers.size());
+    for(auto& broker : report.brokers) {
+        broker.load = mean > 0 ? broker.throughput() / mean : 0.0;
+        report.skew = max(report.skew, broker.load);
+    }
+    stable_sort(report.brokers.begin(), report.brokers.end(), [](const auto& a, const auto& b) {
+        return a.load > b.load;
+    });
+
+    for(const auto& [_, bundle] : bundles) {
+        if (bundle.topics > 1
+                && (bundle.topics > options_.maxBundleTopics
+                    || bundle.rates.msgRateIn + bundle.rates.msgRateOut > options_.maxBundleMsgRate
+                    || bundle.throughput() > options_.maxBundleThroughput)) {
+            report.split.push_back(bundle);
+        }
+    }
+    sort(report.split.begin(), report.split.end(), [](const auto& a, const auto& b) {
+        return a.throughput() > b.throughput();
+    });
+
+    // Unload the largest bundles that fit in what an overloaded broker has
+    // over the mean, until it's down to the mean. A bundle that is larger
+    // than that would just move the hotspot, and must be split instead.
+    if (report.brokers.size() > 1) {
+        for(const auto& broker : report.brokers) {
+            if (broker.load <= options_.maxSkew) {
+                break;
+            }
+
+            vector<const Bundle *> owned;
+            for(const auto& [_, bundle] : bundles) {
+                if (bundle.broker == broker.name) {
+                    owned.push_back(&bundle);
+                }
+            }
+            sort(owned.begin(), owned.end(), [](const auto *a, const auto *b) {
+                return a->throughput() > b->throughput();
+            });
+
+            auto excess = broker.throughput() - mean;
+            for(const auto *bundle : owned) {
+                if (excess <= 0) {
+                    break;
+                }
+                if (bundle->throughput() > 0 && bundle->throughput() <= excess) {
+                    report.unload.push_back(*bundle);
+                    excess -= bundle->throughput();
+                }
+            }
+        }
+    }
+
+    return report;
+}
+
+void BrokerMap::print(const vector<Report> &reports, ostream &out) const
+{
+    // Formatted on its own, so that `out` keeps its flags
+    ostringstream text;
+    text << "Broker load:" << endl;
+    for(const auto& r : reports) {
+        text << "Cluster " << r.cluster << ": " << r.brokers.size() << " brokers, skew "
+             << fixed << setprecision(2) << r.skew << " (the most loaded broker's throughput over the mean).";
+        if (r.unowned) {
+            text << ' ' << r.unowned << " topics are in bundles whose owner we don't know.";
+        }
+        text << endl;
+
+        for(const auto& b : r.brokers) {
+            text << "  " << left << setw(24) << b.name << right << setprecision(2) << " load " << b.load
+                 << setprecision(1) << ", " << b.bundles << " bundles, " << b.topics << " topics, "
+                 << b.rates.msgRateIn << " msg/s in, " << b.rates.msgRateOut << " msg/s out, "
+                 << (b.throughput() / (1024 * 1024)) << " MB/s, backlog " << b.backlog;
+            if (b.report) {
+                const auto& lr = *b.report;
+                text << ". cpu " << lr.cpu.percent() << "%, memory " << lr.memory.percent()
+                     << "%, direct memory " << lr.directMemory.percent() << "%, bandwidth in "
+                     << lr.bandwidthIn.percent() << "%, out " << lr.bandwidthOut.percent() << '%';
+            }
+            text << endl;
+        }
+
+        if (!r.split.empty()) {
+            text << "  Bundles to split (" << r.split.size() << "):" << endl;
+            for(size_t i = 0; i < min(r.split.size(), options_.maxLines); ++i) {
+                formatBundle(text, r.split[i]);
+            }
+        }
+        if (!r.unload.empty()) {
+            text << "  Bundles to unload (" << r.unload.size() << "):" << endl;
+            for(size_t i = 0; i < min(r.unload.size(), options_.maxLines); ++i) {
+                formatBundle(text, r.unload[i]);
+            }
+        }
+    }
+    out << text.str();
+}
+
+uint32_t BrokerMap::bundleHash(string_view topic) noexcept
+{
+    // Guava's Hashing.crc32(), which is the broker's default
+    return static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef *>(topic.data()),
+                                       static_cast<uInt>(topic.size())));
+}
+
+optional<size_t> BrokerMap::bundleOf(const string &ns, string_view topic) const
+{
+    const auto it = boundaries_.find(ns);
+    if (it == boundaries_.end()) {
+        return {};
+    }
+
+    // The last bundle also has its upper boundary, 0xffffffff
+    const auto& b = it->second;
+    const auto hash = bundleHash(topic);
+    if (hash < b.front() || hash > b.back()) {
+        return {};
+    }
+    const auto upper = upper_bound(b.begin(), b.end(), hash);
+    return min<size_t>(static_cast<size_t>(upper - b.begin()) - 1, b.size() - 2);
+}
+
+string BrokerMap::bundleName(const string &ns, const vector<uint32_t> &boundaries, size_t bundle)
+{
+    char range[32];
+    snprintf(range, sizeof(range), "0x%08x_0x%08x", boundaries[bundle], boundaries[bundle + 1]);
+    return ns + '/' + range;
+}
+
+} // ns
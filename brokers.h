@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pulsar.h"
+
+namespace purech {
+
+/*! Which broker owns each namespace bundle of one cluster, and the load
+ *  the topics put on each broker.
+ *
+ *  A topic is in the bundle whose hash range has the CRC-32 of its full
+ *  name, like in the broker's NamespaceBundleFactory. A partitioned
+ *  topic's stats are the sum of its partitions, which may be in
+ *  different bundles, so they are split evenly over its partitions.
+ *
+ *  The report has the load of each broker, the skew between them, the
+ *  bundles that are over the broker's split thresholds, and the bundles
+ *  to unload from the overloaded brokers to bring them down to the mean.
+ *
+ *  Filled while scanning, so the calls are thread-safe.
+ */
+class BrokerMap {
+public:
+    struct Options {
+        double maxSkew = 1.25; // A broker with more than this times the mean throughput is overloaded
+        // The broker's defaults for splitting a bundle
+        size_t maxBundleTopics = 1000;
+        double maxBundleMsgRate = 30000; // In and out
+        double maxBundleThroughput = 100.0 * 1024 * 1024; // Bytes per second, in and out
+        size_t maxLines = 20; // Bundles to list per cluster
+    };
+
+    struct Bundle {
+        std::string name; // tenant/ns/0x00000000_0x40000000
+        std::string broker; // Empty if we don't know the owner
+        size_t topics = 0;
+        Stats rates;
+        uint64_t backlog = 0;
+
+        double throughput() const noexcept {
+            return rates.msgThroughputIn + rates.msgThroughputOut;
+        }
+    };
+
+    struct Broker {
+        std::string name; // host:port
+        size_t bundles = 0; // Bundles with topics from the scan
+        size_t topics = 0;
+        Stats rates;
+        uint64_t backlog = 0;
+        double load = 0; // Throughput relative to the mean of the brokers
+        std::optional<LoadReport> report;
+
+        double throughput() const noexcept {
+            return rates.msgThroughputIn + rates.msgThroughputOut;
+        }
+    };
+
+    struct Report {
+        std::string cluster;
+        std::vector<Broker> brokers; // Most loaded first
+        double skew = 0; // Throughput of the most loaded broker relative to the mean
+        std::vector<Bundle> split; // Over the split thresholds. Largest first
+        std::vector<Bundle> unload; // From the overloaded brokers
+        size_t unowned = 0; // Topics in bundles we don't know the owner of
+    };
+
+    explicit BrokerMap(const Options& options)
+        : options_{options} {}
+
+    // Forgets what the last scan found, but not the brokers we could not reach
+    void clear();
+
+    void setBrokers(std::vector<std::string> brokers);
+    std::vector<std::string> brokers() const;
+    void setOwned(const std::string& broker, const OwnedBundles& owned);
+    void setLoad(const std::string& broker, const LoadReport& report);
+    void setBundles(const std::string& ns, const std::vector<std::string>& boundaries);
+    void setPartitions(const std::string& topic, size_t partitions);
+
+    // One topic from each bundle of the namespace that has no known owner
+    std::vector<std::string> unowned(const std::string& ns, const std::vector<std::string>& topics) const;
+
+    // A lookup of the topic said that the broker owns its bundle
+    void setOwner(const std::string& ns, const std::string& topic, const std::string& broker);
+
+    // The broker (host:port) that owns the topic, if we know it and can reach it
+    std::string route(const std::string& ns, const std::string& topic) const;
+
+    // Requests to the broker failed. Route its topics to the cluster's url from now on.
+    void unreachable(const std::string& broker);
+
+    // For an aggregated cluster
+    Report report(const Engine::Cluster& cluster) const;
+
+    void print(const std::vector<Report>& reports, std::ostream& out) const;
+
+    // The hash that picks a topic's bundle
+    static uint32_t bundleHash(std::string_view topic) noexcept;
+
+private:
+    // The bundle of a topic, as an index in the namespace's boundaries. Needs the lock.
+    std::optional<size_t> bundleOf(const std::string& ns, std::string_view topic) const;
+    static std::string bundleName(const std::string& ns, const std::vector<uint32_t>& boundaries, size_t bundle);
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    std::vector<std::string> brokers_;
+    std::map<std::string /* broker */, LoadReport> loads_;
+    std::unordered_map<std::string /* bundle */, std::string /* broker */> owners_;
+    std::unordered_map<std::string /* ns */, std::vector<uint32_t>> boundaries_;
+    std::unordered_map<std::string /* topic */, size_t> partitions_;
+    std::set<std::string> unreachable_;
+};
+
+} // ns
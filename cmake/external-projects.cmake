@@ -25,7 +25,10 @@ ExternalProject_Add(externalRestcCpp
         #-DRESTC_CPP_LOG_JSON_SERIALIZATION=1
         -DBOOST_ROOT=${BOOST_ROOT}
         -DCMAKE_BUILD_TYPE=${CMAKE_BUILD_TYPE}
-        #-DRESTC_CPP_THREADED_CTX=ON
+        -DRESTC_CPP_THREADED_CTX=ON
+        # We negotiate and decode compressed replies ourself, so that we
+        # can count the bytes on the wire
+        -DRESTC_CPP_WITH_ZLIB=OFF
         -DRESTC_BOOST_VERSION=${USE_BOOST_VERSION}
         -DBOOST_ERROR_CODE_HEADER_ONLY=1
     )
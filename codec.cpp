@@ -0,0 +1,190 @@
+
+#include <array>
+#include <cctype>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "codec.h"
+
+using namespace std;
+using namespace std::string_literals;
+
+namespace purech {
+
+namespace {
+
+bool equals(string_view a, string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); ++i) {
+        if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+string_view trim(string_view v) {
+    while (!v.empty() && isspace(static_cast<unsigned char>(v.front()))) {
+        v.remove_prefix(1);
+    }
+    while (!v.empty() && isspace(static_cast<unsigned char>(v.back()))) {
+        v.remove_suffix(1);
+    }
+    return v;
+}
+
+// zlib's window bits for each format
+constexpr int zlibWindow = 15;
+constexpr int gzipWindow = 15 + 16;
+constexpr int rawWindow = -15;
+
+} // anon ns
+
+optional<ContentEncoding> contentEncoding(string_view header)
+{
+    header = trim(header);
+    if (header.empty() || equals(header, "identity")) {
+        return ContentEncoding::IDENTITY;
+    }
+    if (equals(header, "gzip") || equals(header, "x-gzip")) {
+        return ContentEncoding::GZIP;
+    }
+    if (equals(header, "deflate")) {
+        return ContentEncoding::DEFLATE;
+    }
+    return {};
+}
+
+ContentEncoding preferredEncoding(string_view accept)
+{
+    auto best = ContentEncoding::IDENTITY;
+    while (!accept.empty()) {
+        const auto end = accept.find(',');
+        auto item = accept.substr(0, end);
+        accept = end == string_view::npos ? string_view{} : accept.substr(end + 1);
+
+        // "gzip;q=0" means no gzip
+        if (const auto params = item.find(';'); params != string_view::npos) {
+            if (trim(item.substr(params + 1)) == "q=0") {
+                continue;
+            }
+            item = item.substr(0, params);
+        }
+
+        if (const auto encoding = contentEncoding(item)) {
+            if (*encoding == ContentEncoding::GZIP) {
+                return *encoding;
+            }
+            if (*encoding == ContentEncoding::DEFLATE) {
+                best = *encoding;
+            }
+        }
+    }
+    return best;
+}
+
+struct Inflater::Stream {
+    z_stream z = {};
+    bool initialized = false;
+    // On the heap with the stream, as decode() runs on the coroutines' small stacks
+    array<char, 64 * 1024> buffer;
+};
+
+Inflater::Inflater(ContentEncoding encoding)
+    : encoding_{encoding}, stream_{make_unique<Stream>()}
+{
+    if (encoding_ == ContentEncoding::IDENTITY) {
+        throw invalid_argument("Inflater: Nothing to decode for identity");
+    }
+
+    if (encoding_ == ContentEncoding::GZIP) {
+        init(gzipWindow);
+    }
+    // For deflate we look at the first bytes to tell zlib from raw deflate
+}
+
+Inflater::~Inflater()
+{
+    if (stream_->initialized) {
+        inflateEnd(&stream_->z);
+    }
+}
+
+void Inflater::init(int windowBits)
+{
+    if (inflateInit2(&stream_->z, windowBits) != Z_OK) {
+        throw runtime_error("Inflater: Failed to initialize zlib");
+    }
+    stream_->initialized = true;
+}
+
+void Inflater::decode(string_view in, string &out)
+{
+    if (in.empty() || done_) {
+        return;
+    }
+
+    auto& z = stream_->z;
+    if (!stream_->initialized) {
+        // A zlib header is a CMF byte with method 8, and a check sum
+        // over the first two bytes. With one byte, the method must do.
+        const auto cmf = static_cast<unsigned char>(in[0]);
+        const bool zlib = (cmf & 0x0f) == 8 && (cmf >> 4) <= 7
+                && (in.size() < 2 || ((cmf << 8) | static_cast<unsigned char>(in[1])) % 31 == 0);
+        init(zlib ? zlibWindow : rawWindow);
+    }
+
+    z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    z.avail_in = static_cast<uInt>(in.size());
+
+    auto& buffer = stream_->buffer;
+    do {
+        z.next_out = reinterpret_cast<Bytef *>(buffer.data());
+        z.avail_out = static_cast<uInt>(buffer.size());
+
+        const auto result = inflate(&z, Z_NO_FLUSH);
+        out.append(buffer.data(), buffer.size() - z.avail_out);
+
+        if (result == Z_STREAM_END) {
+            done_ = true;
+            return;
+        }
+        if (result != Z_OK && result != Z_BUF_ERROR) {
+            throw runtime_error("Failed to decompress the reply: "s + (z.msg ? z.msg : "corrupt data"));
+        }
+    } while (z.avail_out == 0); // Until it needs more input
+}
+
+string compress(string_view in, ContentEncoding encoding)
+{
+    if (encoding == ContentEncoding::IDENTITY) {
+        return string{in};
+    }
+
+    z_stream z = {};
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     encoding == ContentEncoding::GZIP ? gzipWindow : zlibWindow,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw runtime_error("Failed to initialize zlib");
+    }
+
+    string out;
+    out.resize(deflateBound(&z, static_cast<uLong>(in.size())) + 32);
+    z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    z.avail_in = static_cast<uInt>(in.size());
+    z.next_out = reinterpret_cast<Bytef *>(out.data());
+    z.avail_out = static_cast<uInt>(out.size());
+
+    const auto result = deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    if (result != Z_STREAM_END) {
+        throw runtime_error("Failed to compress");
+    }
+    return out;
+}
+
+} // ns
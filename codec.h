@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace purech {
+
+enum class ContentEncoding { IDENTITY, GZIP, DEFLATE };
+
+// What we ask for in Accept-Encoding when compression is enabled
+constexpr std::string_view acceptEncoding = "gzip, deflate";
+
+// The encoding named in a Content-Encoding header. Empty if we can't decode it.
+std::optional<ContentEncoding> contentEncoding(std::string_view header);
+
+// The encoding to use for a reply, from a request's Accept-Encoding header
+ContentEncoding preferredEncoding(std::string_view acceptEncoding);
+
+/*! Streaming decompression of a gzip or deflate body.
+ *
+ *  The body is fed to decode() in chunks, as they arrive, and the
+ *  decoded bytes are appended to the output. Some servers send raw
+ *  deflate data for "deflate", rather than the zlib format the RFC
+ *  asks for, so both are accepted.
+ */
+class Inflater {
+public:
+    explicit Inflater(ContentEncoding encoding);
+    ~Inflater();
+
+    Inflater(const Inflater&) = delete;
+    Inflater& operator = (const Inflater&) = delete;
+
+    // Throws on corrupt data
+    void decode(std::string_view in, std::string& out);
+
+    // The end of the compressed data was seen
+    bool done() const noexcept {
+        return done_;
+    }
+
+private:
+    struct Stream;
+
+    void init(int windowBits);
+
+    const ContentEncoding encoding_;
+    std::unique_ptr<Stream> stream_;
+    bool done_ = false;
+};
+
+// Compresses a whole body. The mock server uses it.
+std::string compress(std::string_view in, ContentEncoding encoding);
+
+} // ns
@@ -0,0 +1,183 @@
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "delta.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+struct Line {
+    enum Severity {
+        RATE,
+        BACKLOG,
+        DELAY,
+        LINK
+    };
+
+    Severity severity;
+    double magnitude;
+    string text;
+
+    bool operator < (const Line& v) const noexcept {
+        if (severity != v.severity) {
+            return severity > v.severity;
+        }
+        return magnitude > v.magnitude;
+    }
+};
+
+template <typename T>
+string signedValue(const T& v) {
+    ostringstream out;
+    out << fixed << setprecision(1) << showpos << v;
+    return out.str();
+}
+
+void compareLinks(const string& topic,
+                  const DeltaTracker::TopicSample& prev,
+                  const DeltaTracker::TopicSample& cur,
+                  vector<Line>& lines) {
+
+    for(const auto& [peer, link] : cur.replication) {
+        const auto pit = prev.replication.find(peer);
+        if (pit == prev.replication.end()) {
+            continue;
+        }
+
+        const auto& plink = pit->second;
+        const auto name = topic + " -> " + peer;
+
+        if (plink.connected != link.connected) {
+            lines.push_back({Line::LINK, 0, name + (link.connected ? " reconnected" : " disconnected")});
+        }
+
+        if (const auto d = link.replicationDelayInSeconds - plink.replicationDelayInSeconds; d > 0) {
+            ostringstream out;
+            out << name << " delay " << link.replicationDelayInSeconds << "s ("
+                << showpos << d << "s)" << noshowpos
+                << " backlog " << link.replicationBacklog << " ("
+                << showpos << (link.replicationBacklog - plink.replicationBacklog) << ")";
+            lines.push_back({Line::DELAY, static_cast<double>(d), out.str()});
+        }
+    }
+}
+
+void compareTopics(const string& topic,
+                   const DeltaTracker::TopicSample& prev,
+                   const DeltaTracker::TopicSample& cur,
+                   double seconds,
+                   vector<Line>& lines) {
+
+    if (cur.backlog > prev.backlog) {
+        const auto growth = static_cast<double>(cur.backlog - prev.backlog);
+        ostringstream out;
+        out << topic << " backlog " << cur.backlog << " (+" << (cur.backlog - prev.backlog);
+        if (seconds > 0) {
+            out << ", " << fixed << setprecision(1) << (growth / seconds) << "/s";
+        }
+        out << ')';
+        lines.push_back({Line::BACKLOG, growth, out.str()});
+    }
+
+    // Only report rate changes that are significant
+    auto rate = [&](const char *name, double before, double after) {
+        const auto diff = after - before;
+        if (fabs(diff) >= 1.0 && fabs(diff) >= max(before, after) / 2) {
+            ostringstream out;
+            out << topic << ' ' << name << ' ' << fixed << setprecision(1) << after
+                << " (" << signedValue(diff) << ')';
+            lines.push_back({Line::RATE, fabs(diff), out.str()});
+        }
+    };
+
+    rate("msgRateIn", prev.rates.msgRateIn, cur.rates.msgRateIn);
+    rate("msgRateOut", prev.rates.msgRateOut, cur.rates.msgRateOut);
+
+    compareLinks(topic, prev, cur, lines);
+}
+
+} // anon ns
+
+DeltaTracker::ClusterSample DeltaTracker::sample(const Engine::Cluster &cluster)
+{
+    ClusterSample cs;
+    cs.rates = cluster.stats;
+
+    const auto& store = *cluster.store;
+    for(const auto& topic : store.topics()) {
+        TopicSample ts;
+        ts.rates = topic.rates;
+        ts.backlog = topic.backlog;
+        for(const auto& r : store.replication(topic)) {
+            ts.replication[string{store.str(r.peer)}] = {r.replicationBacklog, r.replicationDelayInSeconds,
+                                                          r.rates.msgRateOut, r.connected};
+        }
+        cs.backlog += ts.backlog;
+        cs.topics.emplace(store.str(topic.topic), move(ts));
+    }
+
+    return cs;
+}
+
+void DeltaTracker::update(const Engine::Cluster &cluster, clock_t::time_point when, ostream &out)
+{
+    auto cur = sample(cluster);
+
+    if (auto it = previous_.find(cluster.name); it != previous_.end()) {
+        const auto& prev = it->second.data;
+        const auto seconds = chrono::duration<double>(when - it->second.when).count();
+
+        size_t added = 0, removed = 0;
+        vector<Line> lines;
+
+        // Both maps are sorted on the topic name
+        auto p = prev.topics.begin();
+        auto c = cur.topics.begin();
+        while(p != prev.topics.end() || c != cur.topics.end()) {
+            if (c == cur.topics.end() || (p != prev.topics.end() && p->first < c->first)) {
+                ++removed;
+                ++p;
+            } else if (p == prev.topics.end() || c->first < p->first) {
+                ++added;
+                ++c;
+            } else {
+                compareTopics(c->first, p->second, c->second, seconds, lines);
+                ++p;
+                ++c;
+            }
+        }
+
+        // Formatted on its own, so that `out` keeps its flags
+        ostringstream summary;
+        summary << "Cluster " << cluster.name << ": " << cur.topics.size() << " topics (+"
+                << added << " -" << removed << ") over " << fixed << setprecision(0) << seconds << "s"
+                << setprecision(1)
+                << ", msgRateIn " << cur.rates.msgRateIn
+                << " (" << signedValue(cur.rates.msgRateIn - prev.rates.msgRateIn) << ')'
+                << ", msgRateOut " << cur.rates.msgRateOut
+                << " (" << signedValue(cur.rates.msgRateOut - prev.rates.msgRateOut) << ')'
+                << ", backlog " << cur.backlog
+                << " (" << showpos << (static_cast<int64_t>(cur.backlog) - static_cast<int64_t>(prev.backlog))
+                << ')';
+        out << summary.str() << endl;
+
+        const auto show = min(lines.size(), maxLines_);
+        partial_sort(lines.begin(), lines.begin() + show, lines.end());
+        for(size_t i = 0; i < show; ++i) {
+            out << "  " << lines[i].text << endl;
+        }
+        if (lines.size() > show) {
+            out << "  ... and " << (lines.size() - show) << " more changes" << endl;
+        }
+    }
+
+    previous_[cluster.name] = {move(cur), when};
+}
+
+} // ns
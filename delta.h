@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "pulsar.h"
+
+namespace purech {
+
+/*! Keeps the key numbers from the previous scan, and reports how
+ *  topics and replication links changed since then.
+ */
+class DeltaTracker {
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    struct LinkSample {
+        int replicationBacklog = {};
+        int replicationDelayInSeconds = {};
+        double msgRateOut = {};
+        bool connected = false;
+    };
+
+    struct TopicSample {
+        Stats rates;
+        uint64_t backlog = {};
+        std::map<std::string /* peer */, LinkSample> replication;
+    };
+
+    using topics_t = std::map<std::string /* topic */, TopicSample>;
+
+    struct ClusterSample {
+        Stats rates;
+        uint64_t backlog = {};
+        topics_t topics;
+    };
+
+    DeltaTracker(size_t maxLines)
+        : maxLines_{maxLines} {}
+
+    // Compare with the previous sample and make `cluster` the new baseline
+    void update(const Engine::Cluster& cluster, clock_t::time_point when, std::ostream& out);
+
+    static ClusterSample sample(const Engine::Cluster& cluster);
+
+private:
+    struct Sampled {
+        ClusterSample data;
+        clock_t::time_point when;
+    };
+
+    const size_t maxLines_;
+    std::map<std::string /* cluster */, Sampled> previous_;
+};
+
+} // ns
@@ -0,0 +1,370 @@
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
+
+#include "exporter.h"
+#include "logging.h"
+#include "textout.h"
+
+using namespace std;
+using namespace std::string_literals;
+
+namespace purech {
+
+namespace {
+
+struct StatsField {
+    const char *name;
+    const char *help;
+    double Stats::*value;
+};
+
+constexpr StatsField statsFields[] = {
+    {"msg_rate_in", "Messages per second published", &Stats::msgRateIn},
+    {"msg_throughput_in", "Bytes per second published", &Stats::msgThroughputIn},
+    {"msg_rate_out", "Messages per second delivered", &Stats::msgRateOut},
+    {"msg_throughput_out", "Bytes per second delivered", &Stats::msgThroughputOut},
+};
+
+void family(TextOut& out, string_view name, string_view help) {
+    out << "# HELP "sv << name << ' ' << help << "\n# TYPE "sv << name << " gauge\n"sv;
+}
+
+bool known(const Engine::Cluster& cluster, const string& peer) {
+    return find(cluster.clusters.begin(), cluster.clusters.end(), peer) != cluster.clusters.end();
+}
+
+const char *toString(Coverage::State state) {
+    switch(state) {
+    case Coverage::State::COMPLETE: return "complete";
+    case Coverage::State::PARTIAL: return "partial";
+    case Coverage::State::MISSING: break;
+    }
+    return "missing";
+}
+
+void jsonStats(TextOut& out, const Stats& stats) {
+    out << "{\"msgRateIn\":"sv << stats.msgRateIn
+        << ",\"msgThroughputIn\":"sv << stats.msgThroughputIn
+        << ",\"msgRateOut\":"sv << stats.msgRateOut
+        << ",\"msgThroughputOut\":"sv << stats.msgThroughputOut << '}';
+}
+
+template <typename T>
+void jsonStrings(TextOut& out, const T& list) {
+    out << '[';
+    bool first = true;
+    for(const auto& v : list) {
+        if (!first) {
+            out << ',';
+        }
+        first = false;
+        out.quoted(v);
+    }
+    out << ']';
+}
+
+} // anon ns
+
+Exporter::Listen Exporter::Listen::parse(const string &value)
+{
+    const auto parsePort = [](string_view text) {
+        unsigned long port = 0;
+        const auto end = text.data() + text.size();
+        if (const auto r = from_chars(text.data(), end, port);
+                r.ec != errc{} || r.ptr != end || port == 0 || port > 0xffff) {
+            throw invalid_argument("The port must be a number from 1 to 65535, not \""s + string{text} + '"');
+        }
+        return static_cast<uint16_t>(port);
+    };
+
+    Listen listen;
+    string address;
+    if (!value.empty() && all_of(value.begin(), value.end(), [](char ch) { return ch >= '0' && ch <= '9'; })) {
+        listen.port = parsePort(value);
+    } else if (!value.empty() && value.front() == '[') {
+        // [ipv6] or [ipv6]:port
+        const auto close = value.find(']');
+        if (close == string::npos || (close + 1 < value.size() && value[close + 1] != ':')) {
+            throw invalid_argument("Expected [address]:port");
+        }
+        address = value.substr(1, close - 1);
+        if (close + 1 < value.size()) {
+            listen.port = parsePort(string_view{value}.substr(close + 2));
+        }
+    } else if (const auto pos = value.find(':'); pos != string::npos && value.find(':', pos + 1) == string::npos) {
+        address = value.substr(0, pos);
+        listen.port = parsePort(string_view{value}.substr(pos + 1));
+    } else {
+        // An address without a port. An IPv6 address has more than one ':'.
+        address = value;
+    }
+
+    if (!address.empty()) {
+        boost::system::error_code ec;
+        boost::asio::ip::make_address(address, ec);
+        if (ec) {
+            throw invalid_argument("\""s + address + "\" is not an IP address");
+        }
+        listen.address = move(address);
+    }
+    return listen;
+}
+
+Exporter::Exporter(boost::asio::io_context &ctx, const string &address, uint16_t port)
+    : server_{ctx, address, port, [this](const HttpServer::Request& req) {
+          return handle(req);
+      }}
+{
+}
+
+void Exporter::start()
+{
+    server_.start();
+}
+
+void Exporter::stop()
+{
+    server_.stop();
+}
+
+void Exporter::update(const vector<const Engine::Cluster *> &clusters)
+{
+    auto metrics = make_shared<const string>(prometheus(clusters));
+    auto json = make_shared<const string>(Exporter::json(clusters));
+
+    LOG_DEBUG << "Exporting " << metrics->size() << " bytes of metrics and "
+              << json->size() << " bytes of json.";
+
+    lock_guard lock{mutex_};
+    metrics_ = move(metrics);
+    json_ = move(json);
+}
+
+string Exporter::prometheus(const vector<const Engine::Cluster *> &clusters)
+{
+    string body;
+    size_t series = 0;
+    for(const auto *c : clusters) {
+        series += c->store->topics().size();
+    }
+    body.reserve(1024 + series * 3 * 160);
+    TextOut out{body};
+
+    family(out, "purech_scan_complete", "1 if the last scan got all the topics of the cluster");
+    for(const auto *c : clusters) {
+        out << "purech_scan_complete{cluster=\""sv;
+        out.escaped(c->name) << "\"} "sv << (c->coverage().state == Coverage::State::COMPLETE ? 1 : 0) << '\n';
+    }
+
+    family(out, "purech_scan_coverage_ratio", "Part of the listed topics that the last scan got stats for");
+    for(const auto *c : clusters) {
+        out << "purech_scan_coverage_ratio{cluster=\""sv;
+        out.escaped(c->name) << "\"} "sv << c->coverage().percent() / 100.0 << '\n';
+    }
+
+    family(out, "purech_topics", "Topics with stats");
+    for(const auto *c : clusters) {
+        out << "purech_topics{cluster=\""sv;
+        out.escaped(c->name) << "\"} "sv << static_cast<uint64_t>(c->store->topics().size()) << '\n';
+    }
+
+    for(const auto& field : statsFields) {
+        const auto name = "purech_cluster_"s + field.name;
+        family(out, name, field.help);
+        for(const auto *c : clusters) {
+            out << name << "{cluster=\""sv;
+            out.escaped(c->name) << "\"} "sv << c->stats.*field.value << '\n';
+        }
+    }
+
+    for(const auto& field : statsFields) {
+        const auto name = "purech_tenant_"s + field.name;
+        family(out, name, field.help);
+        for(const auto *c : clusters) {
+            for(const auto& [tname, tenant] : c->tenants) {
+                out << name << "{cluster=\""sv;
+                out.escaped(c->name) << "\",tenant=\""sv;
+                out.escaped(tname) << "\"} "sv << tenant.stats.*field.value << '\n';
+            }
+        }
+    }
+
+    for(const auto& field : statsFields) {
+        const auto name = "purech_namespace_"s + field.name;
+        family(out, name, field.help);
+        for(const auto *c : clusters) {
+            for(const auto& [_, tenant] : c->tenants) {
+                for(const auto& [nsname, ns] : tenant.namespaces) {
+                    out << name << "{cluster=\""sv;
+                    out.escaped(c->name) << "\",namespace=\""sv;
+                    out.escaped(nsname) << "\"} "sv << ns.stats.*field.value << '\n';
+                }
+            }
+        }
+    }
+
+    family(out, "purech_namespace_replication_peer",
+           "1 for each replication cluster of a namespace that the cluster knows, 0 if it does not");
+    for(const auto *c : clusters) {
+        for(const auto& [_, tenant] : c->tenants) {
+            for(const auto& [nsname, ns] : tenant.namespaces) {
+                for(const auto& peer : ns.policies.replication_clusters) {
+                    out << "purech_namespace_replication_peer{cluster=\""sv;
+                    out.escaped(c->name) << "\",namespace=\""sv;
+                    out.escaped(nsname) << "\",peer=\""sv;
+                    out.escaped(peer) << "\"} "sv << (known(*c, peer) ? 1 : 0) << '\n';
+                }
+            }
+        }
+    }
+
+    // The links come from the flat topic store, one pass per family
+    auto links = [&](string_view name, string_view help, auto value) {
+        family(out, name, help);
+        for(const auto *c : clusters) {
+            const auto& store = *c->store;
+            for(const auto& topic : store.topics()) {
+                for(const auto& r : TopicStore::replication(topic)) {
+                    out << name << "{cluster=\""sv;
+                    out.escaped(c->name) << "\",namespace=\""sv;
+                    out.escaped(store.str(topic.ns)) << "\",topic=\""sv;
+                    out.escaped(store.str(topic.topic)) << "\",peer=\""sv;
+                    out.escaped(store.str(r.peer)) << "\"} "sv << value(r) << '\n';
+                }
+            }
+        }
+    };
+
+    links("purech_replication_backlog", "Messages not yet replicated to the peer",
+          [](const ReplicationRow& r) { return r.replicationBacklog; });
+    links("purech_replication_delay_seconds", "Replication delay to the peer",
+          [](const ReplicationRow& r) { return r.replicationDelayInSeconds; });
+    links("purech_replication_connected", "1 if the replicator is connected to the peer",
+          [](const ReplicationRow& r) { return r.connected ? 1 : 0; });
+
+    return body;
+}
+
+string Exporter::json(const vector<const Engine::Cluster *> &clusters)
+{
+    string body;
+    TextOut out{body, TextOut::Syntax::JSON};
+
+    out << "{\"clusters\":["sv;
+    bool firstCluster = true;
+    for(const auto *c : clusters) {
+        if (!firstCluster) {
+            out << ',';
+        }
+        firstCluster = false;
+
+        const auto coverage = c->coverage();
+        out << "{\"name\":"sv;
+        out.quoted(c->name) << ",\"coverage\":{\"state\":"sv;
+        out.quoted(toString(coverage.state)) << ",\"percent\":"sv << coverage.percent()
+            << ",\"listedTopics\":"sv << static_cast<uint64_t>(coverage.listed)
+            << ",\"fetchedTopics\":"sv << static_cast<uint64_t>(coverage.fetched)
+            << "},\"clusters\":"sv;
+        jsonStrings(out, c->clusters);
+        out << ",\"stats\":"sv;
+        jsonStats(out, c->stats);
+
+        out << ",\"tenants\":["sv;
+        bool firstTenant = true;
+        for(const auto& [tname, tenant] : c->tenants) {
+            if (!firstTenant) {
+                out << ',';
+            }
+            firstTenant = false;
+            out << "{\"name\":"sv;
+            out.quoted(tname) << ",\"stats\":"sv;
+            jsonStats(out, tenant.stats);
+            out << ",\"namespaces\":["sv;
+            bool firstNs = true;
+            for(const auto& [nsname, ns] : tenant.namespaces) {
+                if (!firstNs) {
+                    out << ',';
+                }
+                firstNs = false;
+
+                vector<string_view> unknown;
+                for(const auto& peer : ns.policies.replication_clusters) {
+                    if (!known(*c, peer)) {
+                        unknown.push_back(peer);
+                    }
+                }
+
+                out << "{\"name\":"sv;
+                out.quoted(nsname) << ",\"replication_clusters\":"sv;
+                jsonStrings(out, ns.policies.replication_clusters);
+                out << ",\"unknown_replication_clusters\":"sv;
+                jsonStrings(out, unknown);
+                out << ",\"stats\":"sv;
+                jsonStats(out, ns.stats);
+                out << '}';
+            }
+            out << "]}"sv;
+        }
+        out << ']';
+
+        out << ",\"replication\":["sv;
+        bool firstLink = true;
+        const auto& store = *c->store;
+        for(const auto& topic : store.topics()) {
+            for(const auto& r : TopicStore::replication(topic)) {
+                if (!firstLink) {
+                    out << ',';
+                }
+                firstLink = false;
+                out << "{\"namespace\":"sv;
+                out.quoted(store.str(topic.ns)) << ",\"topic\":"sv;
+                out.quoted(store.str(topic.topic)) << ",\"peer\":"sv;
+                out.quoted(store.str(r.peer)) << ",\"replicationBacklog\":"sv << r.replicationBacklog
+                    << ",\"replicationDelayInSeconds\":"sv << r.replicationDelayInSeconds
+                    << ",\"connected\":"sv << (r.connected ? "true"sv : "false"sv) << '}';
+            }
+        }
+        out << "]}"sv;
+    }
+    out << "]}\n"sv;
+
+    return body;
+}
+
+HttpServer::Response Exporter::handle(const HttpServer::Request &req) const
+{
+    HttpServer::Response res;
+    const auto path = req.target.substr(0, req.target.find('?'));
+
+    if (req.method != "GET") {
+        res.status = 400;
+        return res;
+    }
+
+    if (path == "/") {
+        res.contentType = "text/plain";
+        res.body = make_shared<const string>("purech\n/metrics  Prometheus metrics\n/json     The same as JSON\n");
+        return res;
+    }
+
+    lock_guard lock{mutex_};
+    if (path == "/metrics") {
+        res.contentType = "text/plain; version=0.0.4; charset=utf-8";
+        res.body = metrics_;
+    } else if (path == "/json") {
+        res.body = json_;
+    } else {
+        res.status = 404;
+        return res;
+    }
+
+    if (!res.body) {
+        res.status = 503; // No scan yet
+    }
+    return res;
+}
+
+} // ns
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "pulsar.h"
+#include "httpserver.h"
+
+namespace purech {
+
+/*! Serves the results of the last scan over HTTP.
+ *
+ *  GET /metrics gives the Prometheus text format, and GET /json the
+ *  same numbers as JSON: the cluster, tenant and namespace rates, the
+ *  coverage of the scan, each namespace's replication clusters, and
+ *  the backlog, delay and state of each topic's replication links.
+ *
+ *  The bodies are rendered once per scan, by update(), straight from
+ *  the tree and the topic store, and the scrapes share them.
+ */
+class Exporter {
+public:
+    // Where to listen, from the value of --listen
+    struct Listen {
+        std::string address = "0.0.0.0";
+        uint16_t port = 9124;
+
+        // Throws std::invalid_argument if it's not port, address or address:port
+        static Listen parse(const std::string& value);
+    };
+
+    Exporter(boost::asio::io_context& ctx, const std::string& address, uint16_t port);
+
+    void start();
+    void stop();
+
+    uint16_t port() const {
+        return server_.port();
+    }
+
+    // Call after each scan, when the clusters are aggregated
+    void update(const std::vector<const Engine::Cluster *>& clusters);
+
+    static std::string prometheus(const std::vector<const Engine::Cluster *>& clusters);
+    static std::string json(const std::vector<const Engine::Cluster *>& clusters);
+
+private:
+    HttpServer::Response handle(const HttpServer::Request& req) const;
+
+    HttpServer server_;
+    mutable std::mutex mutex_;
+    std::shared_ptr<const std::string> metrics_;
+    std::shared_ptr<const std::string> json_;
+};
+
+} // ns
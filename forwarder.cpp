@@ -0,0 +1,560 @@
+
+#include <filesystem>
+#include <istream>
+#include <sstream>
+
+#include <unistd.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/process.hpp>
+
+#include "forwarder.h"
+#include "logging.h"
+
+using namespace std;
+using namespace std::string_literals;
+namespace asio = boost::asio;
+namespace bp = boost::process;
+using unix_socket = asio::local::stream_protocol;
+
+namespace purech {
+
+string ForwardSpec::key() const
+{
+    auto key = kubeconfig + ',' + ns + ',' + service;
+    if (instance) {
+        key += ',' + to_string(instance);
+    }
+    return key;
+}
+
+ForwardSpec ForwardSpec::fromKey(const string &key)
+{
+    vector<string> args;
+    boost::split(args, key, boost::is_any_of(","));
+    if (args.size() < 3 || args.size() > 4) {
+        throw runtime_error("Invalid port-forward: "s + key);
+    }
+
+    ForwardSpec spec{args[0], args[1], args[2]};
+    if (args.size() == 4) {
+        spec.instance = static_cast<unsigned>(stoul(args[3]));
+    }
+    return spec;
+}
+
+namespace {
+
+boost::filesystem::path kubectlPath(const string& kubectl) {
+    return kubectl.find('/') == string::npos
+            ? bp::search_path(kubectl) : boost::filesystem::path{kubectl};
+}
+
+vector<string> kubectlArgs(const ForwardSpec& spec) {
+    vector<string> args{"--kubeconfig", spec.kubeconfig};
+    if (!spec.ns.empty()) {
+        args.insert(args.end(), {"-n", spec.ns});
+    }
+    return args;
+}
+
+} // anon ns
+
+struct Forwarder::Tunnel {
+    Tunnel(ForwardSpec spec, uint16_t port)
+        : spec{move(spec)}, port{port}
+        , name{filesystem::path{this->spec.kubeconfig}.filename().string() + '/' + this->spec.service
+               + (this->spec.instance ? '#' + to_string(this->spec.instance) : ""s)} {}
+
+    const ForwardSpec spec;
+    const uint16_t port;
+    const string name;
+    unique_ptr<bp::async_pipe> out;
+    unique_ptr<bp::async_pipe> err;
+    unique_ptr<bp::child> child;
+    asio::streambuf outBuf;
+    asio::streambuf errBuf;
+    unsigned generation = 0; // Output from a replaced kubectl is ignored
+    bool pending = false; // Waiting for kubectl to tell us that it forwards
+    bool ready = false;
+    size_t failedProbes = 0;
+    size_t restarts = 0;
+    vector<ready_handler_t> waiters;
+
+    void kill() {
+        if (child && child->running()) {
+            child->terminate();
+        }
+        child.reset();
+        if (out) {
+            out->close();
+        }
+        if (err) {
+            err->close();
+        }
+        ready = false;
+    }
+};
+
+shared_ptr<Forwarder> Forwarder::Create(asio::io_context &ctx, string kubectl, uint16_t firstPort)
+{
+    return shared_ptr<Forwarder>(new Forwarder(ctx, move(kubectl), firstPort));
+}
+
+Forwarder::Forwarder(asio::io_context &ctx, string kubectl, uint16_t firstPort)
+    : ctx_{ctx}, strand_{ctx}, healthTimer_{ctx}, kubectl_{move(kubectl)}, nextPort_{firstPort}
+{
+}
+
+void Forwarder::get(const ForwardSpec &spec, ready_handler_t handler)
+{
+    asio::post(strand_, [self=shared_from_this(), spec, handler=move(handler)]() mutable {
+        if (self->stopped_) {
+            asio::post(self->ctx_, [handler=move(handler)] {
+                handler(false, 0);
+            });
+            return;
+        }
+
+        auto& tunnel = self->tunnels_[spec.key()];
+        if (!tunnel) {
+            tunnel = make_shared<Tunnel>(spec, self->nextPort_++);
+        }
+
+        if (tunnel->ready) {
+            asio::post(self->ctx_, [handler=move(handler), port=tunnel->port] {
+                handler(true, port);
+            });
+            return;
+        }
+
+        tunnel->waiters.emplace_back(move(handler));
+        if (!tunnel->pending) {
+            self->launch(tunnel);
+        }
+    });
+}
+
+void Forwarder::startHealthChecks(chrono::seconds interval)
+{
+    asio::post(strand_, [self=shared_from_this(), interval] {
+        self->healthInterval_ = interval;
+        self->healthCheck();
+    });
+}
+
+void Forwarder::stop()
+{
+    asio::post(strand_, [self=shared_from_this()] {
+        self->stopped_ = true;
+        self->healthTimer_.cancel();
+        for(auto& [_, tunnel] : self->tunnels_) {
+            tunnel->kill();
+            self->setReady(*tunnel, false);
+        }
+        self->tunnels_.clear();
+    });
+}
+
+vector<string> Forwarder::pods(const string &kubectl, const ForwardSpec &spec)
+{
+    auto args = kubectlArgs(spec);
+    args.insert(args.end(), {"get", "endpoints", spec.service,
+                             "-o", "jsonpath={.subsets[*].addresses[*].targetRef.name}"});
+
+    bp::ipstream out;
+    error_code ec;
+    bp::child child{kubectlPath(kubectl), bp::args(args), bp::std_in.close(),
+                    bp::std_out > out, bp::std_err > bp::null, ec};
+    if (ec) {
+        LOG_WARN << "Failed to launch " << kubectl << ": " << ec.message();
+        return {};
+    }
+
+    vector<string> pods;
+    for(string pod; out >> pod;) {
+        pods.push_back(move(pod));
+    }
+    child.wait();
+
+    if (child.exit_code() != 0) {
+        LOG_WARN << spec.kubeconfig << ": Failed to get the endpoints of " << spec.service;
+        return {};
+    }
+    return pods;
+}
+
+// Must be called on the strand
+void Forwarder::launch(const shared_ptr<Tunnel> &tunnel)
+{
+    tunnel->kill();
+    ++tunnel->generation;
+    tunnel->pending = true;
+    tunnel->failedProbes = 0;
+    tunnel->out = make_unique<bp::async_pipe>(ctx_);
+    tunnel->err = make_unique<bp::async_pipe>(ctx_);
+    tunnel->outBuf.consume(tunnel->outBuf.size());
+    tunnel->errBuf.consume(tunnel->errBuf.size());
+
+    const auto& spec = tunnel->spec;
+    auto args = kubectlArgs(spec);
+    args.insert(args.end(), {"port-forward",
+                             spec.service.find('/') == string::npos ? "svc/"s + spec.service : spec.service,
+                             to_string(tunnel->port) + ":8080"});
+
+    LOG_DEBUG << "Starting port forwarding on " << tunnel->port << " to "
+              << tunnel->spec.service << " on " << tunnel->spec.kubeconfig;
+
+    error_code ec;
+    tunnel->child = make_unique<bp::child>(kubectlPath(kubectl_), bp::args(args), bp::std_in.close(),
+                                           bp::std_out > *tunnel->out,
+                                           bp::std_err > *tunnel->err, ec);
+    if (ec) {
+        LOG_ERROR << tunnel->name << ": Failed to launch " << kubectl_ << ": " << ec.message();
+        tunnel->child.reset();
+        setReady(*tunnel, false);
+        return;
+    }
+
+    readOutput(tunnel, false);
+    readOutput(tunnel, true);
+}
+
+void Forwarder::readOutput(const shared_ptr<Tunnel> &tunnel, bool err)
+{
+    auto& pipe = err ? *tunnel->err : *tunnel->out;
+    auto& buf = err ? tunnel->errBuf : tunnel->outBuf;
+
+    asio::async_read_until(pipe, buf, '\n', asio::bind_executor(strand_,
+            [self=shared_from_this(), tunnel, err, generation=tunnel->generation]
+            (const boost::system::error_code& ec, size_t /*size*/) {
+        if (generation != tunnel->generation) {
+            return;
+        }
+
+        auto& buf = err ? tunnel->errBuf : tunnel->outBuf;
+        istream is(&buf);
+        string line;
+        getline(is, line);
+
+        if (!line.empty()) {
+            if (err) {
+                LOG_ERROR << tunnel->name << " proxy said: " << line;
+                if (tunnel->pending) {
+                    self->setReady(*tunnel, false);
+                }
+            } else {
+                LOG_DEBUG << tunnel->name << " proxy said: " << line;
+                if (tunnel->pending && line.find("Forwarding from") != string::npos) {
+                    self->setReady(*tunnel, true);
+                }
+            }
+        }
+
+        if (ec) {
+            if (err) {
+                return; // kubectl may close stderr and still be running
+            }
+
+            // kubectl is gone. The health check will restart it.
+            if (!self->stopped_) {
+                LOG_WARN << tunnel->name << ": Port-forwarding on " << tunnel->port << " stopped";
+            }
+            tunnel->ready = false;
+            if (tunnel->pending) {
+                self->setReady(*tunnel, false);
+            }
+            return;
+        }
+
+        self->readOutput(tunnel, err);
+    }));
+}
+
+// Must be called on the strand
+void Forwarder::setReady(Tunnel &tunnel, bool ok)
+{
+    tunnel.pending = false;
+    tunnel.ready = ok;
+    if (!ok) {
+        tunnel.kill();
+    }
+
+    for(auto& handler : tunnel.waiters) {
+        asio::post(ctx_, [handler=move(handler), ok, port=tunnel.port] {
+            handler(ok, port);
+        });
+    }
+    tunnel.waiters.clear();
+}
+
+// Must be called on the strand
+void Forwarder::healthCheck()
+{
+    if (stopped_ || healthInterval_.count() == 0) {
+        return;
+    }
+
+    for(auto& [_, tunnel] : tunnels_) {
+        if (tunnel->pending) {
+            continue;
+        }
+
+        if (!tunnel->ready || !tunnel->child || !tunnel->child->running()) {
+            ++tunnel->restarts;
+            LOG_INFO << tunnel->name << ": Restarting the port-forwarding on " << tunnel->port
+                     << " (restart #" << tunnel->restarts << ")";
+            launch(tunnel);
+            continue;
+        }
+
+        probe(tunnel);
+    }
+
+    healthTimer_.expires_after(healthInterval_);
+    healthTimer_.async_wait(asio::bind_executor(strand_,
+            [self=shared_from_this()](const boost::system::error_code& ec) {
+        if (!ec) {
+            self->healthCheck();
+        }
+    }));
+}
+
+// kubectl may stay up after the connection to the cluster is lost.
+// If so, the local port stops accepting connections.
+void Forwarder::probe(const shared_ptr<Tunnel> &tunnel)
+{
+    auto socket = make_shared<asio::ip::tcp::socket>(ctx_);
+    const asio::ip::tcp::endpoint ep{asio::ip::address_v4::loopback(), tunnel->port};
+    socket->async_connect(ep, asio::bind_executor(strand_,
+            [self=shared_from_this(), tunnel, socket, generation=tunnel->generation]
+            (const boost::system::error_code& ec) {
+        if (generation != tunnel->generation || self->stopped_) {
+            return;
+        }
+
+        if (!ec) {
+            tunnel->failedProbes = 0;
+            return;
+        }
+
+        LOG_DEBUG << tunnel->name << ": Health check of port " << tunnel->port
+                  << " failed: " << ec.message();
+        if (++tunnel->failedProbes >= 2) {
+            tunnel->kill(); // Restarted on the next check
+        }
+    }));
+}
+
+class ForwardAgent::Session : public enable_shared_from_this<ForwardAgent::Session> {
+public:
+    Session(unix_socket::socket&& socket, shared_ptr<Forwarder> forwarder)
+        : socket_{move(socket)}, forwarder_{move(forwarder)} {}
+
+    void read() {
+        asio::async_read_until(socket_, buffer_, '\n',
+                               [self=shared_from_this()](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                return;
+            }
+
+            istream is(&self->buffer_);
+            string line;
+            getline(is, line);
+            self->handle(boost::trim_copy(line));
+            self->read();
+        });
+    }
+
+private:
+    void handle(const string& line) {
+        static const string forward = "FORWARD ";
+        if (line.compare(0, forward.size(), forward) != 0) {
+            send("FAILED "s + line);
+            return;
+        }
+
+        const auto key = line.substr(forward.size());
+        ForwardSpec spec;
+        try {
+            spec = ForwardSpec::fromKey(key);
+        } catch (const exception&) {
+            send("FAILED "s + key);
+            return;
+        }
+
+        LOG_DEBUG << "Agent: Request for " << key;
+        forwarder_->get(spec, [self=shared_from_this(), key](bool ok, uint16_t port) {
+            self->send(ok ? "OK "s + to_string(port) + ' ' + key : "FAILED "s + key);
+        });
+    }
+
+    void send(string reply) {
+        outbox_.emplace_back(move(reply) + '\n');
+        if (outbox_.size() == 1) {
+            write();
+        }
+    }
+
+    void write() {
+        asio::async_write(socket_, asio::buffer(outbox_.front()),
+                          [self=shared_from_this()](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                return;
+            }
+            self->outbox_.pop_front();
+            if (!self->outbox_.empty()) {
+                self->write();
+            }
+        });
+    }
+
+    unix_socket::socket socket_;
+    shared_ptr<Forwarder> forwarder_;
+    asio::streambuf buffer_;
+    deque<string> outbox_;
+};
+
+ForwardAgent::ForwardAgent(asio::io_context &ctx, shared_ptr<Forwarder> forwarder,
+                           const string &socketPath)
+    : ctx_{ctx}, forwarder_{move(forwarder)}, socketPath_{socketPath}, acceptor_{ctx}
+{
+}
+
+ForwardAgent::~ForwardAgent()
+{
+    if (acceptor_.is_open()) {
+        acceptor_.close();
+        ::unlink(socketPath_.c_str());
+    }
+}
+
+void ForwardAgent::start()
+{
+    if (filesystem::exists(socketPath_)) {
+        // Take over the socket, unless another agent is using it
+        unix_socket::socket probe{ctx_};
+        boost::system::error_code ec;
+        probe.connect(unix_socket::endpoint{socketPath_}, ec);
+        if (!ec) {
+            throw runtime_error("An agent is already listening on "s + socketPath_);
+        }
+        ::unlink(socketPath_.c_str());
+    }
+
+    acceptor_.open(unix_socket{});
+    acceptor_.bind(unix_socket::endpoint{socketPath_});
+    acceptor_.listen();
+    LOG_INFO << "Forwarding agent listening on " << socketPath_;
+    accept();
+}
+
+void ForwardAgent::accept()
+{
+    acceptor_.async_accept([this](const boost::system::error_code& ec, unix_socket::socket socket) {
+        if (ec) {
+            if (ec != asio::error::operation_aborted) {
+                LOG_WARN << "Agent: accept failed: " << ec.message();
+            }
+            return;
+        }
+
+        make_shared<Session>(move(socket), forwarder_)->read();
+        accept();
+    });
+}
+
+optional<vector<optional<uint16_t>>>
+ForwardAgent::request(const string &socketPath, const vector<ForwardSpec> &specs,
+                      chrono::steady_clock::time_point deadline)
+{
+    asio::io_context ctx;
+    unix_socket::socket socket{ctx};
+    boost::system::error_code ec;
+    socket.connect(unix_socket::endpoint{socketPath}, ec);
+    if (ec) {
+        LOG_DEBUG << "No forwarding agent on " << socketPath << ": " << ec.message();
+        return {};
+    }
+
+    // All the requests go out at once. The agent answers each one when
+    // its tunnel is ready, so they are awaited concurrently.
+    string requests;
+    map<string, size_t> pending;
+    for(const auto& spec : specs) {
+        if (pending[spec.key()]++ == 0) {
+            requests += "FORWARD "s + spec.key() + '\n';
+        }
+    }
+    asio::write(socket, asio::buffer(requests), ec);
+    if (ec) {
+        LOG_WARN << "Failed to talk to the forwarding agent on " << socketPath << ": " << ec.message();
+        return {};
+    }
+
+    map<string, uint16_t> ports;
+    size_t outstanding = pending.size();
+    asio::streambuf buffer;
+
+    asio::steady_timer timer{ctx, deadline};
+    timer.async_wait([&](const boost::system::error_code& err) {
+        if (!err) {
+            socket.close();
+        }
+    });
+
+    function<void()> read = [&] {
+        asio::async_read_until(socket, buffer, '\n', [&](const boost::system::error_code& err, size_t) {
+            if (err) {
+                timer.cancel();
+                return;
+            }
+
+            istream is(&buffer);
+            string line;
+            getline(is, line);
+
+            istringstream reply{line};
+            string status;
+            reply >> status;
+            if (status == "OK") {
+                uint16_t port = 0;
+                string key;
+                reply >> port;
+                reply.ignore(1);
+                getline(reply, key);
+                ports[key] = port;
+            } else {
+                LOG_WARN << "The forwarding agent said: " << line;
+            }
+
+            if (--outstanding == 0) {
+                timer.cancel();
+                return;
+            }
+            read();
+        });
+    };
+    read();
+    ctx.run();
+
+    vector<optional<uint16_t>> result;
+    for(const auto& spec : specs) {
+        if (auto it = ports.find(spec.key()); it != ports.end()) {
+            result.emplace_back(it->second);
+        } else {
+            result.emplace_back();
+        }
+    }
+    return result;
+}
+
+string ForwardAgent::defaultSocketPath()
+{
+    if (const auto dir = getenv("XDG_RUNTIME_DIR")) {
+        return (filesystem::path{dir} / "purech-agent.sock").string();
+    }
+    return "/tmp/purech-agent-"s + to_string(::getuid()) + ".sock";
+}
+
+} // ns
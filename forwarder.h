@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace purech {
+
+// What to port-forward to
+struct ForwardSpec {
+    std::string kubeconfig;
+    std::string ns;
+    std::string service; // Service name, or a resource like "pod/name"
+    unsigned instance = 0; // For more than one port-forwarding to the same service
+
+    // Identifies the tunnel, also over the agent's socket
+    std::string key() const;
+    static ForwardSpec fromKey(const std::string& key);
+};
+
+/*! Keeps `kubectl port-forward` tunnels running.
+ *
+ *  One tunnel per ForwardSpec. Each tunnel gets its own local port,
+ *  and keeps it if it is restarted. With health checks enabled, tunnels
+ *  whose kubectl has died, or whose port no longer accepts connections,
+ *  are restarted.
+ *
+ *  All the state is handled on a strand, so the io_context may be run
+ *  by several threads.
+ */
+class Forwarder : public std::enable_shared_from_this<Forwarder> {
+public:
+    // Called once, on the io_context, when the tunnel is ready or failed to start
+    using ready_handler_t = std::function<void(bool ok, uint16_t port)>;
+
+    static std::shared_ptr<Forwarder> Create(boost::asio::io_context& ctx,
+                                             std::string kubectl, uint16_t firstPort);
+
+    // Start a tunnel, or reuse the one we have for the spec
+    void get(const ForwardSpec& spec, ready_handler_t handler);
+
+    void startHealthChecks(std::chrono::seconds interval);
+
+    // The pods behind the spec's service, from its endpoints
+    static std::vector<std::string> pods(const std::string& kubectl, const ForwardSpec& spec);
+
+    // Kill all the tunnels
+    void stop();
+
+private:
+    struct Tunnel;
+
+    Forwarder(boost::asio::io_context& ctx, std::string kubectl, uint16_t firstPort);
+
+    void launch(const std::shared_ptr<Tunnel>& tunnel);
+    void readOutput(const std::shared_ptr<Tunnel>& tunnel, bool err);
+    void setReady(Tunnel& tunnel, bool ok);
+    void healthCheck();
+    void probe(const std::shared_ptr<Tunnel>& tunnel);
+
+    boost::asio::io_context& ctx_;
+    boost::asio::io_context::strand strand_;
+    boost::asio::steady_timer healthTimer_;
+    const std::string kubectl_;
+    uint16_t nextPort_;
+    std::chrono::seconds healthInterval_ = {};
+    std::map<std::string /* key */, std::shared_ptr<Tunnel>> tunnels_;
+    bool stopped_ = false;
+};
+
+/*! Serves the tunnels of a Forwarder to other purech processes over
+ *  a unix domain socket.
+ *
+ *  The protocol is line based. The client sends
+ *  `FORWARD kubeconfig,namespace,service[,instance]` and the agent
+ *  replies with `OK <port> <the same key>` when the tunnel is ready, or
+ *  `FAILED <the same key>`. Several requests may be sent on one
+ *  connection; they are answered in the order they complete.
+ */
+class ForwardAgent {
+public:
+    ForwardAgent(boost::asio::io_context& ctx, std::shared_ptr<Forwarder> forwarder,
+                 const std::string& socketPath);
+    ~ForwardAgent();
+
+    void start();
+
+    // Ask a running agent for tunnels. Waits for all of them concurrently,
+    // until the deadline. Returns nothing if no agent is listening on the
+    // socket; otherwise one entry per spec, empty for the tunnels that
+    // did not become ready.
+    static std::optional<std::vector<std::optional<uint16_t>>>
+    request(const std::string& socketPath, const std::vector<ForwardSpec>& specs,
+            std::chrono::steady_clock::time_point deadline);
+
+    static std::string defaultSocketPath();
+
+private:
+    class Session;
+
+    void accept();
+
+    boost::asio::io_context& ctx_;
+    std::shared_ptr<Forwarder> forwarder_;
+    const std::string socketPath_;
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+};
+
+} // ns
@@ -0,0 +1,171 @@
+
+#include <algorithm>
+
+#include <boost/asio/steady_timer.hpp>
+
+#include "governor.h"
+#include "logging.h"
+
+using namespace std;
+using namespace restc_cpp;
+
+namespace purech {
+
+namespace {
+
+constexpr auto adjustInterval = chrono::seconds{1};
+
+double seconds(Governor::clock_t::duration d) {
+    return chrono::duration<double>(d).count();
+}
+
+} // anon ns
+
+Governor::Governor(const Options &options)
+    : options_{options}, rate_{max(options.rate, 0.0)}
+{
+    tokens_ = max(1.0, rate_ / 4);
+}
+
+void Governor::acquire(Context &ctx)
+{
+    while(true) {
+        chrono::microseconds wait;
+        {
+            lock_guard lock{mutex_};
+            if (rate_ <= 0) {
+                return;
+            }
+
+            refill(clock_t::now());
+            if (tokens_ >= 1.0) {
+                tokens_ -= 1.0;
+                return;
+            }
+            wait = chrono::microseconds{static_cast<int64_t>((1.0 - tokens_) / rate_ * 1e6) + 1};
+        }
+
+        sleep(ctx, wait);
+    }
+}
+
+bool Governor::tryAcquire()
+{
+    lock_guard lock{mutex_};
+    if (rate_ <= 0) {
+        return true;
+    }
+
+    refill(clock_t::now());
+    if (tokens_ >= 1.0) {
+        tokens_ -= 1.0;
+        return true;
+    }
+    return false;
+}
+
+void Governor::succeeded(chrono::microseconds latency)
+{
+    latencies_.record(static_cast<uint64_t>(latency.count()));
+
+    lock_guard lock{mutex_};
+    const auto now = clock_t::now();
+    ++windowCount_;
+    if (now - windowStart_ >= adjustInterval) {
+        throughput_ = static_cast<double>(windowCount_) / seconds(now - windowStart_);
+        windowStart_ = now;
+        windowCount_ = 0;
+    }
+
+    const auto us = static_cast<double>(latency.count());
+    latency_ = latency_ > 0 ? (latency_ * 0.9 + us * 0.1) : us;
+
+    if (latency_ > static_cast<double>(chrono::duration_cast<chrono::microseconds>(options_.targetLatency).count())) {
+        decrease(now);
+    } else {
+        increase(now);
+    }
+}
+
+void Governor::overloaded()
+{
+    lock_guard lock{mutex_};
+    decrease(clock_t::now());
+}
+
+void Governor::backoff(size_t attempt, Context &ctx)
+{
+    const auto shift = min<size_t>(attempt - 1, 16);
+    const auto cap = min(options_.maxBackoff, options_.backoff * (1 << shift));
+    chrono::microseconds wait;
+    {
+        lock_guard lock{mutex_};
+        uniform_int_distribution<int64_t> dist{0, chrono::duration_cast<chrono::microseconds>(cap).count()};
+        wait = chrono::microseconds{dist(random_)};
+    }
+    sleep(ctx, wait);
+}
+
+chrono::microseconds Governor::hedgeDelay() const
+{
+    static constexpr uint64_t minSamples = 50;
+    if (latencies_.count() < minSamples) {
+        return {};
+    }
+    return chrono::microseconds{latencies_.percentile(0.95)};
+}
+
+double Governor::rate() const
+{
+    lock_guard lock{mutex_};
+    return rate_;
+}
+
+void Governor::sleep(Context &ctx, chrono::microseconds duration)
+{
+    boost::asio::steady_timer timer{ctx.GetClient().GetIoService()};
+    timer.expires_after(duration);
+    timer.async_wait(ctx.GetYield());
+}
+
+void Governor::refill(clock_t::time_point now)
+{
+    const auto burst = max(1.0, rate_ / 4);
+    tokens_ = min(burst, tokens_ + seconds(now - refilled_) * rate_);
+    refilled_ = now;
+}
+
+void Governor::decrease(clock_t::time_point now)
+{
+    if (rate_ > 0 && now - changed_ < adjustInterval) {
+        return; // Give the last change time to take effect
+    }
+
+    auto base = rate_;
+    if (base <= 0) {
+        // No limit yet. Start from what we got through.
+        base = throughput_ > 0 ? throughput_
+                               : static_cast<double>(windowCount_) / max(seconds(now - windowStart_), 0.1);
+    }
+
+    refill(now);
+    rate_ = max(options_.minRate, base / 2);
+    tokens_ = min(tokens_, 1.0);
+    changed_ = now;
+    LOG_DEBUG << options_.name << ": Slowing down to " << rate_ << " requests per second";
+}
+
+void Governor::increase(clock_t::time_point now)
+{
+    if (rate_ <= 0 || now - changed_ < adjustInterval) {
+        return;
+    }
+
+    rate_ += max(1.0, rate_ * 0.05);
+    if (options_.rate > 0) {
+        rate_ = min(rate_, options_.rate);
+    }
+    changed_ = now;
+}
+
+} // ns
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include "restc-cpp/restc-cpp.h"
+
+#include "histogram.h"
+
+namespace purech {
+
+/*! Paces the requests to one cluster.
+ *
+ *  A token bucket limits the request rate. The rate adapts AIMD style:
+ *  it is halved, at most once a second, when the cluster answers 429 or
+ *  503, a request times out or the average latency goes above the target.
+ *  It grows by 5% a second while the cluster keeps up. Without a
+ *  configured rate there is no limit until the cluster first pushes
+ *  back; then we start from half the throughput we had.
+ *
+ *  The waits are done in the restc-cpp co-routine, so they don't hold
+ *  up other requests.
+ */
+class Governor {
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    struct Options {
+        std::string name; // For the logs
+        double rate = 0; // Max requests per second. 0 means no limit
+        double minRate = 1;
+        std::chrono::milliseconds targetLatency{1000};
+        std::chrono::milliseconds backoff{100}; // Base for the retry delays
+        std::chrono::milliseconds maxBackoff{5000};
+    };
+
+    explicit Governor(const Options& options);
+
+    // Wait until we may send a request
+    void acquire(restc_cpp::Context& ctx);
+
+    // Take a token if one is available now. Used for hedged requests.
+    bool tryAcquire();
+
+    void succeeded(std::chrono::microseconds latency);
+
+    // The cluster told us, or showed us, that it is overloaded
+    void overloaded();
+
+    // Wait before retry number `attempt` (1 is the first retry).
+    // Exponential backoff with full jitter.
+    void backoff(size_t attempt, restc_cpp::Context& ctx);
+
+    // When to send a hedged request: The 95th percentile of the latency,
+    // once we have enough samples to know it. Zero until then.
+    std::chrono::microseconds hedgeDelay() const;
+
+    // The current limit. 0 means no limit.
+    double rate() const;
+
+    // HTTP status codes that may go away if we try again
+    static bool retryable(int status) noexcept {
+        return status == 429 || status == 502 || status == 503 || status == 504;
+    }
+
+    static void sleep(restc_cpp::Context& ctx, std::chrono::microseconds duration);
+
+private:
+    // Must be called with the mutex locked
+    void refill(clock_t::time_point now);
+    void decrease(clock_t::time_point now);
+    void increase(clock_t::time_point now);
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    double rate_ = 0; // 0 means no limit
+    double tokens_ = 0;
+    clock_t::time_point refilled_ = clock_t::now();
+    clock_t::time_point changed_ = clock_t::now(); // Last change of the rate
+    double latency_ = 0; // Moving average, in microseconds
+
+    // Throughput, measured over one-second windows
+    clock_t::time_point windowStart_ = clock_t::now();
+    size_t windowCount_ = 0;
+    double throughput_ = 0;
+
+    Histogram latencies_;
+    std::minstd_rand random_{std::random_device{}()};
+};
+
+} // ns
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace purech {
+
+/*! Lock-free log-linear histogram for non-negative integer values,
+ *  like latencies in microseconds.
+ *
+ *  Each power of two is split in 16 buckets, so percentiles are
+ *  accurate to about 6%.
+ */
+class Histogram {
+public:
+    Histogram() = default;
+    Histogram(const Histogram& v) {
+        merge(v);
+    }
+
+    void record(uint64_t value) noexcept {
+        buckets_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        auto max = max_.load(std::memory_order_relaxed);
+        while(value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+            ;
+    }
+
+    void merge(const Histogram& v) noexcept {
+        for(size_t i = 0; i < buckets_.size(); ++i) {
+            buckets_[i].fetch_add(v.buckets_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        count_.fetch_add(v.count(), std::memory_order_relaxed);
+        sum_.fetch_add(v.sum(), std::memory_order_relaxed);
+        auto max = max_.load(std::memory_order_relaxed);
+        while(v.max() > max && !max_.compare_exchange_weak(max, v.max(), std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const noexcept {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum() const noexcept {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const noexcept {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    double mean() const noexcept {
+        const auto c = count();
+        return c ? static_cast<double>(sum()) / static_cast<double>(c) : 0.0;
+    }
+
+    // p in the range [0, 1]. Returns the upper bound of the bucket.
+    uint64_t percentile(double p) const noexcept {
+        const auto total = count();
+        if (!total) {
+            return 0;
+        }
+
+        const auto target = static_cast<uint64_t>(p * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for(size_t i = 0; i < buckets_.size(); ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                const auto upper = upperBound(i);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+    // Number of buckets, and their boundaries, for exporting
+    static constexpr size_t size() noexcept {
+        return numBuckets;
+    }
+
+    uint64_t bucketCount(size_t i) const noexcept {
+        return buckets_[i].load(std::memory_order_relaxed);
+    }
+
+    static uint64_t upperBound(size_t i) noexcept {
+        if (i < subBuckets) {
+            return i;
+        }
+        const auto shift = i / subBuckets - 1;
+        const auto sub = i % subBuckets;
+        return ((subBuckets + sub + 1) << shift) - 1;
+    }
+
+private:
+    static constexpr size_t subBits = 4;
+    static constexpr size_t subBuckets = 1 << subBits;
+    static constexpr size_t numBuckets = subBuckets * (64 - subBits + 1);
+
+    static size_t bucket(uint64_t value) noexcept {
+        if (value < subBuckets) {
+            return static_cast<size_t>(value);
+        }
+        const auto msb = 63 - static_cast<size_t>(__builtin_clzll(value));
+        const auto shift = msb - subBits;
+        return (shift + 1) * subBuckets + static_cast<size_t>((value >> shift) - subBuckets);
+    }
+
+    std::array<std::atomic<uint64_t>, numBuckets> buckets_ = {};
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<uint64_t> sum_ = 0;
+    std::atomic<uint64_t> max_ = 0;
+};
+
+} // ns
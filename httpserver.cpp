@@ -0,0 +1,252 @@
+
+#include <algorithm>
+#include <charconv>
+#include <istream>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+
+#include "httpserver.h"
+#include "logging.h"
+
+using namespace std;
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+namespace purech {
+
+class HttpServer::Session : public enable_shared_from_this<HttpServer::Session> {
+public:
+    Session(tcp::socket&& socket, shared_ptr<const handler_t> handler)
+        : socket_{move(socket)}, timer_{socket_.get_executor()}, handler_{move(handler)} {}
+
+    void close() {
+        asio::post(socket_.get_executor(), [self=shared_from_this()] {
+            boost::system::error_code ignored;
+            self->timer_.cancel();
+            self->socket_.close(ignored);
+        });
+    }
+
+    void read() {
+        asio::async_read_until(socket_, buffer_, "\r\n\r\n",
+                               [self=shared_from_this()](const boost::system::error_code& ec, size_t bytes) {
+            if (ec == asio::error::not_found) {
+                self->reject(431); // The header did not fit in the buffer
+                return;
+            }
+            if (ec) {
+                return; // Closed or broken. Just let go.
+            }
+            self->onHeader(bytes);
+        });
+    }
+
+private:
+    // We only serve GET, so a body is only read to skip it
+    static constexpr size_t maxHeader = 16 * 1024;
+    static constexpr size_t maxBody = 8 * 1024;
+
+    void onHeader(size_t bytes) {
+        Request req;
+        {
+            string header{asio::buffers_begin(buffer_.data()),
+                          asio::buffers_begin(buffer_.data()) + static_cast<ptrdiff_t>(bytes)};
+            buffer_.consume(bytes);
+
+            istringstream in{header};
+            string line;
+            getline(in, line);
+            istringstream rl{line};
+            rl >> req.method >> req.target;
+
+            while(getline(in, line) && line != "\r") {
+                if (auto pos = line.find(':'); pos != string::npos) {
+                    auto name = boost::to_lower_copy(line.substr(0, pos));
+                    req.headers[name] = boost::trim_copy(line.substr(pos + 1));
+                }
+            }
+        }
+
+        keepAlive_ = !(req.headers.count("connection")
+                       && boost::iequals(req.headers["connection"], "close"));
+
+        // Skip any body
+        size_t length = 0;
+        if (auto it = req.headers.find("content-length"); it != req.headers.end()) {
+            const auto& value = it->second;
+            const auto end = value.data() + value.size();
+            if (const auto r = from_chars(value.data(), end, length); r.ec != errc{} || r.ptr != end) {
+                reject(400);
+                return;
+            }
+        }
+        if (length > maxBody) {
+            reject(413);
+            return;
+        }
+        if (length > buffer_.size()) {
+            asio::async_read(socket_, buffer_, asio::transfer_exactly(length - buffer_.size()),
+                             [self=shared_from_this(), req=move(req), length](const boost::system::error_code& ec, size_t) {
+                if (!ec) {
+                    self->buffer_.consume(length);
+                    self->handle(req);
+                }
+            });
+            return;
+        }
+        buffer_.consume(length);
+        handle(req);
+    }
+
+    // Answers with an error and closes the connection, as we don't know
+    // where the next request starts
+    void reject(int status) {
+        keepAlive_ = false;
+        Response res;
+        res.status = status;
+        res.body = make_shared<string>();
+        write(res);
+    }
+
+    void handle(const Request& req) {
+        Response res;
+        try {
+            res = (*handler_)(req);
+        } catch (const exception& ex) {
+            LOG_WARN << "HTTP handler failed for " << req.target << ": " << ex.what();
+            res = {};
+            res.status = 500;
+        }
+
+        if (!res.body) {
+            res.body = make_shared<string>();
+        }
+
+        if (res.delay.count() > 0) {
+            timer_.expires_after(res.delay);
+            timer_.async_wait([self=shared_from_this(), res=move(res)](const boost::system::error_code& ec) {
+                if (!ec) {
+                    self->write(res);
+                }
+            });
+            return;
+        }
+
+        write(res);
+    }
+
+    void write(const Response& res) {
+        ostringstream out;
+        out << "HTTP/1.1 " << res.status << ' ' << reason(res.status) << "\r\n"
+            << "Content-Type: " << res.contentType << "\r\n"
+            << "Content-Length: " << res.body->size() << "\r\n"
+            << "Connection: " << (keepAlive_ ? "keep-alive" : "close") << "\r\n";
+        for(const auto& [name, value] : res.headers) {
+            out << name << ": " << value << "\r\n";
+        }
+        out << "\r\n";
+        header_ = out.str();
+        body_ = res.body;
+
+        array<asio::const_buffer, 2> buffers{asio::buffer(header_), asio::buffer(*body_)};
+        asio::async_write(socket_, buffers, [self=shared_from_this()](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                return;
+            }
+            if (self->keepAlive_) {
+                self->read();
+            } else {
+                boost::system::error_code ignored;
+                self->socket_.shutdown(tcp::socket::shutdown_both, ignored);
+            }
+        });
+    }
+
+    tcp::socket socket_;
+    asio::steady_timer timer_;
+    const shared_ptr<const handler_t> handler_; // Shared, as a session may outlive the server
+    asio::streambuf buffer_{maxHeader};
+    string header_;
+    shared_ptr<const string> body_;
+    bool keepAlive_ = true;
+};
+
+HttpServer::HttpServer(asio::io_context &ctx, const string &address, uint16_t port,
+                       handler_t handler)
+    : ctx_{ctx}, acceptor_{ctx}, handler_{make_shared<const handler_t>(move(handler))}
+{
+    const tcp::endpoint ep{asio::ip::make_address(address), port};
+    acceptor_.open(ep.protocol());
+    acceptor_.set_option(asio::socket_base::reuse_address(true));
+    acceptor_.bind(ep);
+    acceptor_.listen();
+}
+
+void HttpServer::start()
+{
+    accept();
+}
+
+void HttpServer::stop()
+{
+    asio::post(ctx_, [this] {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+    });
+
+    lock_guard lock{mutex_};
+    for(auto& weak : sessions_) {
+        if (auto session = weak.lock()) {
+            session->close();
+        }
+    }
+    sessions_.clear();
+}
+
+uint16_t HttpServer::port() const
+{
+    return acceptor_.local_endpoint().port();
+}
+
+string HttpServer::reason(int status)
+{
+    switch(status) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    }
+    return "Unknown";
+}
+
+void HttpServer::accept()
+{
+    acceptor_.async_accept([this](const boost::system::error_code& ec, tcp::socket socket) {
+        if (ec) {
+            if (ec != asio::error::operation_aborted) {
+                LOG_WARN << "Failed to accept HTTP connection: " << ec.message();
+            }
+            return;
+        }
+
+        socket.set_option(tcp::no_delay(true));
+        auto session = make_shared<Session>(move(socket), handler_);
+        {
+            lock_guard lock{mutex_};
+            sessions_.erase(remove_if(sessions_.begin(), sessions_.end(), [](const auto& s) {
+                return s.expired();
+            }), sessions_.end());
+            sessions_.push_back(session);
+        }
+        session->read();
+        accept();
+    });
+}
+
+} // ns
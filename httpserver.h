@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace purech {
+
+/*! Minimal asynchronous HTTP/1.1 server for GET requests.
+ *
+ *  Supports keep-alive. Request bodies are read and ignored.
+ *  The handler is called from the io_context's thread(s).
+ *
+ *  stop() closes the open connections too, so that an io_context
+ *  that is shared with other work can run out of work.
+ */
+class HttpServer {
+public:
+    struct Request {
+        std::string method;
+        std::string target;
+        std::map<std::string, std::string> headers; // Lower-case names
+    };
+
+    struct Response {
+        int status = 200;
+        std::string contentType = "application/json";
+        std::shared_ptr<const std::string> body;
+        std::map<std::string, std::string> headers;
+        std::chrono::milliseconds delay = {}; // Wait this long before responding
+    };
+
+    using handler_t = std::function<Response(const Request&)>;
+
+    HttpServer(boost::asio::io_context& ctx, const std::string& address, uint16_t port,
+               handler_t handler);
+
+    void start();
+    void stop();
+
+    // The port we listen to. Useful if started with port 0.
+    uint16_t port() const;
+
+    static std::string reason(int status);
+
+private:
+    class Session;
+
+    void accept();
+
+    boost::asio::io_context& ctx_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::shared_ptr<const handler_t> handler_;
+    std::mutex mutex_;
+    std::vector<std::weak_ptr<Session>> sessions_;
+};
+
+} // ns
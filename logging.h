@@ -0,0 +1,9 @@
+#pragma once
+
+#include "logfault/logfault.h"
+
+#define LOG_ERROR   LFLOG_ERROR
+#define LOG_WARN    LFLOG_WARN
+#define LOG_INFO    LFLOG_INFO
+#define LOG_DEBUG   LFLOG_DEBUG
+#define LOG_TRACE   LFLOG_TRACE
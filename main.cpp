@@ -10,6 +10,10 @@
 #include <boost/program_options.hpp>
 
 #include "pulsar.h"
+#include "metacache.h"
+#include "snapshot.h"
+#include "query.h"
+#include "exporter.h"
 
 using namespace std;
 using namespace purech;
@@ -30,6 +34,15 @@ int main(int argc, char* argv[]) {
     po::options_description general("Options");
 
     Config config;
+    string fields;
+    vector<string> clusterDeadlines;
+    vector<string> clusterPools;
+    vector<string> cacheTtl;
+    vector<string> invalidate;
+    string shard, shardBy = "namespace", shardOutput;
+    bool agent = false;
+    config.agentSocket = ForwardAgent::defaultSocketPath();
+    config.cacheFile = MetadataCache::defaultPath();
 
     general.add_options()("help,h", "Print help and exit")
             ("log-level,l", po::value<string>(&log_level)->default_value("info"),
@@ -41,10 +54,167 @@ int main(int argc, char* argv[]) {
             //("show-no-publishers", "Show 'no-publishers' in problems report")
             //("problems-only,p", "No reports - just look for problems.")
             //("streams-report,s", "Just list all the streams without all the details.")
-            ("topic-filter,f", po::value<string>(&config.topicFilter))
+            ("topic-filter,f", po::value<string>(&config.topicFilter),
+             "Regex. Only show topics that match it. Same as --include re:<regex>")
+            ("include,i", po::value<vector<string>>(&config.include)->composing(),
+             "Only show topics that match this pattern. Can be repeated. "
+             "Patterns are globs over tenant/namespace/topic (* within a segment, ** across segments; "
+             "without a '/' only the topic name is matched), prefix:<text> or re:<regex>")
+            ("exclude,x", po::value<vector<string>>(&config.exclude)->composing(),
+             "Don't show topics that match this pattern. Can be repeated")
             ("service-name,N", po::value<string>(&config.brokerSvcName)->default_value(config.brokerSvcName))
             ("local-port,P", po::value<uint16_t>(&config.localPort)->default_value(config.localPort))
             ("namespace,n", po::value<string>(&config.ns)->default_value(config.ns))
+            ("max-inflight", po::value<size_t>(&config.maxInflight)->default_value(config.maxInflight),
+             "Max number of concurrent requests to each cluster")
+            ("bulk", po::bool_switch(&config.bulkStats),
+             "Get topic stats from the brokers' broker-stats/topics endpoint, "
+             "and only request stats for the topics it did not cover")
+            ("direct-brokers", po::bool_switch(&config.directBrokers),
+             "With --bulk, also ask each broker for its topics at the address it is registered with. "
+             "Those addresses must be reachable from here, so this is ignored for port-forwarded clusters")
+            ("brokers", po::bool_switch(&config.brokers),
+             "Get the brokers' load reports and the bundles they own, and report the load of each "
+             "broker from the topics it owns, the skew between them, and the bundles to split or unload. "
+             "Through a port-forwarding, the owners are looked up with one topic per bundle, "
+             "and there are no load reports")
+            ("route-to-owner", po::bool_switch(&config.routeToOwner),
+             "Send each topic's stats request straight to the broker that owns it, when it can be "
+             "reached, instead of to the cluster's url. Implies --brokers")
+            ("max-skew", po::value<double>(&config.maxBrokerSkew)->default_value(config.maxBrokerSkew),
+             "With --brokers, a broker with more than this times the brokers' mean throughput is "
+             "overloaded, and its bundles are candidates to unload")
+            ("watch,w", po::value<unsigned>(&config.watchInterval)->default_value(config.watchInterval),
+             "Re-scan every <seconds> and report what changed. 0 disables watch mode")
+            ("watch-iterations", po::value<size_t>(&config.watchIterations)->default_value(config.watchIterations),
+             "Stop after this many scans in watch mode. 0 means run until killed")
+            ("watch-lines", po::value<size_t>(&config.watchMaxLines)->default_value(config.watchMaxLines),
+             "Max number of changed topics/links to list per cluster in watch mode and in diff, "
+             "and of problems of each kind from --validate")
+            ("topic-tree", po::bool_switch(&config.topicTree),
+             "Also keep each topic's stats in a tree of maps, besides the compact store. "
+             "Only for programs that use the engine's tree. Takes several times the memory")
+            ("fields", po::value<string>(&fields),
+             "Comma-separated list of the topic stats fields to deserialize, like "
+             "'replication,subscriptions.msgBacklog'. Everything else is skipped. "
+             "The topic's rates are always included")
+            ("profile", po::bool_switch(&config.profile),
+             "Print request counts, bytes, latency percentiles and json parse time "
+             "per cluster and endpoint when done")
+            ("trace", po::value<string>(&config.traceFile),
+             "Write a timeline of the requests and port-forwardings to this file, "
+             "in the Chrome trace format (chrome://tracing or https://ui.perfetto.dev)")
+            ("agent", po::bool_switch(&agent),
+             "Run as a forwarding agent: keep the kubectl port-forwardings for the "
+             "kubeconfig targets up, and let later purech runs use them")
+            ("agent-socket", po::value<string>(&config.agentSocket)->default_value(config.agentSocket),
+             "Unix socket of the forwarding agent. Runs without --agent use the agent's "
+             "port-forwardings if it is running. Empty to never use an agent")
+            ("kubectl", po::value<string>(&config.kubectl)->default_value(config.kubectl),
+             "The kubectl command to use for port-forwarding")
+            ("forward-timeout", po::value<unsigned>(&config.forwardTimeout)->default_value(config.forwardTimeout),
+             "Seconds to wait for all the port-forwardings to become ready")
+            ("health-interval", po::value<unsigned>(&config.healthInterval)->default_value(config.healthInterval),
+             "Seconds between health checks of the port-forwardings in agent and watch mode. "
+             "Broken port-forwardings are restarted")
+            ("forwards", po::value<size_t>(&config.forwards)->default_value(config.forwards),
+             "Number of port-forwardings to the broker service per kubeconfig cluster. "
+             "The requests go to the least busy one, and fail over to the others")
+            ("forward-pods", po::bool_switch(&config.forwardPods),
+             "Port-forward to each of the broker service's pods, instead of to the service")
+            ("threads", po::value<size_t>(&config.threads)->default_value(config.threads),
+             "Number of threads for the requests, json parsing and aggregation")
+            ("rate", po::value<double>(&config.rate)->default_value(config.rate),
+             "Max requests per second to each cluster. It is lowered when a cluster is overloaded. "
+             "0 means no limit until a cluster pushes back")
+            ("target-latency", po::value<unsigned>(&config.targetLatency)->default_value(config.targetLatency),
+             "Milliseconds. Slow down when the average latency of a cluster goes above this")
+            ("timeout", po::value<unsigned>(&config.timeout)->default_value(config.timeout),
+             "Seconds to wait for a connection, or for each read or write of a request")
+            ("retries", po::value<size_t>(&config.retries)->default_value(config.retries),
+             "Retries for requests that time out, fail to connect or get 429, 502, 503 or 504")
+            ("hedge", po::bool_switch(&config.hedge),
+             "Send a second request when one takes longer than the cluster's 95th percentile")
+            ("compress", po::bool_switch(&config.compress),
+             "Ask for gzip or deflate compressed replies. They are decompressed as they arrive")
+            ("pool-size", po::value<size_t>(&config.pool.size)->default_value(config.pool.size),
+             "Keep-alive connections to each cluster. Also limits the requests in flight. "
+             "0 means --max-inflight")
+            ("pool-idle", po::value<unsigned>(&config.pool.idleTimeout)->default_value(config.pool.idleTimeout),
+             "Seconds to keep an idle connection open")
+            ("pool-warmup", po::value<size_t>(&config.pool.warmup)->default_value(config.pool.warmup),
+             "Connections to open to each cluster at the start of a scan")
+            ("cluster-pool", po::value<vector<string>>(&clusterPools)->composing(),
+             "<cluster>=<size>[,<idle>[,<warmup>]]. Connection pool for one cluster, "
+             "instead of --pool-size, --pool-idle and --pool-warmup. Can be repeated")
+            ("deadline", po::value<unsigned>(&config.deadline)->default_value(config.deadline),
+             "Seconds to spend on each scan. When it passes, the outstanding requests are "
+             "abandoned and what we got is reported as complete, partial or missing. 0 means no deadline")
+            ("cluster-deadline", po::value<vector<string>>(&clusterDeadlines)->composing(),
+             "<cluster>=<seconds>. Deadline for one cluster, instead of --deadline. Can be repeated")
+            ("cache", po::bool_switch(&config.cache),
+             "Cache the cluster, tenant, namespace and topic lists and the namespace policies, "
+             "so that the scans start on the topic stats right away")
+            ("cache-file", po::value<string>(&config.cacheFile)->default_value(config.cacheFile),
+             "File that keeps the cache between runs. Empty to only cache in memory")
+            ("cache-ttl", po::value<vector<string>>(&cacheTtl)->composing(),
+             "<kind>=<seconds>. How long to cache clusters (default 3600), tenants (600), "
+             "namespaces (600), policies (300), topics (60), partitioned (60) or bundles (60). 0 disables it. Can be repeated")
+            ("invalidate", po::value<vector<string>>(&invalidate)->composing(),
+             "Drop the cached clusters, tenants, namespaces, policies, topics, partitioned or bundles, "
+             "or 'all', before the scan. Can be repeated")
+            ("snapshot", po::value<string>(&config.snapshotFile),
+             "Save the scan to this file. In watch mode it's overwritten by each scan. "
+             "Compare two snapshots with: diff <before> <after>")
+            ("listen", po::value<string>(&config.listen),
+             "[address:]port, where the address defaults to 0.0.0.0. Serve the results of the last scan "
+             "as Prometheus metrics on /metrics and as JSON on /json. Without --watch, serve the one "
+             "scan until stopped")
+            ("validate", po::bool_switch(&config.validate),
+             "Check the replication across the clusters: that the namespaces' replication clusters "
+             "exist, that replicated namespaces have the same topics everywhere, and that every "
+             "topic has a connected link to each peer, within --max-backlog and --max-delay")
+            ("max-backlog", po::value<uint64_t>(&config.maxReplicationBacklog)->default_value(config.maxReplicationBacklog),
+             "Replication backlog, in messages, that --validate reports")
+            ("max-delay", po::value<int>(&config.maxReplicationDelay)->default_value(config.maxReplicationDelay),
+             "Replication delay, in seconds, that --validate reports")
+            ("stream", po::value<string>(&config.stream),
+             "<format>:<path>. Write each topic's stats to the file as soon as they arrive, "
+             "instead of keeping them until the scan is done. The format is ndjson, csv or columnar. "
+             "A path of - is stdout. Only the namespace rates are kept, so --validate, --snapshot "
+             "and the changes in --watch are not available")
+            ("partition-stats", po::bool_switch(&config.partitionStats),
+             "Also keep the stats of each partition of the partitioned topics. "
+             "They are requested with the topic's summed stats, and not kept with --stream")
+            ("incremental", po::bool_switch(&config.incremental),
+             "In watch mode, only fetch the topics that had traffic or a backlog in the last scan, "
+             "or whose namespace got or lost topics. The idle topics keep their stats from an "
+             "earlier scan, and are fetched once in --idle-scans scans")
+            ("idle-scans", po::value<size_t>(&config.idleScans)->default_value(config.idleScans),
+             "With --incremental, fetch each idle topic once in this many scans. "
+             "They are spread over the scans")
+            ("sample", po::value<double>(&config.sample)->default_value(config.sample),
+             "Only fetch this fraction of the topics in each namespace, picked at random, and estimate "
+             "the rates and the share of topics with disconnected or backlogged replication links "
+             "from them. Namespaces where problems are found are sampled more. 0 means all the topics")
+            ("sample-seed", po::value<uint64_t>(&config.sampleSeed)->default_value(config.sampleSeed),
+             "Picks the topics for --sample. The same seed picks the same topics in every cluster")
+            ("query", po::value<vector<string>>(&config.queries)->composing(),
+             ("\"[top <n>] <aggregates> [by <dimensions>]\". Print a table of the stats after each scan, "
+              "like \"top 20 sum(msgBacklog) by cluster,topic,subscription\". The aggregates are sum, min, "
+              "max, avg or pNN (a percentile) of a field, or count. Can be repeated. Dimensions: "
+              + Query::dimensionNames() + ". Fields: " + Query::fieldNames()).c_str())
+            ("workers", po::value<size_t>(&config.workers)->default_value(config.workers),
+             "Split each scan over this many worker processes, and merge their results. "
+             "Each worker has its own port-forwardings and connections. 0 means scan in this process. "
+             "Merge snapshots from workers that ran elsewhere with: merge <snapshot>...")
+            ("shard-by", po::value<string>(&shardBy)->default_value(shardBy),
+             "How the scan is split over the workers: cluster, tenant or namespace")
+            ("shard", po::value<string>(&shard),
+             "<index>/<count>. Only do this part of the scan, and save it with --shard-output. "
+             "The index is from 0. The workers are started with this")
+            ("shard-output", po::value<string>(&shardOutput),
+             "The snapshot file a worker saves its part of the scan to")
             ;
 
     po::options_description hidden("Hidden options");
@@ -72,6 +242,79 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
+    if (!fields.empty()) {
+        boost::split(config.fields, fields, boost::is_any_of(","));
+    }
+
+    for(const auto& cd : clusterDeadlines) {
+        const auto pos = cd.find('=');
+        if (pos == string::npos || pos == 0) {
+            std::cerr << "Expected <cluster>=<seconds> for --cluster-deadline, got: " << cd << endl;
+            return -1;
+        }
+        try {
+            config.clusterDeadlines[cd.substr(0, pos)] = static_cast<unsigned>(stoul(cd.substr(pos + 1)));
+        } catch (const exception&) {
+            std::cerr << "Invalid number of seconds for --cluster-deadline: " << cd << endl;
+            return -1;
+        }
+    }
+
+    for(const auto& cp : clusterPools) {
+        const auto pos = cp.find('=');
+        if (pos == string::npos || pos == 0) {
+            std::cerr << "Expected <cluster>=<size>[,<idle>[,<warmup>]] for --cluster-pool, got: " << cp << endl;
+            return -1;
+        }
+        vector<string> values;
+        boost::split(values, cp.substr(pos + 1), boost::is_any_of(","));
+        auto pool = config.pool;
+        try {
+            if (values.size() > 3) {
+                throw invalid_argument("too many values");
+            }
+            pool.size = stoul(values.at(0));
+            if (values.size() > 1) {
+                pool.idleTimeout = static_cast<unsigned>(stoul(values[1]));
+            }
+            if (values.size() > 2) {
+                pool.warmup = stoul(values[2]);
+            }
+        } catch (const exception&) {
+            std::cerr << "Invalid values for --cluster-pool: " << cp << endl;
+            return -1;
+        }
+        config.clusterPools[cp.substr(0, pos)] = pool;
+    }
+
+    for(const auto& ct : cacheTtl) {
+        const auto pos = ct.find('=');
+        const auto endpoint = MetadataCache::endpoint(ct.substr(0, pos));
+        if (pos == string::npos || !endpoint) {
+            std::cerr << "Expected <kind>=<seconds> for --cache-ttl, got: " << ct << endl;
+            return -1;
+        }
+        try {
+            config.cacheTtl[*endpoint] = static_cast<unsigned>(stoul(ct.substr(pos + 1)));
+        } catch (const exception&) {
+            std::cerr << "Invalid number of seconds for --cache-ttl: " << ct << endl;
+            return -1;
+        }
+    }
+
+    for(const auto& kind : invalidate) {
+        if (kind == "all") {
+            for(const auto name : {"clusters", "tenants", "namespaces", "policies", "topics", "partitioned", "bundles"}) {
+                config.invalidate.push_back(*MetadataCache::endpoint(name));
+            }
+        } else if (const auto endpoint = MetadataCache::endpoint(kind)) {
+            config.invalidate.push_back(*endpoint);
+        } else {
+            std::cerr << "Unknown kind for --invalidate: " << kind << endl;
+            return -1;
+        }
+    }
+
     config.hideIdle = vm.count("hide-idle") > 0;
     //config.hideStats = vm.count("hide-stats") > 0;
     config.hideStreams = vm.count("hide-streams") > 0;
@@ -104,13 +347,159 @@ int main(int argc, char* argv[]) {
                 make_unique<logfault::StreamHandler>(clog, llevel));
 
 
-    if (config.clusters.empty()) {
+    if (!config.clusters.empty() && config.clusters.front() == "diff") {
+        if (config.clusters.size() != 3) {
+            std::cerr << "Usage: diff <before> <after>" << endl;
+            return -1;
+        }
+
+        try {
+            Snapshot before{config.clusters[1]};
+            Snapshot after{config.clusters[2]};
+            SnapshotDiff::Options options;
+            options.maxLines = config.watchMaxLines;
+            SnapshotDiff{before, after, options}.report(cout);
+        } catch (const exception& ex) {
+            LOG_ERROR << "Failed to compare the snapshots: " << ex.what();
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!config.clusters.empty() && config.clusters.front() == "merge") {
+        if (config.clusters.size() < 2) {
+            std::cerr << "Usage: merge <snapshot>..." << endl;
+            return -1;
+        }
+
+        // The snapshots name the clusters
+        config.merge.assign(config.clusters.begin() + 1, config.clusters.end());
+        config.clusters.clear();
+        config.workers = 0;
+        config.watchInterval = 0;
+    }
+
+    const auto by = Shard::parseBy(shardBy);
+    if (!by) {
+        std::cerr << "Unknown --shard-by: " << shardBy << endl;
+        return -1;
+    }
+    config.shard.by = *by;
+
+    if (!shard.empty()) {
+        const auto parsed = Shard::parse(shard, *by);
+        if (!parsed || shardOutput.empty()) {
+            std::cerr << "Expected <index>/<count> for --shard, and a --shard-output file" << endl;
+            return -1;
+        }
+
+        // A worker only saves its part. The coordinator does the rest.
+        config.shard = *parsed;
+        config.snapshotFile = shardOutput;
+        config.workers = 0;
+        config.watchInterval = 0;
+        config.listen.clear();
+        config.validate = false;
+        config.showSummary = false;
+        config.profile = false;
+        config.traceFile.clear();
+        config.stream.clear();
+        config.queries.clear();
+    }
+
+    if (config.sample) {
+        if (config.sample < 0 || config.sample > 1) {
+            std::cerr << "--sample must be between 0 and 1" << endl;
+            return -1;
+        }
+        if (config.validate || config.bulkStats || config.incremental || !config.stream.empty()) {
+            std::cerr << "--sample can not be used with --validate, --bulk, --incremental or --stream" << endl;
+            return -1;
+        }
+    }
+
+    if (config.directBrokers && !config.bulkStats) {
+        std::cerr << "--direct-brokers only applies to --bulk" << endl;
+        return -1;
+    }
+
+    if (config.routeToOwner) {
+        config.brokers = true;
+    }
+    if (config.brokers) {
+        if (!config.stream.empty() || config.workers || !config.merge.empty() || config.sample) {
+            std::cerr << "--brokers maps the topic stats of one scan in this process, "
+                      << "which --stream, --workers, merge and --sample do not keep" << endl;
+            return -1;
+        }
+        if (config.maxBrokerSkew < 1) {
+            std::cerr << "--max-skew must be 1 or more" << endl;
+            return -1;
+        }
+    }
+
+    if (!config.listen.empty()) {
+        try {
+            Exporter::Listen::parse(config.listen);
+        } catch (const exception& ex) {
+            std::cerr << "Invalid --listen \"" << config.listen << "\": " << ex.what() << endl;
+            return -1;
+        }
+    }
+
+    for(const auto& query : config.queries) {
+        try {
+            Query::parse(query);
+        } catch (const exception& ex) {
+            std::cerr << "Invalid --query \"" << query << "\": " << ex.what() << endl;
+            return -1;
+        }
+        if (!config.stream.empty()) {
+            std::cerr << "--query needs the topic stats, which --stream does not keep" << endl;
+            return -1;
+        }
+    }
+
+    if (config.incremental) {
+        if (!config.stream.empty() || config.workers) {
+            std::cerr << "--incremental keeps the last scan, which --stream and --workers do not" << endl;
+            return -1;
+        }
+        if (!config.watchInterval) {
+            LOG_WARN << "--incremental only saves requests in watch mode.";
+        }
+    }
+
+    if (config.workers) {
+        if (!config.stream.empty()) {
+            std::cerr << "--stream can not be used with --workers" << endl;
+            return -1;
+        }
+        config.commandLine.assign(argv, argv + argc);
+    }
+
+    if (!config.stream.empty()) {
+        if (config.validate || !config.snapshotFile.empty()) {
+            std::cerr << "--validate and --snapshot need the topic stats, which --stream does not keep" << endl;
+            return -1;
+        }
+        if (!config.listen.empty()) {
+            std::cerr << "--listen serves the topic stats, which --stream does not keep" << endl;
+            return -1;
+        }
+        if (config.stream.size() > 2 && config.stream.compare(config.stream.size() - 2, 2, ":-") == 0) {
+            // The records have stdout to themselves
+            config.showSummary = false;
+        }
+    }
+
+    if (config.clusters.empty() && config.merge.empty()) {
         if (const auto kc = std::getenv("KUBECONFIG")) {
             boost::split(config.clusters, kc, boost::is_any_of(":"));
         }
     }
 
-    if (config.clusters.empty()) {
+    if (config.clusters.empty() && config.merge.empty()) {
         BOOST_LOG_TRIVIAL(error)
                 << "No kubefiles specified. " << endl
                 << "Please set KUBECONFIG to point to your kubefiles.";
@@ -118,9 +507,14 @@ int main(int argc, char* argv[]) {
 
     try {
         Engine engine{config};
-        engine.run();
+        if (agent) {
+            engine.runAgent();
+        } else {
+            engine.run();
+        }
     } catch (const exception& ex) {
         LOG_ERROR << "Caught exception from run: " << ex.what();
+        return -1;
     }
 
     return 0;
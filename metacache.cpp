@@ -0,0 +1,340 @@
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+#include <unistd.h>
+
+#include "metacache.h"
+#include "logging.h"
+
+using namespace std;
+using namespace std::string_literals;
+
+namespace purech {
+
+namespace {
+
+// File layout, all integers little endian:
+//   magic "PMDC", u16 version
+//   varint clusters, for each:
+//     string cluster, varint entries, for each:
+//       u8 endpoint, string path, i64 fetched, varint values, for each: string
+// Strings are a varint length followed by the bytes.
+constexpr array<char, 4> magic = {'P', 'M', 'D', 'C'};
+constexpr uint16_t version = 1;
+
+class Writer {
+public:
+    Writer(ostream& out)
+        : out_{out} {}
+
+    void fixed(uint64_t value, size_t bytes) {
+        for(size_t i = 0; i < bytes; ++i) {
+            out_.put(static_cast<char>((value >> (i * 8)) & 0xff));
+        }
+    }
+
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            out_.put(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out_.put(static_cast<char>(value));
+    }
+
+    void str(string_view value) {
+        varint(value.size());
+        out_.write(value.data(), static_cast<streamsize>(value.size()));
+    }
+
+private:
+    ostream& out_;
+};
+
+class Reader {
+public:
+    Reader(istream& in)
+        : in_{in} {}
+
+    uint64_t fixed(size_t bytes) {
+        uint64_t value = 0;
+        for(size_t i = 0; i < bytes; ++i) {
+            value |= static_cast<uint64_t>(byte()) << (i * 8);
+        }
+        return value;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for(unsigned shift = 0; shift < 64; shift += 7) {
+            const auto b = byte();
+            value |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                return value;
+            }
+        }
+        throw runtime_error("Invalid varint");
+    }
+
+    string str() {
+        const auto len = varint();
+        if (len > maxString) {
+            throw runtime_error("Invalid string length");
+        }
+        string value(len, '\0');
+        if (!in_.read(value.data(), static_cast<streamsize>(len))) {
+            throw runtime_error("Truncated file");
+        }
+        return value;
+    }
+
+private:
+    static constexpr uint64_t maxString = 1 << 20;
+
+    uint8_t byte() {
+        const auto ch = in_.get();
+        if (ch == istream::traits_type::eof()) {
+            throw runtime_error("Truncated file");
+        }
+        return static_cast<uint8_t>(ch);
+    }
+
+    istream& in_;
+};
+
+int64_t unixNow() {
+    return chrono::duration_cast<chrono::seconds>(MetadataCache::clock_t::now().time_since_epoch()).count();
+}
+
+} // anon ns
+
+MetadataCache::Options::Options()
+    : ttl{{Endpoint::CLUSTERS, chrono::hours{1}},
+          {Endpoint::TENANTS, chrono::minutes{10}},
+          {Endpoint::NAMESPACES, chrono::minutes{10}},
+          {Endpoint::POLICIES, chrono::minutes{5}},
+          {Endpoint::TOPICS, chrono::minutes{1}},
+          {Endpoint::PARTITIONED, chrono::minutes{1}},
+          {Endpoint::BUNDLES, chrono::minutes{1}}}
+{
+}
+
+MetadataCache::MetadataCache(Options options)
+    : options_{move(options)}
+{
+}
+
+optional<MetadataCache::list_t> MetadataCache::get(const string &cluster, Endpoint endpoint,
+                                                   const string &path) const
+{
+    if (cacheable(endpoint)) {
+        lock_guard lock{mutex_};
+        if (auto c = clusters_.find(cluster); c != clusters_.end()) {
+            const key_t key{endpoint, path};
+            if (auto it = c->second.find(key); it != c->second.end()
+                    && !expired(key, it->second, unixNow())) {
+                ++hits_;
+                return it->second.value;
+            }
+        }
+    }
+
+    ++misses_;
+    return {};
+}
+
+void MetadataCache::put(const string &cluster, Endpoint endpoint, const string &path, list_t value)
+{
+    if (!cacheable(endpoint)) {
+        return;
+    }
+
+    lock_guard lock{mutex_};
+    clusters_[cluster][{endpoint, path}] = {unixNow(), move(value)};
+}
+
+void MetadataCache::invalidate(const string &cluster, Endpoint endpoint, const string &path)
+{
+    lock_guard lock{mutex_};
+    if (auto c = clusters_.find(cluster); c != clusters_.end()) {
+        c->second.erase({endpoint, path});
+    }
+}
+
+void MetadataCache::invalidate(const string &cluster, optional<Endpoint> endpoint)
+{
+    lock_guard lock{mutex_};
+    for(auto c = clusters_.begin(); c != clusters_.end(); ++c) {
+        if (!cluster.empty() && c->first != cluster) {
+            continue;
+        }
+
+        auto& entries = c->second;
+        if (!endpoint) {
+            entries.clear();
+            continue;
+        }
+
+        // The keys are sorted by endpoint first
+        entries.erase(entries.lower_bound({*endpoint, {}}),
+                      entries.lower_bound({static_cast<Endpoint>(static_cast<int>(*endpoint) + 1), {}}));
+    }
+}
+
+bool MetadataCache::load()
+{
+    if (options_.path.empty()) {
+        return false;
+    }
+
+    ifstream in{options_.path, ios::binary};
+    if (!in) {
+        return false;
+    }
+
+    decltype(clusters_) clusters;
+    const auto now = unixNow();
+    size_t count = 0;
+    try {
+        Reader r{in};
+        for(const auto ch : magic) {
+            if (static_cast<char>(r.fixed(1)) != ch) {
+                throw runtime_error("Not a metadata cache");
+            }
+        }
+        if (const auto v = r.fixed(2); v != version) {
+            throw runtime_error("Unsupported version "s + to_string(v));
+        }
+
+        for(auto nclusters = r.varint(); nclusters > 0; --nclusters) {
+            auto& entries = clusters[r.str()];
+            for(auto nentries = r.varint(); nentries > 0; --nentries) {
+                const auto endpoint = r.fixed(1);
+                if (endpoint >= static_cast<uint64_t>(Endpoint::COUNT_)) {
+                    throw runtime_error("Invalid endpoint");
+                }
+                key_t key{static_cast<Endpoint>(endpoint), r.str()};
+                Entry entry;
+                entry.fetched = static_cast<int64_t>(r.fixed(8));
+                for(auto nvalues = r.varint(); nvalues > 0; --nvalues) {
+                    entry.value.emplace_back(r.str());
+                }
+                if (!expired(key, entry, now)) {
+                    entries.emplace(move(key), move(entry));
+                    ++count;
+                }
+            }
+        }
+    } catch (const exception& ex) {
+        LOG_WARN << "Ignoring the metadata cache in " << options_.path << ": " << ex.what();
+        return false;
+    }
+
+    LOG_DEBUG << "Loaded " << count << " entries from the metadata cache in " << options_.path;
+    lock_guard lock{mutex_};
+    clusters_ = move(clusters);
+    return true;
+}
+
+bool MetadataCache::save() const
+{
+    if (options_.path.empty()) {
+        return false;
+    }
+
+    // Write a new file and move it in place, so that a run that is killed
+    // while saving, or another run that saves at the same time, does not
+    // leave a broken file.
+    const filesystem::path path{options_.path};
+    const auto tmp = path.string() + ".tmp" + to_string(::getpid());
+    try {
+        if (path.has_parent_path()) {
+            filesystem::create_directories(path.parent_path());
+        }
+
+        {
+            ofstream out{tmp, ios::binary | ios::trunc};
+            Writer w{out};
+            out.write(magic.data(), magic.size());
+            w.fixed(version, 2);
+
+            const auto now = unixNow();
+            lock_guard lock{mutex_};
+            w.varint(clusters_.size());
+            for(const auto& [cluster, entries] : clusters_) {
+                w.str(cluster);
+                size_t valid = 0;
+                for(const auto& [key, entry] : entries) {
+                    valid += expired(key, entry, now) ? 0 : 1;
+                }
+                w.varint(valid);
+                for(const auto& [key, entry] : entries) {
+                    if (expired(key, entry, now)) {
+                        continue;
+                    }
+                    w.fixed(static_cast<uint64_t>(key.first), 1);
+                    w.str(key.second);
+                    w.fixed(static_cast<uint64_t>(entry.fetched), 8);
+                    w.varint(entry.value.size());
+                    for(const auto& v : entry.value) {
+                        w.str(v);
+                    }
+                }
+            }
+
+            if (!out.flush()) {
+                throw runtime_error("Write failed");
+            }
+        }
+
+        filesystem::rename(tmp, path);
+    } catch (const exception& ex) {
+        LOG_WARN << "Failed to save the metadata cache to " << options_.path << ": " << ex.what();
+        error_code ec;
+        filesystem::remove(tmp, ec);
+        return false;
+    }
+
+    return true;
+}
+
+optional<Endpoint> MetadataCache::endpoint(string_view name)
+{
+    static constexpr pair<string_view, Endpoint> names[] = {
+        {"clusters", Endpoint::CLUSTERS},
+        {"tenants", Endpoint::TENANTS},
+        {"namespaces", Endpoint::NAMESPACES},
+        {"policies", Endpoint::POLICIES},
+        {"topics", Endpoint::TOPICS},
+        {"partitioned", Endpoint::PARTITIONED},
+        {"bundles", Endpoint::BUNDLES}
+    };
+
+    for(const auto& [n, e] : names) {
+        if (n == name) {
+            return e;
+        }
+    }
+    return {};
+}
+
+string MetadataCache::defaultPath()
+{
+    if (const auto dir = getenv("XDG_CACHE_HOME")) {
+        return (filesystem::path{dir} / "purech" / "metadata.cache").string();
+    }
+    if (const auto home = getenv("HOME")) {
+        return (filesystem::path{home} / ".cache" / "purech" / "metadata.cache").string();
+    }
+    return "/tmp/purech-metadata-"s + to_string(::getuid()) + ".cache";
+}
+
+bool MetadataCache::expired(const key_t &key, const Entry &entry, int64_t now) const
+{
+    const auto ttl = options_.ttl.find(key.first);
+    return ttl == options_.ttl.end() || entry.fetched + ttl->second.count() <= now
+           || entry.fetched > now; // The clock went back
+}
+
+} // ns
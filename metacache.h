@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "profiler.h"
+
+namespace purech {
+
+/*! Cache for the admin data that rarely changes: the cluster, tenant,
+ *  namespace and topic lists, and the namespace policies.
+ *
+ *  Entries are keyed by the cluster and the request path, and grouped
+ *  by the endpoint they came from, which also selects their time to
+ *  live. All the values are lists of strings. The policies are stored
+ *  as their replication clusters.
+ *
+ *  The cache lives in memory, and is optionally loaded from and saved
+ *  to a file, so that it outlives a run. The file is a compact binary
+ *  format, private to purech. A file we can't read is ignored.
+ *
+ *  Thread-safe.
+ */
+class MetadataCache {
+public:
+    using clock_t = std::chrono::system_clock;
+    using list_t = std::vector<std::string>;
+
+    struct Options {
+        Options();
+
+        // Time to live per endpoint. Endpoints without a ttl are not cached.
+        std::map<Endpoint, std::chrono::seconds> ttl;
+        std::string path; // Empty to only keep the cache in memory
+    };
+
+    explicit MetadataCache(Options options);
+
+    // The cached value, if we have one that has not expired
+    std::optional<list_t> get(const std::string& cluster, Endpoint endpoint,
+                              const std::string& path) const;
+
+    void put(const std::string& cluster, Endpoint endpoint, const std::string& path, list_t value);
+
+    void invalidate(const std::string& cluster, Endpoint endpoint, const std::string& path);
+
+    // Drop all the entries for `endpoint`, or all entries if it's not set.
+    // An empty `cluster` means all clusters.
+    void invalidate(const std::string& cluster, std::optional<Endpoint> endpoint = {});
+
+    bool cacheable(Endpoint endpoint) const noexcept {
+        return options_.ttl.count(endpoint) > 0;
+    }
+
+    // Returns false if there is no file, or we could not read it
+    bool load();
+
+    // Writes the entries that have not expired. Returns false if that failed.
+    bool save() const;
+
+    uint64_t hits() const noexcept {
+        return hits_;
+    }
+
+    uint64_t misses() const noexcept {
+        return misses_;
+    }
+
+    // Endpoint from the names used on the command line:
+    // clusters, tenants, namespaces, policies, topics or partitioned
+    static std::optional<Endpoint> endpoint(std::string_view name);
+
+    static std::string defaultPath();
+
+private:
+    struct Entry {
+        int64_t fetched = 0; // Unix time in seconds
+        list_t value;
+    };
+
+    using key_t = std::pair<Endpoint, std::string /* path */>;
+    using entries_t = std::map<key_t, Entry>;
+
+    bool expired(const key_t& key, const Entry& entry, int64_t now) const;
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    std::map<std::string /* cluster */, entries_t> clusters_;
+    mutable std::atomic<uint64_t> hits_ = 0;
+    mutable std::atomic<uint64_t> misses_ = 0;
+};
+
+} // ns
@@ -0,0 +1,132 @@
+// Serves a synthetic Pulsar deployment over the admin API, one
+// port per cluster, so that purech can be run and measured locally.
+
+#include <iostream>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+#include "logging.h"
+#include "mockserver.h"
+
+using namespace std;
+using namespace purech;
+
+int main(int argc, char *argv[]) {
+    namespace po = boost::program_options;
+
+    MockTopology topology;
+    MockBehavior behavior;
+    string address = "127.0.0.1";
+    uint16_t port = 8080;
+    size_t threads = 1;
+    bool kubectlBanner = false;
+    string log_level;
+
+    po::options_description general("Options");
+    general.add_options()("help,h", "Print help and exit")
+            ("log-level,l", po::value<string>(&log_level)->default_value("info"),
+             "Log-level to use; one of 'info', 'debug', 'trace'")
+            ("address", po::value<string>(&address)->default_value(address))
+            ("port,p", po::value<uint16_t>(&port)->default_value(port),
+             "Port for the first cluster. The next clusters use the following ports")
+            ("threads", po::value<size_t>(&threads)->default_value(threads))
+            ("clusters", po::value<size_t>(&topology.clusters)->default_value(topology.clusters))
+            ("tenants", po::value<size_t>(&topology.tenants)->default_value(topology.tenants))
+            ("namespaces", po::value<size_t>(&topology.namespaces)->default_value(topology.namespaces),
+             "Namespaces per tenant")
+            ("topics", po::value<size_t>(&topology.topics)->default_value(topology.topics),
+             "Topics per namespace")
+            ("partitions", po::value<size_t>(&topology.partitions)->default_value(topology.partitions),
+             "Partitions per topic. 0 means the topics are not partitioned")
+            ("publishers", po::value<size_t>(&topology.publishers)->default_value(topology.publishers),
+             "Publishers per topic")
+            ("subscriptions", po::value<size_t>(&topology.subscriptions)->default_value(topology.subscriptions),
+             "Subscriptions per topic")
+            ("consumers", po::value<size_t>(&topology.consumers)->default_value(topology.consumers),
+             "Consumers per subscription")
+            ("bundles", po::value<size_t>(&topology.bundles)->default_value(topology.bundles),
+             "Bundles per namespace")
+            ("brokers", po::value<size_t>(&topology.brokers)->default_value(topology.brokers),
+             "Brokers per cluster. The bundles are spread over them, but only the first, "
+             "this server, can be reached")
+            ("disconnected-rate", po::value<double>(&topology.disconnectedRate)->default_value(topology.disconnectedRate),
+             "Fraction of the replication links that are disconnected")
+            ("latency-ms", po::value<unsigned>(&behavior.latencyMs)->default_value(behavior.latencyMs),
+             "Latency added to every response")
+            ("jitter-ms", po::value<unsigned>(&behavior.jitterMs)->default_value(behavior.jitterMs),
+             "Random extra latency, up to this value")
+            ("failure-rate", po::value<double>(&behavior.failureRate)->default_value(behavior.failureRate),
+             "Fraction of the requests that fail with HTTP 500")
+            ("seed", po::value<uint64_t>(&behavior.seed)->default_value(behavior.seed))
+            ("kubectl-banner", po::bool_switch(&kubectlBanner),
+             "Print what 'kubectl port-forward' prints when it is ready, instead of the targets. "
+             "Lets the server stand in for kubectl in tests")
+            ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, general), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << general << endl;
+        return -1;
+    }
+
+    auto llevel = logfault::LogLevel::INFO;
+    if (log_level == "debug") {
+        llevel = logfault::LogLevel::DEBUGGING;
+    } else if (log_level == "trace") {
+        llevel = logfault::LogLevel::TRACE;
+    }
+    logfault::LogManager::Instance().AddHandler(
+                make_unique<logfault::StreamHandler>(clog, llevel));
+
+    boost::asio::io_context ctx;
+    vector<unique_ptr<MockPulsar>> clusters;
+    vector<unique_ptr<HttpServer>> servers;
+
+    for(size_t i = 0; i < topology.clusters; ++i) {
+        const auto cport = static_cast<uint16_t>(port + i);
+        auto& mock = clusters.emplace_back(make_unique<MockPulsar>(topology, behavior, i, cport));
+        auto& server = servers.emplace_back(make_unique<HttpServer>(ctx, address, cport,
+                                            [&mock=*mock](const HttpServer::Request& req) {
+            return mock.handle(req);
+        }));
+        server->start();
+
+        if (kubectlBanner) {
+            cout << "Forwarding from " << address << ':' << server->port() << " -> 8080" << endl;
+        } else {
+            // The targets to give to purech
+            cout << "http://" << address << ':' << server->port() << ',' << mock->name() << endl;
+        }
+    }
+
+    LOG_INFO << "Serving " << topology.clusters << " clusters with "
+             << (topology.tenants * topology.namespaces * topology.topics) << " topics each.";
+
+    boost::asio::signal_set signals{ctx, SIGINT, SIGTERM};
+    signals.async_wait([&](const boost::system::error_code&, int) {
+        ctx.stop();
+    });
+
+    vector<thread> workers;
+    for(size_t i = 1; i < threads; ++i) {
+        workers.emplace_back([&ctx] {
+            ctx.run();
+        });
+    }
+    ctx.run();
+
+    for(auto& w : workers) {
+        w.join();
+    }
+
+    for(const auto& mock : clusters) {
+        LOG_INFO << mock->name() << " served " << mock->requests() << " requests.";
+    }
+
+    return 0;
+}
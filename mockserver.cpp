@@ -0,0 +1,528 @@
+
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <thread>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging.h"
+#include "mockserver.h"
+#include "codec.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+const string prefix = "/admin/v2/";
+
+// Cheap, stable pseudo-random numbers from a key
+struct Rnd {
+    explicit Rnd(const string& key)
+        : state{hash<string>{}(key) | 1} {}
+
+    uint64_t next() noexcept {
+        // xorshift64*
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    double real(double max) noexcept {
+        return static_cast<double>(next() % 1000000) / 1000000.0 * max;
+    }
+
+    uint64_t below(uint64_t max) noexcept {
+        return max ? next() % max : 0;
+    }
+
+    uint64_t state;
+};
+
+void add(string& out, double v) {
+    char buf[32];
+    const auto len = snprintf(buf, sizeof(buf), "%.3f", v);
+    out.append(buf, static_cast<size_t>(len));
+}
+
+void add(string& out, uint64_t v) {
+    out += to_string(v);
+}
+
+void add(string& out, bool v) {
+    out += v ? "true" : "false";
+}
+
+void add(string& out, const string& v) {
+    out += '"';
+    out += v;
+    out += '"';
+}
+
+void add(string& out, const char *v) {
+    add(out, string{v});
+}
+
+template <typename T>
+void member(string& out, const char *name, const T& value, bool last = false) {
+    out += '"';
+    out += name;
+    out += "\":";
+    add(out, value);
+    if (!last) {
+        out += ',';
+    }
+}
+
+template <typename T>
+string list(size_t count, const T& name) {
+    string out = "[";
+    for(size_t i = 0; i < count; ++i) {
+        if (i) {
+            out += ',';
+        }
+        add(out, name(i));
+    }
+    out += ']';
+    return out;
+}
+
+bool index(const string& str, const string& prefix, size_t max, size_t& idx) {
+    if (str.compare(0, prefix.size(), prefix) != 0 || str.size() == prefix.size()) {
+        return false;
+    }
+    try {
+        size_t pos = 0;
+        idx = stoul(str.substr(prefix.size()), &pos);
+        return pos == str.size() - prefix.size() && idx < max;
+    } catch(const exception&) {
+        return false;
+    }
+}
+
+string tenantName(size_t i) {
+    return "tenant-" + to_string(i);
+}
+
+string nsName(size_t t, size_t n) {
+    return tenantName(t) + "/ns-" + to_string(n);
+}
+
+HttpServer::Response json(string body, int status = 200) {
+    HttpServer::Response res;
+    res.status = status;
+    res.body = make_shared<string>(move(body));
+    return res;
+}
+
+} // anon ns
+
+MockPulsar::MockPulsar(const MockTopology &topology, const MockBehavior &behavior,
+                       size_t index, uint16_t port)
+    : topology_{topology}, behavior_{behavior}, index_{index}
+    , name_{clusterName(index)}, broker_{"127.0.0.1:" + to_string(port)}
+{
+}
+
+string MockPulsar::clusterName(size_t index)
+{
+    return "cluster-" + to_string(index);
+}
+
+HttpServer::Response MockPulsar::handle(const HttpServer::Request &req)
+{
+    ++requests_;
+
+    thread_local mt19937_64 rnd{behavior_.seed ^ hash<thread::id>{}(this_thread::get_id())};
+
+    chrono::milliseconds delay{behavior_.latencyMs};
+    if (behavior_.jitterMs) {
+        delay += chrono::milliseconds{rnd() % (behavior_.jitterMs + 1)};
+    }
+
+    auto respond = [&](string body, int status = 200) {
+        auto encoding = ContentEncoding::IDENTITY;
+        if (auto it = req.headers.find("accept-encoding"); it != req.headers.end()) {
+            encoding = preferredEncoding(it->second);
+        }
+        auto res = json(compress(body, encoding), status);
+        if (encoding != ContentEncoding::IDENTITY) {
+            res.headers["Content-Encoding"] = encoding == ContentEncoding::GZIP ? "gzip" : "deflate";
+        }
+        res.delay = delay;
+        return res;
+    };
+
+    if (behavior_.failureRate > 0
+            && uniform_real_distribution<double>{0, 1}(rnd) < behavior_.failureRate) {
+        return respond(R"({"reason":"Injected failure"})", 500);
+    }
+
+    auto target = req.target.substr(0, req.target.find('?'));
+    if (req.method != "GET" || target.compare(0, prefix.size(), prefix) != 0) {
+        return respond(R"({"reason":"Not found"})", 404);
+    }
+
+    vector<string> path;
+    boost::split(path, target.substr(prefix.size()), boost::is_any_of("/"));
+
+    const auto& kind = path[0];
+    if (path.size() == 1 && kind == "clusters") {
+        return respond(clusters());
+    }
+    if (path.size() == 1 && kind == "tenants") {
+        return respond(tenants());
+    }
+    if (path.size() == 2 && kind == "namespaces" && exists(path[1])) {
+        return respond(namespaces(path[1]));
+    }
+    if (path.size() == 3 && kind == "namespaces" && exists(path[1], path[2])) {
+        return respond(policies());
+    }
+    if (path.size() == 3 && kind == "persistent" && exists(path[1], path[2])) {
+        return respond(topics(path[1] + "/" + path[2]));
+    }
+    if (path.size() == 4 && kind == "persistent" && path[3] == "partitioned" && exists(path[1], path[2])) {
+        return respond(partitionedTopics(path[1] + "/" + path[2]));
+    }
+    if (path.size() == 5 && kind == "persistent" && path[4] == "stats"
+            && exists(path[1], path[2], path[3])) {
+        return respond(topicStats("persistent://" + path[1] + "/" + path[2] + "/" + path[3]));
+    }
+    if (path.size() == 5 && kind == "persistent" && path[4] == "partitioned-stats"
+            && topology_.partitions && exists(path[1], path[2], path[3])
+            && path[3].find("-partition-") == string::npos) {
+        // Like the broker, we list the partitions unless asked not to
+        const bool perPartition = req.target.find("perPartition=false") == string::npos;
+        return respond(partitionedStats("persistent://" + path[1] + "/" + path[2] + "/" + path[3],
+                                        perPartition));
+    }
+    if (path.size() == 4 && kind == "namespaces" && path[3] == "bundles" && exists(path[1], path[2])) {
+        return respond(bundles());
+    }
+    if (path.size() == 2 && kind == "brokers" && path[1] == name_) {
+        return respond(brokers());
+    }
+    if (path.size() == 4 && kind == "brokers" && path[1] == name_ && path[3] == "ownedNamespaces") {
+        return respond(ownedBundles(path[2]));
+    }
+    if (path.size() == 2 && kind == "broker-stats" && path[1] == "topics") {
+        return respond(brokerStats());
+    }
+    if (path.size() == 2 && kind == "broker-stats" && path[1] == "load-report") {
+        return respond(loadReport());
+    }
+
+    return respond(R"({"reason":"Not found"})", 404);
+}
+
+string MockPulsar::clusters() const
+{
+    return list(topology_.clusters, clusterName);
+}
+
+string MockPulsar::tenants() const
+{
+    return list(topology_.tenants, tenantName);
+}
+
+string MockPulsar::namespaces(const string &tenant) const
+{
+    size_t t = 0;
+    index(tenant, "tenant-", topology_.tenants, t);
+    return list(topology_.namespaces, [t](size_t n) {
+        return nsName(t, n);
+    });
+}
+
+string MockPulsar::policies() const
+{
+    return R"({"replication_clusters":)" + clusters() + R"(,"bundles":{"numBundles":)"
+            + to_string(topology_.bundles) + "}}";
+}
+
+string MockPulsar::topics(const string &ns) const
+{
+    if (topology_.partitions) {
+        const auto partitions = topology_.partitions;
+        return list(topology_.topics * partitions, [&ns, partitions](size_t i) {
+            return "persistent://" + ns + "/topic-" + to_string(i / partitions)
+                    + "-partition-" + to_string(i % partitions);
+        });
+    }
+
+    return list(topology_.topics, [&ns](size_t i) {
+        return "persistent://" + ns + "/topic-" + to_string(i);
+    });
+}
+
+string MockPulsar::partitionedTopics(const string &ns) const
+{
+    return list(topology_.partitions ? topology_.topics : 0, [&ns](size_t i) {
+        return "persistent://" + ns + "/topic-" + to_string(i);
+    });
+}
+
+string MockPulsar::topicStats(const string &topic) const
+{
+    Rnd rnd{name_ + topic};
+    const auto rateIn = rnd.real(100);
+    const auto size = 100 + rnd.real(2000);
+
+    string out;
+    out.reserve(1024 + topology_.subscriptions * topology_.consumers * 300);
+    out += '{';
+    member(out, "msgRateIn", rateIn);
+    member(out, "msgThroughputIn", rateIn * size);
+    member(out, "msgRateOut", rateIn * static_cast<double>(topology_.subscriptions));
+    member(out, "msgThroughputOut", rateIn * size * static_cast<double>(topology_.subscriptions));
+    member(out, "averageMsgSize", size);
+    member(out, "storageSize", rnd.real(1e9));
+
+    out += R"("publishers":[)";
+    for(size_t i = 0; i < topology_.publishers; ++i) {
+        if (i) {
+            out += ',';
+        }
+        out += '{';
+        member(out, "msgRateIn", rateIn / static_cast<double>(topology_.publishers));
+        member(out, "msgThroughputIn", rateIn * size / static_cast<double>(topology_.publishers));
+        member(out, "averageMsgSize", size);
+        member(out, "producerId", static_cast<uint64_t>(i));
+        member(out, "address", "/10.0." + to_string(rnd.below(16)) + "." + to_string(rnd.below(250))
+               + ":" + to_string(30000 + rnd.below(30000)));
+        member(out, "clientVersion", "2.10." + to_string(rnd.below(4)));
+        member(out, "connectedSince", "2021-06-01T10:00:00.000Z");
+        member(out, "producerName", name_ + "-producer-" + to_string(i), true);
+        out += '}';
+    }
+    out += "],";
+
+    out += R"("subscriptions":{)";
+    for(size_t s = 0; s < topology_.subscriptions; ++s) {
+        if (s) {
+            out += ',';
+        }
+        out += "\"subscription-" + to_string(s) + "\":{";
+        member(out, "msgRateOut", rateIn);
+        member(out, "msgThroughputOut", rateIn * size);
+        member(out, "msgRateRedeliver", 0.0);
+        member(out, "msgBacklog", rnd.below(10) ? uint64_t{0} : rnd.below(100000));
+        member(out, "blockedSubscriptionOnUnackedMsgs", false);
+        member(out, "unackedMessages", rnd.below(100));
+        member(out, "type", (s % 2) ? "Shared" : "Exclusive");
+        member(out, "activeConsumerName", "consumer-0");
+        member(out, "msgRateExpired", 0.0);
+        out += R"("consumers":[)";
+        for(size_t c = 0; c < topology_.consumers; ++c) {
+            if (c) {
+                out += ',';
+            }
+            out += '{';
+            member(out, "msgRateOut", rateIn / static_cast<double>(topology_.consumers));
+            member(out, "msgThroughputOut", rateIn * size / static_cast<double>(topology_.consumers));
+            member(out, "msgRateRedeliver", 0.0);
+            member(out, "consumerName", "consumer-" + to_string(c));
+            member(out, "availablePermits", rnd.below(1000));
+            member(out, "unackedMessages", rnd.below(100));
+            member(out, "blockedConsumerOnUnackedMsgs", false);
+            member(out, "address", "/10.1." + to_string(rnd.below(16)) + "." + to_string(rnd.below(250))
+                   + ":" + to_string(30000 + rnd.below(30000)));
+            member(out, "clientVersion", "2.9." + to_string(rnd.below(3)));
+            member(out, "connectedSince", "2021-06-01T10:00:00.000Z", true);
+            out += '}';
+        }
+        out += "]}";
+    }
+    out += "},";
+
+    out += R"("replication":{)";
+    bool first = true;
+    for(size_t c = 0; c < topology_.clusters; ++c) {
+        if (c == index_) {
+            continue;
+        }
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        const bool connected = rnd.real(1) >= topology_.disconnectedRate;
+        out += "\"" + clusterName(c) + "\":{";
+        member(out, "msgRateIn", 0.0);
+        member(out, "msgThroughputIn", 0.0);
+        member(out, "msgRateOut", connected ? rateIn : 0.0);
+        member(out, "msgThroughputOut", connected ? rateIn * size : 0.0);
+        member(out, "msgRateExpired", 0.0);
+        member(out, "replicationBacklog", connected ? rnd.below(10) : rnd.below(100000));
+        member(out, "connected", connected);
+        member(out, "replicationDelayInSeconds", connected ? rnd.below(2) : 60 + rnd.below(3600));
+        member(out, "outboundConnection", "[id: 0x1, L:/10.0.0.1:40000 - R:" + clusterName(c) + "]");
+        member(out, "outboundConnectedSince", "2021-06-01T10:00:00.000Z", true);
+        out += '}';
+    }
+    out += "},";
+
+    member(out, "deduplicationStatus", "Disabled", true);
+    out += '}';
+    return out;
+}
+
+string MockPulsar::partitionedStats(const string &topic, bool perPartition) const
+{
+    // The sum is made up like any other topic's stats, and does not add
+    // up to the partitions. It's the shape of the reply that matters.
+    auto out = topicStats(topic);
+    out.pop_back();
+    out += R"(,"metadata":{"partitions":)" + to_string(topology_.partitions) + R"(},"partitions":{)";
+    for(size_t p = 0; perPartition && p < topology_.partitions; ++p) {
+        const auto partition = topic + "-partition-" + to_string(p);
+        if (p) {
+            out += ',';
+        }
+        out += "\"" + partition + "\":" + topicStats(partition);
+    }
+    out += "}}";
+    return out;
+}
+
+string MockPulsar::brokerStats() const
+{
+    // namespace -> bundle -> domain -> topic -> stats
+    string out = "{";
+    for(size_t t = 0; t < topology_.tenants; ++t) {
+        for(size_t n = 0; n < topology_.namespaces; ++n) {
+            const auto ns = nsName(t, n);
+            if (out.size() > 1) {
+                out += ',';
+            }
+            out += "\"" + ns + R"(":{"0x00000000_0xffffffff":{"persistent":{)";
+            const auto partitions = max<size_t>(topology_.partitions, 1);
+            for(size_t i = 0; i < topology_.topics * partitions; ++i) {
+                auto topic = "persistent://" + ns + "/topic-" + to_string(i / partitions);
+                if (topology_.partitions) {
+                    topic += "-partition-" + to_string(i % partitions);
+                }
+                if (i) {
+                    out += ',';
+                }
+                out += "\"" + topic + "\":" + topicStats(topic);
+            }
+            out += "}}}";
+        }
+    }
+    out += '}';
+    return out;
+}
+
+string MockPulsar::brokers() const
+{
+    return list(max<size_t>(topology_.brokers, 1), [this](size_t i) {
+        return brokerName(i);
+    });
+}
+
+string MockPulsar::bundles() const
+{
+    // Split evenly, like the broker does when a namespace is created
+    const auto count = max<size_t>(topology_.bundles, 1);
+    const uint64_t full = 0xffffffff;
+    return R"({"boundaries":)" + list(count + 1, [count, full](size_t i) {
+        char hex[16];
+        snprintf(hex, sizeof(hex), "0x%08llx",
+                 static_cast<unsigned long long>(i == count ? full : i * (full / count)));
+        return string{hex};
+    }) + R"(,"numBundles":)" + to_string(count) + '}';
+}
+
+string MockPulsar::ownedBundles(const string &broker) const
+{
+    // Each bundle goes to a broker picked by its name, so that
+    // some brokers get more than others
+    const auto brokers = max<size_t>(topology_.brokers, 1);
+    const auto count = max<size_t>(topology_.bundles, 1);
+    const uint64_t full = 0xffffffff;
+    string out = "{";
+    for(size_t t = 0; t < topology_.tenants; ++t) {
+        for(size_t n = 0; n < topology_.namespaces; ++n) {
+            for(size_t b = 0; b < count; ++b) {
+                char range[32];
+                snprintf(range, sizeof(range), "0x%08llx_0x%08llx",
+                         static_cast<unsigned long long>(b * (full / count)),
+                         static_cast<unsigned long long>(b + 1 == count ? full : (b + 1) * (full / count)));
+                const auto bundle = nsName(t, n) + '/' + range;
+                if (brokerName(Rnd{name_ + bundle}.below(brokers)) != broker) {
+                    continue;
+                }
+                if (out.size() > 1) {
+                    out += ',';
+                }
+                out += "\"" + bundle + R"(":{"broker_assignment":"primary","is_controlled":false,"is_active":true})";
+            }
+        }
+    }
+    out += '}';
+    return out;
+}
+
+string MockPulsar::loadReport() const
+{
+    Rnd rnd{name_ + "/load"};
+    const auto usage = [&rnd](string& out, const char *name, double limit, bool last = false) {
+        out += '"';
+        out += name;
+        out += "\":{";
+        member(out, "usage", rnd.real(limit));
+        member(out, "limit", limit, true);
+        out += last ? "}" : "},";
+    };
+
+    string out = "{";
+    member(out, "webServiceUrl", "http://" + broker_);
+    usage(out, "cpu", 400.0);
+    usage(out, "memory", 4096.0);
+    usage(out, "directMemory", 4096.0);
+    usage(out, "bandwidthIn", 1e6);
+    usage(out, "bandwidthOut", 1e6);
+    member(out, "msgRateIn", rnd.real(10000));
+    member(out, "msgRateOut", rnd.real(20000));
+    member(out, "msgThroughputIn", rnd.real(1e7));
+    member(out, "msgThroughputOut", rnd.real(2e7));
+    member(out, "numTopics", topology_.tenants * topology_.namespaces * topology_.topics);
+    member(out, "numBundles", topology_.tenants * topology_.namespaces * topology_.bundles);
+    member(out, "numConsumers", uint64_t{0});
+    member(out, "numProducers", uint64_t{0}, true);
+    out += '}';
+    return out;
+}
+
+string MockPulsar::brokerName(size_t index) const
+{
+    // The others are made up, and can't be reached
+    return index ? "broker-" + to_string(index) + "." + name_ + ".invalid:8080" : broker_;
+}
+
+bool MockPulsar::exists(const string &tenant, const string &ns, const string &topic) const
+{
+    size_t t = 0, n = 0, i = 0;
+    if (!index(tenant, "tenant-", topology_.tenants, t)) {
+        return false;
+    }
+    if (!ns.empty() && !index(ns, "ns-", topology_.namespaces, n)) {
+        return false;
+    }
+    if (topic.empty()) {
+        return true;
+    }
+
+    if (const auto pos = topic.find("-partition-"); pos != string::npos) {
+        size_t p = 0;
+        return index(topic.substr(0, pos), "topic-", topology_.topics, i)
+                && index(topic.substr(pos + 1), "partition-", topology_.partitions, p);
+    }
+    return index(topic, "topic-", topology_.topics, i);
+}
+
+} // ns
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "httpserver.h"
+
+namespace purech {
+
+// Shape of the synthetic deployment
+struct MockTopology {
+    size_t clusters = 3;
+    size_t tenants = 2;
+    size_t namespaces = 4; // Per tenant
+    size_t topics = 50; // Per namespace
+    size_t partitions = 0; // Per topic. 0 means the topics are not partitioned
+    size_t publishers = 1; // Per topic
+    size_t subscriptions = 2; // Per topic
+    size_t consumers = 2; // Per subscription
+    size_t bundles = 4; // Per namespace
+    size_t brokers = 1; // Per cluster. Only the first, which is us, can be reached
+    double disconnectedRate = 0.0; // Fraction of the replication links that are down
+};
+
+struct MockBehavior {
+    unsigned latencyMs = 0; // Added to every response
+    unsigned jitterMs = 0; // Random extra latency, up to this value
+    double failureRate = 0.0; // Fraction of the requests that fail with HTTP 500
+    uint64_t seed = 1;
+};
+
+/*! Serves a subset of the Pulsar admin API (v2) for one cluster
+ *  in a synthetic deployment.
+ *
+ *  The data is generated from the topology and the cluster's index,
+ *  so it is the same every time, and the topic sets are the same in
+ *  all the clusters.
+ */
+class MockPulsar {
+public:
+    MockPulsar(const MockTopology& topology, const MockBehavior& behavior,
+               size_t index, uint16_t port);
+
+    HttpServer::Response handle(const HttpServer::Request& req);
+
+    const std::string& name() const noexcept {
+        return name_;
+    }
+
+    uint64_t requests() const noexcept {
+        return requests_;
+    }
+
+    static std::string clusterName(size_t index);
+
+private:
+    std::string clusters() const;
+    std::string tenants() const;
+    std::string namespaces(const std::string& tenant) const;
+    std::string policies() const;
+    std::string topics(const std::string& ns) const;
+    std::string partitionedTopics(const std::string& ns) const;
+    std::string topicStats(const std::string& topic) const;
+    std::string partitionedStats(const std::string& topic, bool perPartition) const;
+    std::string brokerStats() const;
+    std::string brokers() const;
+    std::string bundles() const;
+    std::string ownedBundles(const std::string& broker) const;
+    std::string loadReport() const;
+    std::string brokerName(size_t index) const;
+    bool exists(const std::string& tenant, const std::string& ns = {}, const std::string& topic = {}) const;
+
+    const MockTopology topology_;
+    const MockBehavior behavior_;
+    const size_t index_;
+    const std::string name_;
+    const std::string broker_;
+    std::atomic<uint64_t> requests_ = 0;
+};
+
+} // ns
@@ -0,0 +1,206 @@
+// Compares memory use and throughput of the Namespace::topics tree
+// with the compact TopicStore, on synthetic topic stats.
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+
+#include <boost/program_options.hpp>
+
+#include "store.h"
+
+using namespace std;
+using namespace purech;
+
+namespace {
+
+struct Params {
+    size_t topics = 100000;
+    size_t namespaces = 100;
+    size_t publishers = 2;
+    size_t subscriptions = 2;
+    size_t consumers = 2;
+    size_t peers = 5;
+};
+
+size_t heapInUse() {
+    return mallinfo2().uordblks;
+}
+
+double seconds(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+PersistentTopicStats makeStats(const Params& p, size_t topic) {
+    static const vector<string> versions{"2.10.1", "2.9.3", "3.0.0", "Pulsar-CPP-v3.1.2"};
+    static const vector<string> regions{"us-east", "us-west", "eu-west", "eu-central", "ap-south", "ap-east"};
+
+    auto address = [](size_t n) {
+        return "/10.0."s + to_string(n % 16) + "." + to_string(n % 251) + ":" + to_string(40000 + n % 97);
+    };
+    auto since = [](size_t n) {
+        return "2021-06-0"s + to_string(1 + n % 9) + "T10:" + to_string(10 + n % 50) + ":00.000Z";
+    };
+
+    PersistentTopicStats st;
+    st.msgRateIn = static_cast<double>(topic % 100);
+    st.msgThroughputIn = st.msgRateIn * 1024;
+    st.msgRateOut = st.msgRateIn * 2;
+    st.msgThroughputOut = st.msgThroughputIn * 2;
+    st.averageMsgSize = 1024;
+    st.storageSize = static_cast<double>(topic * 4096);
+    st.deduplicationStatus = "Disabled";
+
+    for(size_t i = 0; i < p.publishers; ++i) {
+        Publisher pub;
+        pub.msgRateIn = st.msgRateIn / static_cast<double>(p.publishers);
+        pub.producerId = i;
+        pub.address = address(topic + i);
+        pub.clientVersion = versions[(topic + i) % versions.size()];
+        pub.connectedSince = since(topic + i);
+        pub.producerName = "producer-" + to_string(topic) + "-" + to_string(i);
+        st.publishers.push_back(move(pub));
+    }
+
+    for(size_t i = 0; i < p.subscriptions; ++i) {
+        Subscription sub;
+        sub.msgBacklog = (topic * 7 + i) % 1000;
+        sub.type = (i % 2) ? "Shared" : "Exclusive";
+        for(size_t c = 0; c < p.consumers; ++c) {
+            Consumer con;
+            con.msgRateOut = 1;
+            con.consumerName = "consumer-" + to_string(c);
+            con.address = address(topic * 3 + c);
+            con.clientVersion = versions[c % versions.size()];
+            con.connectedSince = since(topic + c);
+            sub.consumers.push_back(move(con));
+        }
+        st.subscriptions.emplace("subscription-" + to_string(i), move(sub));
+    }
+
+    for(size_t i = 0; i < p.peers && i < regions.size(); ++i) {
+        Replication r;
+        r.msgRateOut = st.msgRateIn;
+        r.connected = true;
+        r.replicationBacklog = static_cast<int>(topic % 10);
+        r.outboundConnection = "[id: 0x" + to_string(topic) + ", L:/10.0.0.1:40000 - R:" + regions[i] + "]";
+        r.outboundConnectedSince = since(i);
+        st.replication.emplace(regions[i], move(r));
+    }
+
+    return st;
+}
+
+void tenantAndNs(const Params& p, size_t topic, string& tenant, string& ns, string& name) {
+    const auto nsid = topic % p.namespaces;
+    tenant = "tenant-" + to_string(nsid % 10);
+    ns = tenant + "/ns-" + to_string(nsid);
+    name = "persistent://" + ns + "/topic-" + to_string(topic);
+}
+
+} // anon ns
+
+int main(int argc, char *argv[]) {
+    namespace po = boost::program_options;
+    Params p;
+
+    po::options_description general("Options");
+    general.add_options()("help,h", "Print help and exit")
+            ("topics,t", po::value<size_t>(&p.topics)->default_value(p.topics))
+            ("namespaces,n", po::value<size_t>(&p.namespaces)->default_value(p.namespaces))
+            ("publishers,p", po::value<size_t>(&p.publishers)->default_value(p.publishers))
+            ("subscriptions,s", po::value<size_t>(&p.subscriptions)->default_value(p.subscriptions))
+            ("consumers,c", po::value<size_t>(&p.consumers)->default_value(p.consumers),
+             "Consumers per subscription")
+            ("peers,r", po::value<size_t>(&p.peers)->default_value(p.peers),
+             "Replication links per topic (max 6)")
+            ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, general), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << general << endl;
+        return -1;
+    }
+
+    string tenant, ns, name;
+
+    // The current layout
+    size_t treeBytes = 0;
+    double treeFill = 0, treeSum = 0;
+    Stats treeTotal;
+    {
+        const auto before = heapInUse();
+        const auto start = chrono::steady_clock::now();
+        map<string, Tenant> tenants;
+        for(size_t t = 0; t < p.topics; ++t) {
+            tenantAndNs(p, t, tenant, ns, name);
+            tenants[tenant].namespaces[ns].topics[name] = makeStats(p, t);
+        }
+        treeFill = seconds(start);
+        treeBytes = heapInUse() - before;
+
+        const auto sumStart = chrono::steady_clock::now();
+        for(const auto& [_, tn] : tenants) {
+            for(const auto& [_, n] : tn.namespaces) {
+                for(const auto& [_, topic] : n.topics) {
+                    treeTotal += topic;
+                }
+            }
+        }
+        treeSum = seconds(sumStart);
+    }
+
+    // The compact layout. The PersistentTopicStats are created and
+    // dropped one at a time, like in compact mode.
+    size_t storeBytes = 0, poolBytes = 0;
+    double storeFill = 0, storeSum = 0;
+    Stats storeTotal;
+    {
+        StringPool pool;
+        TopicStore store{pool};
+        const auto before = heapInUse();
+        const auto start = chrono::steady_clock::now();
+        for(size_t t = 0; t < p.topics; ++t) {
+            tenantAndNs(p, t, tenant, ns, name);
+            store.add(tenant, ns, name, makeStats(p, t));
+        }
+        store.seal();
+        storeFill = seconds(start);
+        storeBytes = heapInUse() - before;
+        poolBytes = pool.memoryUsage();
+
+        const auto sumStart = chrono::steady_clock::now();
+        for(const auto& row : store.topics()) {
+            storeTotal += row.rates;
+        }
+        storeSum = seconds(sumStart);
+    }
+
+    if (treeTotal.msgRateIn != storeTotal.msgRateIn) {
+        cerr << "The layouts disagree on msgRateIn!" << endl;
+        return 1;
+    }
+
+    const auto mb = [](size_t bytes) {
+        return static_cast<double>(bytes) / (1024.0 * 1024.0);
+    };
+
+    cout << fixed << setprecision(2)
+         << p.topics << " topics, " << p.publishers << " publishers, " << p.subscriptions
+         << " subscriptions x " << p.consumers << " consumers, " << p.peers << " replication links" << endl
+         << setw(10) << "layout" << setw(12) << "heap MB" << setw(14) << "fill s"
+         << setw(14) << "topics/s" << setw(14) << "roll-up ms" << endl
+         << setw(10) << "tree" << setw(12) << mb(treeBytes) << setw(14) << treeFill
+         << setw(14) << setprecision(0) << (static_cast<double>(p.topics) / treeFill)
+         << setw(14) << setprecision(2) << (treeSum * 1000) << endl
+         << setw(10) << "compact" << setw(12) << mb(storeBytes) << setw(14) << storeFill
+         << setw(14) << setprecision(0) << (static_cast<double>(p.topics) / storeFill)
+         << setw(14) << setprecision(2) << (storeSum * 1000) << endl
+         << "(compact: " << mb(poolBytes) << " MB in the string pool)" << endl;
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+
+#include "profiler.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+string escape(const string& str) {
+    string out;
+    out.reserve(str.size());
+    for(const auto ch : str) {
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+        }
+        if (static_cast<unsigned char>(ch) < 0x20) {
+            out += ' ';
+            continue;
+        }
+        out += ch;
+    }
+    return out;
+}
+
+double ms(uint64_t micros) {
+    return static_cast<double>(micros) / 1000.0;
+}
+
+} // anon ns
+
+const char *toString(Endpoint endpoint) noexcept
+{
+    static constexpr const char *names[] = {
+        "port-forward",
+        "clusters",
+        "tenants",
+        "namespaces/{tenant}",
+        "namespaces/{ns}",
+        "persistent/{ns}",
+        "persistent/{topic}/stats",
+        "brokers/{cluster}",
+        "broker-stats/topics",
+        "persistent/{ns}/partitioned",
+        "persistent/{topic}/partitioned-stats",
+        "namespaces/{ns}/bundles",
+        "brokers/{cluster}/{broker}/ownedNamespaces",
+        "broker-stats/load-report",
+        "lookup/v2/topic/{topic}"
+    };
+
+    static_assert(size(names) == static_cast<size_t>(Endpoint::COUNT_));
+    return names[static_cast<size_t>(endpoint)];
+}
+
+Profiler::Profiler(bool withTimeline)
+    : withTimeline_{withTimeline}
+{
+}
+
+size_t Profiler::addCluster(const string &name)
+{
+    clusters_.emplace_back(name);
+    return clusters_.size() - 1;
+}
+
+void Profiler::record(const Profiler::Sample &sample, const string &what)
+{
+    auto& stats = clusters_.at(sample.cluster).endpoints.at(static_cast<size_t>(sample.endpoint));
+    ++stats.requests;
+    if (sample.failed) {
+        ++stats.failures;
+    } else {
+        stats.bytes += sample.bytes;
+        stats.wireBytes += sample.wireBytes;
+        stats.latency.record(static_cast<uint64_t>(
+            chrono::duration_cast<chrono::microseconds>(sample.received - sample.start).count()));
+        stats.deserialize.record(static_cast<uint64_t>(
+            chrono::duration_cast<chrono::microseconds>(sample.done - sample.received).count()));
+    }
+
+    if (withTimeline_) {
+        lock_guard lock{mutex_};
+        timeline_.push_back({sample, what});
+    }
+}
+
+void Profiler::mark(const string &name, clock_t::time_point start, clock_t::time_point done)
+{
+    if (withTimeline_) {
+        Sample sample;
+        sample.start = start;
+        sample.received = sample.done = done;
+
+        lock_guard lock{mutex_};
+        marks_.push_back({sample, name});
+    }
+}
+
+void Profiler::report(ostream &out) const
+{
+    out << "Profile (latency in milliseconds, until the body is received):" << endl;
+    out << left << setw(28) << "  endpoint" << right
+        << setw(9) << "requests" << setw(8) << "failed" << setw(11) << "MB" << setw(11) << "wire MB"
+        << setw(9) << "p50" << setw(9) << "p90" << setw(9) << "p99" << setw(10) << "max"
+        << setw(11) << "total s" << setw(11) << "parse s" << endl;
+
+    out << fixed;
+    for(const auto& cluster : clusters_) {
+        out << "Cluster " << cluster.name << endl;
+        for(size_t i = 0; i < cluster.endpoints.size(); ++i) {
+            const auto& s = cluster.endpoints[i];
+            if (!s.requests) {
+                continue;
+            }
+
+            out << "  " << left << setw(26) << toString(static_cast<Endpoint>(i)) << right
+                << setw(9) << s.requests << setw(8) << s.failures
+                << setw(11) << setprecision(2) << (static_cast<double>(s.bytes) / (1024.0 * 1024.0))
+                << setw(11) << (static_cast<double>(s.wireBytes) / (1024.0 * 1024.0))
+                << setprecision(1)
+                << setw(9) << ms(s.latency.percentile(0.5))
+                << setw(9) << ms(s.latency.percentile(0.9))
+                << setw(9) << ms(s.latency.percentile(0.99))
+                << setw(10) << ms(s.latency.max())
+                << setprecision(3)
+                << setw(11) << (ms(s.latency.sum()) / 1000.0)
+                << setw(11) << (ms(s.deserialize.sum()) / 1000.0)
+                << endl;
+        }
+    }
+    out << defaultfloat;
+}
+
+void Profiler::writeTrace(ostream &out) const
+{
+    lock_guard lock{mutex_};
+
+    // The requests run concurrently, so each cluster gets as many lanes
+    // as it had requests in flight, and every request goes in the first
+    // lane that is free when it starts.
+    vector<const Event *> events;
+    events.reserve(timeline_.size());
+    for(const auto& e : timeline_) {
+        events.push_back(&e);
+    }
+    stable_sort(events.begin(), events.end(), [](const auto *a, const auto *b) {
+        if (a->sample.cluster != b->sample.cluster) {
+            return a->sample.cluster < b->sample.cluster;
+        }
+        return a->sample.start < b->sample.start;
+    });
+
+    bool first = true;
+    auto next = [&]() -> ostream& {
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+        return out;
+    };
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    // pid 0 is the engine itself. The clusters are numbered from 1.
+    next() << R"({"ph":"M","name":"process_name","pid":0,"tid":0,"args":{"name":"purech"}})";
+    for(size_t i = 0; i < clusters_.size(); ++i) {
+        next() << R"({"ph":"M","name":"process_name","pid":)" << (i + 1)
+               << R"(,"tid":0,"args":{"name":"cluster )" << escape(clusters_[i].name) << "\"}}";
+    }
+
+    for(const auto& m : marks_) {
+        next() << R"({"ph":"X","cat":"engine","name":")" << escape(m.what)
+               << R"(","pid":0,"tid":1,"ts":)" << micros(m.sample.start)
+               << ",\"dur\":" << (micros(m.sample.done) - micros(m.sample.start)) << '}';
+    }
+
+    vector<clock_t::time_point> lanes;
+    size_t cluster = 0;
+    for(const auto *e : events) {
+        const auto& s = e->sample;
+        if (lanes.empty() || s.cluster != cluster) {
+            lanes.clear();
+            cluster = s.cluster;
+        }
+
+        auto lane = find_if(lanes.begin(), lanes.end(), [&s](const auto& end) {
+            return end <= s.start;
+        });
+        if (lane == lanes.end()) {
+            lane = lanes.insert(lanes.end(), s.done);
+        } else {
+            *lane = s.done;
+        }
+        const auto tid = (lane - lanes.begin()) + 1;
+        const auto pid = s.cluster + 1;
+
+        next() << R"({"ph":"X","cat":")" << (s.endpoint == Endpoint::PORT_FORWARD ? "kubectl" : "http")
+               << R"(","name":")" << toString(s.endpoint)
+               << R"(","pid":)" << pid << ",\"tid\":" << tid
+               << ",\"ts\":" << micros(s.start) << ",\"dur\":" << (micros(s.done) - micros(s.start))
+               << R"(,"args":{"url":")" << escape(e->what) << R"(","bytes":)" << s.bytes
+               << ",\"wireBytes\":" << s.wireBytes
+               << ",\"failed\":" << (s.failed ? "true" : "false") << "}}";
+
+        if (!s.failed && s.done > s.received) {
+            next() << R"({"ph":"X","cat":"json","name":"deserialize","pid":)" << pid
+                   << ",\"tid\":" << tid << ",\"ts\":" << micros(s.received)
+                   << ",\"dur\":" << (micros(s.done) - micros(s.received)) << '}';
+        }
+    }
+
+    out << "\n]}\n";
+}
+
+} // ns
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+
+namespace purech {
+
+// The kinds of work we time. The requests are grouped by the
+// admin API endpoint, not by the full url.
+enum class Endpoint {
+    PORT_FORWARD,
+    CLUSTERS,
+    TENANTS,
+    NAMESPACES,
+    POLICIES,
+    TOPICS,
+    TOPIC_STATS,
+    BROKERS,
+    BROKER_STATS,
+    PARTITIONED,
+    PARTITIONED_STATS,
+    BUNDLES,
+    OWNED_BUNDLES,
+    LOAD_REPORT,
+    LOOKUP,
+    COUNT_ // Must be last
+};
+
+const char *toString(Endpoint endpoint) noexcept;
+
+/*! Per-cluster, per-endpoint timing of the requests and the
+ *  port-forwardings, and optionally a timeline of all of them.
+ *
+ *  Recording is thread-safe. The histograms and counters are
+ *  lock-free; the timeline takes a lock.
+ */
+class Profiler {
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    struct EndpointStats {
+        std::atomic<uint64_t> requests = 0;
+        std::atomic<uint64_t> failures = 0;
+        std::atomic<uint64_t> bytes = 0; // Body bytes received, after decompression
+        std::atomic<uint64_t> wireBytes = 0; // Body bytes as sent, maybe compressed
+        Histogram latency; // Microseconds, until the body is received
+        Histogram deserialize; // Microseconds spent parsing the json
+    };
+
+    // One request, or one port-forward startup
+    struct Sample {
+        size_t cluster = 0;
+        Endpoint endpoint = Endpoint::CLUSTERS;
+        clock_t::time_point start;
+        clock_t::time_point received; // The body is in memory
+        clock_t::time_point done; // The body is deserialized
+        uint64_t bytes = 0;
+        uint64_t wireBytes = 0;
+        bool failed = false;
+    };
+
+    explicit Profiler(bool withTimeline);
+
+    // Must be called before recording starts. Returns the cluster's id.
+    size_t addCluster(const std::string& name);
+
+    void record(const Sample& sample, const std::string& what);
+
+    // Something that is not about one cluster, like a scan
+    void mark(const std::string& name, clock_t::time_point start, clock_t::time_point done);
+
+    const EndpointStats& stats(size_t cluster, Endpoint endpoint) const {
+        return clusters_.at(cluster).endpoints.at(static_cast<size_t>(endpoint));
+    }
+
+    void report(std::ostream& out) const;
+
+    // Chrome trace event format; loads in chrome://tracing and Perfetto
+    void writeTrace(std::ostream& out) const;
+
+private:
+    struct ClusterStats {
+        explicit ClusterStats(std::string name)
+            : name{std::move(name)} {}
+
+        const std::string name;
+        std::array<EndpointStats, static_cast<size_t>(Endpoint::COUNT_)> endpoints;
+    };
+
+    struct Event {
+        Sample sample;
+        std::string what; // Url, or the name of a mark
+    };
+
+    uint64_t micros(clock_t::time_point when) const noexcept {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(when - started_).count());
+    }
+
+    const bool withTimeline_;
+    const clock_t::time_point started_ = clock_t::now();
+    std::deque<ClusterStats> clusters_;
+    mutable std::mutex mutex_;
+    std::vector<Event> timeline_;
+    std::vector<Event> marks_;
+};
+
+} // ns
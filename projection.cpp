@@ -0,0 +1,76 @@
+
+#include <boost/algorithm/string.hpp>
+
+#include "projection.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+void addAll(const vector<FieldNode>& nodes, set<string>& names) {
+    for(const auto& node : nodes) {
+        names.insert(node.name);
+        addAll(node.children, names);
+    }
+}
+
+bool hasChildPath(const set<string>& keep, const string& path) {
+    const auto prefix = path + '.';
+    auto it = keep.lower_bound(prefix);
+    return it != keep.end() && it->compare(0, prefix.size(), prefix) == 0;
+}
+
+void walk(const vector<FieldNode>& nodes, const string& prefix, const set<string>& keep,
+          set<string>& all, set<string>& needed, set<string>& matched) {
+    for(const auto& node : nodes) {
+        const auto path = prefix + node.name;
+        all.insert(node.name);
+
+        if (keep.count(path)) {
+            matched.insert(path);
+            needed.insert(node.name);
+            addAll(node.children, all);
+            addAll(node.children, needed);
+        } else if (hasChildPath(keep, path)) {
+            needed.insert(node.name);
+            walk(node.children, path + '.', keep, all, needed, matched);
+        } else {
+            addAll(node.children, all);
+        }
+    }
+}
+
+void paths(const vector<FieldNode>& nodes, const string& prefix, vector<string>& out) {
+    for(const auto& node : nodes) {
+        out.emplace_back(prefix + node.name);
+        paths(node.children, out.back() + '.', out);
+    }
+}
+
+} // anon ns
+
+Projection::Projection(const vector<FieldNode> &tree, const vector<string> &fields)
+{
+    const set<string> keep{fields.begin(), fields.end()};
+    set<string> all, needed, matched;
+
+    walk(tree, {}, keep, all, needed, matched);
+
+    for(const auto& field : keep) {
+        if (!matched.count(field)) {
+            vector<string> valid;
+            paths(tree, {}, valid);
+            throw runtime_error("Unknown field '"s + field + "'. Valid fields are: "
+                                + boost::join(valid, ", "));
+        }
+    }
+
+    set_difference(all.begin(), all.end(), needed.begin(), needed.end(),
+                   inserter(excluded_, excluded_.end()));
+
+    properties_.excluded_names = &excluded_;
+}
+
+} // ns
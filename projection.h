@@ -0,0 +1,115 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/fusion/adapted.hpp>
+#include <boost/fusion/include/size.hpp>
+#include <boost/fusion/include/value_at.hpp>
+
+#include "restc-cpp/restc-cpp.h"
+#include "restc-cpp/SerializeJson.h"
+
+namespace purech {
+
+/*! A member of a fusion-adapted struct, with the members of its
+ *  own type (or element type, for containers) if that is adapted too.
+ */
+struct FieldNode {
+    std::string name;
+    std::vector<FieldNode> children;
+};
+
+namespace detail {
+
+template <typename T>
+struct ElementType {
+    using type = T;
+};
+
+template <typename T, typename A>
+struct ElementType<std::vector<T, A>> {
+    using type = typename ElementType<T>::type;
+};
+
+template <typename T, typename A>
+struct ElementType<std::deque<T, A>> {
+    using type = typename ElementType<T>::type;
+};
+
+template <typename K, typename V, typename C, typename A>
+struct ElementType<std::map<K, V, C, A>> {
+    using type = typename ElementType<V>::type;
+};
+
+template <typename T>
+std::vector<FieldNode> fieldTree();
+
+template <typename T, size_t I>
+FieldNode fieldNode() {
+    using member_t = typename boost::fusion::result_of::value_at_c<T, I>::type;
+    using element_t = typename ElementType<member_t>::type;
+
+    FieldNode node{boost::fusion::extension::struct_member_name<T, I>::call(), {}};
+    if constexpr (boost::fusion::traits::is_sequence<element_t>::value) {
+        node.children = fieldTree<element_t>();
+    }
+    return node;
+}
+
+template <typename T, size_t... I>
+std::vector<FieldNode> fieldTree(std::index_sequence<I...>) {
+    return {fieldNode<T, I>()...};
+}
+
+template <typename T>
+std::vector<FieldNode> fieldTree() {
+    return fieldTree<T>(std::make_index_sequence<boost::fusion::result_of::size<T>::value>{});
+}
+
+} // detail
+
+// The members of a fusion-adapted struct, recursively
+template <typename T>
+std::vector<FieldNode> fieldTree() {
+    return detail::fieldTree<T>();
+}
+
+/*! Tells the JSON deserializer which members a run needs.
+ *
+ *  The deserializer skips excluded members while it parses, without
+ *  building anything for them. Exclusion is by name, at any depth, so
+ *  a name is only excluded if no kept field anywhere in the tree uses it.
+ */
+class Projection {
+public:
+    /*! @param tree Members of the root type, from fieldTree<T>()
+     *  @param fields Dot-separated paths to keep, like "replication" or
+     *      "subscriptions.msgBacklog". A path keeps everything below it.
+     *
+     *  Throws std::runtime_error if a path does not exist.
+     */
+    Projection(const std::vector<FieldNode>& tree, const std::vector<std::string>& fields);
+
+    // properties() points to excluded_
+    Projection(const Projection&) = delete;
+    Projection& operator = (const Projection&) = delete;
+
+    const std::set<std::string>& excluded() const noexcept {
+        return excluded_;
+    }
+
+    const restc_cpp::serialize_properties_t& properties() const noexcept {
+        return properties_;
+    }
+
+private:
+    std::set<std::string> excluded_;
+    restc_cpp::serialize_properties_t properties_;
+};
+
+} // ns
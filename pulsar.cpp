@@ -1,6 +1,12 @@
 
+#include <algorithm>
 #include <regex>
 #include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <thread>
 
 #include <boost/fusion/adapted.hpp>
 #include <boost/fusion/adapted/struct/define_struct.hpp>
@@ -12,6 +18,19 @@
 
 #include "pulsar.h"
 #include "pulsar_api.h"
+#include "scheduler.h"
+#include "delta.h"
+#include "projection.h"
+#include "metacache.h"
+#include "snapshot.h"
+#include "exporter.h"
+#include "validator.h"
+#include "sink.h"
+#include "codec.h"
+#include "rescan.h"
+#include "sample.h"
+#include "query.h"
+#include "brokers.h"
 
 using namespace std;
 using namespace std::string_literals;
@@ -21,92 +40,7 @@ namespace purech {
 
 Config Engine::config_;
 
-struct PrcCtx {
-    using io_buf_t = boost::asio::streambuf;
-    PrcCtx(boost::asio::io_context& ctx, const Config& cfg, const std::string& kubeFile)
-        : id{nextId++},
-          port(id + cfg.localPort),
-          name{std::filesystem::path{kubeFile}.filename()},
-          ctx{ctx},
-          aps{std::make_unique<boost::process::async_pipe>(ctx)},
-          ape{std::make_unique<boost::process::async_pipe>(ctx)} {}
-
-    const uint16_t id;
-    const uint16_t port;
-    const std::string name;
-    boost::asio::io_context& ctx;
-    std::unique_ptr<boost::process::async_pipe> aps;
-    std::unique_ptr<boost::process::async_pipe> ape;
-    std::unique_ptr<boost::process::child> child;
-    io_buf_t stdout;
-    io_buf_t stderr;
-    static uint16_t nextId;
-    std::promise<bool> started;
-    bool pending = true;
-};
-
-uint16_t PrcCtx::nextId = 0;
-
 namespace {
-void FetchProcessOutput(boost::process::async_pipe& ap,
-                        PrcCtx::io_buf_t& buf, PrcCtx& pctx, bool err) {
-    boost::asio::async_read_until(
-                ap, buf, '\n',
-                [&ap, &buf, &pctx, err](const boost::system::error_code& ec, std::size_t /*size*/) {
-        std::istream is(&buf);
-        std::string line;
-        std::getline(is, line);
-
-        if (err) {
-            LOG_ERROR << pctx.name << " proxy said: " << line;
-            if (pctx.pending) {
-                pctx.pending = false;
-                pctx.started.set_value(false);
-            }
-        } else {
-            LOG_DEBUG << pctx.name << " proxy said: " << line;
-        }
-
-        if (ec) {
-            LOG_ERROR << pctx.name << " IO error: " << ec.message();
-            if (pctx.pending) {
-                pctx.pending = false;
-                pctx.started.set_value(false);
-            }
-            return;
-        }
-
-        if (pctx.pending) {
-            pctx.pending = false;
-            pctx.started.set_value(line.find("Forwarding from") != string::npos);
-        }
-
-        FetchProcessOutput(ap, buf, pctx, err);
-    });
-}
-
-void SetupPortForwarding(const Engine::Cluster& cluster, PrcCtx& pctx) {
-    namespace bp = boost::process;
-    std::error_code ec;
-
-    std::ostringstream ports;
-    ports << pctx.port << ":8080";
-
-    LOG_DEBUG << "Starting port forwarding on " << ports.str() << " on " << cluster.origin;
-
-    pctx.child = make_unique<boost::process::child>(
-                bp::search_path("kubectl"), "--kubeconfig", cluster.origin, "-n", cluster.ns,
-                "port-forward", "svc/"s + cluster.svcName, ports.str(), bp::std_in.close(),
-                bp::std_out > *pctx.aps, bp::std_err > *pctx.ape, ec);
-
-    if (ec) {
-        LOG_ERROR << cluster.origin << ": Failed to launch port-forwarding: " << ec;
-        throw std::runtime_error("Failed to launch port-forwarding for: "s + cluster.origin);
-    }
-
-    FetchProcessOutput(*pctx.aps, pctx.stdout, pctx, false);
-    FetchProcessOutput(*pctx.ape, pctx.stderr, pctx, true);
-}
 
 string baseUrl(const Engine::Cluster& c) {
     ostringstream url;
@@ -123,6 +57,26 @@ string stripPersistent(const string& topic) {
   return topic;
 }
 
+void scale(Stats& stats, double factor) {
+    stats.msgRateIn *= factor;
+    stats.msgThroughputIn *= factor;
+    stats.msgRateOut *= factor;
+    stats.msgThroughputOut *= factor;
+}
+
+// "persistent://t/ns/topic" for "persistent://t/ns/topic-partition-3"
+optional<string> partitionedTopic(const string& topic) {
+    static const auto suffix = "-partition-"s;
+
+    const auto pos = topic.rfind(suffix);
+    if (pos == string::npos || pos + suffix.size() == topic.size()
+            || !all_of(topic.begin() + static_cast<ptrdiff_t>(pos + suffix.size()), topic.end(),
+                       [](char ch) { return ch >= '0' && ch <= '9'; })) {
+        return {};
+    }
+    return topic.substr(0, pos);
+}
+
 template <typename T>
 std::string strings(const T& list) {
     ostringstream out;
@@ -140,6 +94,118 @@ std::string strings(const T& list) {
     return out.str();
 }
 
+// The metadata cache keeps lists of strings
+const vector<string>& toList(const vector<string>& data) {
+    return data;
+}
+
+const vector<string>& toList(const NamespacePolicies& data) {
+    return data.replication_clusters;
+}
+
+void fromList(vector<string>&& list, vector<string>& data) {
+    data = move(list);
+}
+
+void fromList(vector<string>&& list, NamespacePolicies& data) {
+    data.replication_clusters = move(list);
+}
+
+const vector<string>& toList(const BundlesData& data) {
+    return data.boundaries;
+}
+
+void fromList(vector<string>&& list, BundlesData& data) {
+    data.boundaries = move(list);
+    data.numBundles = data.boundaries.empty() ? 0 : static_cast<int>(data.boundaries.size()) - 1;
+}
+
+// The connection failed, or broke while we read the reply
+bool transportError(const std::exception& ex) {
+    return dynamic_cast<const CommunicationException *>(&ex)
+            || dynamic_cast<const IoException *>(&ex)
+            || dynamic_cast<const boost::system::system_error *>(&ex);
+}
+
+// Reads a reply's body as it arrives, and decompresses it if the server
+// compressed it, so that the json parser can read it as a stream.
+class ReplyBody : public std::streambuf {
+public:
+    explicit ReplyBody(Reply& reply)
+        : reply_{reply} {
+        if (const auto header = reply_.GetHeader("Content-Encoding")) {
+            const auto encoding = contentEncoding(*header);
+            if (!encoding) {
+                throw runtime_error("Unsupported Content-Encoding: "s + *header);
+            }
+            if (*encoding != ContentEncoding::IDENTITY) {
+                inflater_.emplace(*encoding);
+            }
+        }
+    }
+
+    // Reads what the parser left, so that the connection can be reused
+    void drain() {
+        while (fill())
+            ;
+    }
+
+    uint64_t wireBytes() const noexcept {
+        return wireBytes_;
+    }
+
+    uint64_t bodyBytes() const noexcept {
+        return bodyBytes_;
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() == egptr() && !fill()) {
+            return traits_type::eof();
+        }
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    bool fill() {
+        decoded_.clear();
+        while (reply_.MoreDataToRead()) {
+            const auto chunk = reply_.GetSomeData();
+            const auto *data = boost::asio::buffer_cast<const char *>(chunk);
+            const auto size = boost::asio::buffer_size(chunk);
+            if (!size) {
+                continue;
+            }
+            wireBytes_ += size;
+
+            if (!inflater_) {
+                // The chunk is valid until the next read
+                auto *begin = const_cast<char *>(data);
+                setg(begin, begin, begin + size);
+                bodyBytes_ += size;
+                return true;
+            }
+
+            inflater_->decode({data, size}, decoded_);
+            if (!decoded_.empty()) {
+                setg(decoded_.data(), decoded_.data(), decoded_.data() + decoded_.size());
+                bodyBytes_ += decoded_.size();
+                return true;
+            }
+        }
+        if (inflater_ && !inflater_->done() && wireBytes_) {
+            throw IoException("The compressed reply was truncated");
+        }
+        return false;
+    }
+
+    Reply& reply_;
+    optional<Inflater> inflater_;
+    string decoded_;
+    uint64_t wireBytes_ = 0;
+    uint64_t bodyBytes_ = 0;
+};
+
 
 } // ans
 
@@ -148,154 +214,1846 @@ Engine::Engine(const Config &config)
     config_ = config;
 }
 
+Engine::~Engine() = default;
+
 void Engine::run()
 {
     prepare();
 
-    LOG_INFO << "Fetching information. This may take a little while...";
-    for (auto& [_, c] : clusters_) {
-        // Use one async co-routine for each cluster
-        client_->Process([cluster=c, this](Context &ctx) {
-            processCluster(*cluster, ctx);
+    // In watch mode, the clients and port-forwardings stay up between the scans
+    unique_ptr<DeltaTracker> deltas;
+    if (config_.watchInterval && !sink_) {
+        deltas = make_unique<DeltaTracker>(config_.watchMaxLines);
+    }
+
+    for(size_t iteration = 1;; ++iteration) {
+        const auto started = chrono::steady_clock::now();
+
+        if (config_.workers || !config_.merge.empty()) {
+            scanShards();
+        } else {
+            scan();
+        }
+
+        if (cache_) {
+            LOG_DEBUG << "Metadata cache: " << cache_->hits() << " hits, "
+                      << cache_->misses() << " misses.";
+            cache_->save();
+        }
+
+        if (profiler_) {
+            profiler_->mark("scan #"s + to_string(iteration), started, chrono::steady_clock::now());
+        }
+
+        if (!config_.snapshotFile.empty()) {
+            saveSnapshot();
+        }
+
+        if (exporter_) {
+            exporter_->update(clusterList());
+        }
+
+        if (iteration == 1 && config_.showSummary) {
+            simpleSummary();
+        }
+
+        if (config_.validate) {
+            validate();
+        }
+
+        // Workers leave the report to the coordinator
+        if (sampler_ && config_.shard.all()) {
+            sampleReport();
+        }
+
+        if (!queries_.empty() && config_.shard.all()) {
+            runQueries();
+        }
+
+        if (config_.brokers && config_.shard.all()) {
+            brokerReport();
+        }
+
+        if (!config_.watchInterval) {
+            break;
+        }
+
+        // In streaming mode there are no topic stats to compare
+        if (deltas) {
+            if (iteration > 1) {
+                cout << "Scan #" << iteration << endl;
+            }
+            for (const auto& [_, c] : clusters_) {
+                // Topics we did not get would look like they were deleted
+                if (const auto coverage = c->coverage(); coverage.state != Coverage::State::COMPLETE) {
+                    cout << "Cluster " << c->name << ": Incomplete scan (" << coverage.toString()
+                         << "). Not compared." << endl;
+                    continue;
+                }
+                deltas->update(*c, started, cout);
+            }
+            cout << endl;
+        }
+
+        if (config_.watchIterations && iteration >= config_.watchIterations) {
+            break;
+        }
+
+        this_thread::sleep_until(started + chrono::seconds{config_.watchInterval});
+    }
+
+    if (exporter_ && !config_.watchInterval) {
+        LOG_INFO << "Serving the results on port " << exporter_->port() << " until we are stopped.";
+        promise<void> stopped;
+        boost::asio::signal_set signals{client_->GetIoService(), SIGINT, SIGTERM};
+        signals.async_wait([&stopped](const boost::system::error_code&, int) {
+            stopped.set_value();
         });
+        stopped.get_future().wait();
+    }
+
+    if (exporter_) {
+        exporter_->stop();
+    }
+
+    if (forwarder_) {
+        forwarder_->stop();
     }
 
     client_->CloseWhenReady();
 
+    if (profiler_ && config_.profile) {
+        profiler_->report(cout);
+    }
+
+    if (profiler_ && !config_.traceFile.empty()) {
+        ofstream trace{config_.traceFile};
+        profiler_->writeTrace(trace);
+        if (!trace) {
+            LOG_ERROR << "Failed to write the trace to " << config_.traceFile;
+        } else {
+            LOG_INFO << "Wrote the trace to " << config_.traceFile;
+        }
+    }
+}
+
+void Engine::reset()
+{
+    for (auto& [_, c] : clusters_) {
+        if (c->rescan) {
+            // The idle topics are taken from the last scan
+            c->rescan->begin(move(c->store), move(c->tenants));
+            c->store = make_unique<TopicStore>(pool_);
+        }
+        c->clusters.clear();
+        c->tenants.clear();
+        c->stats = {};
+        c->shardGaps = 0;
+        c->strata.clear();
+        if (c->brokers) {
+            c->brokers->clear();
+        }
+        c->bulkHits = c->bulkMisses = 0;
+        c->store->clear();
+        c->listed = c->expired = false;
+    }
+}
+
+void Engine::scan()
+{
+    reset();
+
+    LOG_INFO << "Fetching information. This may take a little while...";
+    const auto started = chrono::steady_clock::now();
+    const uint64_t wireBytes = metrics_.wireBytes;
+    const uint64_t bodyBytes = metrics_.bodyBytes;
+    vector<pair<shared_ptr<Scheduler>, future<void>>> scans;
+    for (auto& [_, c] : clusters_) {
+        scans.emplace_back(scanCluster(c));
+    }
+
+    auto scan = scans.begin();
+    for (auto& [_, c] : clusters_) {
+        auto& [scheduler, done] = *scan++;
+        if (const auto deadline = this->deadline(*c, started);
+                deadline && done.wait_until(*deadline) == future_status::timeout) {
+            // The requests in flight are left to finish, but what they get
+            // is not used.
+            LOG_WARN << c->logName() << ": The deadline passed. Using what we have so far.";
+            c->expired = true;
+            scheduler->cancel();
+        }
+
+        try {
+            done.get();
+        } catch (const Scheduler::Fatal&) {
+            // Stop the other clusters too
+            for (auto& [other, _] : scans) {
+                other->cancel();
+            }
+            throw;
+        }
+    }
+
     // Process the information
     LOG_INFO << "Done fetching information.";
+    if (const auto body = metrics_.bodyBytes - bodyBytes; config_.compress && body) {
+        const auto wire = metrics_.wireBytes - wireBytes;
+        LOG_INFO << "Received " << wire << " bytes for " << body << " bytes of replies ("
+                 << fixed << setprecision(1) << (100.0 - 100.0 * static_cast<double>(wire) / static_cast<double>(body))
+                 << "% saved by compression).";
+    }
+
+    if (config_.bulkStats) {
+        for (auto& [_, c] : clusters_) {
+            LOG_INFO << c->logName() << ": Got stats for " << c->bulkHits
+                     << " topics from broker-stats and " << c->bulkMisses
+                     << " topics from per-topic requests.";
+            c->bulkStats.clear();
+        }
+    }
+
+    aggregateAll();
+
+    for (auto& [_, c] : clusters_) {
+        if (c->rescan) {
+            if (const auto reused = c->rescan->reused()) {
+                LOG_INFO << c->logName() << ": " << reused
+                         << " idle topics kept their stats from an earlier scan.";
+            }
+            c->rescan->end(*c->store);
+        }
+    }
+
+    if (sink_) {
+        sink_->flush();
+        LOG_INFO << "Streamed the stats for " << sink_->records() << " topics to " << config_.stream;
+    }
+}
+
+void Engine::scanShards()
+{
+    reset();
+
+    // Each snapshot is a shard. The workers are started with the same
+    // clusters as us, in the same order, so they agree on the names.
+    vector<optional<string>> snapshots;
+    if (coordinator_) {
+        const auto& options = coordinator_->options();
+        LOG_INFO << "Scanning with " << options.workers << " workers, sharded by "
+                 << Shard::toString(options.by) << ". This may take a little while...";
+        snapshots = coordinator_->run();
+    } else {
+        snapshots.assign(config_.merge.begin(), config_.merge.end());
+    }
+
+    for(size_t i = 0; i < snapshots.size(); ++i) {
+        if (snapshots[i]) {
+            try {
+                merge(Snapshot{*snapshots[i]});
+                continue;
+            } catch (const exception& ex) {
+                LOG_ERROR << "Failed to merge the snapshot " << *snapshots[i] << ": " << ex.what();
+            }
+        }
+
+        // We don't know what the shard had, so the clusters it had a part
+        // of are partial. A cluster that belongs to the shard alone is
+        // left missing.
+        for (auto& [_, c] : clusters_) {
+            if (!coordinator_ || coordinator_->options().by != Shard::By::CLUSTER) {
+                ++c->shardGaps;
+            }
+        }
+    }
+
+    aggregateAll();
+}
+
+void Engine::merge(const Snapshot &snapshot)
+{
+    for(const auto& from : snapshot.clusters()) {
+        const auto name = snapshot.str(from.name);
+        auto it = clusters_.find(name);
+        if (it == clusters_.end()) {
+            if (coordinator_) {
+                LOG_WARN << "Ignoring the unknown cluster " << name << " from a worker.";
+                continue;
+            }
+
+            // When merging snapshots from the command line, they name the clusters
+            auto cluster = make_shared<Cluster>();
+            cluster->name = name;
+            cluster->id = clusters_.size();
+            cluster->store = make_unique<TopicStore>(pool_);
+            it = clusters_.emplace(cluster->name, cluster).first;
+        }
+
+        auto& cluster = *it->second;
+        snapshot.load(from, cluster);
+
+        // A shard that did not get all its tenants or namespaces has no
+        // names for what is missing, so it's not in the tree.
+        if (from.state != static_cast<uint32_t>(Coverage::State::COMPLETE)) {
+            const auto ns = snapshot.namespaces(from);
+            if (all_of(ns.begin(), ns.end(), [](const auto& n) {
+                    return n.listed && n.fetchedTopics >= n.listedTopics;
+                })) {
+                ++cluster.shardGaps;
+            }
+        }
+    }
+}
+
+void Engine::aggregateAll()
+{
+    // The clusters are aggregated in parallel when we have threads for it
+    vector<future<void>> aggregations;
+    for (auto& [_, c] : clusters_) {
+        aggregations.emplace_back(async(config_.threads > 1 ? launch::async : launch::deferred,
+                                        [this, c=c.get()] {
+            aggregate(*c);
+        }));
+    }
 
-    simpleSummary();
+    for(auto& a : aggregations) {
+        a.get();
+    }
 }
 
 void Engine::prepare()
 {
-    client_ = RestClient::Create();
+    // Allow one connection per in-flight request. The client has one pool
+    // for all the clusters, so it's sized for the largest of them, and
+    // keeps idle connections as long as the cluster that keeps them longest.
+    Request::Properties properties;
+    properties.threads = max<size_t>(config_.threads, 1);
+    auto poolSize = config_.pool.size ? config_.pool.size : config_.maxInflight;
+    auto idleTimeout = config_.pool.idleTimeout;
+    for(const auto& [_, pool] : config_.clusterPools) {
+        poolSize = max(poolSize, pool.size ? pool.size : config_.maxInflight);
+        idleTimeout = max(idleTimeout, pool.idleTimeout);
+    }
+    const auto connections = static_cast<int>(min(poolSize, config_.maxInflight));
+    properties.cacheMaxConnectionsPerEndpoint = max(properties.cacheMaxConnectionsPerEndpoint, connections);
+    properties.cacheMaxConnections = max(properties.cacheMaxConnections,
+                                         connections * static_cast<int>(config_.clusters.size()));
+    properties.cacheTtlSeconds = static_cast<int>(idleTimeout);
+    if (config_.timeout) {
+        const auto timeout = static_cast<int>(config_.timeout * 1000);
+        properties.connectTimeoutMs = timeout;
+        properties.sendTimeoutMs = timeout;
+        properties.recvTimeout = timeout;
+    }
+    client_ = RestClient::Create(properties);
+
+    if (config_.profile || !config_.traceFile.empty()) {
+        profiler_ = make_unique<Profiler>(!config_.traceFile.empty());
+    }
+
+    if (!config_.listen.empty()) {
+        // Served from the REST client's threads
+        const auto listen = Exporter::Listen::parse(config_.listen);
+        exporter_ = make_unique<Exporter>(client_->GetIoService(), listen.address, listen.port);
+        exporter_->start();
+        const bool v6 = listen.address.find(':') != string::npos;
+        LOG_INFO << "Serving /metrics and /json on " << (v6 ? "[" : "") << listen.address << (v6 ? "]:" : ":")
+                 << exporter_->port();
+    }
+
+    if (!config_.stream.empty()) {
+        sink_ = TopicSink::create(config_.stream);
+    }
+
+    if (config_.sample > 0) {
+        Sampler::Options options;
+        options.fraction = config_.sample;
+        options.seed = config_.sampleSeed;
+        options.maxBacklog = config_.maxReplicationBacklog;
+        sampler_ = make_unique<Sampler>(options);
+    }
+
+    for(const auto& query : config_.queries) {
+        queries_.push_back(make_unique<Query>(Query::parse(query)));
+    }
+
+    if (!config_.topicFilter.empty() || !config_.include.empty() || !config_.exclude.empty()) {
+        auto include = config_.include;
+        if (!config_.topicFilter.empty()) {
+            include.push_back("re:"s + config_.topicFilter);
+        }
+        topicFilter_ = make_unique<TopicFilter>(include, config_.exclude);
+    }
+
+    if (!config_.fields.empty()) {
+        // The roll-ups always need the topic's rates
+        auto fields = config_.fields;
+        fields.insert(fields.end(), {"msgRateIn", "msgThroughputIn", "msgRateOut", "msgThroughputOut"});
+        projection_ = make_unique<Projection>(fieldTree<PersistentTopicStats>(), fields);
+        LOG_DEBUG << "Skipping these fields in the topic stats: " << strings(projection_->excluded());
+    }
 
+    if (config_.cache) {
+        MetadataCache::Options options;
+        for(const auto& [endpoint, seconds] : config_.cacheTtl) {
+            if (seconds) {
+                options.ttl[endpoint] = chrono::seconds{seconds};
+            } else {
+                options.ttl.erase(endpoint);
+            }
+        }
+        options.path = config_.cacheFile;
+        cache_ = make_unique<MetadataCache>(move(options));
+        cache_->load();
+        for(const auto endpoint : config_.invalidate) {
+            cache_->invalidate({}, endpoint);
+        }
+    }
+
+    // The clusters we reach through kubectl port-forward
+    vector<shared_ptr<Cluster>> forwarded;
+
+    size_t id = 0, position = 0;
     for(const auto& c : config_.clusters) {
+        if (!config_.shard.ownsCluster(position++)) {
+            continue;
+        }
+
         auto cluster = make_shared<Engine::Cluster>();
+        cluster->store = make_unique<TopicStore>(pool_);
+        cluster->id = id++;
 
         static const regex urlPattern{R"(^https?://.+)", std::regex_constants::icase};
 
         if (regex_match(c, urlPattern)) {
             cluster->setUrl(c);
         } else if (cluster->setKubeconfig(c) ; filesystem::is_regular_file(cluster->origin)) {
-            auto pfw = make_shared<PrcCtx>(client_->GetIoService(), config_, cluster->origin);
-            SetupPortForwarding(*cluster, *pfw);
-            cluster->url = "http://127.0.0.1:"s + to_string(pfw->port);
-            processes_.emplace_back(move(pfw));
-            clusters_.emplace(cluster->name, cluster);
+            forwarded.push_back(cluster);
         } else {
             LOG_ERROR << "I don't know what '" << c << "' is. "
             << "I expected a URL or a kubeconfig file!";
             throw runtime_error("Unknown origin");
         }
-    }
 
-    // Wait for the port-forwarding to start...
-    for (auto& pctx : processes_) {
-        if (!pctx->started.get_future().get()) {
-            LOG_ERROR << "Failed to start port-forwarding for " << pctx->name;
-            throw std::runtime_error("Failed to start port-forwarding for: "s + pctx->name);
+        if (config_.incremental) {
+            Rescan::Options options;
+            options.idleScans = config_.idleScans;
+            cluster->rescan = make_shared<Rescan>(pool_, options);
         }
-    }
-}
 
-void Engine::processCluster(Engine::Cluster &cluster, Context &ctx)
-{
-    unique_ptr<regex> tfilter;
-    if (!config_.topicFilter.empty()) {
-      tfilter = make_unique<regex>(config_.topicFilter);
+        if (config_.brokers) {
+            BrokerMap::Options options;
+            options.maxSkew = config_.maxBrokerSkew;
+            options.maxLines = config_.watchMaxLines;
+            cluster->brokers = make_shared<BrokerMap>(options);
+        }
+
+        Governor::Options governor;
+        governor.name = cluster->name;
+        governor.rate = config_.rate;
+        governor.targetLatency = chrono::milliseconds{config_.targetLatency};
+        cluster->governor = make_shared<Governor>(governor);
+
+        if (profiler_) {
+            profiler_->addCluster(cluster->name);
+        }
+        clusters_.emplace(cluster->name, cluster);
     }
 
-    // Figure out the local cluster name
-    if (cluster.name.empty()) {
-        LOG_ERROR << cluster.origin << " No local cluster-name provided.";
-        throw runtime_error("Unable to determine local cluster-name");
+    if (config_.workers) {
+        // The workers scan, and each has its own port-forwardings
+        ShardCoordinator::Options options;
+        options.workers = config_.workers;
+        options.by = config_.shard.by;
+        options.command = config_.commandLine;
+        coordinator_ = make_unique<ShardCoordinator>(move(options));
+        return;
     }
 
-    // Get cluster names
-    SerializeFromJson(cluster.clusters,
-                      RequestBuilder(ctx).Get(baseUrl(cluster) + "/clusters").Execute());
+    if (!forwarded.empty()) {
+        setupForwarding(forwarded);
+    }
+}
 
-    // Check that our name is there
+void Engine::setupForwarding(const vector<shared_ptr<Cluster>>& clusters)
+{
+    // All the port-forwardings start at once, and share one timeout
+    const auto started = chrono::steady_clock::now();
+    const auto deadline = started + chrono::seconds{config_.forwardTimeout};
+
+    // Looking up the pods also takes a kubectl round-trip per cluster
+    vector<future<vector<ForwardSpec>>> lookups;
+    for(const auto& c : clusters) {
+        lookups.emplace_back(async(launch::async, [this, c] {
+            return forwardSpecs(*c);
+        }));
+    }
 
-    // Get tenants
-    vector<string> tenants;
-    SerializeFromJson(tenants, RequestBuilder(ctx).Get(baseUrl(cluster) + "/tenants").Execute());
+    vector<ForwardSpec> specs;
+    vector<size_t> owners; // Index in clusters for each spec
+    for(size_t i = 0; i < lookups.size(); ++i) {
+        for(auto& spec : lookups[i].get()) {
+            specs.emplace_back(move(spec));
+            owners.push_back(i);
+        }
+    }
 
-    // Get everything
-    for (const auto& tenant : tenants) {
-        const auto tnurl = baseUrl(cluster) + "/namespaces/" + tenant;
-        vector<string> namespaces;
-        try {
-            SerializeFromJson(
-                        namespaces,
-                        RequestBuilder(ctx).Get(tnurl).Execute());
-        } catch (const std::exception& ex) {
-            LOG_WARN << cluster.logName() << ": Failed to access " << tnurl;
-            continue;
+    vector<optional<uint16_t>> ports;
+    if (!config_.agentSocket.empty()) {
+        if (auto fromAgent = ForwardAgent::request(config_.agentSocket, specs, deadline)) {
+            LOG_INFO << "Using the port-forwardings from the agent on " << config_.agentSocket;
+            ports = move(*fromAgent);
+            if (profiler_) {
+                profiler_->mark("port-forwarding via agent", started, chrono::steady_clock::now());
+            }
         }
+    }
 
-        for (const auto& ns : namespaces) {
-            // ns contains "tenant/ns"
+    if (ports.empty()) {
+        forwarder_ = Forwarder::Create(client_->GetIoService(), config_.kubectl, config_.localPort);
+
+        // The port, or 0, and when the tunnel was ready
+        using result_t = pair<uint16_t, chrono::steady_clock::time_point>;
+        vector<future<result_t>> pending;
+        for(const auto& spec : specs) {
+            auto promise = make_shared<std::promise<result_t>>();
+            pending.emplace_back(promise->get_future());
+            forwarder_->get(spec, [promise](bool ok, uint16_t port) {
+                promise->set_value({ok ? port : 0, chrono::steady_clock::now()});
+            });
+        }
 
-            const auto nspurl = baseUrl(cluster) + "/namespaces/" + ns;
-            try {
-                SerializeFromJson(
-                            cluster.tenants[tenant].namespaces[ns].policies,
-                            RequestBuilder(ctx).Get(nspurl).Execute());
-            } catch (const std::exception& ex) {
-                LOG_WARN << cluster.logName() << ": Failed to access " << nspurl;
-                continue;
+        for(size_t i = 0; i < pending.size(); ++i) {
+            result_t result{0, deadline};
+            if (pending[i].wait_until(deadline) == future_status::ready) {
+                result = pending[i].get();
             }
 
-            const auto nsurl = baseUrl(cluster) + "/persistent/" + ns;
-            vector<string> topics;
-            try {
-                SerializeFromJson(
-                            topics, RequestBuilder(ctx).Get(nsurl).Execute());
-            } catch (const std::exception& ex) {
-                LOG_WARN << cluster.logName() << ": Failed to access " << nsurl;
-                continue;
+            if (profiler_) {
+                Profiler::Sample sample;
+                sample.cluster = clusters[owners[i]]->id;
+                sample.endpoint = Endpoint::PORT_FORWARD;
+                sample.start = started;
+                sample.received = sample.done = result.second;
+                sample.failed = result.first == 0;
+                profiler_->record(sample, specs[i].key());
             }
 
-            for (const auto& topic : topics) {
-                if (tfilter && !std::regex_search(topic, *tfilter)) {
-                    continue;
-                }
-
-                const auto sturl = baseUrl(cluster) + "/persistent/" + stripPersistent(topic) + "/stats";
-                try {
-                    SerializeFromJson(cluster.tenants[tenant].namespaces[ns].topics[topic],
-                            RequestBuilder(ctx)
-                            .Get(sturl)
-                            .Execute());
-                } catch (const std::exception& ex) {
-                    LOG_WARN << cluster.logName() << ": Failed to access " << sturl;
-                    continue;
-                }
-
-                LOG_DEBUG << cluster.logName() << ": Got stats from topic " << topic;
+            ports.emplace_back(result.first ? optional<uint16_t>{result.first} : nullopt);
+        }
 
-                const Stats st = cluster.tenants[tenant].namespaces[ns].topics[topic];
-                cluster.tenants[tenant].namespaces[ns].stats += st;
-                cluster.tenants[tenant].stats += st;
-                cluster.stats += st;
-            }
+        if (config_.watchInterval || specs.size() > clusters.size()) {
+            // Broken tunnels are restarted on the same local ports
+            forwarder_->startHealthChecks(chrono::seconds{config_.healthInterval});
         }
     }
-}
 
-void Engine::simpleSummary()
+    vector<vector<string>> urls(clusters.size());
+    for(size_t i = 0; i < specs.size(); ++i) {
+        if (ports[i]) {
+            urls[owners[i]].emplace_back("http://127.0.0.1:"s + to_string(*ports[i]));
+        } else {
+            LOG_WARN << "Failed to start port-forwarding for " << specs[i].key();
+        }
+    }
+
+    string failed;
+    for(size_t i = 0; i < clusters.size(); ++i) {
+        auto& cluster = *clusters[i];
+        if (urls[i].empty()) {
+            LOG_ERROR << "Failed to start port-forwarding for " << cluster.origin;
+            failed += (failed.empty() ? ""s : " "s) + cluster.origin;
+            continue;
+        }
+
+        cluster.url = urls[i].front();
+        if (urls[i].size() > 1) {
+            LOG_DEBUG << cluster.logName() << ": Spreading the requests over "
+                      << urls[i].size() << " port-forwardings.";
+            cluster.balancer = make_shared<Balancer>(move(urls[i]));
+        }
+    }
+
+    if (!failed.empty()) {
+        throw std::runtime_error("Failed to start port-forwarding for: "s + failed);
+    }
+
+    LOG_DEBUG << "Port-forwarding for " << clusters.size() << " cluster(s) was ready after "
+              << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count()
+              << " ms.";
+}
+
+vector<ForwardSpec> Engine::forwardSpecs(const Engine::Cluster &cluster) const
+{
+    vector<ForwardSpec> specs;
+    const auto service = cluster.forwardSpec();
+
+    if (config_.forwardPods) {
+        for(const auto& pod : Forwarder::pods(config_.kubectl, service)) {
+            specs.push_back({service.kubeconfig, service.ns, "pod/"s + pod});
+        }
+
+        if (specs.empty()) {
+            LOG_WARN << cluster.logName() << ": Found no pods for " << service.service
+                     << ". Forwarding to the service instead.";
+        }
+    }
+
+    if (specs.empty()) {
+        const auto count = config_.forwardPods ? 1 : max<size_t>(config_.forwards, 1);
+        for(size_t i = 0; i < count; ++i) {
+            auto spec = service;
+            spec.instance = static_cast<unsigned>(i);
+            specs.push_back(move(spec));
+        }
+    }
+
+    return specs;
+}
+
+void Engine::runAgent()
+{
+    boost::asio::io_context ctx;
+    auto forwarder = Forwarder::Create(ctx, config_.kubectl, config_.localPort);
+    forwarder->startHealthChecks(chrono::seconds{config_.healthInterval});
+
+    ForwardAgent agent{ctx, forwarder, config_.agentSocket.empty()
+                ? ForwardAgent::defaultSocketPath() : config_.agentSocket};
+    agent.start();
+
+    // Warm up the tunnels we already know about
+    for(const auto& c : config_.clusters) {
+        Cluster cluster;
+        cluster.setKubeconfig(c);
+        if (!filesystem::is_regular_file(cluster.origin)) {
+            LOG_WARN << "Ignoring '" << c << "'. The agent only handles kubeconfig files.";
+            continue;
+        }
+
+        for(const auto& spec : forwardSpecs(cluster)) {
+            forwarder->get(spec, [key=spec.key()](bool ok, uint16_t port) {
+                if (ok) {
+                    LOG_INFO << key << ": Forwarding from port " << port;
+                } else {
+                    LOG_WARN << key << ": Port-forwarding failed. Will retry.";
+                }
+            });
+        }
+    }
+
+    boost::asio::signal_set signals{ctx, SIGINT, SIGTERM};
+    signals.async_wait([&](const boost::system::error_code&, int) {
+        LOG_INFO << "Stopping the forwarding agent.";
+        forwarder->stop();
+        boost::asio::post(ctx, [&ctx] {
+            ctx.stop();
+        });
+    });
+
+    ctx.run();
+}
+
+template <typename T>
+void Engine::fetch(const Cluster& cluster, Scheduler& scheduler, Endpoint endpoint, const string &url,
+                   T &data, Context &ctx, const serialize_properties_t& properties)
+{
+    // With several port-forwardings, send the request through the least
+    // busy one, and try the others if that one is broken.
+    const bool balanced = cluster.balancer && url.compare(0, cluster.url.size(), cluster.url) == 0;
+    const auto path = balanced ? url.substr(cluster.url.size()) : string{};
+    const auto attempts = 1 + max(config_.retries, balanced ? cluster.balancer->size() - 1 : 0);
+
+    for(size_t attempt = 1;; ++attempt) {
+        if (scheduler.cancelled()) {
+            // Don't spend more time on a scan that is over
+            throw runtime_error("The deadline passed");
+        }
+
+        optional<Balancer::Lease> lease;
+        if (balanced) {
+            lease.emplace(cluster.balancer->acquire());
+        }
+
+        cluster.governor->acquire(ctx);
+        const auto& target = lease ? lease->url() + path : url;
+        try {
+            fetchOnce(cluster, scheduler, endpoint, target, data, ctx, properties);
+            return;
+        } catch (const RequestFailedWithErrorException& ex) {
+            const auto status = ex.http_response.status_code;
+            if (status == 429 || status == 503) {
+                cluster.governor->overloaded();
+            }
+            if (!Governor::retryable(status) || attempt >= attempts) {
+                throw;
+            }
+            LOG_DEBUG << cluster.logName() << ": Retrying " << url << " after HTTP status " << status;
+        } catch (const RequestTimeOutException&) {
+            cluster.governor->overloaded();
+            if (attempt >= attempts) {
+                throw;
+            }
+            LOG_DEBUG << cluster.logName() << ": Retrying " << url << " after a timeout";
+        } catch (const std::exception& ex) {
+            // Only a broken connection is worth another try, and says that
+            // the port-forwarding is broken. A reply we could not parse came
+            // through it just fine, and would fail the same way again.
+            if (!transportError(ex)) {
+                throw;
+            }
+            if (lease) {
+                lease->failed();
+            }
+            if (attempt >= attempts) {
+                throw;
+            }
+            LOG_DEBUG << cluster.logName() << ": Retrying " << url << " after "
+                      << target << " failed: " << ex.what();
+        }
+
+        data = {};
+        ++metrics_.retries;
+        lease.reset();
+        cluster.governor->backoff(attempt, ctx);
+    }
+}
+
+template <typename T>
+void Engine::fetchTopicStats(const Cluster &cluster, Scheduler &scheduler, Endpoint endpoint, const string &ns,
+                             const string &topic, const string &path, T &data, Context &ctx)
+{
+    // Straight to the broker that owns the topic, rather than to one that
+    // would have to redirect us
+    if (config_.routeToOwner) {
+        if (const auto owner = cluster.brokers->route(ns, topic); !owner.empty()) {
+            try {
+                fetch(cluster, scheduler, endpoint, "http://"s + owner + "/admin/v2" + path, data, ctx, topicProperties());
+                return;
+            } catch (const RequestFailedWithErrorException&) {
+                throw;
+            } catch (const std::exception& ex) {
+                if (scheduler.cancelled()) {
+                    throw;
+                }
+                LOG_DEBUG << cluster.logName() << ": Failed to reach broker " << owner << ": "
+                          << ex.what() << ". Sending its requests to " << baseUrl(cluster) << " instead.";
+                if (auto guard = scheduler.guard()) {
+                    cluster.brokers->unreachable(owner);
+                }
+                data = {};
+            }
+        }
+    }
+
+    fetch(cluster, scheduler, endpoint, baseUrl(cluster) + path, data, ctx, topicProperties());
+}
+
+template <typename T>
+void Engine::fetchMetadata(const Cluster &cluster, Scheduler &scheduler, Endpoint endpoint,
+                           const string &path, T &data, Context &ctx)
+{
+    if (cache_) {
+        if (auto list = cache_->get(cluster.cacheKey(), endpoint, path)) {
+            fromList(move(*list), data);
+            return;
+        }
+    }
+
+    fetch(cluster, scheduler, endpoint, baseUrl(cluster) + path, data, ctx);
+
+    if (cache_) {
+        if (auto guard = scheduler.guard()) {
+            cache_->put(cluster.cacheKey(), endpoint, path, toList(data));
+        }
+    }
+}
+
+template <typename T>
+void Engine::fetchOnce(const Cluster& cluster, Scheduler& scheduler, Endpoint endpoint, const string &url,
+                       T &data, Context &ctx, const serialize_properties_t& properties)
+{
+    Profiler::Sample sample;
+    sample.cluster = cluster.id;
+    sample.endpoint = endpoint;
+    sample.start = chrono::steady_clock::now();
+    const auto start = sample.start;
+    ++metrics_.requests;
+    try {
+        const auto hedgeDelay = config_.hedge ? cluster.governor->hedgeDelay() : chrono::microseconds{};
+        if (hedgeDelay.count() || profiler_) {
+            // Receive the whole body before parsing it, so that the time
+            // spent on the network and in the parser can be told apart.
+            const auto body = hedgeDelay.count()
+                    ? fetchHedged(cluster, scheduler, url, hedgeDelay, ctx)
+                    : readBody(*get(url, ctx));
+            sample.received = chrono::steady_clock::now();
+            sample.bytes = body.json.size();
+            sample.wireBytes = body.wireBytes;
+            istringstream in{body.json};
+            SerializeFromJson(data, in, properties);
+            sample.done = chrono::steady_clock::now();
+            if (profiler_) {
+                profiler_->record(sample, url);
+            }
+            metrics_.wireBytes += body.wireBytes;
+            metrics_.bodyBytes += body.json.size();
+        } else {
+            auto reply = get(url, ctx);
+            ReplyBody body{*reply};
+            istream in{&body};
+            // So that a truncated body fails with its own error, and not as bad json
+            in.exceptions(istream::badbit);
+            SerializeFromJson(data, in, properties);
+            body.drain();
+            metrics_.wireBytes += body.wireBytes();
+            metrics_.bodyBytes += body.bodyBytes();
+        }
+    } catch (...) {
+        ++metrics_.failures;
+        if (profiler_) {
+            sample.failed = true;
+            sample.received = sample.done = chrono::steady_clock::now();
+            profiler_->record(sample, url);
+        }
+        throw;
+    }
+
+    const auto latency = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+    metrics_.latency.record(static_cast<uint64_t>(latency.count()));
+    cluster.governor->succeeded(latency);
+}
+
+// Sends the request, and one more if the first is not done after `delay`.
+// Returns the body from the first one that succeeds. The requests run in
+// their own co-routines, which may be on other threads. The first one
+// stands in for the caller, who just waits. The hedge takes a free slot
+// in the scheduler, so it counts against the requests in flight.
+// The caller sleeps until one of them is done, or it's time to hedge.
+Engine::Body Engine::fetchHedged(const Cluster &cluster, Scheduler &scheduler, const string &url,
+                                 chrono::microseconds delay, Context &ctx)
+{
+    using wake_t = boost::asio::async_completion<boost::asio::yield_context, void()>::completion_handler_type;
+
+    struct Race {
+        std::mutex mutex;
+        bool done = false;
+        size_t running = 0;
+        Body body;
+        exception_ptr error;
+        optional<wake_t> wake; // Resumes the caller, who is waiting for it
+
+        // Must be called with the mutex locked
+        void wakeUp() {
+            if (wake) {
+                // The handler resumes the caller on its own strand
+                boost::asio::post(move(*wake));
+                wake.reset();
+            }
+        }
+    };
+
+    auto race = make_shared<Race>();
+    auto request = [this, race, url](Context& ctx) {
+        try {
+            auto body = readBody(*get(url, ctx));
+            lock_guard lock{race->mutex};
+            --race->running;
+            if (!race->done) {
+                race->done = true;
+                race->error = {};
+                race->body = move(body);
+                race->wakeUp();
+            }
+        } catch (...) {
+            lock_guard lock{race->mutex};
+            if (!race->error) {
+                race->error = current_exception();
+            }
+            if (--race->running == 0 && !race->done) {
+                race->done = true;
+                race->wakeUp();
+            }
+        }
+    };
+
+    race->running = 1;
+    client_->Process(request);
+
+    const auto hedgeAt = chrono::steady_clock::now() + delay;
+    for(bool hedged = false;;) {
+        boost::asio::steady_timer timer{ctx.GetClient().GetIoService()};
+        // The token is a reference, so that the context's yield is copied, not moved from
+        boost::asio::async_completion<boost::asio::yield_context&, void()> wait{ctx.GetYield()};
+        {
+            lock_guard lock{race->mutex};
+            if (race->done) {
+                if (race->error) {
+                    rethrow_exception(race->error);
+                }
+                return move(race->body);
+            }
+            race->wake.emplace(move(wait.completion_handler));
+        }
+
+        if (!hedged) {
+            timer.expires_at(hedgeAt);
+            timer.async_wait([race](const boost::system::error_code& ec) {
+                if (ec != boost::asio::error::operation_aborted) {
+                    lock_guard lock{race->mutex};
+                    race->wakeUp();
+                }
+            });
+        }
+        wait.result.get();
+
+        if (!hedged && chrono::steady_clock::now() >= hedgeAt) {
+            // Once. If there is no token or slot for it now, we don't hedge.
+            hedged = true;
+            if (scheduler.cancelled() || !cluster.governor->tryAcquire()) {
+                continue;
+            }
+            {
+                lock_guard lock{race->mutex};
+                if (race->done) {
+                    continue;
+                }
+                ++race->running;
+            }
+            if (scheduler.tryRun(request)) {
+                ++metrics_.requests;
+                ++metrics_.hedges;
+                LOG_TRACE << cluster.logName() << ": Hedging " << url;
+            } else {
+                lock_guard lock{race->mutex};
+                if (--race->running == 0) {
+                    // The first one failed meanwhile
+                    race->done = true;
+                }
+            }
+        }
+    }
+}
+
+unique_ptr<Reply> Engine::get(const string &url, Context &ctx) const
+{
+    RequestBuilder builder{ctx};
+    builder.Get(url);
+    if (config_.compress) {
+        builder.Header("Accept-Encoding", string{acceptEncoding});
+    }
+    return builder.Execute();
+}
+
+Engine::Body Engine::readBody(Reply &reply)
+{
+    ReplyBody body{reply};
+    Body rval;
+    rval.json.assign(istreambuf_iterator<char>{&body}, istreambuf_iterator<char>{});
+    rval.wireBytes = body.wireBytes();
+    return rval;
+}
+
+void Engine::warmUp(const Cluster &cluster, Context &ctx)
+{
+    // A small request, so that the connection is open and back in the
+    // pool when the scan needs it
+    optional<Balancer::Lease> lease;
+    if (cluster.balancer) {
+        lease.emplace(cluster.balancer->acquire());
+    }
+
+    const auto url = (lease ? lease->url() : cluster.url) + "/admin/v2/clusters";
+    try {
+        ReplyBody{*get(url, ctx)}.drain();
+    } catch (const std::exception& ex) {
+        LOG_DEBUG << cluster.logName() << ": Failed to warm up a connection to " << url << ": " << ex.what();
+    }
+}
+
+const PoolConfig &Engine::pool(const Cluster &cluster) const
+{
+    if (auto it = config_.clusterPools.find(cluster.name); it != config_.clusterPools.end()) {
+        return it->second;
+    }
+    return config_.pool;
+}
+
+const serialize_properties_t &Engine::topicProperties() const
+{
+    static const serialize_properties_t all;
+    return projection_ ? projection_->properties() : all;
+}
+
+optional<chrono::steady_clock::time_point>
+Engine::deadline(const Cluster &cluster, chrono::steady_clock::time_point started) const
+{
+    auto seconds = config_.deadline;
+    if (auto it = config_.clusterDeadlines.find(cluster.name); it != config_.clusterDeadlines.end()) {
+        seconds = it->second;
+    }
+
+    if (!seconds) {
+        return {};
+    }
+    return started + chrono::seconds{seconds};
+}
+
+pair<shared_ptr<Scheduler>, future<void>> Engine::scanCluster(const std::shared_ptr<Engine::Cluster>& cluster)
+{
+    // Each cluster gets its own work-queue, so that the number of
+    // concurrent requests is bounded per cluster. A cluster with a smaller
+    // connection pool gets fewer, so that its connections are reused.
+    const auto& pool = this->pool(*cluster);
+    const auto inflight = pool.size ? min(pool.size, config_.maxInflight) : config_.maxInflight;
+    auto scheduler = Scheduler::Create(*client_, inflight);
+    auto done = scheduler->done();
+    for(size_t i = 0; i < min(pool.warmup, inflight); ++i) {
+        scheduler->add([this, cluster](Context& ctx) {
+            warmUp(*cluster, ctx);
+        });
+    }
+    scheduler->add([this, cluster, &scheduler=*scheduler](Context& ctx) {
+        processCluster(*cluster, scheduler, ctx);
+    });
+
+    return {move(scheduler), move(done)};
+}
+
+void Engine::processCluster(Engine::Cluster &cluster, Scheduler& scheduler, Context &ctx)
+{
+    // Figure out the local cluster name
+    if (cluster.name.empty()) {
+        LOG_ERROR << cluster.origin << " No local cluster-name provided.";
+        throw runtime_error("Unable to determine local cluster-name");
+    }
+
+    // Get cluster names
+    vector<string> clusters;
+    fetchMetadata(cluster, scheduler, Endpoint::CLUSTERS, "/clusters", clusters, ctx);
+
+    // Check that our name is there
+
+    // Get tenants
+    vector<string> tenants;
+    fetchMetadata(cluster, scheduler, Endpoint::TENANTS, "/tenants", tenants, ctx);
+
+    auto guard = scheduler.guard();
+    if (!guard) {
+        return;
+    }
+    cluster.clusters = move(clusters);
+    cluster.listed = true;
+
+    if (cluster.brokers) {
+        // The tenants are processed when we know who owns the bundles
+        guard.unlock();
+        processOwnership(cluster, scheduler, move(tenants), ctx);
+        return;
+    }
+
+    if (config_.bulkStats) {
+        // The tenants are processed when the bulk stats are in place
+        guard.unlock();
+        processBrokers(cluster, scheduler, move(tenants), ctx);
+        return;
+    }
+
+    addTenants(cluster, scheduler, tenants);
+}
+
+// Must be called with the scheduler's guard held
+void Engine::addTenants(Engine::Cluster &cluster, Scheduler &scheduler,
+                        const vector<string> &tenants)
+{
+    for (const auto& tenant : tenants) {
+        if (topicFilter_ && topicFilter_->scope(tenant + '/') == TopicFilter::Scope::NONE) {
+            LOG_DEBUG << cluster.logName() << ": The topic filter skips tenant " << tenant;
+            continue;
+        }
+
+        if (!config_.shard.ownsTenant(tenant)) {
+            continue;
+        }
+
+        {
+            // Known, so that it's reported as missing if we don't get it
+            lock_guard lock{cluster.mutex};
+            cluster.tenants[tenant];
+        }
+
+        scheduler.add([this, &cluster, &scheduler, tenant](Context& ctx) {
+            processTenant(cluster, scheduler, tenant, ctx);
+        });
+    }
+}
+
+void Engine::processBrokers(Engine::Cluster &cluster, Scheduler &scheduler,
+                            vector<string> tenants, Context &ctx)
+{
+    // Ask the broker we are connected to for the stats of the topics it
+    // owns. With --direct-brokers, ask every broker in the cluster too, at
+    // its own address. A port-forwarding only gets us to the service.
+    vector<string> urls{baseUrl(cluster)};
+
+    vector<string> brokers;
+    if (config_.directBrokers && !cluster.portForwarded()) {
+        if (cluster.brokers) {
+            // Listed for the bundle ownership
+            brokers = cluster.brokers->brokers();
+        } else {
+            const auto brurl = baseUrl(cluster) + "/brokers/" + cluster.name;
+            try {
+                fetch(cluster, scheduler, Endpoint::BROKERS, brurl, brokers, ctx);
+            } catch (const std::exception& ex) {
+                LOG_WARN << cluster.logName() << ": Failed to access " << brurl;
+            }
+        }
+    }
+
+    for(const auto& broker : brokers) {
+        urls.emplace_back("http://"s + broker + "/admin/v2");
+    }
+
+    struct Pending {
+        atomic<size_t> count = 0;
+        vector<string> tenants;
+    };
+
+    auto pending = make_shared<Pending>();
+    pending->count = urls.size();
+    pending->tenants = move(tenants);
+
+    for(const auto& url : urls) {
+        scheduler.add([this, &cluster, &scheduler, pending, url](Context& ctx) {
+            const auto bsurl = url + "/broker-stats/topics";
+            BrokerTopicStats bstats;
+            try {
+                fetch(cluster, scheduler, Endpoint::BROKER_STATS, bsurl, bstats, ctx, topicProperties());
+            } catch (const std::exception& ex) {
+                LOG_DEBUG << cluster.logName() << ": Failed to access " << bsurl
+                          << ": " << ex.what();
+            }
+
+            if (topicFilter_) {
+                // Don't keep stats that we will not use
+                for(auto& [ns, bundles] : bstats) {
+                    for(auto& [_, domains] : bundles) {
+                        if (auto it = domains.find("persistent"); it != domains.end()) {
+                            auto& topics = it->second;
+                            for(auto t = topics.begin(); t != topics.end();) {
+                                // A partition is selected by its partitioned topic
+                                const auto parent = partitionedTopic(t->first);
+                                if (topicFilter_->matches(stripPersistent(t->first))
+                                        || (parent && topicFilter_->matches(stripPersistent(*parent)))) {
+                                    ++t;
+                                } else {
+                                    t = topics.erase(t);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            auto guard = scheduler.guard();
+            if (!guard) {
+                return;
+            }
+
+            {
+                lock_guard lock{cluster.mutex};
+                for(auto& [ns, bundles] : bstats) {
+                    for(auto& [_, domains] : bundles) {
+                        if (auto it = domains.find("persistent"); it != domains.end()) {
+                            for(auto& [topic, stats] : it->second) {
+                                cluster.bulkStats[ns][topic] = move(stats);
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (--pending->count == 0) {
+                addTenants(cluster, scheduler, pending->tenants);
+            }
+        });
+    }
+}
+
+void Engine::processOwnership(Engine::Cluster &cluster, Scheduler &scheduler,
+                              vector<string> tenants, Context &ctx)
+{
+    // Then on to the bulk stats or the tenants, like processCluster()
+    auto proceed = [this, &cluster, &scheduler](vector<string> tenants, Context& ctx) {
+        if (config_.bulkStats) {
+            processBrokers(cluster, scheduler, move(tenants), ctx);
+            return;
+        }
+        auto guard = scheduler.guard();
+        if (guard) {
+            addTenants(cluster, scheduler, tenants);
+        }
+    };
+
+    const auto brurl = baseUrl(cluster) + "/brokers/" + cluster.name;
+    vector<string> brokers;
+    try {
+        fetch(cluster, scheduler, Endpoint::BROKERS, brurl, brokers, ctx);
+    } catch (const std::exception& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << brurl;
+    }
+
+    if (auto guard = scheduler.guard()) {
+        cluster.brokers->setBrokers(brokers);
+    } else {
+        return;
+    }
+
+    if (brokers.empty()) {
+        proceed(move(tenants), ctx);
+        return;
+    }
+
+    if (cluster.portForwarded()) {
+        // A broker answers ownedNamespaces for another broker with a
+        // redirect to it, which we can't follow through a port-forwarding.
+        // The owners are looked up per bundle instead, by lookupOwners(),
+        // and we have no load reports.
+        if (auto guard = scheduler.guard()) {
+            for(const auto& broker : brokers) {
+                cluster.brokers->unreachable(broker);
+            }
+        } else {
+            return;
+        }
+        proceed(move(tenants), ctx);
+        return;
+    }
+
+    struct Pending {
+        atomic<size_t> count = 0;
+        vector<string> tenants;
+    };
+
+    auto pending = make_shared<Pending>();
+    pending->count = brokers.size();
+    pending->tenants = move(tenants);
+
+    for(const auto& broker : brokers) {
+        scheduler.add([this, &cluster, &scheduler, pending, proceed, broker](Context& ctx) {
+            // Each broker only answers for itself. The cluster's url may
+            // get us another broker, which would redirect us, so we ask
+            // the broker directly, and only use the cluster's url if we
+            // can't reach it.
+            const auto direct = "http://"s + broker + "/admin/v2";
+            const auto path = "/brokers/" + cluster.name + '/' + broker + "/ownedNamespaces";
+            OwnedBundles owned;
+            bool reachable = true;
+            try {
+                fetch(cluster, scheduler, Endpoint::OWNED_BUNDLES, direct + path, owned, ctx);
+            } catch (const RequestFailedWithErrorException& ex) {
+                LOG_WARN << cluster.logName() << ": Failed to access " << direct + path;
+            } catch (const std::exception& ex) {
+                LOG_DEBUG << cluster.logName() << ": Failed to reach broker " << broker << ": "
+                          << ex.what() << ". Asking " << baseUrl(cluster) << " instead.";
+                reachable = false;
+                owned = {};
+            }
+            if (!reachable) {
+                try {
+                    fetch(cluster, scheduler, Endpoint::OWNED_BUNDLES, baseUrl(cluster) + path, owned, ctx);
+                } catch (const std::exception& ex) {
+                    LOG_WARN << cluster.logName() << ": Failed to access " << baseUrl(cluster) + path;
+                }
+            }
+
+            // Any broker answers this one, so it must be asked directly
+            optional<LoadReport> load;
+            if (reachable) {
+                const auto lrurl = direct + "/broker-stats/load-report";
+                try {
+                    fetch(cluster, scheduler, Endpoint::LOAD_REPORT, lrurl, load.emplace(), ctx);
+                } catch (const std::exception& ex) {
+                    LOG_DEBUG << cluster.logName() << ": Failed to access " << lrurl << ": " << ex.what();
+                    load.reset();
+                }
+            }
+
+            {
+                auto guard = scheduler.guard();
+                if (!guard) {
+                    return;
+                }
+                if (!reachable) {
+                    cluster.brokers->unreachable(broker);
+                }
+                cluster.brokers->setOwned(broker, owned);
+                if (load) {
+                    cluster.brokers->setLoad(broker, *load);
+                }
+            }
+
+            if (--pending->count == 0) {
+                proceed(move(pending->tenants), ctx);
+            }
+        });
+    }
+}
+
+void Engine::lookupOwners(Engine::Cluster &cluster, Scheduler &scheduler, const string &ns,
+                          const vector<string> &topics)
+{
+    // Any broker answers a lookup, with the broker that owns the topic's
+    // bundle. Looking up a topic in a bundle that is not loaded makes a
+    // broker load it, like a client would.
+    for(auto& topic : cluster.brokers->unowned(ns, topics)) {
+        scheduler.add([this, &cluster, &scheduler, ns, topic=move(topic)](Context& ctx) {
+            const auto url = cluster.url + "/lookup/v2/topic/persistent/" + stripPersistent(topic);
+            LookupData lookup;
+            try {
+                fetch(cluster, scheduler, Endpoint::LOOKUP, url, lookup, ctx);
+            } catch (const std::exception& ex) {
+                LOG_DEBUG << cluster.logName() << ": Failed to look up the owner of " << topic << ": " << ex.what();
+                return;
+            }
+
+            // The broker's name is the host:port of its web service
+            auto owner = lookup.httpUrl.empty() ? lookup.httpUrlTls : lookup.httpUrl;
+            if (const auto pos = owner.find("://"); pos != string::npos) {
+                owner.erase(0, pos + 3);
+            }
+            while(!owner.empty() && owner.back() == '/') {
+                owner.pop_back();
+            }
+            if (owner.empty()) {
+                return;
+            }
+
+            if (auto guard = scheduler.guard()) {
+                cluster.brokers->setOwner(ns, topic, owner);
+            }
+        });
+    }
+}
+
+void Engine::processTenant(Engine::Cluster &cluster, Scheduler &scheduler,
+                           const string &tenant, Context &ctx)
+{
+    const auto tnpath = "/namespaces/" + tenant;
+    vector<string> namespaces;
+    try {
+        fetchMetadata(cluster, scheduler, Endpoint::NAMESPACES, tnpath, namespaces, ctx);
+    } catch (const std::exception& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << baseUrl(cluster) + tnpath;
+        return;
+    }
+
+    auto guard = scheduler.guard();
+    if (!guard) {
+        return;
+    }
+
+    for (const auto& ns : namespaces) {
+        // ns contains "tenant/ns"
+        const auto scope = topicFilter_ ? topicFilter_->scope(ns + '/') : TopicFilter::Scope::ALL;
+        if (scope == TopicFilter::Scope::NONE) {
+            LOG_DEBUG << cluster.logName() << ": The topic filter skips namespace " << ns;
+            continue;
+        }
+
+        if (!config_.shard.ownsNamespace(ns)) {
+            continue;
+        }
+
+        {
+            lock_guard lock{cluster.mutex};
+            cluster.tenants[tenant].namespaces[ns];
+        }
+
+        scheduler.add([this, &cluster, &scheduler, tenant, ns, filter=scope == TopicFilter::Scope::SOME](Context& ctx) {
+            processNamespace(cluster, scheduler, tenant, ns, filter, ctx);
+        });
+    }
+
+    lock_guard lock{cluster.mutex};
+    cluster.tenants[tenant].listed = true;
+}
+
+void Engine::processNamespace(Engine::Cluster &cluster, Scheduler &scheduler,
+                              const string &tenant, const string &ns, bool filter, Context &ctx)
+{
+    // ns contains "tenant/ns"
+    const auto nsppath = "/namespaces/" + ns;
+    NamespacePolicies policies;
+    try {
+        fetchMetadata(cluster, scheduler, Endpoint::POLICIES, nsppath, policies, ctx);
+    } catch (const RequestFailedWithErrorException& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << baseUrl(cluster) + nsppath;
+        if (cache_ && ex.http_response.status_code == 404) {
+            // The namespace is gone
+            if (auto guard = scheduler.guard()) {
+                cache_->invalidate(cluster.cacheKey(), Endpoint::NAMESPACES, "/namespaces/" + tenant);
+            }
+        }
+        return;
+    } catch (const std::exception& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << baseUrl(cluster) + nsppath;
+        return;
+    }
+
+    const auto nspath = "/persistent/" + ns;
+    vector<string> topics;
+    bool listed = true;
+    try {
+        fetchMetadata(cluster, scheduler, Endpoint::TOPICS, nspath, topics, ctx);
+    } catch (const std::exception& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << baseUrl(cluster) + nspath;
+        listed = false;
+    }
+
+    // The topic list has each partition of the partitioned topics. We get
+    // the stats for all the partitions of a topic in one request, summed
+    // by the broker. Without the list, each partition is asked for.
+    vector<string> partitioned;
+    if (listed) {
+        try {
+            fetchMetadata(cluster, scheduler, Endpoint::PARTITIONED, nspath + "/partitioned", partitioned, ctx);
+        } catch (const std::exception& ex) {
+            LOG_DEBUG << cluster.logName() << ": Failed to list the partitioned topics in " << ns
+                      << ". Getting the stats for each partition.";
+        }
+    }
+
+    // The bundles, so that the topics can be mapped to their brokers
+    // before we ask for their stats
+    BundlesData bundles;
+    if (cluster.brokers && listed) {
+        try {
+            fetchMetadata(cluster, scheduler, Endpoint::BUNDLES, nsppath + "/bundles", bundles, ctx);
+        } catch (const std::exception& ex) {
+            LOG_DEBUG << cluster.logName() << ": Failed to get the bundles of " << ns;
+        }
+    }
+
+    auto guard = scheduler.guard();
+    if (!guard) {
+        return;
+    }
+
+    if (!bundles.boundaries.empty()) {
+        cluster.brokers->setBundles(ns, bundles.boundaries);
+        if (cluster.portForwarded()) {
+            lookupOwners(cluster, scheduler, ns, topics);
+        }
+    }
+
+    Namespace *nsptr = {};
+    {
+        lock_guard lock{cluster.mutex};
+        nsptr = &cluster.tenants[tenant].namespaces[ns];
+    }
+    auto& nsdata = *nsptr;
+    nsdata.policies = move(policies);
+    if (!listed) {
+        return;
+    }
+
+    // In incremental mode, the idle topics keep their stats from the
+    // last scan, unless topics were added or removed
+    const bool unchanged = cluster.rescan && cluster.rescan->sameTopics(ns, topics);
+
+    // Topics that the brokers already reported in bulk don't need a request
+    Namespace::topics_t bulk;
+    {
+        lock_guard lock{cluster.mutex};
+        if (auto it = cluster.bulkStats.find(ns); it != cluster.bulkStats.end()) {
+            bulk = move(it->second);
+            cluster.bulkStats.erase(it);
+        }
+    }
+
+    // The partitions of each partitioned topic, in the topic list
+    map<string, vector<string>> partitions;
+    for (const auto& topic : partitioned) {
+        partitions[topic];
+    }
+
+    // In sample mode, the topics to fetch are picked when we have them all
+    vector<SampleStratum::Topic> candidates;
+    auto fetchLater = [&](const string& topic, bool partitioned) {
+        if (sampler_) {
+            candidates.push_back({topic, partitioned});
+        } else {
+            fetchTopic(cluster, scheduler, tenant, ns, nsdata, topic, partitioned);
+        }
+    };
+
+    size_t selected = 0;
+    for (const auto& topic : topics) {
+        if (const auto parent = partitionedTopic(topic)) {
+            if (auto it = partitions.find(*parent); it != partitions.end()) {
+                it->second.push_back(topic);
+                continue;
+            }
+        }
+
+        if (filter && !topicFilter_->matches(stripPersistent(topic))) {
+            continue;
+        }
+        ++selected;
+
+        if (config_.bulkStats) {
+            if (auto it = bulk.find(topic); it != bulk.end()) {
+                commitTopic(cluster, tenant, ns, nsdata, topic, move(it->second));
+                ++cluster.bulkHits;
+                continue;
+            }
+            ++cluster.bulkMisses;
+        }
+
+        if (unchanged && reuseTopic(cluster, tenant, ns, nsdata, topic)) {
+            continue;
+        }
+
+        fetchLater(topic, false);
+    }
+
+    for (auto& [topic, names] : partitions) {
+        if (filter && !topicFilter_->matches(stripPersistent(topic))) {
+            continue;
+        }
+        if (cluster.brokers && !names.empty()) {
+            cluster.brokers->setPartitions(topic, names.size());
+        }
+        ++selected;
+
+        if (config_.bulkStats) {
+            // The brokers report each partition. If they reported all of
+            // them, we sum them like the broker would.
+            if (!names.empty() && all_of(names.begin(), names.end(), [&bulk](const auto& name) {
+                    return bulk.count(name) > 0;
+                })) {
+                PersistentTopicStats stats;
+                PartitionedTopicStats::partitions_t each;
+                for (const auto& name : names) {
+                    auto& p = bulk[name];
+                    stats.addPartition(p);
+                    if (config_.partitionStats) {
+                        each.emplace(name, move(p));
+                    }
+                }
+                commitTopic(cluster, tenant, ns, nsdata, topic, move(stats), move(each));
+                ++cluster.bulkHits;
+                continue;
+            }
+            ++cluster.bulkMisses;
+        }
+
+        if (unchanged && reuseTopic(cluster, tenant, ns, nsdata, topic)) {
+            continue;
+        }
+
+        fetchLater(topic, true);
+    }
+
+    if (!partitioned.empty()) {
+        LOG_DEBUG << cluster.logName() << ": " << ns << " has " << partitioned.size()
+                  << " partitioned topics.";
+    }
+
+    if (!candidates.empty()) {
+        auto stratum = sampler_->stratum(move(candidates));
+        const auto sample = stratum->start();
+        {
+            lock_guard lock{cluster.mutex};
+            cluster.strata[ns] = stratum;
+        }
+        {
+            lock_guard lock{cluster.stripe(ns)};
+            nsdata.sampledTopics = sample.size();
+        }
+        for (const auto& t : sample) {
+            fetchTopic(cluster, scheduler, tenant, ns, nsdata, t.name, t.partitioned);
+        }
+    }
+
+    lock_guard lock{cluster.stripe(ns)};
+    nsdata.listedTopics = selected;
+    nsdata.listed = true;
+}
+
+void Engine::processTopic(Engine::Cluster &cluster, Scheduler& scheduler, const string& tenant,
+                          const string& ns, Namespace &nsdata, const string &topic, Context &ctx)
+{
+    const auto stpath = "/persistent/" + stripPersistent(topic) + "/stats";
+    const auto sturl = baseUrl(cluster) + stpath;
+    PersistentTopicStats stats;
+    try {
+        fetchTopicStats(cluster, scheduler, Endpoint::TOPIC_STATS, ns, topic, stpath, stats, ctx);
+    } catch (const RequestFailedWithErrorException& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << sturl;
+        if (cache_ && ex.http_response.status_code == 404) {
+            // The topic was deleted. Get a fresh topic list next time.
+            if (auto guard = scheduler.guard()) {
+                cache_->invalidate(cluster.cacheKey(), Endpoint::TOPICS, "/persistent/" + ns);
+            }
+        }
+        return;
+    } catch (const std::exception& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << sturl;
+        return;
+    }
+
+    auto guard = scheduler.guard();
+    if (!guard) {
+        return;
+    }
+
+    LOG_DEBUG << cluster.logName() << ": Got stats from topic " << topic;
+    const bool problem = sampler_ && (sampler_->disconnected(stats) || sampler_->backlogged(stats));
+    commitTopic(cluster, tenant, ns, nsdata, topic, move(stats));
+    if (problem) {
+        widenSample(cluster, scheduler, tenant, ns, nsdata);
+    }
+}
+
+void Engine::fetchTopic(Engine::Cluster &cluster, Scheduler &scheduler, const string &tenant,
+                        const string &ns, Namespace &nsdata, const string &topic, bool partitioned)
+{
+    if (partitioned) {
+        scheduler.add([this, &cluster, &scheduler, &nsdata, tenant, ns, topic](Context& ctx) {
+            processPartitionedTopic(cluster, scheduler, tenant, ns, nsdata, topic, ctx);
+        });
+    } else {
+        scheduler.add([this, &cluster, &scheduler, &nsdata, tenant, ns, topic](Context& ctx) {
+            processTopic(cluster, scheduler, tenant, ns, nsdata, topic, ctx);
+        });
+    }
+}
+
+void Engine::widenSample(Engine::Cluster &cluster, Scheduler &scheduler, const string &tenant,
+                         const string &ns, Namespace &nsdata)
+{
+    shared_ptr<SampleStratum> stratum;
+    {
+        lock_guard lock{cluster.mutex};
+        if (auto it = cluster.strata.find(ns); it != cluster.strata.end()) {
+            stratum = it->second;
+        }
+    }
+    if (!stratum) {
+        return;
+    }
+
+    const auto more = stratum->widen();
+    if (more.empty()) {
+        return;
+    }
+
+    LOG_DEBUG << cluster.logName() << ": Found a replication problem in " << ns
+              << ". Sampling " << more.size() << " more topics.";
+    {
+        lock_guard lock{cluster.stripe(ns)};
+        nsdata.sampledTopics += more.size();
+    }
+    for (const auto& t : more) {
+        fetchTopic(cluster, scheduler, tenant, ns, nsdata, t.name, t.partitioned);
+    }
+}
+
+void Engine::processPartitionedTopic(Engine::Cluster &cluster, Scheduler &scheduler, const string &tenant,
+                                     const string &ns, Namespace &nsdata, const string &topic,
+                                     Context &ctx)
+{
+    // The broker lists each partition unless we ask it not to
+    const auto sturl = baseUrl(cluster) + "/persistent/" + stripPersistent(topic) + "/partitioned-stats"
+            + (config_.partitionStats ? "?perPartition=true" : "?perPartition=false");
+    PartitionedTopicStats stats;
+    try {
+        fetch(cluster, scheduler, Endpoint::PARTITIONED_STATS, sturl, stats, ctx, topicProperties());
+    } catch (const RequestFailedWithErrorException& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << sturl;
+        if (cache_ && ex.http_response.status_code == 404) {
+            // The topic was deleted. Get fresh topic lists next time.
+            if (auto guard = scheduler.guard()) {
+                cache_->invalidate(cluster.cacheKey(), Endpoint::PARTITIONED, "/persistent/" + ns + "/partitioned");
+                cache_->invalidate(cluster.cacheKey(), Endpoint::TOPICS, "/persistent/" + ns);
+            }
+        }
+        return;
+    } catch (const std::exception& ex) {
+        LOG_WARN << cluster.logName() << ": Failed to access " << sturl;
+        return;
+    }
+
+    auto guard = scheduler.guard();
+    if (!guard) {
+        return;
+    }
+
+    LOG_DEBUG << cluster.logName() << ": Got stats from partitioned topic " << topic
+              << " with " << stats.metadata.partitions << " partitions";
+    auto partitions = move(stats.partitions);
+    const bool problem = sampler_ && (sampler_->disconnected(stats) || sampler_->backlogged(stats));
+    commitTopic(cluster, tenant, ns, nsdata, topic, move(static_cast<PersistentTopicStats&>(stats)),
+                move(partitions));
+    if (problem) {
+        widenSample(cluster, scheduler, tenant, ns, nsdata);
+    }
+}
+
+bool Engine::reuseTopic(Engine::Cluster &cluster, const string &tenant, const string &ns,
+                        Namespace &nsdata, const string &topic)
+{
+    const auto *row = cluster.rescan->reuse(topic);
+    if (!row) {
+        return false;
+    }
+
+    ++metrics_.reused;
+    cluster.store->add(*row);
+    auto *previous = config_.topicTree || config_.partitionStats
+        ? cluster.rescan->previous(tenant, ns) : nullptr;
+
+    lock_guard lock{cluster.stripe(ns)};
+    ++nsdata.fetchedTopics;
+    if (previous) {
+        // Each topic is only reused once, so we can move it
+        if (auto it = previous->topics.find(topic); it != previous->topics.end()) {
+            nsdata.topics[topic] = move(it->second);
+        }
+        if (auto it = previous->partitions.find(topic); it != previous->partitions.end()) {
+            nsdata.partitions[topic] = move(it->second);
+        }
+    }
+    return true;
+}
+
+void Engine::commitTopic(Engine::Cluster &cluster, const string &tenant, const string &ns,
+                         Namespace &nsdata, const string &topic, PersistentTopicStats &&stats,
+                         PartitionedTopicStats::partitions_t &&partitions)
+{
+    ++metrics_.topics;
+    if (sink_) {
+        // Only the namespace's rates are kept
+        try {
+            sink_->write({cluster.name, tenant, ns, topic, stats});
+        } catch (const std::exception& ex) {
+            // Without the output, the scan is of no use
+            throw Scheduler::Fatal{ex.what()};
+        }
+        lock_guard lock{cluster.stripe(ns)};
+        ++nsdata.fetchedTopics;
+        nsdata.stats += stats;
+        return;
+    }
+
+    cluster.store->add(tenant, ns, topic, stats);
+    lock_guard lock{cluster.stripe(ns)};
+    ++nsdata.fetchedTopics;
+    if (config_.topicTree) {
+        nsdata.topics[topic] = move(stats);
+    }
+    if (!partitions.empty()) {
+        nsdata.partitions[topic] = move(partitions);
+    }
+}
+
+void Engine::aggregate(Engine::Cluster &cluster)
+{
+    // Roll up the topic stats after the scan, in key order, so that
+    // the result does not depend on the order the requests completed.
+    // In streaming mode the store is empty, and the namespaces' rates
+    // were summed as the topics arrived.
+    auto& store = *cluster.store;
+    store.seal();
+
+    cluster.stats = {};
+    for(auto& [_, tenant] : cluster.tenants) {
+        tenant.stats = {};
+        for(auto& [_, ns] : tenant.namespaces) {
+            if (!sink_) {
+                ns.stats = {};
+            }
+        }
+    }
+
+    // Sum the rates per namespace. The rows are sorted, so each chunk of
+    // rows yields runs of (namespace, partial sum), and the runs are
+    // merged in order. With one thread there is one chunk.
+    struct Run {
+        sid_t tenant = {};
+        sid_t ns = {};
+        Stats stats;
+    };
+
+    static constexpr size_t minRowsPerChunk = 20000;
+    const auto& rows = store.topics();
+    const auto chunks = max<size_t>(1, min(config_.threads, rows.size() / minRowsPerChunk));
+    vector<vector<Run>> runs(chunks);
+
+    auto sum = [&rows, &runs, chunks](size_t chunk) {
+        auto& out = runs[chunk];
+        const auto end = rows.size() * (chunk + 1) / chunks;
+        for(auto i = rows.size() * chunk / chunks; i < end; ++i) {
+            const auto& row = rows[i];
+            if (out.empty() || out.back().ns != row.ns) {
+                out.push_back({row.tenant, row.ns, {}});
+            }
+            out.back().stats += row.rates;
+        }
+    };
+
+    vector<future<void>> workers;
+    for(size_t chunk = 1; chunk < chunks; ++chunk) {
+        workers.emplace_back(async(launch::async, sum, chunk));
+    }
+    sum(0);
+    for(auto& w : workers) {
+        w.get();
+    }
+
+    Namespace *ns = {};
+    sid_t currentNs = StringPool::none;
+    for(const auto& chunk : runs) {
+        for(const auto& run : chunk) {
+            if (!ns || run.ns != currentNs) {
+                currentNs = run.ns;
+                ns = &cluster.tenants[string{store.str(run.tenant)}].namespaces[string{store.str(run.ns)}];
+            }
+            ns->stats += run.stats;
+        }
+    }
+
+    for(auto& [_, tenant] : cluster.tenants) {
+        for(auto& [_, ns] : tenant.namespaces) {
+            if (sampler_ && ns.fetchedTopics && ns.listedTopics > ns.fetchedTopics) {
+                // The sampled topics' sums, extrapolated to all the topics
+                scale(ns.stats, static_cast<double>(ns.listedTopics) / static_cast<double>(ns.fetchedTopics));
+            }
+            tenant.stats += ns.stats;
+        }
+        cluster.stats += tenant.stats;
+    }
+
+    LOG_DEBUG << cluster.logName() << ": " << store.topics().size() << " topics use "
+              << store.memoryUsage() << " bytes in the topic store. ";
+}
+
+void Engine::simpleSummary()
 {
     for(const auto& [_, c] : clusters_) {
-        cout << "Cluster " << c->name << ": " << strings(c->clusters) << endl;
+        cout << "Cluster " << c->name << ": " << strings(c->clusters)
+             << " (" << c->coverage().toString() << (c->expired ? ", deadline passed" : "") << ')' << endl;
         cout << "  Tenants: " << endl;
         for(const auto& [name, tenant] : c->tenants) {
-            cout << "    " << name << " namespaces:" << endl;
+            cout << "    " << name << " namespaces:" << (tenant.listed ? "" : " (missing)") << endl;
             for(const auto& [nsname, ns] : tenant.namespaces) {
-                cout << "      " << nsname << ' ' << strings(ns.policies.replication_clusters) << endl;
+                cout << "      " << nsname << ' ' << strings(ns.policies.replication_clusters);
+                if (const auto coverage = Cluster::coverage(ns); coverage.state != Coverage::State::COMPLETE) {
+                    cout << " (" << coverage.toString() << ')';
+                }
+                cout << endl;
             }
         }
 
@@ -303,6 +2061,155 @@ void Engine::simpleSummary()
     }
 }
 
+void Engine::validate()
+{
+    ReplicationValidator::Options options;
+    options.maxBacklog = config_.maxReplicationBacklog;
+    options.maxDelay = config_.maxReplicationDelay;
+    options.maxLines = config_.watchMaxLines;
+    options.threads = config_.threads;
+
+    const auto started = chrono::steady_clock::now();
+    ReplicationValidator validator{pool_, options};
+    const auto report = validator.check(clusterList());
+    LOG_DEBUG << "Validated the replication in "
+              << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count()
+              << " ms.";
+
+    validator.print(report, cout);
+    cout << endl;
+}
+
+void Engine::sampleReport()
+{
+    vector<Sampler::Report> reports;
+    for(const auto& [_, c] : clusters_) {
+        reports.push_back(sampler_->estimate(*c));
+    }
+    sampler_->print(reports, cout);
+    cout << endl;
+}
+
+void Engine::runQueries()
+{
+    const auto clusters = clusterList();
+    for(const auto& query : queries_) {
+        const auto started = chrono::steady_clock::now();
+        const auto result = query->run(clusters, config_.threads);
+        LOG_DEBUG << "Ran the query \"" << query->text() << "\" over " << result.facts << " rows in "
+                  << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count()
+                  << " ms.";
+
+        cout << "Query: " << query->text() << endl;
+        Query::print(result, cout);
+        cout << endl;
+    }
+}
+
+void Engine::brokerReport()
+{
+    if (clusters_.empty()) {
+        return;
+    }
+
+    const auto started = chrono::steady_clock::now();
+    vector<BrokerMap::Report> reports;
+    for(const auto& [_, c] : clusters_) {
+        reports.push_back(c->brokers->report(*c));
+    }
+    LOG_DEBUG << "Mapped the topics to their brokers in "
+              << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count()
+              << " ms.";
+
+    clusters_.begin()->second->brokers->print(reports, cout);
+    cout << endl;
+}
+
+vector<const Engine::Cluster *> Engine::clusterList() const
+{
+    vector<const Cluster *> clusters;
+    for(const auto& [_, c] : clusters_) {
+        clusters.push_back(c.get());
+    }
+    return clusters;
+}
+
+void Engine::saveSnapshot()
+{
+    try {
+        Snapshot::write(clusterList(), config_.snapshotFile);
+        LOG_INFO << "Saved the scan to " << config_.snapshotFile;
+    } catch (const exception& ex) {
+        LOG_ERROR << "Failed to save the snapshot " << config_.snapshotFile << ": " << ex.what();
+    }
+}
+
+double Coverage::percent() const noexcept
+{
+    if (!listed) {
+        return state == State::COMPLETE ? 100.0 : 0.0;
+    }
+    return 100.0 * static_cast<double>(min(fetched, listed)) / static_cast<double>(listed);
+}
+
+string Coverage::toString() const
+{
+    switch(state) {
+    case State::COMPLETE:
+        return "complete";
+    case State::MISSING:
+        return "missing";
+    case State::PARTIAL:
+        break;
+    }
+
+    ostringstream out;
+    out << "partial, " << fixed << setprecision(1) << percent() << "% of " << listed << " topics";
+    if (unlisted) {
+        out << ", " << unlisted << " tenants or namespaces not listed";
+    }
+    return out.str();
+}
+
+Coverage Engine::Cluster::coverage() const
+{
+    Coverage total;
+    if (!listed) {
+        return total;
+    }
+
+    for(const auto& [_, tenant] : tenants) {
+        if (!tenant.listed) {
+            ++total.unlisted;
+        }
+        for(const auto& [_, ns] : tenant.namespaces) {
+            const auto c = coverage(ns);
+            total.listed += c.listed;
+            total.fetched += c.fetched;
+            total.unlisted += c.unlisted;
+        }
+    }
+
+    total.unlisted += shardGaps;
+    total.state = (!total.unlisted && total.fetched >= total.listed)
+            ? Coverage::State::COMPLETE : Coverage::State::PARTIAL;
+    return total;
+}
+
+Coverage Engine::Cluster::coverage(const Namespace &ns)
+{
+    Coverage coverage;
+    if (!ns.listed) {
+        coverage.unlisted = 1;
+        return coverage;
+    }
+
+    coverage.listed = ns.sampledTopics ? ns.sampledTopics : ns.listedTopics;
+    coverage.fetched = ns.fetchedTopics;
+    coverage.state = coverage.fetched >= coverage.listed ? Coverage::State::COMPLETE : Coverage::State::PARTIAL;
+    return coverage;
+}
+
 void Engine::Cluster::setKubeconfig(const string &def)
 {
     vector<string> args;
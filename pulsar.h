@@ -1,23 +1,47 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <future>
 
 #include "restc-cpp/restc-cpp.h"
-#include "logfault/logfault.h"
+#include "logging.h"
 #include "pulsar_api.h"
-
-#define LOG_ERROR   LFLOG_ERROR
-#define LOG_WARN    LFLOG_WARN
-#define LOG_INFO    LFLOG_INFO
-#define LOG_DEBUG   LFLOG_DEBUG
-#define LOG_TRACE   LFLOG_TRACE
+#include "store.h"
+#include "histogram.h"
+#include "profiler.h"
+#include "forwarder.h"
+#include "balancer.h"
+#include "topicfilter.h"
+#include "governor.h"
+#include "shard.h"
 
 namespace purech {
 
-struct PrcCtx;
+class Scheduler;
+class Projection;
+class MetadataCache;
+class Exporter;
+class TopicSink;
+class Snapshot;
+class Rescan;
+class Sampler;
+class SampleStratum;
+class Query;
+class BrokerMap;
+
+// Keep-alive connections to a cluster
+struct PoolConfig {
+  size_t size = 0; // Connections. Also limits the requests in flight. 0 means --max-inflight
+  unsigned idleTimeout = 60; // Seconds an idle connection is kept open
+  size_t warmup = 0; // Connections to open at the start of each scan
+};
 
 struct Config {
   std::vector<std::string> clusters; // url|kubeconfig,cluster-name[,namespace[,brokerSvcName]]
@@ -29,9 +53,75 @@ struct Config {
   //bool hideNoPublishers = true;
   //bool showStreamsReport = false;
   //bool showActivityReport = true;
-  std::string topicFilter;
+  std::string topicFilter; // Regex. Same as an include pattern of "re:<regex>"
+  std::vector<std::string> include; // Topic patterns, see TopicFilter
+  std::vector<std::string> exclude;
   std::string brokerSvcName = "pulsar-broker";
   std::string ns;
+  size_t maxInflight = 8; // Concurrent requests per cluster
+  bool bulkStats = false; // Use broker-stats/topics and only fetch missing topics one by one
+  bool directBrokers = false; // With bulkStats, also ask each broker at its own address, unless port-forwarding
+  bool brokers = false; // Map the topics to the brokers that own their bundles, and report the load per broker
+  bool routeToOwner = false; // Send each topic's stats request to the broker that owns it. Needs `brokers`
+  double maxBrokerSkew = 1.25; // Throughput over the mean of the brokers that makes a broker overloaded
+  bool partitionStats = false; // Keep the stats of each partition, not just their sum
+  bool incremental = false; // Only fetch the topics that were active in the last scan, or changed
+  size_t idleScans = 10; // In incremental mode, fetch each idle topic once in this many scans
+  double sample = 0; // Fraction of the topics in each namespace to fetch, and estimate the rest from. 0 means all
+  uint64_t sampleSeed = 1; // Picks the sampled topics
+  unsigned watchInterval = 0; // Seconds between scans. 0 means run once
+  size_t watchIterations = 0; // Number of scans in watch mode. 0 means forever
+  size_t watchMaxLines = 20; // Changes to report per cluster in watch mode
+  bool topicTree = false; // Also keep the topic stats in Namespace::topics, besides the TopicStore
+  std::vector<std::string> fields; // Topic stats fields to deserialize. Empty means all
+  bool showSummary = true;
+  bool profile = false; // Print per-cluster, per-endpoint request timing after the run
+  std::string traceFile; // Write a Chrome trace of the requests to this file
+  std::string kubectl = "kubectl"; // Searched for in PATH unless it contains a '/'
+  std::string agentSocket; // Get the port-forwardings from an agent on this socket, if one is running
+  unsigned forwardTimeout = 30; // Seconds to wait for all the port-forwardings to be ready
+  unsigned healthInterval = 10; // Seconds between health checks of the port-forwardings
+  size_t forwards = 1; // Port-forwardings to the broker service, per cluster
+  bool forwardPods = false; // One port-forwarding per broker pod instead
+  size_t threads = 1; // Threads for the REST client, deserialization and aggregation
+  double rate = 0; // Max requests per second to each cluster. 0 means no limit until a cluster pushes back
+  unsigned targetLatency = 1000; // Milliseconds. Slow down when a cluster's average latency goes above it
+  unsigned timeout = 12; // Seconds, for connecting, sending and for each read
+  size_t retries = 2; // Retries for requests that failed in a way that may go away
+  bool hedge = false; // Send a second request when one is slower than the cluster's 95th percentile
+  unsigned deadline = 0; // Seconds for each scan. What we have by then is reported. 0 means no deadline
+  std::map<std::string, unsigned> clusterDeadlines; // Seconds, by cluster name. Overrides `deadline`
+  bool cache = false; // Cache the cluster, tenant, namespace and topic lists and the policies
+  std::string cacheFile; // Keep the cache in this file between runs. Empty means in memory only
+  std::map<Endpoint, unsigned> cacheTtl; // Seconds. Overrides the defaults. 0 disables caching
+  std::vector<Endpoint> invalidate; // Drop the cached data from these endpoints at startup
+  std::string snapshotFile; // Save each scan to this file
+  std::string listen; // [address:]port to serve the results on. Empty means no HTTP server
+  bool validate = false; // Check the replication across the clusters after each scan
+  uint64_t maxReplicationBacklog = 10000; // Messages. More is reported by the validation
+  int maxReplicationDelay = 300; // Seconds. More is reported by the validation
+  bool compress = false; // Ask for gzip or deflate compressed replies
+  PoolConfig pool;
+  std::map<std::string, PoolConfig> clusterPools; // By cluster name. Overrides `pool`
+  std::string stream; // <format>:<path>. Write each topic's stats there as they arrive, instead of keeping them
+  size_t workers = 0; // Split each scan over this many worker processes. 0 means scan in this process
+  Shard shard; // In a worker: The part of the scan to do
+  std::vector<std::string> commandLine; // Our arguments, to start the workers with
+  std::vector<std::string> merge; // Snapshots from workers to merge, instead of scanning
+  std::vector<std::string> queries; // Run these after each scan. See Query
+};
+
+// How much of a cluster or namespace a scan got
+struct Coverage {
+    enum class State { COMPLETE, PARTIAL, MISSING };
+
+    State state = State::MISSING;
+    size_t listed = 0; // Topics in the topic lists we got
+    size_t fetched = 0; // Topics with stats
+    size_t unlisted = 0; // Tenants and namespaces whose lists we did not get
+
+    double percent() const noexcept;
+    std::string toString() const;
 };
 
 class Engine {
@@ -46,29 +136,174 @@ public:
         std::string ns; // if port-forwarding
         std::string svcName; // if port-forwarding
         std::string url; // Url used by the rest client
+        std::shared_ptr<Balancer> balancer; // If there is more than one url for the cluster
+        std::shared_ptr<Governor> governor;
         std::string name;
+        size_t id = 0; // Position in the config; used by the profiler
+        bool listed = false; // We got the tenant list
+        std::atomic_bool expired = false; // The deadline passed before the scan was done. Jobs check their scheduler instead.
         std::vector<std::string> clusters; // Clusters know in this location
         tenants_t tenants; // Tenants in this region
         Stats stats;
+        size_t shardGaps = 0; // Parts of a merged scan we don't have, and can't name
+        std::shared_ptr<Rescan> rescan; // Only in incremental mode
+        std::shared_ptr<BrokerMap> brokers; // Only with --brokers
+        std::map<std::string /* ns */, std::shared_ptr<SampleStratum>> strata; // In sample mode. Guarded by `mutex`
+
+        // All the topic stats. Namespace::topics is only filled with
+        // `topicTree`. Both are empty in streaming mode.
+        std::unique_ptr<TopicStore> store;
+
+        // Topic stats reported by the brokers in bulk mode, per namespace
+        std::map<std::string /* ns */, Namespace::topics_t> bulkStats;
+        std::atomic<size_t> bulkHits = 0;
+        std::atomic<size_t> bulkMisses = 0;
+
+        // While scanning, `mutex` guards the tenants and namespaces maps
+        // and bulkStats. Each namespace's topics are guarded by a stripe.
+        std::mutex mutex;
+        std::array<std::mutex, 32> stripes;
+
+        std::mutex& stripe(const std::string& ns) {
+            return stripes[std::hash<std::string>{}(ns) % stripes.size()];
+        }
 
         std::string logName() const {
             return name;
         }
+
+        // Key for the metadata cache. The url of a port-forwarding
+        // changes between runs, so we use the kubeconfig file for those.
+        std::string cacheKey() const {
+            return name + '|' + (origin.empty() ? url : origin);
+        }
+
+        // Then we can only reach the brokers' service, not each broker
+        bool portForwarded() const noexcept {
+            return !origin.empty();
+        }
+
+        Coverage coverage() const;
+        static Coverage coverage(const Namespace& ns);
+
+        ForwardSpec forwardSpec() const {
+            return {origin, ns, svcName};
+        }
     };
 
 
+    struct Metrics {
+        std::atomic<uint64_t> requests = 0;
+        std::atomic<uint64_t> failures = 0;
+        std::atomic<uint64_t> topics = 0; // Topics with stats
+        std::atomic<uint64_t> retries = 0;
+        std::atomic<uint64_t> hedges = 0; // Extra requests sent for slow ones
+        std::atomic<uint64_t> reused = 0; // Topics that kept their stats from an earlier scan
+        std::atomic<uint64_t> wireBytes = 0; // Reply bodies as received, maybe compressed
+        std::atomic<uint64_t> bodyBytes = 0; // Reply bodies after decompression
+        Histogram latency; // Microseconds, for successful requests
+    };
+
     Engine(const Config& config);
+    ~Engine();
 
     void run();
+
+    // Keep the port-forwardings for the clusters up, and serve
+    // them to other purech instances, until we are killed.
+    void runAgent();
+
+    const Metrics& metrics() const noexcept {
+        return metrics_;
+    }
 private:
+    // A reply's body, decoded, and its size on the wire
+    struct Body {
+        std::string json;
+        uint64_t wireBytes = 0;
+    };
+
     void prepare();
-    void processCluster(Cluster& cluster, restc_cpp::Context& ctx);
+    void setupForwarding(const std::vector<std::shared_ptr<Cluster>>& clusters);
+    void scan();
+    void scanShards();
+    void merge(const Snapshot& snapshot);
+    void reset();
+    void aggregateAll();
+    std::pair<std::shared_ptr<Scheduler>, std::future<void>> scanCluster(const std::shared_ptr<Cluster>& cluster);
+    std::optional<std::chrono::steady_clock::time_point> deadline(const Cluster& cluster,
+                                                                  std::chrono::steady_clock::time_point started) const;
+    void processCluster(Cluster& cluster, Scheduler& scheduler, restc_cpp::Context& ctx);
+    void addTenants(Cluster& cluster, Scheduler& scheduler, const std::vector<std::string>& tenants);
+    void processBrokers(Cluster& cluster, Scheduler& scheduler, std::vector<std::string> tenants,
+                        restc_cpp::Context& ctx);
+    void processOwnership(Cluster& cluster, Scheduler& scheduler, std::vector<std::string> tenants,
+                          restc_cpp::Context& ctx);
+    // Finds the owners of the namespace's bundles from a topic in each
+    void lookupOwners(Cluster& cluster, Scheduler& scheduler, const std::string& ns,
+                      const std::vector<std::string>& topics);
+    void processTenant(Cluster& cluster, Scheduler& scheduler, const std::string& tenant,
+                       restc_cpp::Context& ctx);
+    void processNamespace(Cluster& cluster, Scheduler& scheduler, const std::string& tenant,
+                          const std::string& ns, bool filter, restc_cpp::Context& ctx);
+    void processTopic(Cluster& cluster, Scheduler& scheduler, const std::string& tenant, const std::string& ns,
+                      Namespace& nsdata, const std::string& topic, restc_cpp::Context& ctx);
+    void processPartitionedTopic(Cluster& cluster, Scheduler& scheduler, const std::string& tenant,
+                                 const std::string& ns, Namespace& nsdata, const std::string& topic,
+                                 restc_cpp::Context& ctx);
+    void fetchTopic(Cluster& cluster, Scheduler& scheduler, const std::string& tenant, const std::string& ns,
+                    Namespace& nsdata, const std::string& topic, bool partitioned);
+    void widenSample(Cluster& cluster, Scheduler& scheduler, const std::string& tenant,
+                     const std::string& ns, Namespace& nsdata);
+    bool reuseTopic(Cluster& cluster, const std::string& tenant, const std::string& ns,
+                    Namespace& nsdata, const std::string& topic);
+    void commitTopic(Cluster& cluster, const std::string& tenant, const std::string& ns,
+                     Namespace& nsdata, const std::string& topic, PersistentTopicStats&& stats,
+                     PartitionedTopicStats::partitions_t&& partitions = {});
+    void aggregate(Cluster& cluster);
+    template <typename T>
+    void fetch(const Cluster& cluster, Scheduler& scheduler, Endpoint endpoint, const std::string& url,
+               T& data, restc_cpp::Context& ctx, const restc_cpp::serialize_properties_t& properties = {});
+    template <typename T>
+    void fetchTopicStats(const Cluster& cluster, Scheduler& scheduler, Endpoint endpoint, const std::string& ns,
+                         const std::string& topic, const std::string& path, T& data, restc_cpp::Context& ctx);
+    template <typename T>
+    void fetchMetadata(const Cluster& cluster, Scheduler& scheduler, Endpoint endpoint, const std::string& path,
+                       T& data, restc_cpp::Context& ctx);
+    template <typename T>
+    void fetchOnce(const Cluster& cluster, Scheduler& scheduler, Endpoint endpoint, const std::string& url,
+                   T& data, restc_cpp::Context& ctx, const restc_cpp::serialize_properties_t& properties);
+    Body fetchHedged(const Cluster& cluster, Scheduler& scheduler, const std::string& url,
+                     std::chrono::microseconds delay, restc_cpp::Context& ctx);
+    std::unique_ptr<restc_cpp::Reply> get(const std::string& url, restc_cpp::Context& ctx) const;
+    static Body readBody(restc_cpp::Reply& reply);
+    void warmUp(const Cluster& cluster, restc_cpp::Context& ctx);
+    const PoolConfig& pool(const Cluster& cluster) const;
+    std::vector<ForwardSpec> forwardSpecs(const Cluster& cluster) const;
+    const restc_cpp::serialize_properties_t& topicProperties() const;
     void simpleSummary();
+    void saveSnapshot();
+    void validate();
+    void sampleReport();
+    void runQueries();
+    void brokerReport();
+    std::vector<const Cluster *> clusterList() const;
 
     static Config config_;
+    StringPool pool_; // Shared by all the clusters, so the ids are comparable
     std::map<std::string_view, std::shared_ptr<Cluster>> clusters_;
     std::unique_ptr<restc_cpp::RestClient> client_;
-    std::vector<std::shared_ptr<PrcCtx>> processes_;
+    std::shared_ptr<Forwarder> forwarder_; // When we run kubectl ourself
+    std::unique_ptr<TopicFilter> topicFilter_;
+    std::unique_ptr<Projection> projection_;
+    std::unique_ptr<MetadataCache> cache_; // Only when caching
+    std::unique_ptr<Exporter> exporter_; // Only when serving the results
+    std::unique_ptr<TopicSink> sink_; // Only in streaming mode
+    std::unique_ptr<ShardCoordinator> coordinator_; // Only when the scans are split over workers
+    std::unique_ptr<Sampler> sampler_; // Only in sample mode
+    std::vector<std::unique_ptr<Query>> queries_;
+    Metrics metrics_;
+    std::unique_ptr<Profiler> profiler_; // Only when profiling or tracing
 };
 
 } // ns
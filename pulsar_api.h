@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+
 #include <boost/fusion/adapted.hpp>
 #include <boost/fusion/adapted/struct/define_struct.hpp>
 #include <boost/fusion/include/define_struct.hpp>
@@ -78,6 +80,113 @@ struct PersistentTopicStats : public Stats {
     subscriptions_t subscriptions;
     replication_t replication;
     std::string deduplicationStatus;
+
+    // Adds a partition, like the broker does for partitioned-stats
+    void addPartition(const PersistentTopicStats& p) {
+        const auto rate = msgRateIn + p.msgRateIn;
+        averageMsgSize = rate > 0 ? (averageMsgSize * msgRateIn + p.averageMsgSize * p.msgRateIn) / rate
+                                  : std::max(averageMsgSize, p.averageMsgSize);
+        Stats::operator+=(p);
+        storageSize += p.storageSize;
+        publishers.insert(publishers.end(), p.publishers.begin(), p.publishers.end());
+        for(const auto& [name, from] : p.subscriptions) {
+            auto& sub = subscriptions[name];
+            sub.msgRateOut += from.msgRateOut;
+            sub.msgThroughputOut += from.msgThroughputOut;
+            sub.msgRateRedeliver += from.msgRateRedeliver;
+            sub.msgBacklog += from.msgBacklog;
+            sub.blockedSubscriptionOnUnackedMsgs |= from.blockedSubscriptionOnUnackedMsgs;
+            sub.unackedMessages += from.unackedMessages;
+            sub.msgRateExpired += from.msgRateExpired;
+            if (sub.type.empty()) {
+                sub.type = from.type;
+            }
+            if (sub.activeConsumerName.empty()) {
+                sub.activeConsumerName = from.activeConsumerName;
+            }
+            sub.consumers.insert(sub.consumers.end(), from.consumers.begin(), from.consumers.end());
+        }
+        for(const auto& [peer, from] : p.replication) {
+            // A link is connected when all the partitions' links are
+            const bool first = replication.find(peer) == replication.end();
+            auto& r = replication[peer];
+            r += from;
+            r.msgRateExpired += from.msgRateExpired;
+            r.replicationBacklog += from.replicationBacklog;
+            r.connected = (first || r.connected) && from.connected;
+            r.replicationDelayInSeconds = std::max(r.replicationDelayInSeconds, from.replicationDelayInSeconds);
+            if (r.outboundConnection.empty()) {
+                r.outboundConnection = from.outboundConnection;
+                r.outboundConnectedSince = from.outboundConnectedSince;
+            }
+        }
+        if (deduplicationStatus.empty()) {
+            deduplicationStatus = p.deduplicationStatus;
+        }
+    }
+};
+
+struct PartitionedTopicMetadata {
+    int partitions = {};
+};
+
+// Reply from /admin/v2/persistent/{topic}/partitioned-stats. The broker
+// sums the partitions. They are only listed with perPartition=true.
+struct PartitionedTopicStats : public PersistentTopicStats {
+    using partitions_t = std::map<std::string /* partition */, PersistentTopicStats>;
+    PartitionedTopicMetadata metadata;
+    partitions_t partitions;
+};
+
+// Reply from /admin/v2/broker-stats/topics:
+// namespace -> bundle -> "persistent" | "non-persistent" -> topic -> stats
+using BrokerTopicStats = std::map<std::string /* ns */,
+    std::map<std::string /* bundle */,
+        std::map<std::string /* domain */,
+            std::map<std::string /* topic */, PersistentTopicStats>>>>;
+
+// Reply from /admin/v2/namespaces/{ns}/bundles
+struct BundlesData {
+    std::vector<std::string> boundaries; // Hex, like "0x40000000". One more than the bundles
+    int numBundles = {};
+};
+
+// Values from /admin/v2/brokers/{cluster}/{broker}/ownedNamespaces
+struct NamespaceOwnershipStatus {
+    std::string broker_assignment; // primary, secondary or shared
+    bool is_controlled = false;
+    bool is_active = false;
+};
+
+using OwnedBundles = std::map<std::string /* tenant/ns/0x00000000_0x40000000 */, NamespaceOwnershipStatus>;
+
+// Reply from /lookup/v2/topic/{topic}
+struct LookupData {
+    std::string brokerUrl; // pulsar://host:port
+    std::string httpUrl; // http://host:port
+    std::string httpUrlTls; // https://host:port
+};
+
+struct ResourceUsage {
+    double percent() const noexcept {
+        return limit > 0 ? 100.0 * usage / limit : 0.0;
+    }
+
+    double usage = {};
+    double limit = {};
+};
+
+// Reply from /admin/v2/broker-stats/load-report
+struct LoadReport : public Stats {
+    ResourceUsage cpu;
+    ResourceUsage memory;
+    ResourceUsage directMemory;
+    ResourceUsage bandwidthIn;
+    ResourceUsage bandwidthOut;
+    int numTopics = {};
+    int numBundles = {};
+    int numConsumers = {};
+    int numProducers = {};
 };
 
 struct  NamespacePolicies {
@@ -87,15 +196,22 @@ struct  NamespacePolicies {
 
 struct Namespace {
     using topics_t = std::map<std::string /* topic */, PersistentTopicStats>;
+    using partitions_t = std::map<std::string /* partitioned topic */, PartitionedTopicStats::partitions_t>;
     Stats stats;
-    topics_t topics;
+    topics_t topics; // A partitioned topic is one topic, with the sum of its partitions
+    partitions_t partitions; // Each partition of the partitioned topics. Only with --partition-stats
     NamespacePolicies policies;
+    bool listed = false; // We got the topic list
+    size_t listedTopics = 0; // Topics in the list that the filter selects
+    size_t fetchedTopics = 0; // Topics we got the stats for
+    size_t sampledTopics = 0; // Topics picked by --sample. 0 when not sampling
 };
 
 struct Tenant {
     using namespaces_t = std::map<std::string /* tenant */, Namespace>;
     Stats stats;
     namespaces_t namespaces;
+    bool listed = false; // We got the namespace list
 };
 
 struct Location {
@@ -162,5 +278,55 @@ BOOST_FUSION_ADAPT_STRUCT(PersistentTopicStats,
     (PersistentTopicStats::replication_t, replication)
     (std::string, deduplicationStatus))
 
+BOOST_FUSION_ADAPT_STRUCT(PartitionedTopicMetadata,
+    (int, partitions))
+
+BOOST_FUSION_ADAPT_STRUCT(PartitionedTopicStats,
+    (double, msgRateIn)
+    (double, msgThroughputIn)
+    (double, msgRateOut)
+    (double, msgThroughputOut)
+    (double, averageMsgSize)
+    (double, storageSize)
+    (PersistentTopicStats::publishers_t, publishers)
+    (PersistentTopicStats::subscriptions_t, subscriptions)
+    (PersistentTopicStats::replication_t, replication)
+    (std::string, deduplicationStatus)
+    (PartitionedTopicMetadata, metadata)
+    (PartitionedTopicStats::partitions_t, partitions))
+
+BOOST_FUSION_ADAPT_STRUCT(BundlesData,
+    (std::vector<std::string>, boundaries)
+    (int, numBundles))
+
+BOOST_FUSION_ADAPT_STRUCT(NamespaceOwnershipStatus,
+    (std::string, broker_assignment)
+    (bool, is_controlled)
+    (bool, is_active))
+
+BOOST_FUSION_ADAPT_STRUCT(LookupData,
+    (std::string, brokerUrl)
+    (std::string, httpUrl)
+    (std::string, httpUrlTls))
+
+BOOST_FUSION_ADAPT_STRUCT(ResourceUsage,
+    (double, usage)
+    (double, limit))
+
+BOOST_FUSION_ADAPT_STRUCT(LoadReport,
+    (double, msgRateIn)
+    (double, msgThroughputIn)
+    (double, msgRateOut)
+    (double, msgThroughputOut)
+    (ResourceUsage, cpu)
+    (ResourceUsage, memory)
+    (ResourceUsage, directMemory)
+    (ResourceUsage, bandwidthIn)
+    (ResourceUsage, bandwidthOut)
+    (int, numTopics)
+    (int, numBundles)
+    (int, numConsumers)
+    (int, numProducers))
+
 BOOST_FUSION_ADAPT_STRUCT(NamespacePolicies,
     (NamespacePolicies::strlist_t, replication_clusters))
@@ -0,0 +1,623 @@
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <future>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "query.h"
+
+using namespace std;
+using namespace std::string_literals;
+
+namespace purech {
+
+namespace {
+
+using Level = Query::Level;
+using Function = Query::Function;
+
+constexpr size_t maxDimensions = 8;
+
+// One row of the level a query is evaluated over, with its parents
+struct Fact {
+    sid_t cluster = {};
+    const TopicRow *topic = {};
+    const SubscriptionRow *subscription = {};
+    const ConsumerRow *consumer = {};
+    const PublisherRow *producer = {};
+    const ReplicationRow *link = {};
+};
+
+struct Dimension {
+    string_view name;
+    Level level;
+    sid_t (*get)(const Fact&);
+};
+
+const Dimension dimensions[] = {
+    {"cluster", Level::TOPIC, [](const Fact& f) { return f.cluster; }},
+    {"tenant", Level::TOPIC, [](const Fact& f) { return f.topic->tenant; }},
+    {"namespace", Level::TOPIC, [](const Fact& f) { return f.topic->ns; }},
+    {"topic", Level::TOPIC, [](const Fact& f) { return f.topic->topic; }},
+    {"subscription", Level::SUBSCRIPTION, [](const Fact& f) { return f.subscription->name; }},
+    {"type", Level::SUBSCRIPTION, [](const Fact& f) { return f.subscription->type; }},
+    {"consumer", Level::CONSUMER, [](const Fact& f) { return f.consumer->consumerName; }},
+    {"clientVersion", Level::CONSUMER, [](const Fact& f) { return f.consumer->clientVersion; }},
+    {"consumerAddress", Level::CONSUMER, [](const Fact& f) { return f.consumer->address; }},
+    {"producer", Level::PRODUCER, [](const Fact& f) { return f.producer->producerName; }},
+    {"address", Level::PRODUCER, [](const Fact& f) { return f.producer->address; }},
+    {"producerVersion", Level::PRODUCER, [](const Fact& f) { return f.producer->clientVersion; }},
+    {"peer", Level::REPLICATION, [](const Fact& f) { return f.link->peer; }},
+};
+
+struct Field {
+    string_view name;
+    Level level;
+    double (*get)(const Fact&);
+};
+
+// A name can be in several levels. The first one that fits the query is used.
+const Field fields[] = {
+    {"msgRateIn", Level::TOPIC, [](const Fact& f) { return f.topic->rates.msgRateIn; }},
+    {"msgThroughputIn", Level::TOPIC, [](const Fact& f) { return f.topic->rates.msgThroughputIn; }},
+    {"msgRateOut", Level::TOPIC, [](const Fact& f) { return f.topic->rates.msgRateOut; }},
+    {"msgThroughputOut", Level::TOPIC, [](const Fact& f) { return f.topic->rates.msgThroughputOut; }},
+    {"averageMsgSize", Level::TOPIC, [](const Fact& f) { return f.topic->averageMsgSize; }},
+    {"storageSize", Level::TOPIC, [](const Fact& f) { return f.topic->storageSize; }},
+    {"backlog", Level::TOPIC, [](const Fact& f) { return static_cast<double>(f.topic->backlog); }},
+    {"publishers", Level::TOPIC, [](const Fact& f) { return static_cast<double>(f.topic->numPublishers); }},
+    {"subscriptions", Level::TOPIC, [](const Fact& f) { return static_cast<double>(f.topic->numSubscriptions); }},
+
+    {"msgBacklog", Level::SUBSCRIPTION, [](const Fact& f) { return static_cast<double>(f.subscription->msgBacklog); }},
+    {"unackedMessages", Level::SUBSCRIPTION, [](const Fact& f) { return static_cast<double>(f.subscription->unackedMessages); }},
+    {"msgRateOut", Level::SUBSCRIPTION, [](const Fact& f) { return f.subscription->msgRateOut; }},
+    {"msgThroughputOut", Level::SUBSCRIPTION, [](const Fact& f) { return f.subscription->msgThroughputOut; }},
+    {"msgRateRedeliver", Level::SUBSCRIPTION, [](const Fact& f) { return f.subscription->msgRateRedeliver; }},
+    {"msgRateExpired", Level::SUBSCRIPTION, [](const Fact& f) { return f.subscription->msgRateExpired; }},
+    {"consumers", Level::SUBSCRIPTION, [](const Fact& f) { return static_cast<double>(f.subscription->numConsumers); }},
+
+    {"msgRateOut", Level::CONSUMER, [](const Fact& f) { return f.consumer->msgRateOut; }},
+    {"msgThroughputOut", Level::CONSUMER, [](const Fact& f) { return f.consumer->msgThroughputOut; }},
+    {"msgRateRedeliver", Level::CONSUMER, [](const Fact& f) { return f.consumer->msgRateRedeliver; }},
+    {"unackedMessages", Level::CONSUMER, [](const Fact& f) { return static_cast<double>(f.consumer->unackedMessages); }},
+    {"availablePermits", Level::CONSUMER, [](const Fact& f) { return static_cast<double>(f.consumer->availablePermits); }},
+
+    {"msgRateIn", Level::PRODUCER, [](const Fact& f) { return f.producer->msgRateIn; }},
+    {"msgThroughputIn", Level::PRODUCER, [](const Fact& f) { return f.producer->msgThroughputIn; }},
+    {"averageMsgSize", Level::PRODUCER, [](const Fact& f) { return f.producer->averageMsgSize; }},
+
+    {"replicationBacklog", Level::REPLICATION, [](const Fact& f) { return static_cast<double>(f.link->replicationBacklog); }},
+    {"replicationDelayInSeconds", Level::REPLICATION, [](const Fact& f) { return static_cast<double>(f.link->replicationDelayInSeconds); }},
+    {"disconnected", Level::REPLICATION, [](const Fact& f) { return f.link->connected ? 0.0 : 1.0; }},
+    {"msgRateIn", Level::REPLICATION, [](const Fact& f) { return f.link->rates.msgRateIn; }},
+    {"msgThroughputIn", Level::REPLICATION, [](const Fact& f) { return f.link->rates.msgThroughputIn; }},
+    {"msgRateOut", Level::REPLICATION, [](const Fact& f) { return f.link->rates.msgRateOut; }},
+    {"msgThroughputOut", Level::REPLICATION, [](const Fact& f) { return f.link->rates.msgThroughputOut; }},
+    {"msgRateExpired", Level::REPLICATION, [](const Fact& f) { return f.link->msgRateExpired; }},
+};
+
+const char *toString(Level level) noexcept {
+    switch(level) {
+    case Level::TOPIC:
+        return "topic";
+    case Level::SUBSCRIPTION:
+        return "subscription";
+    case Level::CONSUMER:
+        return "consumer";
+    case Level::PRODUCER:
+        return "producer";
+    case Level::REPLICATION:
+        return "replication link";
+    }
+    return "?";
+}
+
+// True if rows of `detail` have a row of `level` as a parent, or are the same
+bool within(Level level, Level detail) noexcept {
+    return level == detail || level == Level::TOPIC
+            || (level == Level::SUBSCRIPTION && detail == Level::CONSUMER);
+}
+
+vector<string> split(const string& text, char sep) {
+    vector<string> parts;
+    istringstream in{text};
+    for(string part; getline(in, part, sep);) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+using GroupKey = array<sid_t, maxDimensions>;
+
+uint64_t hash(const GroupKey& key) noexcept {
+    uint64_t h = 0;
+    for(const auto id : key) {
+        h = (h + id) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+struct Acc {
+    double sum = 0;
+    double min = numeric_limits<double>::infinity();
+    double max = -numeric_limits<double>::infinity();
+    uint64_t count = 0;
+    vector<double> values; // Only for percentiles
+
+    void add(double v, bool keep) {
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+        ++count;
+        if (keep) {
+            values.push_back(v);
+        }
+    }
+
+    void merge(Acc&& v) {
+        sum += v.sum;
+        min = std::min(min, v.min);
+        max = std::max(max, v.max);
+        count += v.count;
+        values.insert(values.end(), v.values.begin(), v.values.end());
+    }
+};
+
+// The groups of one or more clusters. The accumulators are in one
+// array, `width` per group, in the order the groups were first seen.
+// The index is open addressing with linear probing, like the StringPool,
+// as a node per group costs more than the aggregation itself.
+struct Groups {
+    explicit Groups(size_t width)
+        : width{width} {}
+
+    Acc *group(const GroupKey& key) {
+        // Rows of the same group often come in runs, like the
+        // subscriptions of a topic
+        if (last < keys.size() && keys[last] == key) {
+            return &accs[last * width];
+        }
+
+        if ((keys.size() + 1) * 2 > table.size()) {
+            rehash();
+        }
+        const auto h = hash(key);
+        const auto mask = table.size() - 1;
+        for(auto i = h & mask;; i = (i + 1) & mask) {
+            auto& slot = table[i];
+            if (slot == empty) {
+                slot = last = static_cast<uint32_t>(keys.size());
+                keys.push_back(key);
+                hashes.push_back(h);
+                accs.resize(accs.size() + width);
+                break;
+            }
+            if (hashes[slot] == h && keys[slot] == key) {
+                last = slot;
+                break;
+            }
+        }
+        return &accs[last * width];
+    }
+
+    void merge(Groups&& v) {
+        facts += v.facts;
+        if (keys.empty()) {
+            swap(table, v.table);
+            swap(keys, v.keys);
+            swap(hashes, v.hashes);
+            swap(accs, v.accs);
+            return;
+        }
+        for(size_t i = 0; i < v.keys.size(); ++i) {
+            auto *to = group(v.keys[i]);
+            for(size_t a = 0; a < width; ++a) {
+                to[a].merge(move(v.accs[i * width + a]));
+            }
+        }
+    }
+
+    void rehash() {
+        table.assign(max<size_t>(64, table.size() * 2), empty);
+        const auto mask = table.size() - 1;
+        for(uint32_t g = 0; g < keys.size(); ++g) {
+            auto i = hashes[g] & mask;
+            while(table[i] != empty) {
+                i = (i + 1) & mask;
+            }
+            table[i] = g;
+        }
+    }
+
+    static constexpr uint32_t empty = ~uint32_t{};
+
+    const size_t width;
+    vector<uint32_t> table; // Group indexes
+    vector<GroupKey> keys;
+    vector<uint64_t> hashes;
+    vector<Acc> accs;
+    size_t facts = 0;
+    uint32_t last = empty;
+};
+
+} // anon ns
+
+Query Query::parse(const string &text)
+{
+    Query q;
+    q.text_ = text;
+
+    auto words = split(text, ' ');
+    size_t w = 0;
+    if (w < words.size() && words[w] == "top") {
+        if (++w == words.size()) {
+            throw invalid_argument("Expected a number after top");
+        }
+        try {
+            size_t pos = 0;
+            q.top_ = stoul(words[w], &pos);
+            if (pos != words[w].size() || !q.top_) {
+                throw invalid_argument("");
+            }
+        } catch (const exception&) {
+            throw invalid_argument("Expected a number after top, got: "s + words[w]);
+        }
+        ++w;
+    }
+
+    if (w == words.size()) {
+        throw invalid_argument("Expected one or more aggregates, like sum(msgBacklog)");
+    }
+    const auto aggregates = split(words[w++], ',');
+
+    if (w < words.size()) {
+        if (words[w] != "by" || w + 2 != words.size()) {
+            throw invalid_argument("Expected: [top <n>] <aggregates> [by <dimensions>]");
+        }
+        for(const auto& name : split(words[w + 1], ',')) {
+            const auto it = find_if(begin(dimensions), end(dimensions), [&name](const auto& d) {
+                return d.name == name;
+            });
+            if (it == end(dimensions)) {
+                throw invalid_argument("Unknown dimension: "s + name);
+            }
+            if (q.dimensions_.size() == maxDimensions) {
+                throw invalid_argument("Too many dimensions");
+            }
+            if (within(q.level_, it->level)) {
+                q.level_ = it->level;
+            } else if (!within(it->level, q.level_)) {
+                throw invalid_argument("Can't group by both "s + toString(q.level_) + " and "
+                                       + toString(it->level) + " dimensions");
+            }
+            q.dimensions_.push_back(static_cast<size_t>(it - begin(dimensions)));
+        }
+    }
+
+    // The aggregates' fields may make the query more detailed. Each must
+    // then be found at the level we end up with.
+    vector<string> names;
+    for(const auto& agg : aggregates) {
+        Aggregate a;
+        a.name = agg;
+        string field;
+        if (agg == "count" || agg == "count()") {
+            a.function = Function::COUNT;
+        } else {
+            const auto open = agg.find('(');
+            if (open == string::npos || agg.back() != ')') {
+                throw invalid_argument("Expected <function>(<field>), got: "s + agg);
+            }
+            const auto function = agg.substr(0, open);
+            field = agg.substr(open + 1, agg.size() - open - 2);
+            if (function == "sum") {
+                a.function = Function::SUM;
+            } else if (function == "min") {
+                a.function = Function::MIN;
+            } else if (function == "max") {
+                a.function = Function::MAX;
+            } else if (function == "avg") {
+                a.function = Function::AVG;
+            } else if (function.size() > 1 && function[0] == 'p') {
+                a.function = Function::PERCENTILE;
+                try {
+                    size_t pos = 0;
+                    a.percentile = stod(function.substr(1), &pos) / 100.0;
+                    if (pos + 1 != function.size() || a.percentile < 0 || a.percentile > 1) {
+                        throw invalid_argument("");
+                    }
+                } catch (const exception&) {
+                    throw invalid_argument("Expected a percentile like p99, got: "s + function);
+                }
+            } else {
+                throw invalid_argument("Unknown function: "s + function);
+            }
+
+            bool known = false;
+            for(const auto& f : fields) {
+                if (f.name != field) {
+                    continue;
+                }
+                known = true;
+                if (f.level == q.level_) {
+                    break;
+                }
+                if (within(q.level_, f.level)) {
+                    q.level_ = f.level;
+                    break;
+                }
+            }
+            if (!known) {
+                throw invalid_argument("Unknown field: "s + field);
+            }
+        }
+        names.push_back(field);
+        q.aggregates_.push_back(move(a));
+    }
+
+    for(size_t i = 0; i < q.aggregates_.size(); ++i) {
+        auto& a = q.aggregates_[i];
+        if (a.function == Function::COUNT) {
+            continue;
+        }
+        const auto it = find_if(begin(fields), end(fields), [&](const auto& f) {
+            return f.name == names[i] && f.level == q.level_;
+        });
+        if (it == end(fields)) {
+            throw invalid_argument(names[i] + " is not a field of a "s + toString(q.level_));
+        }
+        a.field = static_cast<size_t>(it - begin(fields));
+    }
+
+    return q;
+}
+
+Query::Result Query::run(const vector<const Engine::Cluster *> &clusters, size_t threads) const
+{
+    const auto width = aggregates_.size();
+    vector<bool> keep(width);
+    for(size_t a = 0; a < width; ++a) {
+        keep[a] = aggregates_[a].function == Function::PERCENTILE;
+    }
+
+    auto aggregate = [&](const Engine::Cluster& cluster) {
+        Groups groups{width};
+        const auto& store = *cluster.store;
+        Fact fact;
+        fact.cluster = store.pool().intern(cluster.name);
+
+        auto add = [&] {
+            GroupKey key = {};
+            for(size_t d = 0; d < dimensions_.size(); ++d) {
+                key[d] = dimensions[dimensions_[d]].get(fact);
+            }
+            auto *acc = groups.group(key);
+            for(size_t a = 0; a < width; ++a) {
+                const auto& agg = aggregates_[a];
+                acc[a].add(agg.function == Function::COUNT ? 1.0 : fields[agg.field].get(fact), keep[a]);
+            }
+            ++groups.facts;
+        };
+
+        for(const auto& topic : store.topics()) {
+            fact.topic = &topic;
+            switch(level_) {
+            case Level::TOPIC:
+                add();
+                break;
+            case Level::SUBSCRIPTION:
+            case Level::CONSUMER:
+                for(const auto& s : store.subscriptions(topic)) {
+                    fact.subscription = &s;
+                    if (level_ == Level::SUBSCRIPTION) {
+                        add();
+                        continue;
+                    }
+                    for(const auto& c : store.consumers(s)) {
+                        fact.consumer = &c;
+                        add();
+                    }
+                }
+                break;
+            case Level::PRODUCER:
+                for(const auto& p : store.publishers(topic)) {
+                    fact.producer = &p;
+                    add();
+                }
+                break;
+            case Level::REPLICATION:
+                for(const auto& r : store.replication(topic)) {
+                    fact.link = &r;
+                    add();
+                }
+                break;
+            }
+        }
+        return groups;
+    };
+
+    vector<future<Groups>> partials;
+    for(const auto *cluster : clusters) {
+        partials.emplace_back(async(threads > 1 ? launch::async : launch::deferred, [&aggregate, cluster] {
+            return aggregate(*cluster);
+        }));
+    }
+
+    Groups groups{width};
+    for(auto& p : partials) {
+        groups.merge(p.get());
+    }
+
+    // The values of each group, in one array
+    const auto count = groups.keys.size();
+    vector<double> values(count * width);
+    for(size_t g = 0; g < count; ++g) {
+        for(size_t a = 0; a < width; ++a) {
+            auto& acc = groups.accs[g * width + a];
+            auto& v = values[g * width + a];
+            switch(aggregates_[a].function) {
+            case Function::SUM:
+                v = acc.sum;
+                break;
+            case Function::MIN:
+                v = acc.count ? acc.min : 0;
+                break;
+            case Function::MAX:
+                v = acc.count ? acc.max : 0;
+                break;
+            case Function::AVG:
+                v = acc.count ? acc.sum / static_cast<double>(acc.count) : 0;
+                break;
+            case Function::COUNT:
+                v = static_cast<double>(acc.count);
+                break;
+            case Function::PERCENTILE: {
+                auto& all = acc.values;
+                if (all.empty()) {
+                    v = 0;
+                    break;
+                }
+                const auto nth = all.begin() + static_cast<ptrdiff_t>(
+                            lround(aggregates_[a].percentile * static_cast<double>(all.size() - 1)));
+                nth_element(all.begin(), nth, all.end());
+                v = *nth;
+            } break;
+            }
+        }
+    }
+
+    // Only the groups we show are sorted, and ties are broken on the keys
+    const StringPool *pool = clusters.empty() ? nullptr : &clusters.front()->store->pool();
+    vector<uint32_t> order(count);
+    for(uint32_t g = 0; g < count; ++g) {
+        order[g] = g;
+    }
+    const auto shown = top_ ? min<size_t>(top_, count) : count;
+    partial_sort(order.begin(), order.begin() + static_cast<ptrdiff_t>(shown), order.end(),
+                 [&](uint32_t a, uint32_t b) {
+        if (width && values[a * width] != values[b * width]) {
+            return values[a * width] > values[b * width];
+        }
+        for(size_t d = 0; d < dimensions_.size(); ++d) {
+            const auto& ka = groups.keys[a][d];
+            const auto& kb = groups.keys[b][d];
+            if (ka != kb) {
+                return pool->str(ka) < pool->str(kb);
+            }
+        }
+        return false;
+    });
+
+    Result result;
+    result.groups = count;
+    result.facts = groups.facts;
+    for(const auto d : dimensions_) {
+        result.columns.emplace_back(dimensions[d].name);
+    }
+    for(const auto& a : aggregates_) {
+        result.columns.push_back(a.name);
+    }
+    result.rows.reserve(shown);
+    for(size_t i = 0; i < shown; ++i) {
+        const auto g = order[i];
+        Result::Row row;
+        for(size_t d = 0; d < dimensions_.size(); ++d) {
+            row.keys.push_back(pool->str(groups.keys[g][d]));
+        }
+        row.values.assign(values.begin() + static_cast<ptrdiff_t>(g * width),
+                          values.begin() + static_cast<ptrdiff_t>((g + 1) * width));
+        result.rows.push_back(move(row));
+    }
+    return result;
+}
+
+void Query::print(const Result &result, ostream &out)
+{
+    // Format the cells first, to size the columns
+    vector<vector<string>> cells;
+    cells.reserve(result.rows.size());
+    for(const auto& row : result.rows) {
+        auto& line = cells.emplace_back();
+        for(const auto key : row.keys) {
+            line.emplace_back(key.empty() ? "-"sv : key);
+        }
+        for(const auto v : row.values) {
+            ostringstream s;
+            if (v == floor(v) && fabs(v) < 1e15) {
+                s << static_cast<int64_t>(v);
+            } else {
+                s << fixed << setprecision(2) << v;
+            }
+            line.push_back(s.str());
+        }
+    }
+
+    vector<size_t> widths;
+    for(const auto& c : result.columns) {
+        widths.push_back(c.size());
+    }
+    for(const auto& line : cells) {
+        for(size_t i = 0; i < line.size(); ++i) {
+            widths[i] = max(widths[i], line[i].size());
+        }
+    }
+
+    const auto keys = result.rows.empty() ? result.columns.size() : result.rows.front().keys.size();
+    auto printLine = [&](const vector<string>& line) {
+        for(size_t i = 0; i < line.size(); ++i) {
+            if (i) {
+                out << "  ";
+            }
+            // Keys to the left, numbers to the right
+            out << (i < keys ? left : right) << setw(static_cast<int>(widths[i])) << line[i];
+        }
+        out << right << endl;
+    };
+
+    printLine(result.columns);
+    for(const auto& line : cells) {
+        printLine(line);
+    }
+    out << result.rows.size() << " of " << result.groups << " groups, from " << result.facts << " rows." << endl;
+}
+
+string Query::dimensionNames()
+{
+    string names;
+    for(const auto& d : dimensions) {
+        if (!names.empty()) {
+            names += ", ";
+        }
+        names += d.name;
+    }
+    return names;
+}
+
+string Query::fieldNames()
+{
+    vector<string_view> names;
+    for(const auto& f : fields) {
+        if (find(names.begin(), names.end(), f.name) == names.end()) {
+            names.push_back(f.name);
+        }
+    }
+
+    string all;
+    for(const auto name : names) {
+        if (!all.empty()) {
+            all += ", ";
+        }
+        all += name;
+    }
+    return all;
+}
+
+} // ns
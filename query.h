@@ -0,0 +1,86 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pulsar.h"
+
+namespace purech {
+
+/*! Group-by and top-N queries over the topic stores of a scan.
+ *
+ *  A query is text like:
+ *
+ *    top 20 sum(msgBacklog) by cluster,topic,subscription
+ *    max(replicationDelayInSeconds),p99(replicationDelayInSeconds) by peer
+ *    count,sum(msgThroughputOut) by type
+ *
+ *  The aggregates are sum, min, max, avg, count and pNN, a percentile.
+ *  The groups are sorted on the first aggregate, largest first, and
+ *  `top N` keeps the first N.
+ *
+ *  Each query is evaluated over one kind of row: topics, subscriptions,
+ *  consumers, producers or replication links. The kind is the most
+ *  detailed one named by the dimensions and fields. A field like
+ *  msgRateOut means the subscription's rate in a query by subscription,
+ *  and the topic's rate in a query by tenant.
+ *
+ *  The clusters are aggregated in parallel into hash tables keyed on
+ *  the interned ids, which are merged, and only the top N groups are
+ *  sorted and resolved to strings. The stores must share a StringPool
+ *  and be sealed.
+ */
+class Query {
+public:
+    enum class Level { TOPIC, SUBSCRIPTION, CONSUMER, PRODUCER, REPLICATION };
+    enum class Function { SUM, MIN, MAX, AVG, COUNT, PERCENTILE };
+
+    struct Aggregate {
+        Function function = Function::SUM;
+        size_t field = 0; // In the field table. Not used by COUNT
+        double percentile = 0; // 0 - 1
+        std::string name; // As written
+    };
+
+    struct Result {
+        struct Row {
+            std::vector<std::string_view> keys;
+            std::vector<double> values;
+        };
+
+        std::vector<std::string> columns; // The dimensions, then the aggregates
+        std::vector<Row> rows;
+        size_t groups = 0; // Before top-N
+        size_t facts = 0; // Rows that were aggregated
+    };
+
+    // Throws std::invalid_argument if the text is not a valid query
+    static Query parse(const std::string& text);
+
+    Result run(const std::vector<const Engine::Cluster *>& clusters, size_t threads = 1) const;
+
+    static void print(const Result& result, std::ostream& out);
+
+    const std::string& text() const noexcept {
+        return text_;
+    }
+
+    Level level() const noexcept {
+        return level_;
+    }
+
+    // The names of the dimensions and the fields, for the help text
+    static std::string dimensionNames();
+    static std::string fieldNames();
+
+private:
+    std::string text_;
+    Level level_ = Level::TOPIC;
+    std::vector<size_t> dimensions_; // In the dimension table
+    std::vector<Aggregate> aggregates_;
+    size_t top_ = 0; // 0 means all the groups
+};
+
+} // ns
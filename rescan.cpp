@@ -0,0 +1,123 @@
+
+#include "rescan.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+bool idle(const TopicRow& row) noexcept {
+    if (row.rates.msgRateIn > 0 || row.rates.msgRateOut > 0 || row.backlog) {
+        return false;
+    }
+
+    // A replication link that is behind or down is what we are looking for
+    for(uint32_t i = 0; i < row.numReplication; ++i) {
+        const auto& r = row.replication[i];
+        if (r.replicationBacklog || !r.connected) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // anon ns
+
+Rescan::Rescan(StringPool &pool, Options options)
+    : pool_{pool}, options_{options}
+{
+}
+
+void Rescan::begin(unique_ptr<TopicStore> previous, Engine::Cluster::tenants_t &&tree)
+{
+    ++scan_;
+    previous_ = move(previous);
+    tree_ = move(tree);
+    reused_.clear();
+
+    index_.clear();
+    if (previous_) {
+        const auto& rows = previous_->topics();
+        index_.reserve(rows.size());
+        for(uint32_t i = 0; i < rows.size(); ++i) {
+            index_.emplace(rows[i].topic, i);
+        }
+    }
+}
+
+bool Rescan::sameTopics(const string &ns, const vector<string> &topics)
+{
+    // The brokers don't promise an order, so the hashes are summed
+    uint64_t h = topics.size();
+    for(const auto& topic : topics) {
+        h += Shard::hash(topic);
+    }
+
+    lock_guard lock{mutex_};
+    auto& known = lists_[ns];
+    return exchange(known, h) == h;
+}
+
+const TopicRow *Rescan::reuse(const string &topic)
+{
+    const auto id = pool_.find(topic);
+    if (id == StringPool::none) {
+        return {};
+    }
+
+    const auto it = index_.find(id);
+    if (it == index_.end()) {
+        return {};
+    }
+
+    const auto& row = previous_->topics()[it->second];
+    if (!idle(row)) {
+        return {};
+    }
+
+    // Each idle topic is fetched again in its own slot of the cycle, so
+    // that not all of them are due in the same scan
+    const auto f = fetched_.find(id);
+    if (f == fetched_.end() || options_.idleScans <= 1 || scan_ - f->second >= options_.idleScans
+            || (scan_ + id) % options_.idleScans == 0) {
+        return {};
+    }
+
+    lock_guard lock{mutex_};
+    reused_.insert(id);
+    return &row;
+}
+
+Namespace *Rescan::previous(const string &tenant, const string &ns)
+{
+    // Only looked up, so the map is not changed by the scan's threads
+    if (auto t = tree_.find(tenant); t != tree_.end()) {
+        if (auto n = t->second.namespaces.find(ns); n != t->second.namespaces.end()) {
+            return &n->second;
+        }
+    }
+    return {};
+}
+
+void Rescan::end(const TopicStore &store)
+{
+    // Topics that are gone are forgotten
+    decltype(fetched_) fetched;
+    fetched.reserve(store.topics().size());
+    for(const auto& row : store.topics()) {
+        if (reused_.count(row.topic)) {
+            fetched.emplace(row.topic, fetched_[row.topic]);
+        } else {
+            fetched.emplace(row.topic, scan_);
+        }
+    }
+    fetched_.swap(fetched);
+
+    // The rows we used are copied to the new store
+    tree_.clear();
+    index_.clear();
+    previous_.reset();
+}
+
+} // ns
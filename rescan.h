@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "pulsar.h"
+
+namespace purech {
+
+/*! Decides which topics an incremental scan fetches again.
+ *
+ *  Each scan keeps the one before it: its topic store and, if kept,
+ *  its topic tree and partition stats. A topic that was idle in the last scan (no
+ *  messages in or out, no backlog, and each replication link connected
+ *  with nothing to send), in a namespace whose topic list is the same
+ *  as then, keeps its stats from the last scan until it's due to be
+ *  fetched again. So once the scans are warm, the requests
+ *  scale with the active topics rather than with all the topics.
+ *
+ *  One per cluster. The calls between begin() and end() are thread-safe.
+ */
+class Rescan {
+public:
+    struct Options {
+        size_t idleScans = 10; // Fetch each idle topic again once in this many scans. 1 or less fetches all
+    };
+
+    Rescan(StringPool& pool, Options options);
+
+    // Starts a scan, with the store and topic tree of the last one
+    void begin(std::unique_ptr<TopicStore> previous, Engine::Cluster::tenants_t&& tree);
+
+    // Notes the namespace's topic list. True if it's the same as in the last scan.
+    bool sameTopics(const std::string& ns, const std::vector<std::string>& topics);
+
+    // The topic's row from the last scan, if it's used instead of fetching the topic
+    const TopicRow *reuse(const std::string& topic);
+
+    // The topic in the last scan's tree, if it's there. For moving into the new tree.
+    Namespace *previous(const std::string& tenant, const std::string& ns);
+
+    // Ends the scan. `store` is the sealed store of this scan.
+    void end(const TopicStore& store);
+
+    // Topics that kept their stats in this scan
+    size_t reused() const {
+        std::lock_guard lock{mutex_};
+        return reused_.size();
+    }
+
+private:
+    StringPool& pool_;
+    const Options options_;
+    size_t scan_ = 0;
+    std::unique_ptr<TopicStore> previous_;
+    Engine::Cluster::tenants_t tree_;
+    std::unordered_map<sid_t /* topic */, uint32_t /* row */> index_; // In previous_
+    std::unordered_map<sid_t /* topic */, size_t /* scan */> fetched_; // When the stats were fetched
+    std::unordered_map<std::string /* ns */, uint64_t> lists_; // Hash of each namespace's topic list
+
+    mutable std::mutex mutex_; // Guards lists_ and reused_ while scanning
+    std::unordered_set<sid_t /* topic */> reused_;
+};
+
+} // ns
@@ -0,0 +1,248 @@
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+#include "sample.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+// 95% two-sided
+constexpr double z95 = 1.96;
+
+enum Variable {
+    RATE_IN,
+    THROUGHPUT_IN,
+    RATE_OUT,
+    THROUGHPUT_OUT,
+    DISCONNECTED,
+    BACKLOGGED,
+    VARIABLES_
+};
+
+// Sums for the sampled topics of one stratum
+struct Sums {
+    size_t n = 0;
+    array<double, VARIABLES_> sum = {};
+    array<double, VARIABLES_> squares = {};
+
+    void add(const array<double, VARIABLES_>& values) {
+        ++n;
+        for(size_t i = 0; i < values.size(); ++i) {
+            sum[i] += values[i];
+            squares[i] += values[i] * values[i];
+        }
+    }
+};
+
+// Stratified estimate of a total: sum of N * mean, and its variance
+// sum of N^2 * (1 - n/N) * s^2 / n
+struct Total {
+    double value = 0;
+    double variance = 0;
+
+    void add(double N, const Sums& s, size_t var) {
+        const auto n = static_cast<double>(s.n);
+        const auto mean = s.sum[var] / n;
+        value += N * mean;
+        if (s.n > 1 && n < N) {
+            const auto s2 = max(0.0, (s.squares[var] - n * mean * mean) / (n - 1));
+            variance += N * N * (1 - n / N) * s2 / n;
+        }
+    }
+
+    Sampler::Estimate estimate(double scale = 1) const {
+        return {value / scale, z95 * sqrt(variance) / scale};
+    }
+};
+
+// The lines are formatted on their own, so that `out` keeps its flags
+
+void formatRate(ostream& out, const char *name, const Sampler::Estimate& e) {
+    ostringstream line;
+    line << "  " << left << setw(20) << name << right << fixed << setprecision(1)
+         << e.value << " +/- " << e.margin;
+    out << line.str() << endl;
+}
+
+void formatFraction(ostream& out, const string& name, const Sampler::Estimate& e, size_t topics) {
+    ostringstream line;
+    line << "  " << left << setw(20) << name << right << fixed << setprecision(2)
+         << (100.0 * e.value) << "% +/- " << (100.0 * e.margin) << "% of the topics (about "
+         << setprecision(0) << (e.value * static_cast<double>(topics)) << ')';
+    out << line.str() << endl;
+}
+
+} // anon ns
+
+vector<SampleStratum::Topic> SampleStratum::start()
+{
+    return take(step_);
+}
+
+vector<SampleStratum::Topic> SampleStratum::widen()
+{
+    return take(step_);
+}
+
+vector<SampleStratum::Topic> SampleStratum::take(size_t count)
+{
+    lock_guard lock{mutex_};
+    const auto begin = next_;
+    next_ = min(ranked_.size(), next_ + count);
+    if (begin && next_ > begin) {
+        widened_ = true;
+    }
+    return {ranked_.begin() + static_cast<ptrdiff_t>(begin), ranked_.begin() + static_cast<ptrdiff_t>(next_)};
+}
+
+shared_ptr<SampleStratum> Sampler::stratum(vector<SampleStratum::Topic> topics) const
+{
+    // Sorting on the seeded hash shuffles the topics the same way,
+    // whatever order the broker listed them in
+    vector<pair<uint64_t, size_t>> keys;
+    keys.reserve(topics.size());
+    for(size_t i = 0; i < topics.size(); ++i) {
+        keys.emplace_back(Shard::hash(topics[i].name) ^ (options_.seed * 0x9E3779B97F4A7C15ull), i);
+    }
+    sort(keys.begin(), keys.end());
+
+    vector<SampleStratum::Topic> ranked;
+    ranked.reserve(topics.size());
+    for(const auto& [_, i] : keys) {
+        ranked.push_back(move(topics[i]));
+    }
+
+    const auto initial = max(options_.minTopics,
+                             static_cast<size_t>(ceil(options_.fraction * static_cast<double>(ranked.size()))));
+    return make_shared<SampleStratum>(move(ranked), initial);
+}
+
+bool Sampler::disconnected(const PersistentTopicStats &stats) const noexcept
+{
+    return any_of(stats.replication.begin(), stats.replication.end(), [](const auto& r) {
+        return !r.second.connected;
+    });
+}
+
+bool Sampler::backlogged(const PersistentTopicStats &stats) const noexcept
+{
+    return any_of(stats.replication.begin(), stats.replication.end(), [this](const auto& r) {
+        return r.second.replicationBacklog > 0
+                && static_cast<uint64_t>(r.second.replicationBacklog) > options_.maxBacklog;
+    });
+}
+
+Sampler::Report Sampler::estimate(const Engine::Cluster &cluster) const
+{
+    Report report;
+    report.cluster = cluster.name;
+
+    for(const auto& [_, stratum] : cluster.strata) {
+        if (stratum->widened()) {
+            ++report.widened;
+        }
+    }
+
+    const auto& store = *cluster.store;
+    const auto& rows = store.topics();
+
+    array<Total, VARIABLES_> totals;
+    auto addStratum = [&](const TopicRow& first, const Sums& sums) {
+        const Namespace *ns = {};
+        if (auto t = cluster.tenants.find(string{store.str(first.tenant)}); t != cluster.tenants.end()) {
+            if (auto n = t->second.namespaces.find(string{store.str(first.ns)}); n != t->second.namespaces.end()) {
+                ns = &n->second;
+            }
+        }
+
+        const auto N = max(sums.n, ns ? ns->listedTopics : sums.n);
+        report.topics += N;
+        report.sampled += sums.n;
+        ++report.strata;
+        for(size_t var = 0; var < VARIABLES_; ++var) {
+            totals[var].add(static_cast<double>(N), sums, var);
+        }
+    };
+
+    // The rows are sorted, so each namespace is a run
+    Sums sums;
+    const TopicRow *first = {};
+    for(const auto& row : rows) {
+        if (first && row.ns != first->ns) {
+            addStratum(*first, sums);
+            sums = {};
+        }
+        if (!sums.n) {
+            first = &row;
+        }
+
+        bool disconnected = false, backlogged = false;
+        for(const auto& r : store.replication(row)) {
+            disconnected |= !r.connected;
+            backlogged |= r.replicationBacklog > 0
+                    && static_cast<uint64_t>(r.replicationBacklog) > options_.maxBacklog;
+        }
+        sums.add({row.rates.msgRateIn, row.rates.msgThroughputIn, row.rates.msgRateOut,
+                  row.rates.msgThroughputOut, disconnected ? 1.0 : 0.0, backlogged ? 1.0 : 0.0});
+    }
+    if (sums.n) {
+        addStratum(*first, sums);
+    }
+
+    for(const auto& [_, tenant] : cluster.tenants) {
+        for(const auto& [_, ns] : tenant.namespaces) {
+            if (ns.listedTopics && !ns.fetchedTopics) {
+                report.unsampled += ns.listedTopics;
+            }
+        }
+    }
+
+    report.msgRateIn = totals[RATE_IN].estimate();
+    report.msgThroughputIn = totals[THROUGHPUT_IN].estimate();
+    report.msgRateOut = totals[RATE_OUT].estimate();
+    report.msgThroughputOut = totals[THROUGHPUT_OUT].estimate();
+    if (report.topics) {
+        const auto topics = static_cast<double>(report.topics);
+        report.disconnected = totals[DISCONNECTED].estimate(topics);
+        report.backlogged = totals[BACKLOGGED].estimate(topics);
+    }
+    return report;
+}
+
+void Sampler::print(const vector<Report> &reports, ostream &out) const
+{
+    out << "Sample estimates, with 95% confidence intervals (seed " << options_.seed << "):" << endl;
+    for(const auto& r : reports) {
+        out << "Cluster " << r.cluster << ": Sampled " << r.sampled << " of " << r.topics
+            << " topics in " << r.strata << " namespaces";
+        if (r.widened) {
+            out << ", " << r.widened << " widened where problems were found";
+        }
+        out << '.';
+        if (r.unsampled) {
+            out << ' ' << r.unsampled << " topics in namespaces without samples are not included.";
+        }
+        out << endl;
+
+        if (!r.sampled) {
+            continue;
+        }
+
+        formatRate(out, "msgRateIn", r.msgRateIn);
+        formatRate(out, "msgThroughputIn", r.msgThroughputIn);
+        formatRate(out, "msgRateOut", r.msgRateOut);
+        formatRate(out, "msgThroughputOut", r.msgThroughputOut);
+        formatFraction(out, "Disconnected links", r.disconnected, r.topics);
+        formatFraction(out, "Backlog > " + to_string(options_.maxBacklog), r.backlogged, r.topics);
+    }
+}
+
+} // ns
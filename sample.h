@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pulsar.h"
+
+namespace purech {
+
+/*! The topics of one namespace in --sample mode, in the order they
+ *  are sampled.
+ *
+ *  The sample is the first topics in that order. Each problem found
+ *  widens it by its initial size, until it has all the topics.
+ */
+class SampleStratum {
+public:
+    struct Topic {
+        std::string name;
+        bool partitioned = false;
+    };
+
+    SampleStratum(std::vector<Topic> ranked, size_t initial)
+        : ranked_{std::move(ranked)}, step_{std::max<size_t>(initial, 1)} {}
+
+    // The initial sample
+    std::vector<Topic> start();
+
+    // A sampled topic has a problem. Returns the topics to add to the sample.
+    std::vector<Topic> widen();
+
+    size_t topics() const noexcept {
+        return ranked_.size();
+    }
+
+    bool widened() const {
+        std::lock_guard lock{mutex_};
+        return widened_;
+    }
+
+private:
+    std::vector<Topic> take(size_t count);
+
+    const std::vector<Topic> ranked_;
+    const size_t step_;
+    mutable std::mutex mutex_;
+    size_t next_ = 0;
+    bool widened_ = false;
+};
+
+/*! Picks the topics to fetch in --sample mode, and estimates what a
+ *  full scan would have found from them.
+ *
+ *  Each namespace is a stratum. Its topics are ordered by a seeded hash
+ *  of their names, so a seed picks the same topics in every run and in
+ *  every cluster. The totals are stratified estimates, with 95%
+ *  confidence intervals from the variance within each namespace.
+ *
+ *  Widening a stratum where problems are found makes the estimates a
+ *  little pessimistic, as the sample stops growing on a problem rather
+ *  than at a fixed size. That's the side we want to err on in a health
+ *  check.
+ */
+class Sampler {
+public:
+    struct Options {
+        double fraction = 0.05; // Of the topics in each namespace
+        size_t minTopics = 2; // Per namespace, if it has them
+        uint64_t seed = 1;
+        uint64_t maxBacklog = 10000; // Replication backlog that counts as a problem
+    };
+
+    // A value with the half-width of its 95% confidence interval
+    struct Estimate {
+        double value = 0;
+        double margin = 0;
+    };
+
+    struct Report {
+        std::string cluster;
+        size_t topics = 0; // In the namespaces with samples
+        size_t sampled = 0; // Topics with stats
+        size_t strata = 0; // Namespaces with samples
+        size_t widened = 0; // Namespaces whose sample was widened
+        size_t unsampled = 0; // Topics in namespaces where we got no stats
+        Estimate msgRateIn;
+        Estimate msgThroughputIn;
+        Estimate msgRateOut;
+        Estimate msgThroughputOut;
+        Estimate disconnected; // Fraction of the topics with a disconnected replication link
+        Estimate backlogged; // Fraction of the topics with a link over the max backlog
+    };
+
+    explicit Sampler(const Options& options)
+        : options_{options} {}
+
+    std::shared_ptr<SampleStratum> stratum(std::vector<SampleStratum::Topic> topics) const;
+
+    bool disconnected(const PersistentTopicStats& stats) const noexcept;
+    bool backlogged(const PersistentTopicStats& stats) const noexcept;
+
+    // For an aggregated cluster
+    Report estimate(const Engine::Cluster& cluster) const;
+
+    void print(const std::vector<Report>& reports, std::ostream& out) const;
+
+    const Options& options() const noexcept {
+        return options_;
+    }
+
+private:
+    const Options options_;
+};
+
+} // ns
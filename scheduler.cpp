@@ -0,0 +1,132 @@
+
+#include "scheduler.h"
+#include "pulsar.h"
+
+using namespace std;
+using namespace restc_cpp;
+
+namespace purech {
+
+shared_ptr<Scheduler> Scheduler::Create(RestClient &client, size_t maxInflight)
+{
+    return shared_ptr<Scheduler>(new Scheduler(client, maxInflight));
+}
+
+Scheduler::Scheduler(RestClient &client, size_t maxInflight)
+    : client_{client}, maxInflight_{max<size_t>(maxInflight, 1)}
+{
+}
+
+void Scheduler::add(job_t job)
+{
+    if (cancelled_) {
+        return;
+    }
+
+    lock_guard<mutex> lock{mutex_};
+    queue_.emplace_back(move(job));
+    schedule();
+}
+
+bool Scheduler::tryRun(job_t job)
+{
+    if (cancelled_) {
+        return false;
+    }
+
+    lock_guard<mutex> lock{mutex_};
+    if (finished_ || active_ >= maxInflight_) {
+        return false;
+    }
+
+    // The co-routine goes on with the queue when the job is done
+    ++active_;
+    client_.Process([self=shared_from_this(), job=move(job)](Context& ctx) mutable {
+        self->work(ctx, move(job));
+    });
+    return true;
+}
+
+future<void> Scheduler::done()
+{
+    return done_.get_future();
+}
+
+void Scheduler::cancel()
+{
+    fail({});
+}
+
+shared_lock<shared_mutex> Scheduler::guard()
+{
+    shared_lock<shared_mutex> lock{guard_};
+    if (cancelled_) {
+        lock.unlock();
+    }
+    return lock;
+}
+
+// Must be called with the mutex locked
+void Scheduler::schedule()
+{
+    while (active_ < maxInflight_ && !queue_.empty()) {
+        ++active_;
+        client_.Process([self=shared_from_this()](Context& ctx) {
+            self->work(ctx);
+        });
+    }
+}
+
+void Scheduler::work(Context &ctx, job_t job)
+{
+    while(true) {
+        if (job) {
+            try {
+                job(ctx);
+            } catch (const Fatal& ex) {
+                LOG_ERROR << "Giving up on the scan: " << ex.what();
+                fail(current_exception());
+            } catch (const std::exception& ex) {
+                LOG_WARN << "Job failed: " << ex.what();
+            }
+        }
+
+        lock_guard<mutex> lock{mutex_};
+        if (queue_.empty()) {
+            if (--active_ == 0) {
+                finish();
+            }
+            return;
+        }
+        job = move(queue_.front());
+        queue_.pop_front();
+    }
+}
+
+// Cancels, and satisfies done() with the error, if there is one
+void Scheduler::fail(exception_ptr error)
+{
+    {
+        unique_lock<shared_mutex> lock{guard_};
+        cancelled_ = true;
+    }
+
+    lock_guard<mutex> lock{mutex_};
+    queue_.clear();
+    finish(error);
+}
+
+// Must be called with the mutex locked
+void Scheduler::finish(exception_ptr error)
+{
+    if (!finished_) {
+        finished_ = true;
+        if (error) {
+            done_.set_exception(error);
+        } else {
+            done_.set_value();
+        }
+    }
+}
+
+} // ns
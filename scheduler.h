@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+
+#include "restc-cpp/restc-cpp.h"
+
+namespace purech {
+
+/*! Work-queue that runs jobs as restc-cpp co-routines.
+ *
+ *  At most `maxInflight` jobs are active at any time. Jobs may add
+ *  new jobs to the queue while they run. The future returned by
+ *  done() is satisfied when the queue is empty and the last job
+ *  has returned.
+ *
+ *  cancel() gives up on the jobs. Jobs that are running can't be
+ *  interrupted, so they hold guard() while they store their results,
+ *  and store nothing once the scheduler is cancelled. Each scan has its
+ *  own scheduler, so a job that outlives a cancelled scan still sees it
+ *  cancelled when the next scan has started.
+ */
+class Scheduler : public std::enable_shared_from_this<Scheduler> {
+public:
+    using job_t = std::function<void(restc_cpp::Context& ctx)>;
+
+    // Thrown by a job when the scan can't go on. The scheduler is
+    // cancelled, and the future from done() throws it.
+    struct Fatal : public std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    static std::shared_ptr<Scheduler> Create(restc_cpp::RestClient& client, size_t maxInflight);
+
+    void add(job_t job);
+
+    // Run the job now, ahead of the queue, if fewer than maxInflight jobs
+    // are active. Returns false if it was not started.
+    bool tryRun(job_t job);
+    std::future<void> done();
+
+    // Drop the queued jobs and satisfy done() now. Waits for the jobs
+    // that hold guard().
+    void cancel();
+
+    // Empty (false) once we are cancelled
+    std::shared_lock<std::shared_mutex> guard();
+
+    bool cancelled() const noexcept {
+        return cancelled_;
+    }
+
+    size_t maxInflight() const noexcept {
+        return maxInflight_;
+    }
+
+private:
+    Scheduler(restc_cpp::RestClient& client, size_t maxInflight);
+
+    void schedule();
+    void work(restc_cpp::Context& ctx, job_t job = {});
+    void fail(std::exception_ptr error);
+    void finish(std::exception_ptr error = {});
+
+    restc_cpp::RestClient& client_;
+    const size_t maxInflight_;
+    std::mutex mutex_;
+    std::deque<job_t> queue_;
+    size_t active_ = 0;
+    std::promise<void> done_;
+    bool finished_ = false;
+    std::atomic_bool cancelled_ = false;
+    std::shared_mutex guard_;
+};
+
+} // ns
@@ -0,0 +1,186 @@
+
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <system_error>
+
+#include <boost/process.hpp>
+
+#include "shard.h"
+#include "logging.h"
+
+using namespace std;
+using namespace std::string_literals;
+using namespace std::string_view_literals;
+
+namespace bp = boost::process;
+
+namespace purech {
+
+string Shard::toString() const
+{
+    return to_string(index) + '/' + to_string(count) + " by " + toString(by);
+}
+
+optional<Shard> Shard::parse(string_view spec, By by)
+{
+    const auto pos = spec.find('/');
+    if (pos == string_view::npos) {
+        return {};
+    }
+
+    Shard shard;
+    shard.by = by;
+    try {
+        shard.index = stoul(string{spec.substr(0, pos)});
+        shard.count = stoul(string{spec.substr(pos + 1)});
+    } catch (const exception&) {
+        return {};
+    }
+
+    if (!shard.count || shard.index >= shard.count) {
+        return {};
+    }
+    return shard;
+}
+
+optional<Shard::By> Shard::parseBy(string_view name)
+{
+    if (name == "cluster") {
+        return By::CLUSTER;
+    }
+    if (name == "tenant") {
+        return By::TENANT;
+    }
+    if (name == "namespace") {
+        return By::NAMESPACE;
+    }
+    return {};
+}
+
+const char *Shard::toString(By by) noexcept
+{
+    switch(by) {
+    case By::CLUSTER:
+        return "cluster";
+    case By::TENANT:
+        return "tenant";
+    case By::NAMESPACE:
+        return "namespace";
+    }
+    return "?";
+}
+
+uint64_t Shard::hash(string_view value) noexcept
+{
+    uint64_t h = 14695981039346656037ull;
+    for(const auto ch : value) {
+        h ^= static_cast<unsigned char>(ch);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+ShardCoordinator::ShardCoordinator(Options options)
+    : options_{move(options)}
+{
+    if (options_.command.empty()) {
+        throw invalid_argument("ShardCoordinator: No command line");
+    }
+
+    // Made by mkdtemp(), so that no one else can have it ready for us
+    auto dir = (filesystem::temp_directory_path() / "purech-shards-XXXXXX").string();
+    if (!::mkdtemp(dir.data())) {
+        throw system_error(errno, system_category(), "ShardCoordinator: Failed to create " + dir);
+    }
+    dir_ = move(dir);
+}
+
+ShardCoordinator::~ShardCoordinator()
+{
+    error_code ec;
+    filesystem::remove_all(dir_, ec);
+}
+
+vector<string> ShardCoordinator::workerArgs() const
+{
+    // Our arguments, without the ones that start the workers
+    vector<string> args;
+    for(auto it = options_.command.begin() + 1; it != options_.command.end(); ++it) {
+        const string_view arg = *it;
+        bool skip = false;
+        for(const string_view name : {"--workers"sv, "--shard-by"sv}) {
+            if (arg == name) {
+                skip = true;
+                if (it + 1 != options_.command.end()) {
+                    ++it; // The value
+                }
+            } else if (arg.size() > name.size() && arg.substr(0, name.size()) == name
+                       && arg[name.size()] == '=') {
+                skip = true;
+            }
+        }
+        if (!skip) {
+            args.emplace_back(*it);
+        }
+    }
+    return args;
+}
+
+vector<optional<string>> ShardCoordinator::run()
+{
+    // Our own executable, even if we were started through PATH
+    error_code ec;
+    auto program = filesystem::read_symlink("/proc/self/exe", ec).string();
+    if (ec) {
+        program = options_.command.front();
+    }
+
+    struct Worker {
+        string snapshot;
+        unique_ptr<bp::child> child;
+    };
+
+    vector<Worker> workers;
+    for(size_t i = 0; i < options_.workers; ++i) {
+        Worker w;
+        w.snapshot = dir_ + "/shard-" + to_string(i) + ".snap";
+        filesystem::remove(w.snapshot, ec);
+
+        auto args = workerArgs();
+        args.insert(args.end(), {"--shard", to_string(i) + '/' + to_string(options_.workers),
+                                 "--shard-by", Shard::toString(options_.by),
+                                 "--shard-output", w.snapshot});
+
+        LOG_DEBUG << "Starting the worker for shard " << i << '/' << options_.workers;
+        w.child = make_unique<bp::child>(program, bp::args(args), bp::std_in.close(), ec);
+        if (ec) {
+            LOG_ERROR << "Failed to start the worker for shard " << i << ": " << ec.message();
+            w.child.reset();
+        }
+        workers.push_back(move(w));
+    }
+
+    vector<optional<string>> snapshots;
+    for(size_t i = 0; i < workers.size(); ++i) {
+        auto& w = workers[i];
+        if (!w.child) {
+            snapshots.emplace_back();
+            continue;
+        }
+
+        w.child->wait(ec);
+        const auto status = ec ? -1 : w.child->exit_code();
+        if (status != 0 || !filesystem::is_regular_file(w.snapshot)) {
+            LOG_ERROR << "The worker for shard " << i << " failed (exit code " << status << ").";
+            snapshots.emplace_back();
+            continue;
+        }
+        snapshots.emplace_back(w.snapshot);
+    }
+
+    return snapshots;
+}
+
+} // ns
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace purech {
+
+/*! One part of a scan that is split over several processes.
+ *
+ *  The clusters are split by their position on the command line, and
+ *  tenants and namespaces by a hash of their name. The hash does not
+ *  depend on the build or the host, so workers on different hosts
+ *  agree on who owns what, as long as they get the same clusters.
+ */
+struct Shard {
+    enum class By { CLUSTER, TENANT, NAMESPACE };
+
+    size_t index = 0;
+    size_t count = 1;
+    By by = By::NAMESPACE;
+
+    // This is the whole scan
+    bool all() const noexcept {
+        return count <= 1;
+    }
+
+    bool ownsCluster(size_t id) const noexcept {
+        return by != By::CLUSTER || id % count == index;
+    }
+
+    bool ownsTenant(std::string_view tenant) const noexcept {
+        return by != By::TENANT || hash(tenant) % count == index;
+    }
+
+    bool ownsNamespace(std::string_view ns) const noexcept {
+        return by != By::NAMESPACE || hash(ns) % count == index;
+    }
+
+    std::string toString() const;
+
+    // <index>/<count>, with index from 0
+    static std::optional<Shard> parse(std::string_view spec, By by);
+    static std::optional<By> parseBy(std::string_view name);
+    static const char *toString(By by) noexcept;
+
+    // FNV-1a
+    static uint64_t hash(std::string_view value) noexcept;
+};
+
+/*! Runs a scan as several worker processes, one per shard.
+ *
+ *  The workers are this program, started with our own command line
+ *  and --shard, and each saves its part of the scan to a snapshot in
+ *  a temporary directory. The caller merges the snapshots.
+ */
+class ShardCoordinator {
+public:
+    struct Options {
+        size_t workers = 2;
+        Shard::By by = Shard::By::NAMESPACE;
+        std::vector<std::string> command; // Our command line, with the program first
+    };
+
+    explicit ShardCoordinator(Options options);
+    ~ShardCoordinator(); // Removes the snapshots
+
+    ShardCoordinator(const ShardCoordinator&) = delete;
+    ShardCoordinator& operator = (const ShardCoordinator&) = delete;
+
+    // Starts the workers and waits for all of them. Returns the snapshot
+    // from each shard, or nothing for the shards whose worker failed.
+    std::vector<std::optional<std::string>> run();
+
+    const Options& options() const noexcept {
+        return options_;
+    }
+
+private:
+    std::vector<std::string> workerArgs() const;
+
+    const Options options_;
+    std::string dir_;
+};
+
+} // ns
@@ -0,0 +1,347 @@
+
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "sink.h"
+#include "textout.h"
+
+using namespace std;
+using namespace std::string_literals;
+
+namespace purech {
+
+namespace {
+
+// The numeric columns of the flat formats
+struct Numbers {
+    static constexpr size_t strings = 4; // cluster, tenant, namespace, topic
+    array<double, 6> rates = {};
+    array<uint64_t, 8> counts = {};
+};
+
+const vector<string_view> columnNames = {
+    "cluster", "tenant", "namespace", "topic",
+    "msgRateIn", "msgThroughputIn", "msgRateOut", "msgThroughputOut", "averageMsgSize", "storageSize",
+    "publishers", "subscriptions", "consumers", "msgBacklog",
+    "replicationLinks", "disconnectedLinks", "replicationBacklog", "maxReplicationDelay"
+};
+
+Numbers numbers(const PersistentTopicStats& stats) {
+    Numbers n;
+    n.rates = {stats.msgRateIn, stats.msgThroughputIn, stats.msgRateOut, stats.msgThroughputOut,
+               stats.averageMsgSize, stats.storageSize};
+
+    uint64_t consumers = 0, backlog = 0;
+    for(const auto& [_, sub] : stats.subscriptions) {
+        consumers += sub.consumers.size();
+        backlog += sub.msgBacklog;
+    }
+
+    uint64_t disconnected = 0, replicationBacklog = 0, maxDelay = 0;
+    for(const auto& [_, r] : stats.replication) {
+        disconnected += r.connected ? 0 : 1;
+        replicationBacklog += static_cast<uint64_t>(max(r.replicationBacklog, 0));
+        maxDelay = max<uint64_t>(maxDelay, static_cast<uint64_t>(max(r.replicationDelayInSeconds, 0)));
+    }
+
+    n.counts = {stats.publishers.size(), stats.subscriptions.size(), consumers, backlog,
+                stats.replication.size(), disconnected, replicationBacklog, maxDelay};
+    return n;
+}
+
+// The text formats. Each record is formatted by the caller's thread,
+// and the lines are written out when there are enough of them.
+class TextSink : public TopicSink {
+public:
+    explicit TextSink(const string& path)
+        : TopicSink(path) {}
+
+    void write(const Record& record) override {
+        string line;
+        format(record, line);
+
+        lock_guard lock{mutex_};
+        buffer_ += line;
+        ++records_;
+        if (buffer_.size() >= flushAt) {
+            writeBuffer();
+        }
+    }
+
+    void flush() override {
+        lock_guard lock{mutex_};
+        writeBuffer();
+    }
+
+protected:
+    virtual void format(const Record& record, string& line) const = 0;
+
+    void writeBuffer() {
+        out().write(buffer_.data(), static_cast<streamsize>(buffer_.size()));
+        out().flush();
+        if (!out()) {
+            failed();
+        }
+        buffer_.clear();
+    }
+
+    string buffer_;
+
+private:
+    static constexpr size_t flushAt = 64 * 1024;
+};
+
+class NdjsonSink : public TextSink {
+public:
+    explicit NdjsonSink(const string& path)
+        : TextSink(path) {}
+
+protected:
+    void format(const Record& record, string& line) const override {
+        const auto& s = record.stats;
+        TextOut out{line, TextOut::Syntax::JSON};
+        out << "{\"cluster\":"sv;
+        out.quoted(record.cluster) << ",\"tenant\":"sv;
+        out.quoted(record.tenant) << ",\"namespace\":"sv;
+        out.quoted(record.ns) << ",\"topic\":"sv;
+        out.quoted(record.topic)
+            << ",\"msgRateIn\":"sv << s.msgRateIn
+            << ",\"msgThroughputIn\":"sv << s.msgThroughputIn
+            << ",\"msgRateOut\":"sv << s.msgRateOut
+            << ",\"msgThroughputOut\":"sv << s.msgThroughputOut
+            << ",\"averageMsgSize\":"sv << s.averageMsgSize
+            << ",\"storageSize\":"sv << s.storageSize
+            << ",\"publishers\":"sv << static_cast<uint64_t>(s.publishers.size())
+            << ",\"subscriptions\":{"sv;
+
+        bool first = true;
+        for(const auto& [name, sub] : s.subscriptions) {
+            if (!exchange(first, false)) {
+                out << ',';
+            }
+            out.quoted(name) << ":{\"type\":"sv;
+            out.quoted(sub.type)
+                << ",\"msgBacklog\":"sv << sub.msgBacklog
+                << ",\"msgRateOut\":"sv << sub.msgRateOut
+                << ",\"consumers\":"sv << static_cast<uint64_t>(sub.consumers.size()) << '}';
+        }
+
+        out << "},\"replication\":{"sv;
+        first = true;
+        for(const auto& [peer, r] : s.replication) {
+            if (!exchange(first, false)) {
+                out << ',';
+            }
+            out.quoted(peer) << ":{\"connected\":"sv << (r.connected ? "true"sv : "false"sv)
+                << ",\"replicationBacklog\":"sv << r.replicationBacklog
+                << ",\"replicationDelayInSeconds\":"sv << r.replicationDelayInSeconds
+                << ",\"msgRateOut\":"sv << r.msgRateOut << '}';
+        }
+        out << "}}\n"sv;
+    }
+};
+
+class CsvSink : public TextSink {
+public:
+    explicit CsvSink(const string& path)
+        : TextSink(path) {
+        for(const auto name : columnNames) {
+            buffer_ += name;
+            buffer_ += name == columnNames.back() ? '\n' : ',';
+        }
+    }
+
+protected:
+    void format(const Record& record, string& line) const override {
+        TextOut out{line};
+        for(const auto value : {record.cluster, record.tenant, record.ns, record.topic}) {
+            if (value.find_first_of(",\"\n") == string_view::npos) {
+                out << value;
+            } else {
+                out << '"';
+                for(const auto ch : value) {
+                    if (ch == '"') {
+                        out << '"';
+                    }
+                    out << ch;
+                }
+                out << '"';
+            }
+            out << ',';
+        }
+
+        const auto n = numbers(record.stats);
+        for(const auto v : n.rates) {
+            out << v << ',';
+        }
+        for(size_t i = 0; i < n.counts.size(); ++i) {
+            out << n.counts[i] << (i + 1 < n.counts.size() ? ',' : '\n');
+        }
+    }
+};
+
+/* The columnar format:
+ *
+ *   "PURECOLS"         8 bytes
+ *   version            u32, 1
+ *   columns            u32
+ *   for each column:   u8 type (0 string, 1 f64, 2 u64), u8 name length, the name
+ *
+ * followed by row groups until the end of the file:
+ *
+ *   rows               u32
+ *   for each column:   string: u32 offsets[rows + 1] into the bytes that follow, then the bytes
+ *                      f64 and u64: the values
+ *
+ * Like the snapshots, the numbers are in the byte order of the host
+ * that wrote the file. A row group is written when it is full and
+ * after each scan, so a reader can follow the file while we scan.
+ */
+class ColumnarSink : public TopicSink {
+public:
+    explicit ColumnarSink(const string& path)
+        : TopicSink(path) {
+        string header = "PURECOLS"s;
+        append(header, uint32_t{1});
+        append(header, static_cast<uint32_t>(columnNames.size()));
+        for(size_t i = 0; i < columnNames.size(); ++i) {
+            const auto type = i < Numbers::strings ? 0 : i < Numbers::strings + rates_.size() ? 1 : 2;
+            header += static_cast<char>(type);
+            header += static_cast<char>(columnNames[i].size());
+            header += columnNames[i];
+        }
+        out().write(header.data(), static_cast<streamsize>(header.size()));
+    }
+
+    void write(const Record& record) override {
+        const auto n = numbers(record.stats);
+
+        lock_guard lock{mutex_};
+        const array<string_view, Numbers::strings> values = {record.cluster, record.tenant, record.ns, record.topic};
+        for(size_t i = 0; i < values.size(); ++i) {
+            auto& col = strings_[i];
+            col.bytes += values[i];
+            col.offsets.push_back(static_cast<uint32_t>(col.bytes.size()));
+        }
+        for(size_t i = 0; i < n.rates.size(); ++i) {
+            rates_[i].push_back(n.rates[i]);
+        }
+        for(size_t i = 0; i < n.counts.size(); ++i) {
+            counts_[i].push_back(n.counts[i]);
+        }
+
+        ++records_;
+        if (++rows_ >= rowsPerGroup) {
+            writeGroup();
+        }
+    }
+
+    void flush() override {
+        lock_guard lock{mutex_};
+        writeGroup();
+    }
+
+private:
+    struct StringColumn {
+        vector<uint32_t> offsets = {0};
+        string bytes;
+    };
+
+    template <typename T>
+    static void append(string& out, T value) {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    void put(const vector<T>& values) {
+        out().write(reinterpret_cast<const char *>(values.data()),
+                    static_cast<streamsize>(values.size() * sizeof(T)));
+    }
+
+    void writeGroup() {
+        if (!rows_) {
+            return;
+        }
+
+        out().write(reinterpret_cast<const char *>(&rows_), sizeof(rows_));
+        for(auto& col : strings_) {
+            put(col.offsets);
+            out().write(col.bytes.data(), static_cast<streamsize>(col.bytes.size()));
+            col = {};
+        }
+        for(auto& col : rates_) {
+            put(col);
+            col.clear();
+        }
+        for(auto& col : counts_) {
+            put(col);
+            col.clear();
+        }
+
+        out().flush();
+        if (!out()) {
+            failed();
+        }
+        rows_ = 0;
+    }
+
+    static constexpr uint32_t rowsPerGroup = 8192;
+    uint32_t rows_ = 0;
+    array<StringColumn, Numbers::strings> strings_;
+    array<vector<double>, tuple_size_v<decltype(Numbers::rates)>> rates_;
+    array<vector<uint64_t>, tuple_size_v<decltype(Numbers::counts)>> counts_;
+};
+
+} // anon ns
+
+TopicSink::TopicSink(const string &path)
+    : path_{path}
+{
+    if (path == "-") {
+        stdout_ = &cout;
+        return;
+    }
+
+    file_.open(path, ios::out | ios::trunc | ios::binary);
+    if (!file_) {
+        throw runtime_error("Failed to open "s + path);
+    }
+}
+
+void TopicSink::failed()
+{
+    throw runtime_error("Failed to write to "s + (path_ == "-" ? "stdout"s : path_));
+}
+
+unique_ptr<TopicSink> TopicSink::create(const string &spec)
+{
+    const auto pos = spec.find(':');
+    if (pos == string::npos || pos + 1 == spec.size()) {
+        throw runtime_error("Expected <format>:<path> for the stream, got: "s + spec);
+    }
+
+    const auto format = spec.substr(0, pos);
+    const auto path = spec.substr(pos + 1);
+    if (format == "ndjson") {
+        return make_unique<NdjsonSink>(path);
+    }
+    if (format == "csv") {
+        return make_unique<CsvSink>(path);
+    }
+    if (format == "columnar") {
+        if (path == "-") {
+            throw runtime_error("The columnar format can not be written to stdout");
+        }
+        return make_unique<ColumnarSink>(path);
+    }
+    throw runtime_error("Unknown stream format: "s + format);
+}
+
+const vector<string_view>& TopicSink::columns()
+{
+    return columnNames;
+}
+
+} // ns
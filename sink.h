@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pulsar_api.h"
+
+namespace purech {
+
+/*! Where each topic's stats go in streaming mode.
+ *
+ *  In streaming mode the engine does not keep the topic stats. Each
+ *  topic that passes the topic filter is written to the sink as soon
+ *  as its stats arrive, and only the namespace rates are kept for the
+ *  roll-ups. So the memory use does not grow with the number of topics,
+ *  and other tools can read the output while the scan is running.
+ *
+ *  write() is called from the scan's threads. The records are formatted
+ *  without a lock, and written out in batches.
+ *
+ *  The formats are:
+ *  - ndjson: One JSON object per line, with the topic's rates, sizes,
+ *    counts, and its subscriptions and replication links.
+ *  - csv: One line per topic with the columns in `columns()`, after a
+ *    header line.
+ *  - columnar: The same columns, in a binary file of row groups. See sink.cpp.
+ */
+class TopicSink {
+public:
+    struct Record {
+        std::string_view cluster;
+        std::string_view tenant;
+        std::string_view ns;
+        std::string_view topic;
+        const PersistentTopicStats& stats;
+    };
+
+    virtual ~TopicSink() = default;
+
+    virtual void write(const Record& record) = 0;
+
+    // Writes out what is buffered. Called after each scan.
+    virtual void flush() = 0;
+
+    size_t records() const noexcept {
+        return records_;
+    }
+
+    // `spec` is <format>:<path>. A path of "-" is stdout.
+    static std::unique_ptr<TopicSink> create(const std::string& spec);
+
+    // The flat columns of the csv and columnar formats
+    static const std::vector<std::string_view>& columns();
+
+protected:
+    explicit TopicSink(const std::string& path);
+
+    std::ostream& out() {
+        return file_.is_open() ? file_ : *stdout_;
+    }
+
+    [[noreturn]] void failed();
+
+    std::mutex mutex_; // Guards the stream and the buffers
+    std::atomic<size_t> records_ = 0;
+
+private:
+    const std::string path_;
+    std::ofstream file_;
+    std::ostream *stdout_ = {};
+};
+
+} // ns
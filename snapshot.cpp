@@ -0,0 +1,760 @@
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+using namespace std;
+using namespace std::string_literals;
+
+namespace purech {
+
+using snap::SectionId;
+
+namespace {
+
+static_assert(sizeof(Stats) == 4 * sizeof(double) && is_trivially_copyable_v<Stats>,
+              "Stats is stored as is in the snapshots");
+static_assert(is_trivially_copyable_v<snap::Header> && is_trivially_copyable_v<snap::Topic>);
+
+constexpr uint64_t align8(uint64_t offset) noexcept {
+    return (offset + 7) & ~uint64_t{7};
+}
+
+// Collects the records for a snapshot, and gives each distinct string an index
+class Builder {
+public:
+    Builder() {
+        strings_.emplace_back();
+        index_.emplace(string_view{}, 0);
+    }
+
+    uint32_t str(string_view value) {
+        auto [it, added] = index_.emplace(value, static_cast<uint32_t>(strings_.size()));
+        if (added) {
+            strings_.push_back(value);
+        }
+        return it->second;
+    }
+
+    template <typename T>
+    uint32_t list(const T& values) {
+        const auto first = static_cast<uint32_t>(lists.size());
+        for(const auto& v : values) {
+            lists.push_back(str(v));
+        }
+        return first;
+    }
+
+    void add(const Engine::Cluster& cluster);
+    void write(ostream& out) const;
+
+    vector<uint32_t> lists;
+    vector<snap::Cluster> clusters;
+    vector<snap::Namespace> namespaces;
+    vector<snap::Topic> topics;
+    vector<snap::Publisher> publishers;
+    vector<snap::Subscription> subscriptions;
+    vector<snap::Consumer> consumers;
+    vector<snap::Replication> replication;
+
+private:
+    void add(const TopicStore& store, const TopicRow& row, uint32_t ns);
+
+    // The views point into the clusters' string pool and trees,
+    // which don't change while we write.
+    unordered_map<string_view, uint32_t> index_;
+    vector<string_view> strings_;
+};
+
+void Builder::add(const Engine::Cluster &cluster)
+{
+    const auto coverage = cluster.coverage();
+
+    snap::Cluster c;
+    c.name = str(cluster.name);
+    c.state = static_cast<uint32_t>(coverage.state);
+    c.numKnown = static_cast<uint32_t>(cluster.clusters.size());
+    c.known = list(cluster.clusters);
+    c.firstNamespace = static_cast<uint32_t>(namespaces.size());
+    c.expired = cluster.expired;
+    c.listedTopics = coverage.listed;
+    c.fetchedTopics = coverage.fetched;
+    c.stats = cluster.stats;
+
+    // The tree and the sealed store are both sorted on (tenant, namespace),
+    // so the store's rows are merged into the tree.
+    const auto& store = *cluster.store;
+    const auto& rows = store.topics();
+    size_t r = 0;
+    for(const auto& [tname, tenant] : cluster.tenants) {
+        for(const auto& [nsname, ns] : tenant.namespaces) {
+            const auto key = make_pair(string_view{tname}, string_view{nsname});
+            auto rowKey = [&](const TopicRow& row) {
+                return make_pair(store.str(row.tenant), store.str(row.ns));
+            };
+            while (r < rows.size() && rowKey(rows[r]) < key) {
+                ++r; // Not in the tree. Should not happen.
+            }
+
+            snap::Namespace n;
+            n.cluster = static_cast<uint32_t>(clusters.size());
+            n.tenant = str(tname);
+            n.name = str(nsname);
+            n.listed = ns.listed;
+            n.numReplicationClusters = static_cast<uint32_t>(ns.policies.replication_clusters.size());
+            n.replicationClusters = list(ns.policies.replication_clusters);
+            n.firstTopic = static_cast<uint32_t>(topics.size());
+            n.listedTopics = ns.listedTopics;
+            n.fetchedTopics = ns.fetchedTopics;
+            n.stats = ns.stats;
+
+            const auto nsIndex = static_cast<uint32_t>(namespaces.size());
+            for(; r < rows.size() && rowKey(rows[r]) == key; ++r) {
+                add(store, rows[r], nsIndex);
+            }
+            n.numTopics = static_cast<uint32_t>(topics.size() - n.firstTopic);
+            namespaces.push_back(n);
+        }
+    }
+
+    c.numNamespaces = static_cast<uint32_t>(namespaces.size() - c.firstNamespace);
+    clusters.push_back(c);
+}
+
+void Builder::add(const TopicStore &store, const TopicRow &row, uint32_t ns)
+{
+    snap::Topic t;
+    t.name = str(store.str(row.topic));
+    t.ns = ns;
+    t.rates = row.rates;
+    t.averageMsgSize = row.averageMsgSize;
+    t.storageSize = row.storageSize;
+    t.backlog = row.backlog;
+
+    t.firstPublisher = static_cast<uint32_t>(publishers.size());
+    for(const auto& p : TopicStore::publishers(row)) {
+        snap::Publisher sp;
+        sp.producerName = str(store.str(p.producerName));
+        sp.address = str(store.str(p.address));
+        sp.clientVersion = str(store.str(p.clientVersion));
+        sp.connectedSince = p.connectedSince;
+        sp.producerId = p.producerId;
+        sp.msgRateIn = p.msgRateIn;
+        sp.msgThroughputIn = p.msgThroughputIn;
+        sp.averageMsgSize = p.averageMsgSize;
+        publishers.push_back(sp);
+    }
+    t.numPublishers = row.numPublishers;
+
+    t.firstSubscription = static_cast<uint32_t>(subscriptions.size());
+    for(const auto& s : TopicStore::subscriptions(row)) {
+        snap::Subscription ss;
+        ss.name = str(store.str(s.name));
+        ss.type = str(store.str(s.type));
+        ss.activeConsumerName = str(store.str(s.activeConsumerName));
+        ss.blockedSubscriptionOnUnackedMsgs = s.blockedSubscriptionOnUnackedMsgs;
+        ss.firstConsumer = static_cast<uint32_t>(consumers.size());
+        ss.numConsumers = s.numConsumers;
+        ss.msgBacklog = s.msgBacklog;
+        ss.unackedMessages = s.unackedMessages;
+        ss.msgRateOut = s.msgRateOut;
+        ss.msgThroughputOut = s.msgThroughputOut;
+        ss.msgRateRedeliver = s.msgRateRedeliver;
+        ss.msgRateExpired = s.msgRateExpired;
+        subscriptions.push_back(ss);
+
+        for(const auto& c : TopicStore::consumers(s)) {
+            snap::Consumer sc;
+            sc.consumerName = str(store.str(c.consumerName));
+            sc.address = str(store.str(c.address));
+            sc.clientVersion = str(store.str(c.clientVersion));
+            sc.blockedConsumerOnUnackedMsgs = c.blockedConsumerOnUnackedMsgs;
+            sc.availablePermits = c.availablePermits;
+            sc.unackedMessages = c.unackedMessages;
+            sc.connectedSince = c.connectedSince;
+            sc.msgRateOut = c.msgRateOut;
+            sc.msgThroughputOut = c.msgThroughputOut;
+            sc.msgRateRedeliver = c.msgRateRedeliver;
+            consumers.push_back(sc);
+        }
+    }
+    t.numSubscriptions = row.numSubscriptions;
+
+    t.firstReplication = static_cast<uint32_t>(replication.size());
+    for(const auto& r : TopicStore::replication(row)) {
+        snap::Replication sr;
+        sr.peer = str(store.str(r.peer));
+        sr.connected = r.connected;
+        sr.replicationBacklog = r.replicationBacklog;
+        sr.replicationDelayInSeconds = r.replicationDelayInSeconds;
+        sr.outboundConnectedSince = r.outboundConnectedSince;
+        sr.rates = r.rates;
+        sr.msgRateExpired = r.msgRateExpired;
+        replication.push_back(sr);
+    }
+    t.numReplication = row.numReplication;
+
+    topics.push_back(t);
+}
+
+void Builder::write(ostream &out) const
+{
+    vector<uint64_t> offsets;
+    offsets.reserve(strings_.size() + 1);
+    uint64_t chars = 0;
+    for(const auto& s : strings_) {
+        offsets.push_back(chars);
+        chars += s.size();
+    }
+    offsets.push_back(chars);
+
+    snap::Header header;
+    header.magic = snap::magic;
+    header.version = snap::version;
+    header.byteOrder = snap::byteOrder;
+    header.created = chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+
+    // Lay out the sections
+    uint64_t pos = sizeof(header);
+    auto place = [&](SectionId id, uint64_t count, size_t recordSize) {
+        auto& section = header.sections[static_cast<size_t>(id)];
+        section.offset = pos = align8(pos);
+        section.count = count;
+        pos += count * recordSize;
+    };
+
+    place(SectionId::STRING_OFFSETS, offsets.size(), sizeof(uint64_t));
+    place(SectionId::STRING_DATA, chars, 1);
+    place(SectionId::STRING_LISTS, lists.size(), sizeof(uint32_t));
+    place(SectionId::CLUSTERS, clusters.size(), sizeof(snap::Cluster));
+    place(SectionId::NAMESPACES, namespaces.size(), sizeof(snap::Namespace));
+    place(SectionId::TOPICS, topics.size(), sizeof(snap::Topic));
+    place(SectionId::PUBLISHERS, publishers.size(), sizeof(snap::Publisher));
+    place(SectionId::SUBSCRIPTIONS, subscriptions.size(), sizeof(snap::Subscription));
+    place(SectionId::CONSUMERS, consumers.size(), sizeof(snap::Consumer));
+    place(SectionId::REPLICATION, replication.size(), sizeof(snap::Replication));
+
+    // Write them
+    pos = 0;
+    auto raw = [&](const void *data, size_t bytes) {
+        out.write(static_cast<const char *>(data), static_cast<streamsize>(bytes));
+        pos += bytes;
+    };
+    auto pad = [&] {
+        static constexpr char zeros[8] = {};
+        raw(zeros, align8(pos) - pos);
+    };
+    auto records = [&](const auto& v) {
+        pad();
+        raw(v.data(), v.size() * sizeof(v[0]));
+    };
+
+    raw(&header, sizeof(header));
+    records(offsets);
+    pad();
+    for(const auto& s : strings_) {
+        raw(s.data(), s.size());
+    }
+    records(lists);
+    records(clusters);
+    records(namespaces);
+    records(topics);
+    records(publishers);
+    records(subscriptions);
+    records(consumers);
+    records(replication);
+}
+
+int64_t delta(uint64_t before, uint64_t after) noexcept {
+    return static_cast<int64_t>(after) - static_cast<int64_t>(before);
+}
+
+struct Change {
+    double magnitude = {};
+    string text;
+
+    bool operator < (const Change& v) const noexcept {
+        return magnitude > v.magnitude;
+    }
+};
+
+// Prints the `maxLines` largest changes under a heading
+void print(vector<Change>& changes, const char *heading, size_t maxLines, ostream& out) {
+    if (changes.empty()) {
+        return;
+    }
+
+    const auto lines = min(changes.size(), maxLines);
+    partial_sort(changes.begin(), changes.begin() + static_cast<ptrdiff_t>(lines), changes.end());
+
+    out << "  " << heading << " (" << changes.size() << "):" << endl;
+    for(size_t i = 0; i < lines; ++i) {
+        out << "    " << changes[i].text << endl;
+    }
+    if (changes.size() > lines) {
+        out << "    ... and " << (changes.size() - lines) << " more" << endl;
+    }
+}
+
+template <typename T>
+string names(const Snapshot& snapshot, const T& list) {
+    ostringstream out;
+    out << '[';
+    for(size_t i = 0; i < list.size(); ++i) {
+        out << (i ? " " : "") << snapshot.str(list[i]);
+    }
+    out << ']';
+    return out.str();
+}
+
+} // anon ns
+
+Snapshot::Snapshot(const string &path)
+    : path_{path}
+{
+    const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw runtime_error("Failed to open "s + path + ": " + strerror(errno));
+    }
+
+    struct stat st = {};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(snap::Header)) {
+        ::close(fd);
+        throw runtime_error(path + " is not a snapshot");
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    auto *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw runtime_error("Failed to map "s + path + ": " + strerror(errno));
+    }
+    data_ = data;
+
+    try {
+        const auto& h = header();
+        if (h.magic != snap::magic) {
+            throw runtime_error(path + " is not a snapshot");
+        }
+        if (h.byteOrder != snap::byteOrder) {
+            throw runtime_error(path + " was written on a host with another byte order");
+        }
+        if (h.version != snap::version) {
+            throw runtime_error(path + " has unsupported version " + to_string(h.version));
+        }
+
+        stringOffsets_ = section<uint64_t>(SectionId::STRING_OFFSETS);
+        stringData_ = section<char>(SectionId::STRING_DATA);
+        stringLists_ = section<uint32_t>(SectionId::STRING_LISTS);
+        clusters_ = section<snap::Cluster>(SectionId::CLUSTERS);
+        namespaces_ = section<snap::Namespace>(SectionId::NAMESPACES);
+        topics_ = section<snap::Topic>(SectionId::TOPICS);
+        publishers_ = section<snap::Publisher>(SectionId::PUBLISHERS);
+        subscriptions_ = section<snap::Subscription>(SectionId::SUBSCRIPTIONS);
+        consumers_ = section<snap::Consumer>(SectionId::CONSUMERS);
+        replication_ = section<snap::Replication>(SectionId::REPLICATION);
+    } catch (...) {
+        ::munmap(data, size_);
+        throw;
+    }
+}
+
+Snapshot::~Snapshot()
+{
+    ::munmap(const_cast<void *>(data_), size_);
+}
+
+string_view Snapshot::str(uint32_t index) const
+{
+    if (index + 1ULL >= stringOffsets_.size()) {
+        throw runtime_error(path_ + ": Invalid string index");
+    }
+
+    const auto b = stringOffsets_[index];
+    const auto e = stringOffsets_[index + 1];
+    if (b > e || e > stringData_.size()) {
+        throw runtime_error(path_ + ": Invalid string offset");
+    }
+    return {stringData_.b + b, static_cast<size_t>(e - b)};
+}
+
+Snapshot::Span<snap::Namespace> Snapshot::namespaces(const snap::Cluster &cluster) const
+{
+    return children(namespaces_, cluster.firstNamespace, cluster.numNamespaces);
+}
+
+Snapshot::Span<snap::Topic> Snapshot::topics(const snap::Namespace &ns) const
+{
+    return children(topics_, ns.firstTopic, ns.numTopics);
+}
+
+Snapshot::Span<snap::Publisher> Snapshot::publishers(const snap::Topic &topic) const
+{
+    return children(publishers_, topic.firstPublisher, topic.numPublishers);
+}
+
+Snapshot::Span<snap::Subscription> Snapshot::subscriptions(const snap::Topic &topic) const
+{
+    return children(subscriptions_, topic.firstSubscription, topic.numSubscriptions);
+}
+
+Snapshot::Span<snap::Consumer> Snapshot::consumers(const snap::Subscription &subscription) const
+{
+    return children(consumers_, subscription.firstConsumer, subscription.numConsumers);
+}
+
+Snapshot::Span<snap::Replication> Snapshot::replication(const snap::Topic &topic) const
+{
+    return children(replication_, topic.firstReplication, topic.numReplication);
+}
+
+Snapshot::Span<uint32_t> Snapshot::knownClusters(const snap::Cluster &cluster) const
+{
+    return children(stringLists_, cluster.known, cluster.numKnown);
+}
+
+Snapshot::Span<uint32_t> Snapshot::replicationClusters(const snap::Namespace &ns) const
+{
+    return children(stringLists_, ns.replicationClusters, ns.numReplicationClusters);
+}
+
+const snap::Cluster *Snapshot::findCluster(string_view name) const
+{
+    auto it = lower_bound(clusters_.begin(), clusters_.end(), name, [this](const auto& c, string_view n) {
+        return str(c.name) < n;
+    });
+    return it != clusters_.end() && str(it->name) == name ? it : nullptr;
+}
+
+const snap::Namespace *Snapshot::findNamespace(const snap::Cluster &cluster, string_view name) const
+{
+    // Sorted on (tenant, name), and name is "tenant/ns"
+    const auto key = make_pair(name.substr(0, name.find('/')), name);
+    const auto all = namespaces(cluster);
+    auto it = lower_bound(all.begin(), all.end(), key, [this](const auto& ns, const auto& k) {
+        return make_pair(str(ns.tenant), str(ns.name)) < k;
+    });
+    return it != all.end() && str(it->name) == name ? it : nullptr;
+}
+
+const snap::Topic *Snapshot::findTopic(const snap::Namespace &ns, string_view name) const
+{
+    const auto all = topics(ns);
+    auto it = lower_bound(all.begin(), all.end(), name, [this](const auto& t, string_view n) {
+        return str(t.name) < n;
+    });
+    return it != all.end() && str(it->name) == name ? it : nullptr;
+}
+
+void Snapshot::write(const vector<const Engine::Cluster *> &clusters, const string &path)
+{
+    Builder builder;
+    for(const auto *c : clusters) {
+        builder.add(*c);
+    }
+
+    // Write a new file and move it in place, so that readers never see
+    // half a snapshot.
+    const auto tmp = path + ".tmp" + to_string(::getpid());
+    {
+        ofstream out{tmp, ios::binary | ios::trunc};
+        builder.write(out);
+        if (!out.flush()) {
+            error_code ec;
+            filesystem::remove(tmp, ec);
+            throw runtime_error("Failed to write "s + tmp);
+        }
+    }
+    filesystem::rename(tmp, path);
+
+    LOG_DEBUG << "Wrote " << builder.topics.size() << " topics in " << builder.clusters.size()
+              << " clusters to the snapshot " << path;
+}
+
+void Snapshot::load(const snap::Cluster &from, Engine::Cluster &cluster) const
+{
+    auto& pool = cluster.store->pool();
+    auto id = [&](uint32_t index) {
+        return pool.intern(str(index));
+    };
+
+    if (from.state != static_cast<uint32_t>(Coverage::State::MISSING)) {
+        cluster.listed = true;
+    }
+    if (from.expired) {
+        cluster.expired = true;
+    }
+    for(const auto name : knownClusters(from)) {
+        if (find(cluster.clusters.begin(), cluster.clusters.end(), str(name)) == cluster.clusters.end()) {
+            cluster.clusters.emplace_back(str(name));
+        }
+    }
+
+    vector<PublisherRow> publishers;
+    vector<SubscriptionRow> subscriptions;
+    vector<vector<ConsumerRow>> consumers;
+    vector<ReplicationRow> replication;
+    for(const auto& n : namespaces(from)) {
+        auto& tenant = cluster.tenants[string{str(n.tenant)}];
+        tenant.listed = true;
+
+        auto& ns = tenant.namespaces[string{str(n.name)}];
+        ns.listed = n.listed;
+        ns.listedTopics = n.listedTopics;
+        ns.fetchedTopics = n.fetchedTopics;
+        ns.policies.replication_clusters.clear();
+        for(const auto name : replicationClusters(n)) {
+            ns.policies.replication_clusters.emplace_back(str(name));
+        }
+
+        const auto tenantId = id(n.tenant);
+        const auto nsId = id(n.name);
+        for(const auto& t : topics(n)) {
+            publishers.clear();
+            for(const auto& p : this->publishers(t)) {
+                publishers.push_back({id(p.producerName), id(p.address), id(p.clientVersion),
+                                      p.connectedSince, p.producerId, p.msgRateIn,
+                                      p.msgThroughputIn, p.averageMsgSize});
+            }
+
+            subscriptions.clear();
+            consumers.clear();
+            for(const auto& s : this->subscriptions(t)) {
+                auto& cr = consumers.emplace_back();
+                for(const auto& c : this->consumers(s)) {
+                    cr.push_back({id(c.consumerName), id(c.address), id(c.clientVersion),
+                                  c.availablePermits, c.unackedMessages, c.blockedConsumerOnUnackedMsgs != 0,
+                                  c.connectedSince, c.msgRateOut, c.msgThroughputOut, c.msgRateRedeliver});
+                }
+                subscriptions.push_back({id(s.name), id(s.type), id(s.activeConsumerName),
+                                         static_cast<uint32_t>(cr.size()), cr.data(),
+                                         s.blockedSubscriptionOnUnackedMsgs != 0, s.msgBacklog,
+                                         s.unackedMessages, s.msgRateOut, s.msgThroughputOut,
+                                         s.msgRateRedeliver, s.msgRateExpired});
+            }
+
+            replication.clear();
+            for(const auto& r : this->replication(t)) {
+                replication.push_back({id(r.peer), r.connected != 0, r.replicationBacklog,
+                                       r.replicationDelayInSeconds, r.outboundConnectedSince,
+                                       r.rates, r.msgRateExpired});
+            }
+
+            TopicRow row;
+            row.tenant = tenantId;
+            row.ns = nsId;
+            row.topic = id(t.name);
+            row.numPublishers = static_cast<uint32_t>(publishers.size());
+            row.numSubscriptions = static_cast<uint32_t>(subscriptions.size());
+            row.numReplication = static_cast<uint32_t>(replication.size());
+            row.publishers = publishers.data();
+            row.subscriptions = subscriptions.data();
+            row.replication = replication.data();
+            row.rates = t.rates;
+            row.averageMsgSize = t.averageMsgSize;
+            row.storageSize = t.storageSize;
+            row.backlog = t.backlog;
+            cluster.store->add(row);
+        }
+    }
+}
+
+template <typename T>
+Snapshot::Span<T> Snapshot::section(SectionId id) const
+{
+    const auto& s = header().sections[static_cast<size_t>(id)];
+    if (s.offset > size_ || s.offset % alignof(T) || s.count > (size_ - s.offset) / sizeof(T)) {
+        throw runtime_error(path_ + ": A section is outside of the file");
+    }
+
+    const auto *first = reinterpret_cast<const T *>(static_cast<const char *>(data_) + s.offset);
+    return {first, first + s.count};
+}
+
+template <typename T>
+Snapshot::Span<T> Snapshot::children(const Span<T>& all, uint32_t first, uint32_t count) const
+{
+    if (first > all.size() || count > all.size() - first) {
+        throw runtime_error(path_ + ": Invalid record index");
+    }
+    return {all.b + first, all.b + first + count};
+}
+
+void SnapshotDiff::report(ostream &out) const
+{
+    // Both are sorted by name
+    const auto before = before_.clusters();
+    const auto after = after_.clusters();
+    auto b = before.begin();
+    auto a = after.begin();
+    while (b != before.end() || a != after.end()) {
+        if (a == after.end() || (b != before.end() && before_.str(b->name) < after_.str(a->name))) {
+            out << "Cluster " << before_.str(b->name) << ": Only in " << before_.path() << endl << endl;
+            ++b;
+        } else if (b == before.end() || after_.str(a->name) < before_.str(b->name)) {
+            out << "Cluster " << after_.str(a->name) << ": Only in " << after_.path() << endl << endl;
+            ++a;
+        } else {
+            compare(*b++, *a++, out);
+        }
+    }
+}
+
+void SnapshotDiff::compare(const snap::Cluster &before, const snap::Cluster &after, ostream &out) const
+{
+    vector<Change> namespaces, added, removed, backlog, links;
+    uint64_t topicsBefore = 0, topicsAfter = 0, backlogBefore = 0, backlogAfter = 0;
+
+    const auto nsKey = [](const Snapshot& s, const snap::Namespace& ns) {
+        return make_pair(s.str(ns.tenant), s.str(ns.name));
+    };
+    const auto topicKey = [](const Snapshot& s, const snap::Topic& t) {
+        return s.str(t.name);
+    };
+
+    auto countTopics = [](const Snapshot& s, const snap::Namespace& ns, uint64_t& topics, uint64_t& backlog) {
+        for(const auto& t : s.topics(ns)) {
+            ++topics;
+            backlog += t.backlog;
+        }
+    };
+
+    auto compareLinks = [&](const snap::Topic& tb, const snap::Topic& ta) {
+        const auto name = string{after_.str(ta.name)};
+        const auto rb = before_.replication(tb);
+        const auto ra = after_.replication(ta);
+        auto peer = [](const Snapshot& s, const snap::Replication& r) {
+            return s.str(r.peer);
+        };
+        auto b = rb.begin();
+        auto a = ra.begin();
+        while (b != rb.end() || a != ra.end()) {
+            if (a == ra.end() || (b != rb.end() && peer(before_, *b) < peer(after_, *a))) {
+                links.push_back({static_cast<double>(b->replicationBacklog),
+                                 name + " -> " + string{before_.str(b->peer)} + " removed"});
+                ++b;
+            } else if (b == rb.end() || peer(after_, *a) < peer(before_, *b)) {
+                if (!a->connected) {
+                    links.push_back({static_cast<double>(a->replicationBacklog),
+                                     name + " -> " + string{after_.str(a->peer)} + " is new and disconnected"});
+                }
+                ++a;
+            } else {
+                if (b->connected && !a->connected) {
+                    ostringstream text;
+                    text << name << " -> " << after_.str(a->peer) << " disconnected, backlog "
+                         << a->replicationBacklog << " (" << showpos
+                         << (a->replicationBacklog - b->replicationBacklog) << noshowpos
+                         << "), delay " << a->replicationDelayInSeconds << 's';
+                    links.push_back({static_cast<double>(a->replicationBacklog), text.str()});
+                }
+                ++b;
+                ++a;
+            }
+        }
+    };
+
+    const auto& bs = before_;
+    const auto& as = after_;
+    auto b = bs.namespaces(before);
+    auto a = as.namespaces(after);
+    auto bi = b.begin();
+    auto ai = a.begin();
+    while (bi != b.end() || ai != a.end()) {
+        if (ai == a.end() || (bi != b.end() && nsKey(bs, *bi) < nsKey(as, *ai))) {
+            uint64_t topics = 0, nsBacklog = 0;
+            countTopics(bs, *bi, topics, nsBacklog);
+            topicsBefore += topics;
+            backlogBefore += nsBacklog;
+            namespaces.push_back({static_cast<double>(topics), "- "s + string{bs.str(bi->name)}
+                                  + " (" + to_string(topics) + " topics)"});
+            ++bi;
+            continue;
+        }
+
+        if (bi == b.end() || nsKey(as, *ai) < nsKey(bs, *bi)) {
+            uint64_t topics = 0, nsBacklog = 0;
+            countTopics(as, *ai, topics, nsBacklog);
+            topicsAfter += topics;
+            backlogAfter += nsBacklog;
+            namespaces.push_back({static_cast<double>(topics), "+ "s + string{as.str(ai->name)}
+                                  + " (" + to_string(topics) + " topics)"});
+            ++ai;
+            continue;
+        }
+
+        const auto& nb = *bi++;
+        const auto& na = *ai++;
+        if (const auto rcb = names(bs, bs.replicationClusters(nb)), rca = names(as, as.replicationClusters(na));
+                rcb != rca) {
+            namespaces.push_back({0, "  "s + string{as.str(na.name)} + " replication clusters "
+                                  + rcb + " -> " + rca});
+        }
+
+        const auto tb = bs.topics(nb);
+        const auto ta = as.topics(na);
+        auto tbi = tb.begin();
+        auto tai = ta.begin();
+        while (tbi != tb.end() || tai != ta.end()) {
+            if (tai == ta.end() || (tbi != tb.end() && topicKey(bs, *tbi) < topicKey(as, *tai))) {
+                ++topicsBefore;
+                backlogBefore += tbi->backlog;
+                removed.push_back({static_cast<double>(tbi->backlog), "- "s + string{bs.str(tbi->name)}});
+                ++tbi;
+            } else if (tbi == tb.end() || topicKey(as, *tai) < topicKey(bs, *tbi)) {
+                ++topicsAfter;
+                backlogAfter += tai->backlog;
+                added.push_back({static_cast<double>(tai->backlog), "+ "s + string{as.str(tai->name)}});
+                ++tai;
+            } else {
+                ++topicsBefore;
+                ++topicsAfter;
+                backlogBefore += tbi->backlog;
+                backlogAfter += tai->backlog;
+                if (const auto d = delta(tbi->backlog, tai->backlog);
+                        static_cast<uint64_t>(d < 0 ? -d : d) >= options_.minBacklogChange) {
+                    ostringstream text;
+                    text << as.str(tai->name) << ' ' << tbi->backlog << " -> " << tai->backlog
+                         << " (" << showpos << d << ')';
+                    backlog.push_back({static_cast<double>(d < 0 ? -d : d), text.str()});
+                }
+                compareLinks(*tbi, *tai);
+                ++tbi;
+                ++tai;
+            }
+        }
+    }
+
+    out << "Cluster " << as.str(after.name) << ": " << topicsBefore << " -> " << topicsAfter
+        << " topics, backlog " << backlogBefore << " -> " << backlogAfter
+        << " (" << showpos << delta(backlogBefore, backlogAfter) << noshowpos << ')' << endl;
+
+    if (before.state != static_cast<uint32_t>(Coverage::State::COMPLETE)
+            || after.state != static_cast<uint32_t>(Coverage::State::COMPLETE)) {
+        out << "  Note: At least one of the scans is incomplete. "
+            << "Topics that are missing may not be gone." << endl;
+    }
+
+    print(namespaces, "Namespaces", options_.maxLines, out);
+    print(added, "Added topics", options_.maxLines, out);
+    print(removed, "Removed topics", options_.maxLines, out);
+    print(backlog, "Backlog changes", options_.maxLines, out);
+    print(links, "Replication links down", options_.maxLines, out);
+    out << endl;
+}
+
+} // ns
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pulsar.h"
+
+namespace purech {
+
+/*! The on-disk records of a snapshot.
+ *
+ *  A snapshot is a header followed by sections of fixed-size records,
+ *  each aligned to 8 bytes, so that it can be used where it's mapped.
+ *  Strings are indexes into the snapshot's own string table, and the
+ *  children of a record are a run of records in their section. The
+ *  byte order is the one of the host that wrote it.
+ *
+ *  Clusters are sorted by name, namespaces by cluster and name, and
+ *  topics by namespace and name, which is what makes lookups and
+ *  diffs cheap. Subscriptions and replication links keep the order
+ *  they have in the stats (by name).
+ */
+namespace snap {
+
+constexpr std::array<char, 8> magic = {'P', 'U', 'R', 'E', 'S', 'N', 'A', 'P'};
+constexpr uint32_t version = 1;
+constexpr uint32_t byteOrder = 0x01020304;
+
+enum class SectionId {
+    STRING_OFFSETS, // uint64_t, one more than there are strings
+    STRING_DATA, // char
+    STRING_LISTS, // uint32_t string indexes, for lists of names
+    CLUSTERS,
+    NAMESPACES,
+    TOPICS,
+    PUBLISHERS,
+    SUBSCRIPTIONS,
+    CONSUMERS,
+    REPLICATION,
+    COUNT_ // Must be last
+};
+
+struct Section {
+    uint64_t offset = {}; // From the start of the file
+    uint64_t count = {}; // Records
+};
+
+struct Header {
+    std::array<char, 8> magic = {};
+    uint32_t version = {};
+    uint32_t byteOrder = {};
+    int64_t created = {}; // Unix time in milliseconds
+    std::array<Section, static_cast<size_t>(SectionId::COUNT_)> sections = {};
+};
+
+struct Cluster {
+    uint32_t name = {};
+    uint32_t state = {}; // Coverage::State
+    uint32_t known = {}; // Clusters known in this location, in STRING_LISTS
+    uint32_t numKnown = {};
+    uint32_t firstNamespace = {};
+    uint32_t numNamespaces = {};
+    uint32_t expired = {}; // The deadline passed
+    uint32_t reserved = {};
+    uint64_t listedTopics = {};
+    uint64_t fetchedTopics = {};
+    Stats stats;
+};
+
+struct Namespace {
+    uint32_t cluster = {};
+    uint32_t tenant = {};
+    uint32_t name = {}; // tenant/ns
+    uint32_t listed = {};
+    uint32_t replicationClusters = {}; // In STRING_LISTS
+    uint32_t numReplicationClusters = {};
+    uint32_t firstTopic = {};
+    uint32_t numTopics = {};
+    uint64_t listedTopics = {};
+    uint64_t fetchedTopics = {};
+    Stats stats;
+};
+
+struct Topic {
+    uint32_t name = {};
+    uint32_t ns = {}; // Index of the namespace
+    uint32_t firstPublisher = {};
+    uint32_t numPublishers = {};
+    uint32_t firstSubscription = {};
+    uint32_t numSubscriptions = {};
+    uint32_t firstReplication = {};
+    uint32_t numReplication = {};
+    Stats rates;
+    double averageMsgSize = {};
+    double storageSize = {};
+    uint64_t backlog = {}; // Sum of the subscriptions' msgBacklog
+};
+
+struct Publisher {
+    uint32_t producerName = {};
+    uint32_t address = {};
+    uint32_t clientVersion = {};
+    uint32_t reserved = {};
+    int64_t connectedSince = {}; // Unix time in milliseconds
+    uint64_t producerId = {};
+    double msgRateIn = {};
+    double msgThroughputIn = {};
+    double averageMsgSize = {};
+};
+
+struct Subscription {
+    uint32_t name = {};
+    uint32_t type = {};
+    uint32_t activeConsumerName = {};
+    uint32_t blockedSubscriptionOnUnackedMsgs = {};
+    uint32_t firstConsumer = {};
+    uint32_t numConsumers = {};
+    uint64_t msgBacklog = {};
+    uint64_t unackedMessages = {};
+    double msgRateOut = {};
+    double msgThroughputOut = {};
+    double msgRateRedeliver = {};
+    double msgRateExpired = {};
+};
+
+struct Consumer {
+    uint32_t consumerName = {};
+    uint32_t address = {};
+    uint32_t clientVersion = {};
+    uint32_t blockedConsumerOnUnackedMsgs = {};
+    int32_t availablePermits = {};
+    int32_t unackedMessages = {};
+    int64_t connectedSince = {}; // Unix time in milliseconds
+    double msgRateOut = {};
+    double msgThroughputOut = {};
+    double msgRateRedeliver = {};
+};
+
+struct Replication {
+    uint32_t peer = {};
+    uint32_t connected = {};
+    int32_t replicationBacklog = {};
+    int32_t replicationDelayInSeconds = {};
+    int64_t outboundConnectedSince = {}; // Unix time in milliseconds
+    Stats rates;
+    double msgRateExpired = {};
+};
+
+} // snap
+
+/*! A saved scan, memory-mapped.
+ *
+ *  Opening a snapshot only checks the header and that the sections are
+ *  inside the file. The records are used where they are mapped, and the
+ *  indexes in them are checked when they are followed, so a damaged
+ *  file gives an exception rather than a crash.
+ */
+class Snapshot {
+public:
+    template <typename T>
+    struct Span {
+        const T *b = {};
+        const T *e = {};
+
+        const T *begin() const noexcept { return b; }
+        const T *end() const noexcept { return e; }
+        size_t size() const noexcept { return static_cast<size_t>(e - b); }
+        bool empty() const noexcept { return b == e; }
+        const T& operator[](size_t i) const noexcept { return b[i]; }
+    };
+
+    // Throws std::runtime_error if the file can't be mapped or is not a snapshot
+    explicit Snapshot(const std::string& path);
+    ~Snapshot();
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator = (const Snapshot&) = delete;
+
+    const std::string& path() const noexcept {
+        return path_;
+    }
+
+    int64_t created() const noexcept {
+        return header().created;
+    }
+
+    std::string_view str(uint32_t index) const;
+
+    Span<snap::Cluster> clusters() const noexcept { return clusters_; }
+    Span<snap::Namespace> namespaces(const snap::Cluster& cluster) const;
+    Span<snap::Topic> topics(const snap::Namespace& ns) const;
+    Span<snap::Publisher> publishers(const snap::Topic& topic) const;
+    Span<snap::Subscription> subscriptions(const snap::Topic& topic) const;
+    Span<snap::Consumer> consumers(const snap::Subscription& subscription) const;
+    Span<snap::Replication> replication(const snap::Topic& topic) const;
+    Span<uint32_t> knownClusters(const snap::Cluster& cluster) const;
+    Span<uint32_t> replicationClusters(const snap::Namespace& ns) const;
+
+    // Binary searches. nullptr if not found.
+    const snap::Cluster *findCluster(std::string_view name) const;
+    const snap::Namespace *findNamespace(const snap::Cluster& cluster, std::string_view name) const;
+    const snap::Topic *findTopic(const snap::Namespace& ns, std::string_view name) const;
+
+    // Save the clusters, which must be aggregated (and so, sealed) and
+    // sorted by name. Throws std::runtime_error if it fails.
+    static void write(const std::vector<const Engine::Cluster *>& clusters, const std::string& path);
+
+    // Adds a cluster from the snapshot to the tree and the store of
+    // `cluster`, as if it had been scanned. The shards of a scan are
+    // merged this way, so the namespaces must not be there already.
+    // Call aggregate on the cluster afterwards.
+    void load(const snap::Cluster& from, Engine::Cluster& cluster) const;
+
+private:
+    const snap::Header& header() const noexcept {
+        return *static_cast<const snap::Header *>(data_);
+    }
+
+    template <typename T>
+    Span<T> section(snap::SectionId id) const;
+
+    template <typename T>
+    Span<T> children(const Span<T>& all, uint32_t first, uint32_t count) const;
+
+    std::string path_;
+    const void *data_ = {};
+    size_t size_ = 0;
+    Span<uint64_t> stringOffsets_;
+    Span<char> stringData_;
+    Span<uint32_t> stringLists_;
+    Span<snap::Cluster> clusters_;
+    Span<snap::Namespace> namespaces_;
+    Span<snap::Topic> topics_;
+    Span<snap::Publisher> publishers_;
+    Span<snap::Subscription> subscriptions_;
+    Span<snap::Consumer> consumers_;
+    Span<snap::Replication> replication_;
+};
+
+/*! Compares two snapshots: clusters, namespaces and topics that were
+ *  added or removed, the topics whose backlog changed the most, and
+ *  the replication links that went down.
+ *
+ *  The clusters, namespaces and topics are merged in their sorted
+ *  order, so the cost is linear in the size of the snapshots.
+ */
+class SnapshotDiff {
+public:
+    struct Options {
+        size_t maxLines = 20; // Per cluster and kind of change
+        uint64_t minBacklogChange = 1;
+    };
+
+    SnapshotDiff(const Snapshot& before, const Snapshot& after, const Options& options)
+        : before_{before}, after_{after}, options_{options} {}
+
+    void report(std::ostream& out) const;
+
+private:
+    void compare(const snap::Cluster& before, const snap::Cluster& after, std::ostream& out) const;
+
+    const Snapshot& before_;
+    const Snapshot& after_;
+    const Options options_;
+};
+
+} // ns
@@ -0,0 +1,353 @@
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <tuple>
+
+#include "store.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+// Days since 1970-01-01 (Howard Hinnant's days_from_civil)
+int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) noexcept {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const auto yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+} // anon ns
+
+int64_t parseTimestamp(string_view ts) noexcept
+{
+    size_t pos = 0;
+    auto number = [&](size_t digits, int64_t& value) {
+        value = 0;
+        for(size_t i = 0; i < digits; ++i, ++pos) {
+            if (pos >= ts.size() || ts[pos] < '0' || ts[pos] > '9') {
+                return false;
+            }
+            value = value * 10 + (ts[pos] - '0');
+        }
+        return true;
+    };
+    auto expect = [&](char ch) {
+        return pos < ts.size() && ts[pos++] == ch;
+    };
+
+    int64_t year, month, day, hour, minute, second;
+    if (!(number(4, year) && expect('-') && number(2, month) && expect('-') && number(2, day)
+          && expect('T') && number(2, hour) && expect(':') && number(2, minute) && expect(':')
+          && number(2, second))) {
+        return 0;
+    }
+
+    if (month < 1 || month > 12 || day < 1 || day > 31) {
+        return 0;
+    }
+
+    int64_t ms = 0;
+    if (pos < ts.size() && ts[pos] == '.') {
+        ++pos;
+        int64_t scale = 100;
+        for(; pos < ts.size() && ts[pos] >= '0' && ts[pos] <= '9'; ++pos) {
+            ms += (ts[pos] - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    int64_t offset = 0; // Minutes
+    if (pos < ts.size() && (ts[pos] == '+' || ts[pos] == '-')) {
+        const auto sign = ts[pos++] == '-' ? -1 : 1;
+        int64_t oh = 0, om = 0;
+        if (!number(2, oh)) {
+            return 0;
+        }
+        if (pos < ts.size() && ts[pos] == ':') {
+            ++pos;
+        }
+        number(2, om);
+        offset = sign * (oh * 60 + om);
+    }
+
+    const auto days = daysFromCivil(year, static_cast<unsigned>(month), static_cast<unsigned>(day));
+    const auto secs = days * 86400 + hour * 3600 + minute * 60 + second - offset * 60;
+    return secs * 1000 + ms;
+}
+
+StringPool::StringPool()
+{
+    table_.assign(1024, empty);
+    intern({});
+}
+
+sid_t StringPool::intern(string_view str)
+{
+    {
+        shared_lock<shared_mutex> lock{mutex_};
+        if (const auto id = findLocked(str, hash<string_view>{}(str)); id != empty) {
+            return id;
+        }
+    }
+
+    unique_lock<shared_mutex> lock{mutex_};
+    return internLocked(str);
+}
+
+sid_t StringPool::find(string_view str) const
+{
+    shared_lock<shared_mutex> lock{mutex_};
+    const auto id = findLocked(str, hash<string_view>{}(str));
+    return id == empty ? none : id;
+}
+
+sid_t StringPool::findLocked(string_view str, size_t hash) const noexcept
+{
+    const auto mask = table_.size() - 1;
+    for(auto slot = hash & mask;; slot = (slot + 1) & mask) {
+        const auto id = table_[slot];
+        if (id == empty || this->str(id) == str) {
+            return id;
+        }
+    }
+}
+
+sid_t StringPool::internLocked(string_view str)
+{
+    const auto h = hash<string_view>{}(str);
+    if (const auto id = findLocked(str, h); id != empty) {
+        return id;
+    }
+
+    const auto id = static_cast<sid_t>(count_.load(memory_order_relaxed));
+    const auto block = id / blockSize;
+    if (block >= maxBlocks) {
+        throw runtime_error("The string pool is full");
+    }
+
+    if (!blocks_[block].load(memory_order_relaxed)) {
+        views_.emplace_back(make_unique<string_view[]>(blockSize));
+        blocks_[block].store(views_.back().get(), memory_order_release);
+    }
+
+    blocks_[block].load(memory_order_relaxed)[id % blockSize] = store(str);
+    count_.store(id + 1, memory_order_release);
+
+    if (size() * 2 > table_.size()) {
+        rehash();
+    } else {
+        const auto mask = table_.size() - 1;
+        auto slot = h & mask;
+        while(table_[slot] != empty) {
+            slot = (slot + 1) & mask;
+        }
+        table_[slot] = id;
+    }
+
+    return id;
+}
+
+string_view StringPool::store(string_view str)
+{
+    if (str.empty()) {
+        return {};
+    }
+
+    if (str.size() > charBlockSize / 4) {
+        // Don't waste the rest of the current block on a large string
+        auto& chars = chars_.emplace_back(make_unique<char[]>(str.size()));
+        charBytes_ += str.size();
+        memcpy(chars.get(), str.data(), str.size());
+        string_view sv{chars.get(), str.size()};
+        // Keep the current block last
+        if (chars_.size() > 1) {
+            swap(chars_.back(), chars_[chars_.size() - 2]);
+        } else {
+            charsUsed_ = charBlockSize;
+        }
+        return sv;
+    }
+
+    if (charsUsed_ + str.size() > charBlockSize) {
+        chars_.emplace_back(make_unique<char[]>(charBlockSize));
+        charBytes_ += charBlockSize;
+        charsUsed_ = 0;
+    }
+
+    auto *p = chars_.back().get() + charsUsed_;
+    memcpy(p, str.data(), str.size());
+    charsUsed_ += str.size();
+    return {p, str.size()};
+}
+
+void StringPool::rehash()
+{
+    vector<sid_t> table(table_.size() * 2, empty);
+    const auto mask = table.size() - 1;
+    const auto count = size();
+    for(sid_t id = 0; id < count; ++id) {
+        auto slot = hash<string_view>{}(str(id)) & mask;
+        while(table[slot] != empty) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = id;
+    }
+    table_.swap(table);
+}
+
+size_t StringPool::memoryUsage() const
+{
+    shared_lock<shared_mutex> lock{mutex_};
+    return charBytes_ + views_.size() * blockSize * sizeof(string_view)
+            + table_.size() * sizeof(sid_t);
+}
+
+void *TopicStore::Upstream::do_allocate(size_t bytes, size_t alignment)
+{
+    allocated += bytes;
+    return pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void TopicStore::Upstream::do_deallocate(void *p, size_t bytes, size_t alignment)
+{
+    allocated -= bytes;
+    pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+bool TopicStore::Upstream::do_is_equal(const pmr::memory_resource &other) const noexcept
+{
+    return this == &other;
+}
+
+TopicStore::TopicStore(StringPool &pool)
+    : pool_{pool}
+{
+    clear();
+}
+
+void TopicStore::add(string_view tenant, string_view ns, string_view topic,
+                     const PersistentTopicStats &stats)
+{
+    // Lock order: the store, then the pool
+    lock_guard<mutex> lock{mutex_};
+    StringPool::Writer strings{pool_};
+
+    TopicRow row;
+    row.tenant = strings.intern(tenant);
+    row.ns = strings.intern(ns);
+    row.topic = strings.intern(topic);
+    row.rates = stats;
+    row.averageMsgSize = stats.averageMsgSize;
+    row.storageSize = stats.storageSize;
+
+    auto *pr = allocate<PublisherRow>(stats.publishers.size());
+    row.publishers = pr;
+    row.numPublishers = static_cast<uint32_t>(stats.publishers.size());
+    for(const auto& p : stats.publishers) {
+        new (pr++) PublisherRow{strings.intern(p.producerName), strings.intern(p.address),
+                                strings.intern(p.clientVersion), parseTimestamp(p.connectedSince),
+                                p.producerId, p.msgRateIn, p.msgThroughputIn, p.averageMsgSize};
+    }
+
+    auto *sr = allocate<SubscriptionRow>(stats.subscriptions.size());
+    row.subscriptions = sr;
+    row.numSubscriptions = static_cast<uint32_t>(stats.subscriptions.size());
+    for(const auto& [name, s] : stats.subscriptions) {
+        auto *cr = allocate<ConsumerRow>(s.consumers.size());
+        new (sr) SubscriptionRow{strings.intern(name), strings.intern(s.type),
+                                 strings.intern(s.activeConsumerName),
+                                 static_cast<uint32_t>(s.consumers.size()), cr,
+                                 s.blockedSubscriptionOnUnackedMsgs, s.msgBacklog, s.unackedMessages,
+                                 s.msgRateOut, s.msgThroughputOut, s.msgRateRedeliver, s.msgRateExpired};
+        for(const auto& c : s.consumers) {
+            new (cr++) ConsumerRow{strings.intern(c.consumerName), strings.intern(c.address),
+                                   strings.intern(c.clientVersion), c.availablePermits,
+                                   c.unackedMessages, c.blockedConsumerOnUnackedMsgs,
+                                   parseTimestamp(c.connectedSince), c.msgRateOut,
+                                   c.msgThroughputOut, c.msgRateRedeliver};
+        }
+        row.backlog += s.msgBacklog;
+        ++sr;
+    }
+
+    auto *rr = allocate<ReplicationRow>(stats.replication.size());
+    row.replication = rr;
+    row.numReplication = static_cast<uint32_t>(stats.replication.size());
+    for(const auto& [peer, r] : stats.replication) {
+        new (rr++) ReplicationRow{strings.intern(peer), r.connected, r.replicationBacklog,
+                                  r.replicationDelayInSeconds, parseTimestamp(r.outboundConnectedSince),
+                                  r, r.msgRateExpired};
+    }
+
+    topics_.push_back(row);
+}
+
+void TopicStore::add(const TopicRow &row)
+{
+    lock_guard<mutex> lock{mutex_};
+
+    auto copy = row;
+    auto *pr = allocate<PublisherRow>(row.numPublishers);
+    copy.publishers = pr;
+    uninitialized_copy_n(row.publishers, row.numPublishers, pr);
+
+    auto *sr = allocate<SubscriptionRow>(row.numSubscriptions);
+    copy.subscriptions = sr;
+    for(const auto& s : subscriptions(row)) {
+        auto *cr = allocate<ConsumerRow>(s.numConsumers);
+        uninitialized_copy_n(s.consumers, s.numConsumers, cr);
+        new (sr) SubscriptionRow{s};
+        (sr++)->consumers = cr;
+    }
+
+    auto *rr = allocate<ReplicationRow>(row.numReplication);
+    copy.replication = rr;
+    uninitialized_copy_n(row.replication, row.numReplication, rr);
+
+    topics_.push_back(copy);
+}
+
+void TopicStore::seal()
+{
+    lock_guard<mutex> lock{mutex_};
+
+    // The children are in the arena, so only the topic rows move.
+    // Resolve the strings once, rather than in every comparison.
+    using key_t = tuple<string_view, string_view, string_view>;
+    vector<pair<key_t, uint32_t>> keys;
+    keys.reserve(topics_.size());
+    for(uint32_t i = 0; i < topics_.size(); ++i) {
+        const auto& t = topics_[i];
+        keys.emplace_back(key_t{pool_.str(t.tenant), pool_.str(t.ns), pool_.str(t.topic)}, i);
+    }
+
+    sort(keys.begin(), keys.end());
+
+    vector<TopicRow> sorted;
+    sorted.reserve(topics_.size());
+    for(const auto& [_, i] : keys) {
+        sorted.push_back(topics_[i]);
+    }
+    topics_.swap(sorted);
+}
+
+void TopicStore::clear()
+{
+    lock_guard<mutex> lock{mutex_};
+    topics_ = {};
+    arena_ = make_unique<pmr::monotonic_buffer_resource>(64 * 1024, &upstream_);
+}
+
+size_t TopicStore::memoryUsage() const
+{
+    lock_guard<mutex> lock{mutex_};
+    return upstream_.allocated + topics_.capacity() * sizeof(TopicRow);
+}
+
+} // ns
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pulsar_api.h"
+
+namespace purech {
+
+// Id of an interned string
+using sid_t = uint32_t;
+
+/*! Thread-safe string interning.
+ *
+ *  Each distinct string is stored once, in large blocks of characters.
+ *  Ids are stable for the lifetime of the pool, so they can be compared
+ *  across clusters and scans. Id 0 is always the empty string.
+ *
+ *  str() does not lock. It is safe as long as the id was obtained in a
+ *  way that synchronizes with the thread that interned it.
+ */
+class StringPool {
+public:
+    // Holds the pool's write lock while interning several strings
+    class Writer {
+    public:
+        Writer(StringPool& pool)
+            : pool_{pool}, lock_{pool.mutex_} {}
+
+        sid_t intern(std::string_view str) {
+            return pool_.internLocked(str);
+        }
+
+    private:
+        StringPool& pool_;
+        std::unique_lock<std::shared_mutex> lock_;
+    };
+
+    StringPool();
+
+    sid_t intern(std::string_view str);
+
+    // Returns `none` if the string is not in the pool
+    sid_t find(std::string_view str) const;
+
+    std::string_view str(sid_t id) const noexcept {
+        return blocks_[id / blockSize].load(std::memory_order_acquire)[id % blockSize];
+    }
+
+    size_t size() const noexcept {
+        return count_.load(std::memory_order_acquire);
+    }
+
+    size_t memoryUsage() const;
+
+    static constexpr sid_t none = 0;
+
+private:
+    static constexpr size_t blockSize = 1 << 16;
+    static constexpr size_t maxBlocks = 1 << 14;
+    static constexpr size_t charBlockSize = 1 << 16;
+    static constexpr sid_t empty = ~sid_t{};
+
+    sid_t internLocked(std::string_view str);
+    sid_t findLocked(std::string_view str, size_t hash) const noexcept;
+    std::string_view store(std::string_view str);
+    void rehash();
+
+    mutable std::shared_mutex mutex_;
+    std::array<std::atomic<std::string_view *>, maxBlocks> blocks_ = {};
+    std::vector<std::unique_ptr<std::string_view[]>> views_;
+    std::vector<std::unique_ptr<char[]>> chars_;
+    size_t charsUsed_ = charBlockSize;
+    size_t charBytes_ = 0;
+    std::atomic<size_t> count_ = 0;
+    std::vector<sid_t> table_; // Open addressing, linear probing
+};
+
+struct ConsumerRow {
+    sid_t consumerName = {};
+    sid_t address = {};
+    sid_t clientVersion = {};
+    int availablePermits = {};
+    int unackedMessages = {};
+    bool blockedConsumerOnUnackedMsgs = false;
+    int64_t connectedSince = {}; // Unix time in milliseconds
+    double msgRateOut = {};
+    double msgThroughputOut = {};
+    double msgRateRedeliver = {};
+};
+
+struct PublisherRow {
+    sid_t producerName = {};
+    sid_t address = {};
+    sid_t clientVersion = {};
+    int64_t connectedSince = {}; // Unix time in milliseconds
+    uint64_t producerId = {};
+    double msgRateIn = {};
+    double msgThroughputIn = {};
+    double averageMsgSize = {};
+};
+
+struct SubscriptionRow {
+    sid_t name = {};
+    sid_t type = {};
+    sid_t activeConsumerName = {};
+    uint32_t numConsumers = {};
+    const ConsumerRow *consumers = {};
+    bool blockedSubscriptionOnUnackedMsgs = false;
+    uint64_t msgBacklog = {};
+    uint64_t unackedMessages = {};
+    double msgRateOut = {};
+    double msgThroughputOut = {};
+    double msgRateRedeliver = {};
+    double msgRateExpired = {};
+};
+
+struct ReplicationRow {
+    sid_t peer = {};
+    bool connected = false;
+    int replicationBacklog = {};
+    int replicationDelayInSeconds = {};
+    int64_t outboundConnectedSince = {}; // Unix time in milliseconds
+    Stats rates;
+    double msgRateExpired = {};
+};
+
+struct TopicRow {
+    sid_t tenant = {};
+    sid_t ns = {};
+    sid_t topic = {};
+    uint32_t numPublishers = {};
+    uint32_t numSubscriptions = {};
+    uint32_t numReplication = {};
+    const PublisherRow *publishers = {};
+    const SubscriptionRow *subscriptions = {};
+    const ReplicationRow *replication = {};
+    Stats rates;
+    double averageMsgSize = {};
+    double storageSize = {};
+    uint64_t backlog = {}; // Sum of the subscriptions' msgBacklog
+};
+
+// Parses Pulsar's ISO 8601 timestamps. Returns 0 if `ts` is not valid.
+int64_t parseTimestamp(std::string_view ts) noexcept;
+
+/*! Compact, flat copy of the topic stats from one scan of one cluster.
+ *
+ *  Strings are interned in a (shared) StringPool, and timestamps are
+ *  stored as numbers. Each topic's publishers, subscriptions and
+ *  replication links, and each subscription's consumers, are stored
+ *  contiguously in an arena that is released in one go by clear().
+ *
+ *  add() is thread-safe. After seal(), the topics are sorted on
+ *  (tenant, namespace, topic) and the store is read-only until the
+ *  next add() or clear().
+ */
+class TopicStore {
+public:
+    template <typename T>
+    struct Range {
+        const T *b = {};
+        const T *e = {};
+
+        const T *begin() const noexcept { return b; }
+        const T *end() const noexcept { return e; }
+        size_t size() const noexcept { return static_cast<size_t>(e - b); }
+        bool empty() const noexcept { return b == e; }
+    };
+
+    explicit TopicStore(StringPool& pool);
+
+    void add(std::string_view tenant, std::string_view ns, std::string_view topic,
+             const PersistentTopicStats& stats);
+
+    // Adds a topic that is already a row, like one from a snapshot. The
+    // children are copied, and the ids must be from this store's pool.
+    void add(const TopicRow& row);
+    void seal();
+    void clear();
+
+    const std::vector<TopicRow>& topics() const noexcept { return topics_; }
+
+    static Range<PublisherRow> publishers(const TopicRow& t) noexcept {
+        return {t.publishers, t.publishers + t.numPublishers};
+    }
+
+    static Range<SubscriptionRow> subscriptions(const TopicRow& t) noexcept {
+        return {t.subscriptions, t.subscriptions + t.numSubscriptions};
+    }
+
+    static Range<ConsumerRow> consumers(const SubscriptionRow& s) noexcept {
+        return {s.consumers, s.consumers + s.numConsumers};
+    }
+
+    static Range<ReplicationRow> replication(const TopicRow& t) noexcept {
+        return {t.replication, t.replication + t.numReplication};
+    }
+
+    StringPool& pool() const noexcept {
+        return pool_;
+    }
+
+    std::string_view str(sid_t id) const noexcept {
+        return pool_.str(id);
+    }
+
+    // Bytes used by the rows (not including the shared string pool)
+    size_t memoryUsage() const;
+
+private:
+    // Counts the bytes the arena gets from the heap
+    class Upstream : public std::pmr::memory_resource {
+    public:
+        size_t allocated = 0;
+
+    private:
+        void *do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+    };
+
+    template <typename T>
+    T *allocate(size_t count) {
+        return count ? static_cast<T *>(arena_->allocate(sizeof(T) * count, alignof(T))) : nullptr;
+    }
+
+    StringPool& pool_;
+    mutable std::mutex mutex_;
+    Upstream upstream_;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_;
+    std::vector<TopicRow> topics_; // Points into the arena
+};
+
+} // ns
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace purech {
+
+// Appends text to a string. Numbers are formatted without streams, as
+// the exporter and the sinks write a lot of them.
+class TextOut {
+public:
+    // How a number that is not finite is written
+    enum class Syntax {
+        TEXT, // NaN, +Inf and -Inf, like Prometheus
+        JSON  // null, as JSON has no such numbers
+    };
+
+    explicit TextOut(std::string& out, Syntax syntax = Syntax::TEXT)
+        : out_{out}, syntax_{syntax} {}
+
+    TextOut& operator << (std::string_view v) {
+        out_.append(v);
+        return *this;
+    }
+
+    TextOut& operator << (char v) {
+        out_.push_back(v);
+        return *this;
+    }
+
+    TextOut& operator << (double v) {
+        if (syntax_ == Syntax::JSON && !std::isfinite(v)) {
+            return *this << std::string_view{"null"};
+        }
+        if (std::isnan(v)) {
+            return *this << std::string_view{"NaN"};
+        }
+        if (std::isinf(v)) {
+            return *this << std::string_view{v > 0 ? "+Inf" : "-Inf"};
+        }
+        return number(v);
+    }
+
+    TextOut& operator << (int64_t v) {
+        return number(v);
+    }
+
+    TextOut& operator << (uint64_t v) {
+        return number(v);
+    }
+
+    TextOut& operator << (int v) {
+        return number(v);
+    }
+
+    TextOut& operator << (bool v) = delete; // Use 0/1 or true/false explicitly
+
+    // A Prometheus label value or a JSON string, without the quotes
+    TextOut& escaped(std::string_view v) {
+        for(const auto ch : v) {
+            switch(ch) {
+            case '\\': out_ += "\\\\"; break;
+            case '"': out_ += "\\\""; break;
+            case '\n': out_ += "\\n"; break;
+            default:
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    static constexpr char hex[] = "0123456789abcdef";
+                    out_ += "\\u00";
+                    out_ += hex[(ch >> 4) & 0xf];
+                    out_ += hex[ch & 0xf];
+                } else {
+                    out_ += ch;
+                }
+            }
+        }
+        return *this;
+    }
+
+    TextOut& quoted(std::string_view v) {
+        out_ += '"';
+        escaped(v);
+        out_ += '"';
+        return *this;
+    }
+
+private:
+    template <typename T>
+    TextOut& number(T v) {
+        char buf[32];
+        const auto r = std::to_chars(std::begin(buf), std::end(buf), v);
+        out_.append(buf, r.ptr);
+        return *this;
+    }
+
+    std::string& out_;
+    const Syntax syntax_;
+};
+
+} // ns
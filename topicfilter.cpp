@@ -0,0 +1,440 @@
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cctype>
+#include <stdexcept>
+
+#include "topicfilter.h"
+
+using namespace std;
+using namespace std::string_literals;
+
+namespace purech {
+
+namespace {
+
+const auto persistent = "persistent://"s;
+
+bool startsWith(string_view what, string_view prefix) {
+    return what.compare(0, prefix.size(), prefix) == 0;
+}
+
+// What an anchored regex requires the name to start with. Empty if we
+// can't tell.
+string regexLiteral(const string& re) {
+    static const string_view meta = ".[]{}()*+?|^$\\";
+
+    if (re.empty() || re.front() != '^' || re.find('|') != string::npos) {
+        return {};
+    }
+
+    string literal;
+    for(size_t i = 1; i < re.size(); ++i) {
+        auto ch = re[i];
+        if (ch == '\\') {
+            if (i + 1 >= re.size() || !ispunct(static_cast<unsigned char>(re[i + 1]))) {
+                break; // A character class like \d
+            }
+            ch = re[++i];
+        } else if (meta.find(ch) != string_view::npos) {
+            if ((ch == '?' || ch == '*' || ch == '{') && !literal.empty()) {
+                literal.pop_back(); // The last character is optional
+            }
+            break;
+        }
+        literal += ch;
+    }
+    return literal;
+}
+
+} // anon ns
+
+/*! A glob, compiled to a bit-parallel NFA.
+ *
+ *  Each token is a state. A bit in the state mask is set for each token
+ *  we may be at, and one character moves all of them at once with a few
+ *  table lookups. The bit after the last token means "matched".
+ */
+class TopicFilter::Glob {
+public:
+    explicit Glob(string_view glob) {
+        if (glob.find('/') == string_view::npos) {
+            add(STAR);
+            add(CHAR, '/');
+            add(STAR);
+            add(CHAR, '/');
+        }
+
+        for(size_t i = 0; i < glob.size(); ++i) {
+            const auto ch = glob[i];
+            if (ch == '*') {
+                const bool any = i + 1 < glob.size() && glob[i + 1] == '*';
+                while(i + 1 < glob.size() && glob[i + 1] == '*') {
+                    ++i;
+                }
+                add(any ? STARSTAR : STAR);
+            } else if (ch == '?') {
+                add(ANY);
+            } else if (ch == '[' && parseClass(glob, i)) {
+                ;
+            } else if (ch == '\\' && i + 1 < glob.size()) {
+                add(CHAR, glob[++i]);
+            } else {
+                add(CHAR, ch);
+            }
+        }
+
+        if (tokens_.size() >= 64) {
+            throw runtime_error("Glob is too long: "s + string{glob});
+        }
+
+        for(size_t i = 0; i < tokens_.size(); ++i) {
+            const auto& t = tokens_[i];
+            const uint64_t bit = 1ULL << i;
+            if (t.kind == STAR || t.kind == STARSTAR) {
+                stars_ |= bit;
+            }
+            for(unsigned c = 0; c < 256; ++c) {
+                const bool slash = c == '/';
+                switch(t.kind) {
+                case CHAR:
+                    if (static_cast<unsigned char>(t.ch) == c) {
+                        advance_[c] |= bit;
+                    }
+                    break;
+                case ANY:
+                    if (!slash) {
+                        advance_[c] |= bit;
+                    }
+                    break;
+                case CLASS:
+                    if (!slash && t.set[c]) {
+                        advance_[c] |= bit;
+                    }
+                    break;
+                case STAR:
+                    if (!slash) {
+                        stay_[c] |= bit;
+                    }
+                    break;
+                case STARSTAR:
+                    stay_[c] |= bit;
+                    break;
+                }
+            }
+        }
+
+        accept_ = 1ULL << tokens_.size();
+    }
+
+    bool matches(string_view name) const {
+        return run(name) & accept_;
+    }
+
+    // Some name that starts with `prefix` may match
+    bool mayMatch(string_view prefix) const {
+        return run(prefix) != 0;
+    }
+
+    // All the topic names that start with `prefix` match
+    bool covers(string_view prefix) const {
+        // The rest of the name has this many segments
+        const auto segments = static_cast<size_t>(3 - count(prefix.begin(), prefix.end(), '/'));
+        const auto state = run(prefix);
+        for(size_t i = 0; i < tokens_.size(); ++i) {
+            if ((state & (1ULL << i)) && coversRest(i, segments)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    enum Kind { CHAR, ANY, STAR, STARSTAR, CLASS };
+
+    struct Token {
+        Kind kind;
+        char ch = 0;
+        bitset<256> set;
+    };
+
+    void add(Kind kind, char ch = 0) {
+        tokens_.push_back({kind, ch, {}});
+    }
+
+    bool parseClass(string_view glob, size_t& i) {
+        auto j = i + 1;
+        const bool negate = j < glob.size() && (glob[j] == '!' || glob[j] == '^');
+        if (negate) {
+            ++j;
+        }
+
+        bitset<256> set;
+        for(bool first = true; j < glob.size() && (first || glob[j] != ']'); first = false, ++j) {
+            const auto from = static_cast<unsigned char>(glob[j]);
+            if (j + 2 < glob.size() && glob[j + 1] == '-' && glob[j + 2] != ']') {
+                const auto to = static_cast<unsigned char>(glob[j + 2]);
+                for(unsigned c = from; c <= to; ++c) {
+                    set.set(c);
+                }
+                j += 2;
+            } else {
+                set.set(from);
+            }
+        }
+
+        if (j >= glob.size()) {
+            return false; // No ']'. Treat the '[' as a character.
+        }
+
+        tokens_.push_back({CLASS, 0, negate ? ~set : set});
+        i = j;
+        return true;
+    }
+
+    uint64_t closure(uint64_t state) const noexcept {
+        // A star may match nothing
+        for(uint64_t more; (more = ((state & stars_) << 1) & ~state);) {
+            state |= more;
+        }
+        return state;
+    }
+
+    uint64_t run(string_view text) const noexcept {
+        auto state = closure(1);
+        for(const auto ch : text) {
+            const auto c = static_cast<unsigned char>(ch);
+            state = closure(((state & advance_[c]) << 1) | (state & stay_[c]));
+            if (!state) {
+                break;
+            }
+        }
+        return state;
+    }
+
+    // Tokens from `from` on match any name with this many non-empty segments
+    bool coversRest(size_t from, size_t segments) const {
+        if (from == tokens_.size()) {
+            return false;
+        }
+
+        size_t found = 1;
+        bool star = false; // The current segment has a star, so it is not empty
+        bool anything = true;
+        for(auto i = from; i < tokens_.size(); ++i) {
+            const auto& t = tokens_[i];
+            if (t.kind == CHAR && t.ch == '/') {
+                if (!star) {
+                    return false;
+                }
+                ++found;
+                star = anything = false;
+                continue;
+            }
+            if (t.kind != STAR && t.kind != STARSTAR) {
+                return false;
+            }
+            star = true;
+            anything = anything && t.kind == STARSTAR;
+        }
+
+        // "**" alone matches everything
+        return star && ((anything && found == 1) || found == segments);
+    }
+
+    vector<Token> tokens_;
+    array<uint64_t, 256> advance_ = {}; // Tokens that consume the character and move on
+    array<uint64_t, 256> stay_ = {}; // Stars that consume the character
+    uint64_t stars_ = 0;
+    uint64_t accept_ = 0;
+};
+
+void TopicFilter::Trie::add(string_view prefix)
+{
+    uint32_t node = 0;
+    for(const auto ch : prefix) {
+        auto& children = nodes_[node].children;
+        auto it = lower_bound(children.begin(), children.end(), ch, [](const auto& child, char c) {
+            return child.first < c;
+        });
+        if (it == children.end() || it->first != ch) {
+            const auto next = static_cast<uint32_t>(nodes_.size());
+            children.insert(it, {ch, next});
+            nodes_.emplace_back(); // Invalidates `children`
+            node = next;
+        } else {
+            node = it->second;
+        }
+    }
+    nodes_[node].terminal = true;
+}
+
+bool TopicFilter::Trie::matches(string_view name) const
+{
+    const auto *node = &nodes_.front();
+    for(const auto ch : name) {
+        if (node->terminal) {
+            return true;
+        }
+        if (!(node = child(*node, ch))) {
+            return false;
+        }
+    }
+    return node->terminal;
+}
+
+bool TopicFilter::Trie::overlaps(string_view name) const
+{
+    if (empty()) {
+        return false;
+    }
+
+    const auto *node = &nodes_.front();
+    for(const auto ch : name) {
+        if (node->terminal) {
+            return true;
+        }
+        if (!(node = child(*node, ch))) {
+            return false;
+        }
+    }
+    return true; // All the nodes lead to a prefix
+}
+
+const TopicFilter::Trie::Node *TopicFilter::Trie::child(const Node &node, char ch) const
+{
+    for(const auto& [c, index] : node.children) {
+        if (c == ch) {
+            return &nodes_[index];
+        }
+        if (c > ch) {
+            break;
+        }
+    }
+    return {};
+}
+
+void TopicFilter::Patterns::add(const string &pattern)
+{
+    static const string prefix = "prefix:";
+    static const string re = "re:";
+    static const string glob = "glob:";
+
+    if (startsWith(pattern, prefix)) {
+        prefixes.add(string_view{pattern}.substr(prefix.size()));
+    } else if (startsWith(pattern, re)) {
+        const auto expr = pattern.substr(re.size());
+        try {
+            regexes.push_back({regex{expr, regex::ECMAScript | regex::optimize}, regexLiteral(expr)});
+        } catch (const regex_error& ex) {
+            throw runtime_error("Invalid regex in the topic filter: "s + expr + ": " + ex.what());
+        }
+    } else {
+        globs.push_back(make_unique<Glob>(startsWith(pattern, glob)
+                                          ? string_view{pattern}.substr(glob.size())
+                                          : string_view{pattern}));
+    }
+}
+
+bool TopicFilter::Patterns::empty() const noexcept
+{
+    return prefixes.empty() && globs.empty() && regexes.empty();
+}
+
+bool TopicFilter::Patterns::matches(string_view topic) const
+{
+    if (prefixes.matches(topic)) {
+        return true;
+    }
+
+    for(const auto& g : globs) {
+        if (g->matches(topic)) {
+            return true;
+        }
+    }
+
+    if (!regexes.empty()) {
+        const auto name = persistent + string{topic};
+        for(const auto& r : regexes) {
+            if (regex_search(name, r.re)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool TopicFilter::Patterns::mayMatch(string_view prefix) const
+{
+    if (prefixes.overlaps(prefix)) {
+        return true;
+    }
+
+    for(const auto& g : globs) {
+        if (g->mayMatch(prefix)) {
+            return true;
+        }
+    }
+
+    const auto name = persistent + string{prefix};
+    for(const auto& r : regexes) {
+        if (startsWith(name, r.literal) || startsWith(r.literal, name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool TopicFilter::Patterns::covers(string_view prefix) const
+{
+    if (prefixes.matches(prefix)) {
+        return true;
+    }
+
+    for(const auto& g : globs) {
+        if (g->covers(prefix)) {
+            return true;
+        }
+    }
+
+    return false; // We don't know that about regexes
+}
+
+TopicFilter::TopicFilter(const vector<string> &include, const vector<string> &exclude)
+{
+    for(const auto& p : include) {
+        include_.add(p);
+    }
+    for(const auto& p : exclude) {
+        exclude_.add(p);
+    }
+}
+
+TopicFilter::~TopicFilter() = default;
+
+TopicFilter::Scope TopicFilter::scope(string_view prefix) const
+{
+    if (exclude_.covers(prefix)) {
+        return Scope::NONE;
+    }
+
+    if (!include_.empty() && !include_.mayMatch(prefix)) {
+        return Scope::NONE;
+    }
+
+    if ((include_.empty() || include_.covers(prefix)) && !exclude_.mayMatch(prefix)) {
+        return Scope::ALL;
+    }
+
+    return Scope::SOME;
+}
+
+bool TopicFilter::matches(string_view topic) const
+{
+    return (include_.empty() || include_.matches(topic)) && !exclude_.matches(topic);
+}
+
+} // ns
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace purech {
+
+/*! Selects topics by name, with include and exclude patterns.
+ *
+ *  A topic is selected if it matches any include pattern (or there are
+ *  none), and no exclude pattern. The patterns are matched against the
+ *  topic's name without the domain, like "tenant/namespace/topic":
+ *
+ *  - `prefix:<text>` A literal prefix of the name.
+ *  - `re:<regex>` An ECMAScript regex, searched for in the full name,
+ *     like "persistent://tenant/namespace/topic".
+ *  - `glob:<glob>`, or just `<glob>`. `*` matches within one path segment,
+ *     `**` matches across segments, `?` matches one character in a segment
+ *     and `[...]` matches a character class (`[!...]` to negate). A glob
+ *     without a '/' is matched against the topic's local name only.
+ *
+ *  Besides matching topics, the filter tells what it can match below a
+ *  tenant or a namespace, so that we don't have to list what it can't
+ *  match, and don't have to check each topic where it matches them all.
+ */
+class TopicFilter {
+public:
+    enum class Scope {
+        NONE, // No topic below the prefix can match
+        SOME, // Check each topic
+        ALL   // All the topics below the prefix match
+    };
+
+    // Throws std::runtime_error if a pattern is invalid
+    TopicFilter(const std::vector<std::string>& include, const std::vector<std::string>& exclude);
+    ~TopicFilter();
+
+    /*! @param prefix "tenant/" or "tenant/namespace/" */
+    Scope scope(std::string_view prefix) const;
+
+    /*! @param topic "tenant/namespace/topic" */
+    bool matches(std::string_view topic) const;
+
+private:
+    class Glob;
+
+    // Literal prefixes. A node is terminal if a prefix ends there.
+    class Trie {
+    public:
+        void add(std::string_view prefix);
+        bool empty() const noexcept { return nodes_.size() == 1; }
+
+        // A prefix in the trie is a prefix of `name`
+        bool matches(std::string_view name) const;
+
+        // A prefix in the trie is a prefix of `name`, or the other way around
+        bool overlaps(std::string_view name) const;
+
+    private:
+        struct Node {
+            std::vector<std::pair<char, uint32_t>> children; // Sorted by the char
+            bool terminal = false;
+        };
+
+        const Node *child(const Node& node, char ch) const;
+
+        std::vector<Node> nodes_ = {Node{}};
+    };
+
+    struct Regex {
+        std::regex re;
+        std::string literal; // What the name must start with, if the regex is anchored
+    };
+
+    struct Patterns {
+        Trie prefixes;
+        std::vector<std::unique_ptr<Glob>> globs;
+        std::vector<Regex> regexes;
+
+        void add(const std::string& pattern);
+        bool empty() const noexcept;
+        bool matches(std::string_view topic) const;
+        bool mayMatch(std::string_view prefix) const;
+        bool covers(std::string_view prefix) const;
+    };
+
+    Patterns include_;
+    Patterns exclude_;
+};
+
+} // ns
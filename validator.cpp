@@ -0,0 +1,367 @@
+
+#include <algorithm>
+#include <future>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "validator.h"
+
+using namespace std;
+
+namespace purech {
+
+namespace {
+
+using Issue = ReplicationValidator::Issue;
+
+struct NsView {
+    size_t begin = 0; // The namespace's rows in the store
+    size_t end = 0;
+    bool complete = false; // We got all its topics
+    vector<sid_t> peers; // The replication clusters
+};
+
+struct ClusterView {
+    const Engine::Cluster *cluster = {};
+    sid_t name = {};
+    unordered_set<sid_t> known; // Clusters known in this location
+    unordered_set<sid_t> listedTenants;
+    unordered_map<sid_t, NsView> namespaces;
+};
+
+ClusterView view(const Engine::Cluster& cluster, StringPool& pool) {
+    ClusterView cv;
+    cv.cluster = &cluster;
+    cv.name = pool.intern(cluster.name);
+    for(const auto& c : cluster.clusters) {
+        cv.known.insert(pool.intern(c));
+    }
+
+    // The tree and the sealed store are both sorted on (tenant, namespace)
+    const auto& store = *cluster.store;
+    const auto& rows = store.topics();
+    size_t r = 0;
+    for(const auto& [tname, tenant] : cluster.tenants) {
+        if (tenant.listed) {
+            cv.listedTenants.insert(pool.intern(tname));
+        }
+        for(const auto& [nsname, ns] : tenant.namespaces) {
+            const auto key = make_pair(string_view{tname}, string_view{nsname});
+            auto rowKey = [&](const TopicRow& row) {
+                return make_pair(store.str(row.tenant), store.str(row.ns));
+            };
+            while (r < rows.size() && rowKey(rows[r]) < key) {
+                ++r;
+            }
+
+            NsView nv;
+            nv.begin = r;
+            while (r < rows.size() && rowKey(rows[r]) == key) {
+                ++r;
+            }
+            nv.end = r;
+            nv.complete = Engine::Cluster::coverage(ns).state == Coverage::State::COMPLETE;
+            for(const auto& peer : ns.policies.replication_clusters) {
+                nv.peers.push_back(pool.intern(peer));
+            }
+            cv.namespaces.emplace(pool.intern(nsname), move(nv));
+        }
+    }
+
+    return cv;
+}
+
+// The checks that only need one cluster: the replication clusters, and each topic's links
+void checkCluster(const ClusterView& cv, const ReplicationValidator::Options& options,
+                  vector<Issue>& issues, size_t& topics) {
+    const auto& rows = cv.cluster->store->topics();
+    for(const auto& [ns, nv] : cv.namespaces) {
+        for(const auto peer : nv.peers) {
+            if (!cv.known.count(peer)) {
+                issues.push_back({Issue::UNKNOWN_CLUSTER, cv.name, ns, {}, peer, {}});
+            }
+        }
+
+        if (nv.peers.size() < 2) {
+            continue; // Not replicated
+        }
+
+        for(auto i = nv.begin; i < nv.end; ++i) {
+            const auto& row = rows[i];
+            ++topics;
+            const auto links = TopicStore::replication(row);
+            for(const auto peer : nv.peers) {
+                if (peer == cv.name) {
+                    continue;
+                }
+
+                auto link = find_if(links.begin(), links.end(), [peer](const auto& r) {
+                    return r.peer == peer;
+                });
+                if (link == links.end()) {
+                    issues.push_back({Issue::NO_LINK, cv.name, ns, row.topic, peer, {}});
+                    continue;
+                }
+                if (!link->connected) {
+                    issues.push_back({Issue::DISCONNECTED, cv.name, ns, row.topic, peer, {}});
+                }
+                if (link->replicationBacklog > 0
+                        && static_cast<uint64_t>(link->replicationBacklog) > options.maxBacklog) {
+                    issues.push_back({Issue::BACKLOG, cv.name, ns, row.topic, peer, link->replicationBacklog});
+                }
+                if (link->replicationDelayInSeconds > options.maxDelay) {
+                    issues.push_back({Issue::DELAY, cv.name, ns, row.topic, peer, link->replicationDelayInSeconds});
+                }
+            }
+        }
+    }
+}
+
+} // anon ns
+
+ReplicationValidator::Report ReplicationValidator::check(const vector<const Engine::Cluster *> &clusters) const
+{
+    const auto launch = options_.threads > 1 ? std::launch::async : std::launch::deferred;
+
+    vector<future<ClusterView>> building;
+    for(const auto *c : clusters) {
+        building.emplace_back(async(launch, [c, &pool=pool_] {
+            return view(*c, pool);
+        }));
+    }
+
+    vector<ClusterView> views;
+    for(auto& b : building) {
+        views.emplace_back(b.get());
+    }
+
+    Report report;
+
+    // Per cluster, in parallel
+    struct Partial {
+        vector<Issue> issues;
+        size_t topics = 0;
+    };
+    vector<future<Partial>> checks;
+    for(const auto& cv : views) {
+        checks.emplace_back(async(launch, [&cv, this] {
+            Partial p;
+            checkCluster(cv, options_, p.issues, p.topics);
+            return p;
+        }));
+    }
+    for(auto& c : checks) {
+        auto p = c.get();
+        report.topics += p.topics;
+        report.issues.insert(report.issues.end(), p.issues.begin(), p.issues.end());
+    }
+
+    // Compare the topic sets of each replicated namespace across the clusters
+    unordered_map<sid_t, size_t> byName; // Index in views
+    for(size_t i = 0; i < views.size(); ++i) {
+        byName.emplace(views[i].name, i);
+    }
+
+    unordered_map<sid_t, vector<sid_t>> replicated; // ns -> all the clusters it's replicated to
+    for(const auto& cv : views) {
+        for(const auto& [ns, nv] : cv.namespaces) {
+            if (nv.peers.size() > 1) {
+                auto& peers = replicated[ns];
+                peers.insert(peers.end(), nv.peers.begin(), nv.peers.end());
+            }
+        }
+    }
+
+    struct Cursor {
+        const vector<TopicRow> *rows;
+        size_t pos;
+        size_t end;
+        sid_t cluster;
+
+        bool done() const noexcept { return pos >= end; }
+        sid_t topic() const noexcept { return (*rows)[pos].topic; }
+    };
+
+    vector<Cursor> cursors;
+    for(auto& [ns, peers] : replicated) {
+        sort(peers.begin(), peers.end());
+        peers.erase(unique(peers.begin(), peers.end()), peers.end());
+
+        ++report.namespaces;
+        cursors.clear();
+        bool skipped = false;
+        const auto tenant = pool_.intern(pool_.str(ns).substr(0, pool_.str(ns).find('/')));
+        for(const auto peer : peers) {
+            auto it = byName.find(peer);
+            if (it == byName.end()) {
+                continue; // Not scanned
+            }
+
+            const auto& cv = views[it->second];
+            auto nv = cv.namespaces.find(ns);
+            if (nv == cv.namespaces.end()) {
+                if (cv.listedTenants.count(tenant)) {
+                    report.issues.push_back({Issue::MISSING_NAMESPACE, cv.name, ns, {}, {}, {}});
+                } else {
+                    skipped = true;
+                }
+                continue;
+            }
+
+            if (!nv->second.complete) {
+                skipped = true;
+                continue;
+            }
+            cursors.push_back({&cv.cluster->store->topics(), nv->second.begin, nv->second.end, cv.name});
+        }
+
+        report.skipped += skipped ? 1 : 0;
+        if (cursors.size() < 2) {
+            continue;
+        }
+
+        // k-way merge, in the stores' (string) order. The ids are the same
+        // in all the clusters, so the common case, where every cluster has
+        // the topic, is found without comparing strings.
+        while (true) {
+            bool all = true;
+            bool any = false;
+            for(const auto& c : cursors) {
+                if (c.done()) {
+                    all = false;
+                } else {
+                    any = true;
+                    all = all && c.topic() == cursors.front().topic();
+                }
+            }
+
+            if (!any) {
+                break;
+            }
+
+            if (all) {
+                for(auto& c : cursors) {
+                    ++c.pos;
+                }
+                continue;
+            }
+
+            const Cursor *least = {};
+            for(const auto& c : cursors) {
+                if (!c.done() && (!least || (c.topic() != least->topic()
+                                             && pool_.str(c.topic()) < pool_.str(least->topic())))) {
+                    least = &c;
+                }
+            }
+
+            const auto topic = least->topic();
+            for(auto& c : cursors) {
+                if (!c.done() && c.topic() == topic) {
+                    ++c.pos;
+                } else {
+                    report.issues.push_back({Issue::MISSING_TOPIC, c.cluster, ns, topic, {}, {}});
+                }
+            }
+        }
+    }
+
+    for(const auto& issue : report.issues) {
+        ++report.counts[issue.kind];
+    }
+
+    return report;
+}
+
+void ReplicationValidator::print(const Report &report, ostream &out) const
+{
+    out << "Replication: Checked " << report.namespaces << " replicated namespaces and "
+        << report.topics << " topics. ";
+    if (report.ok()) {
+        out << "No problems found.";
+    } else {
+        out << report.issues.size() << " problems.";
+    }
+    if (report.skipped) {
+        out << ' ' << report.skipped << " namespaces were not compared across the clusters, "
+            << "as a scan did not get all of their topics.";
+    }
+    out << endl;
+
+    vector<const Issue *> lines;
+    for(size_t kind = 0; kind < Issue::COUNT_; ++kind) {
+        if (!report.counts[kind]) {
+            continue;
+        }
+
+        lines.clear();
+        for(const auto& issue : report.issues) {
+            if (issue.kind == static_cast<Issue::Kind>(kind)) {
+                lines.push_back(&issue);
+            }
+        }
+
+        const auto count = min(lines.size(), options_.maxLines);
+        partial_sort(lines.begin(), lines.begin() + static_cast<ptrdiff_t>(count), lines.end(),
+                     [this](const Issue *a, const Issue *b) {
+            if (a->value != b->value) {
+                return a->value > b->value;
+            }
+            return make_tuple(pool_.str(a->cluster), pool_.str(a->ns), pool_.str(a->topic), pool_.str(a->peer))
+                    < make_tuple(pool_.str(b->cluster), pool_.str(b->ns), pool_.str(b->topic), pool_.str(b->peer));
+        });
+
+        out << "  " << toString(static_cast<Issue::Kind>(kind)) << " (" << lines.size() << "):" << endl;
+        for(size_t i = 0; i < count; ++i) {
+            const auto& issue = *lines[i];
+            out << "    " << pool_.str(issue.cluster) << ": ";
+            switch(issue.kind) {
+            case Issue::UNKNOWN_CLUSTER:
+                out << pool_.str(issue.ns) << " replicates to " << pool_.str(issue.peer);
+                break;
+            case Issue::MISSING_NAMESPACE:
+                out << pool_.str(issue.ns);
+                break;
+            case Issue::MISSING_TOPIC:
+                out << pool_.str(issue.topic);
+                break;
+            case Issue::NO_LINK:
+            case Issue::DISCONNECTED:
+                out << pool_.str(issue.topic) << " -> " << pool_.str(issue.peer);
+                break;
+            case Issue::BACKLOG:
+                out << pool_.str(issue.topic) << " -> " << pool_.str(issue.peer)
+                    << " backlog " << issue.value;
+                break;
+            case Issue::DELAY:
+                out << pool_.str(issue.topic) << " -> " << pool_.str(issue.peer)
+                    << " delay " << issue.value << 's';
+                break;
+            case Issue::COUNT_:
+                break;
+            }
+            out << endl;
+        }
+        if (lines.size() > count) {
+            out << "    ... and " << (lines.size() - count) << " more" << endl;
+        }
+    }
+}
+
+const char *ReplicationValidator::toString(Issue::Kind kind) noexcept
+{
+    static constexpr const char *names[] = {
+        "Unknown replication clusters",
+        "Missing namespaces",
+        "Missing topics",
+        "Topics without a replication link",
+        "Disconnected replication links",
+        "Replication backlog above the limit",
+        "Replication delay above the limit"
+    };
+
+    static_assert(size(names) == static_cast<size_t>(Issue::COUNT_));
+    return names[kind];
+}
+
+} // ns
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+#include "pulsar.h"
+
+namespace purech {
+
+/*! Checks that replication is set up and working across the clusters
+ *  of one scan.
+ *
+ *  - Every cluster in a namespace's replication clusters must be known
+ *    to the cluster the namespace was read from.
+ *  - A replicated namespace must have the same topics in all the
+ *    scanned clusters it's replicated to.
+ *  - Each topic must have a connected replication link to each of the
+ *    other replication clusters of its namespace, and the links' backlog
+ *    and delay must be within the limits.
+ *
+ *  The clusters must share a StringPool, and be aggregated (so their
+ *  stores are sealed). Topics are matched by their interned ids, in a
+ *  merge of the sorted stores, so the cost is linear in the number of
+ *  topics. Namespaces that a scan did not fully get are not compared,
+ *  as their missing topics would look like replication problems.
+ */
+class ReplicationValidator {
+public:
+    struct Options {
+        uint64_t maxBacklog = 10000; // Messages
+        int maxDelay = 300; // Seconds
+        size_t maxLines = 20; // Per kind of issue
+        size_t threads = 1;
+    };
+
+    struct Issue {
+        enum Kind {
+            UNKNOWN_CLUSTER, // `peer` is not known in `cluster`
+            MISSING_NAMESPACE, // `cluster` does not have the namespace
+            MISSING_TOPIC, // `cluster` does not have `topic`
+            NO_LINK, // `topic` in `cluster` has no link to `peer`
+            DISCONNECTED,
+            BACKLOG,
+            DELAY,
+            COUNT_ // Must be last
+        };
+
+        Kind kind = {};
+        sid_t cluster = {};
+        sid_t ns = {};
+        sid_t topic = {};
+        sid_t peer = {};
+        int64_t value = {}; // Backlog or delay
+    };
+
+    struct Report {
+        std::vector<Issue> issues;
+        std::array<size_t, Issue::COUNT_> counts = {};
+        size_t namespaces = 0; // Replicated namespaces checked
+        size_t topics = 0; // Topics checked
+        size_t skipped = 0; // Namespaces not compared, as a scan was incomplete
+
+        bool ok() const noexcept {
+            return issues.empty();
+        }
+    };
+
+    ReplicationValidator(StringPool& pool, const Options& options)
+        : pool_{pool}, options_{options} {}
+
+    Report check(const std::vector<const Engine::Cluster *>& clusters) const;
+
+    void print(const Report& report, std::ostream& out) const;
+
+    static const char *toString(Issue::Kind kind) noexcept;
+
+private:
+    StringPool& pool_;
+    const Options options_;
+};
+
+} // ns